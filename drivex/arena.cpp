@@ -0,0 +1,87 @@
+#include <drivex/arena.h>
+#include <algorithm>
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+std::uintptr_t align_up(std::uintptr_t address, std::size_t alignment) {
+  return (address + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace
+
+arena::arena(std::size_t chunk_size, std::size_t retain)
+    : chunk_size_(std::max<std::size_t>(chunk_size, 256)),
+      retain_(retain),
+      current_(0),
+      used_(0),
+      allocated_(0),
+      reserved_(0) {}
+
+void* arena::allocate(std::size_t size, std::size_t alignment) {
+  auto fits = [size, alignment](const chunk& c, std::size_t used) {
+    auto base = reinterpret_cast<std::uintptr_t>(c.data.get());
+    return align_up(base + used, alignment) + size <= base + c.size;
+  };
+  if (chunks_.empty() || !fits(chunks_[current_], used_)) {
+    auto next = chunks_.empty() ? 0 : current_ + 1;
+    auto spare = std::find_if(
+        chunks_.begin() + next, chunks_.end(),
+        [&fits](const chunk& c) { return fits(c, 0); });
+    if (spare == chunks_.end()) {
+      auto length = std::max(chunk_size_, size + alignment);
+      chunks_.insert(chunks_.begin() + next,
+                     chunk{std::unique_ptr<char[]>(new char[length]), length});
+      reserved_ += length;
+    } else {
+      std::swap(*spare, chunks_[next]);
+    }
+    current_ = next;
+    used_ = 0;
+  }
+  const auto& c = chunks_[current_];
+  auto base = reinterpret_cast<std::uintptr_t>(c.data.get());
+  auto start = align_up(base + used_, alignment);
+  used_ = start - base + size;
+  allocated_ += size;
+  return reinterpret_cast<void*>(start);
+}
+
+void arena::reset() noexcept {
+  current_ = 0;
+  used_ = 0;
+  allocated_ = 0;
+  while (reserved_ > retain_) {
+    auto largest = std::max_element(
+        chunks_.begin(), chunks_.end(),
+        [](const chunk& a, const chunk& b) { return a.size < b.size; });
+    reserved_ -= largest->size;
+    chunks_.erase(largest);
+  }
+}
+
+arena::scope::scope(arena& source) noexcept
+    : source_(source),
+      chunk_(source.current_),
+      used_(source.used_),
+      allocated_(source.allocated_) {}
+
+arena::scope::~scope() {
+  source_.current_ = chunk_;  // chunks up to it stay where they were
+  source_.used_ = used_;
+  source_.allocated_ = allocated_;
+}
+
+std::size_t arena::allocated() const noexcept { return allocated_; }
+
+std::size_t arena::reserved() const noexcept { return reserved_; }
+
+arena& arena::local() {
+  thread_local arena instance;
+  return instance;
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Bump allocator for temporaries that die together
+ *
+ * Allocation takes the next aligned bytes of the current chunk, and nothing
+ * is freed until reset, which makes all of it available again.  Chunks are
+ * kept across resets up to a retained size, so that a thread handling one
+ * request after another reaches a steady state that never calls the global
+ * allocator.  Not synchronized; each thread has its own through local(). */
+class arena {
+ public:
+  explicit arena(std::size_t chunk_size = 64u << 10u,
+                 std::size_t retain = 1u << 20u);
+
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  /** Uninitialized memory, valid until the next reset */
+  void* allocate(std::size_t size,
+                 std::size_t alignment = alignof(std::max_align_t));
+
+  /** Invalidate everything allocated, keeping up to the retained size of
+   * chunks for reuse */
+  void reset() noexcept;
+
+  /** Rewinds an arena on destruction to where it was on construction
+   *
+   * For temporaries of a call that may run on any thread, including ones
+   * that never reset their arena.  Scopes must nest, and the arena must not
+   * be reset while one is open. */
+  class scope {
+   public:
+    explicit scope(arena& source) noexcept;
+    ~scope();
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+   private:
+    arena& source_;
+    std::size_t chunk_;
+    std::size_t used_;
+    std::size_t allocated_;
+  };
+
+  /** Bytes allocated since the last reset */
+  std::size_t allocated() const noexcept;
+
+  /** Bytes of chunks held */
+  std::size_t reserved() const noexcept;
+
+  /** The arena of the calling thread
+   *
+   * thread_pool workers reset theirs after each task they take from the
+   * queue, so memory from it must not outlive the task. */
+  static arena& local();
+
+ private:
+  struct chunk {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  std::size_t chunk_size_;
+  std::size_t retain_;
+  std::vector<chunk> chunks_;  // up to current_ hold allocations
+  std::size_t current_;
+  std::size_t used_;  // of the current chunk
+  std::size_t allocated_;
+  std::size_t reserved_;
+};
+
+/** Standard allocator drawing from an arena, for containers of temporaries
+ *
+ * Deallocation is a no-op; the memory returns when the arena is reset. */
+template <typename T>
+class arena_allocator {
+ public:
+  using value_type = T;
+
+  explicit arena_allocator(arena& source = arena::local()) noexcept
+      : source_(&source) {}
+
+  template <typename U>
+  arena_allocator(const arena_allocator<U>& other) noexcept
+      : source_(&other.source()) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(source_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, std::size_t) noexcept {}
+
+  arena& source() const noexcept { return *source_; }
+
+ private:
+  arena* source_;
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator<T>& a,
+                const arena_allocator<U>& b) noexcept {
+  return &a.source() == &b.source();
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator<T>& a,
+                const arena_allocator<U>& b) noexcept {
+  return !(a == b);
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,48 @@
+#pragma once
+#include <drivex/Permissions.h>
+#include <boost/optional.hpp>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+namespace lockblox {
+namespace drivex {
+
+/** A point in time with nanosecond resolution */
+using file_time = std::chrono::time_point<std::chrono::system_clock,
+                                          std::chrono::nanoseconds>;
+
+/** Whole seconds of a file_time, rounding toward the past */
+inline std::time_t to_time_t(file_time time) {
+  auto since = time.time_since_epoch();
+  auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since);
+  if (seconds > since) {
+    seconds -= std::chrono::seconds(1);
+  }
+  return static_cast<std::time_t>(seconds.count());
+}
+
+/** A file_time of whole seconds */
+inline file_time from_time_t(std::time_t time) {
+  return file_time(std::chrono::seconds(time));
+}
+
+/** Last read and write times of a file */
+struct file_times {
+  file_time last_read_time;
+  file_time last_write_time;
+};
+
+/** A set of attribute changes to apply to a file in one operation
+ *
+ * Only the attributes that are present are changed. */
+struct attribute_update {
+  boost::optional<drivex::permissions> permissions;
+  boost::optional<std::uint32_t> user_id;
+  boost::optional<std::uint32_t> group_id;
+  boost::optional<std::uint64_t> size;
+  boost::optional<file_time> last_read_time;
+  boost::optional<file_time> last_write_time;
+};
+}  // namespace drivex
+}  // namespace lockblox
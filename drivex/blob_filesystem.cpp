@@ -0,0 +1,1222 @@
+#include <drivex/blob_filesystem.h>
+#include <drivex/directory_entry.h>
+#include <drivex/journal.h>
+#include <boost/filesystem/operations.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const char index_magic[8] = {'D', 'R', 'V', 'X', 'B', 'L', 'B', '2'};
+/** Of indexes that stored times in whole seconds */
+const char index_magic_seconds[8] = {'D', 'R', 'V', 'X', 'B', 'L', 'B', '1'};
+const int max_symlink_hops = 40;
+const auto default_file_permissions = static_cast<drivex::permissions>(0644);
+const auto default_directory_permissions =
+    static_cast<drivex::permissions>(0755);
+
+/** Appends host-order integers and length-prefixed strings */
+template <typename T>
+void append(std::string& output, T value) {
+  output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void append_string(std::string& output, const std::string& value) {
+  append(output, static_cast<std::uint32_t>(value.size()));
+  output.append(value);
+}
+
+/** Reads what append wrote */
+class index_reader {
+ public:
+  explicit index_reader(const std::string& data) : data_(data), position_(0) {}
+
+  template <typename T>
+  T get() {
+    T value;
+    std::memcpy(&value, take(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+  std::string get_string() {
+    auto size = get<std::uint32_t>();
+    return std::string(take(size), size);
+  }
+
+ private:
+  const char* take(std::size_t size) {
+    if (size > data_.size() - position_) {
+      throw error(error_code::io_error, "truncated blob index");
+    }
+    auto data = data_.data() + position_;
+    position_ += size;
+    return data;
+  }
+
+  const std::string& data_;
+  std::size_t position_;
+};
+
+void pwrite_all(int fd, const char* data, std::size_t size,
+                std::uint64_t offset) {
+  while (size > 0) {
+    auto result = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      throw error(error_code::io_error, "staged write failed");
+    }
+    data += result;
+    size -= result;
+    offset += result;
+  }
+}
+
+std::size_t pread_all(int fd, char* output, std::size_t size,
+                      std::uint64_t offset) {
+  std::size_t done = 0;
+  while (done < size) {
+    auto result = ::pread(fd, output + done, size - done,
+                          static_cast<off_t>(offset + done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0) {
+      throw error(error_code::io_error, "staged read failed");
+    }
+    if (result == 0) {
+      break;
+    }
+    done += result;
+  }
+  return done;
+}
+
+std::uint64_t staged_size(int fd) {
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    throw error(error_code::io_error, "staged file");
+  }
+  return static_cast<std::uint64_t>(file_stat.st_size);
+}
+
+/** A fresh random object key */
+std::string new_key() {
+  thread_local std::mt19937_64 engine{std::random_device{}()};
+  static const char digits[] = "0123456789abcdef";
+  std::string key;
+  for (auto word : {engine(), engine()}) {
+    for (auto shift = 60; shift >= 0; shift -= 4) {
+      key += digits[(word >> shift) & 0xfu];
+    }
+  }
+  return key;
+}
+
+std::uint64_t ceil_div(std::uint64_t value, std::uint64_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+/** Kinds of journal record */
+const char journal_put = 'N';
+const char journal_put_seconds = 'P';  // times in whole seconds
+const char journal_erase = 'E';
+
+/** The current time, for the times of a node */
+file_time now() {
+  return std::chrono::time_point_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now());
+}
+
+template <typename Node>
+void append_node(std::string& output, const std::string& key,
+                 const Node& entry) {
+  append_string(output, key);
+  append(output, static_cast<std::uint32_t>(entry.status.type()));
+  append(output, static_cast<std::uint32_t>(entry.status.permissions()));
+  append(output, entry.user_id);
+  append(output, entry.group_id);
+  append(output, entry.size);
+  append(output, static_cast<std::int64_t>(
+                     entry.last_read_time.time_since_epoch().count()));
+  append(output, static_cast<std::int64_t>(
+                     entry.last_write_time.time_since_epoch().count()));
+  append_string(output, entry.object);
+  append_string(output, entry.target);
+  append(output, static_cast<std::uint32_t>(entry.xattrs.size()));
+  for (const auto& attribute : entry.xattrs) {
+    append_string(output, attribute.first);
+    append_string(output, attribute.second);
+  }
+}
+
+/** @param nanoseconds whether times are stored in nanoseconds, else in
+ *        whole seconds */
+template <typename Node>
+std::string read_node(index_reader& reader, Node& entry, bool nanoseconds) {
+  auto key = reader.get_string();
+  auto type = static_cast<file_type>(reader.get<std::uint32_t>());
+  auto permissions =
+      static_cast<drivex::permissions>(reader.get<std::uint32_t>());
+  entry.status = file_status(type, permissions);
+  entry.user_id = reader.get<std::uint32_t>();
+  entry.group_id = reader.get<std::uint32_t>();
+  entry.size = reader.get<std::uint64_t>();
+  for (auto time : {&entry.last_read_time, &entry.last_write_time}) {
+    auto count = reader.get<std::int64_t>();
+    *time = nanoseconds ? file_time(std::chrono::nanoseconds(count))
+                        : from_time_t(static_cast<std::time_t>(count));
+  }
+  entry.object = reader.get_string();
+  entry.target = reader.get_string();
+  for (auto attributes = reader.get<std::uint32_t>(); attributes != 0;
+       --attributes) {
+    auto name = reader.get_string();
+    entry.xattrs.emplace(std::move(name), reader.get_string());
+  }
+  return key;
+}
+
+void write_durably(const Path& path, const std::string& data) {
+  auto temporary = path.string() + ".tmp";
+  auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  if (fd < 0) {
+    throw error(error_code::io_error, temporary);
+  }
+  auto written = true;
+  try {
+    pwrite_all(fd, data.data(), data.size(), 0);
+  } catch (const error&) {
+    written = false;
+  }
+  written = ::fsync(fd) == 0 && written;
+  if (::close(fd) != 0 || !written ||
+      std::rename(temporary.c_str(), path.string().c_str()) != 0) {
+    ::unlink(temporary.c_str());
+    throw error(error_code::io_error, path.string());
+  }
+  auto directory = path.parent_path().empty() ? Path(".") : path.parent_path();
+  fd = ::open(directory.string().c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+}  // namespace
+
+blob_filesystem::blob_filesystem(std::shared_ptr<blob_store> store,
+                                 blob_settings settings)
+    : store_(std::move(store)),
+      settings_(std::move(settings)),
+      cache_(settings_.cache_ranges),
+      journal_(Path(settings_.index.string() + ".journal"), settings_.journal),
+      index_changed_(false),
+      next_staged_(0),
+      prefetching_(0),
+      flush_requested_(false),
+      stopping_(false) {
+  if (settings_.part_size == 0 || settings_.range_size == 0) {
+    throw error(error_code::invalid_argument, "blob part and range size");
+  }
+  boost::system::error_code code;
+  boost::filesystem::create_directories(settings_.staging, code);
+  if (code) {
+    throw error(error_code::io_error, settings_.staging.string());
+  }
+  load();
+  flusher_ = std::thread([this]() { flush_journal(); });
+}
+
+blob_filesystem::~blob_filesystem() {
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    stopping_ = true;
+  }
+  flush_wake_.notify_all();
+  flusher_.join();
+  for (auto& file : files_) {
+    try {
+      std::lock_guard<std::mutex> lock(file.second->mutex);
+      upload(Path(file.first), *file.second);
+    } catch (...) {  // nothing sensible to do with it here
+    }
+    unstage(*file.second);
+  }
+  {
+    std::unique_lock<std::mutex> lock(prefetch_mutex_);
+    prefetch_done_.wait(lock, [this]() { return prefetching_ == 0; });
+  }
+  try {
+    save();
+  } catch (...) {
+  }
+  try {
+    collect();
+  } catch (...) {
+  }
+}
+
+std::uintmax_t blob_filesystem::file_size(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return resolve(path).size;
+}
+
+file_status blob_filesystem::status(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return resolve(path).status;
+}
+
+file_status blob_filesystem::symlink_status(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return lookup(absolute(path).string()).status;
+}
+
+Path blob_filesystem::read_symlink(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& entry = lookup(absolute(path).string());
+  if (entry.status.type() != file_type::symlink) {
+    throw error(error_code::invalid_argument, path.string());
+  }
+  return Path(entry.target);
+}
+
+void blob_filesystem::create_directory(const Path& path) {
+  create_directory(path, default_directory_permissions);
+}
+
+void blob_filesystem::create_directory(const Path& path,
+                                       drivex::permissions permissions) {
+  node entry;
+  entry.status = file_status(file_type::directory, permissions);
+  add(path, std::move(entry));
+}
+
+bool blob_filesystem::remove(const Path& path) {
+  auto key = absolute(path).string();
+  std::string object;
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(index_mutex_);
+    auto found = nodes_.find(key);
+    if (found == nodes_.end()) {
+      return false;
+    }
+    if (!found->second.children.empty()) {
+      throw error(error_code::directory_not_empty, path.string());
+    }
+    if (key == "/") {
+      throw error(error_code::permission_denied, path.string());
+    }
+    object = found->second.object;
+    nodes_.erase(found);
+    nodes_[Path(key).parent_path().string()].children.erase(
+        Path(key).filename().string());
+    discard(log_erase(key), object);
+  }
+  state file;
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    auto found = files_.find(key);
+    if (found != files_.end()) {
+      file = std::move(found->second);
+      files_.erase(found);
+    }
+  }
+  if (file) {  // what open handles wrote goes with the file
+    std::lock_guard<std::mutex> lock(file->mutex);
+    file->dirty = false;
+    unstage(*file);
+  }
+  return true;
+}
+
+void blob_filesystem::create_symlink(const Path& target, const Path& link) {
+  const auto all = drivex::permissions::owner_all |
+                   drivex::permissions::group_all |
+                   drivex::permissions::others_all;
+  node entry;
+  entry.status = file_status(file_type::symlink, all);
+  entry.target = target.string();
+  entry.size = entry.target.size();
+  add(link, std::move(entry));
+}
+
+void blob_filesystem::rename(const Path& from, const Path& to) {
+  auto source = absolute(from).string();
+  auto target = absolute(to).string();
+  if (source == target) {
+    return;
+  }
+  std::string replaced;  // object of a file the rename replaces
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(index_mutex_);
+    auto& moved = lookup(source);
+    auto& parent = lookup(Path(target).parent_path().string());
+    if (parent.status.type() != file_type::directory) {
+      throw error(error_code::not_a_directory, to.string());
+    }
+    if (target.compare(0, source.size() + 1, source + "/") == 0) {
+      throw error(error_code::invalid_argument, to.string());
+    }
+    auto existing = nodes_.find(target);
+    if (existing != nodes_.end()) {
+      auto directory = existing->second.status.type() == file_type::directory;
+      if (directory && moved.status.type() != file_type::directory) {
+        throw error(error_code::is_a_directory, to.string());
+      }
+      if (!directory && moved.status.type() == file_type::directory) {
+        throw error(error_code::not_a_directory, to.string());
+      }
+      if (!existing->second.children.empty()) {
+        throw error(error_code::directory_not_empty, to.string());
+      }
+      replaced = existing->second.object;
+      nodes_.erase(existing);
+      discard(log_erase(target), replaced);
+    }
+    // move the node and everything under it
+    std::vector<std::string> keys{source};
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      for (const auto& child : nodes_.at(keys[i]).children) {
+        keys.push_back(keys[i] == "/" ? "/" + child : keys[i] + "/" + child);
+      }
+    }
+    for (const auto& key : keys) {
+      auto entry = std::move(nodes_.at(key));
+      nodes_.erase(key);
+      log_erase(key);
+      auto moved_key = target + key.substr(source.size());
+      log_put(moved_key, entry);
+      nodes_[moved_key] = std::move(entry);
+    }
+    nodes_[Path(source).parent_path().string()].children.erase(
+        Path(source).filename().string());
+    nodes_[Path(target).parent_path().string()].children.insert(
+        Path(target).filename().string());
+  }
+  state dropped;  // of the file the rename replaces
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    auto found = files_.find(target);
+    if (found != files_.end()) {
+      dropped = std::move(found->second);
+      files_.erase(found);
+    }
+    // open files keep their staged data under the new path
+    std::vector<std::string> moved;
+    for (const auto& file : files_) {
+      if (file.first == source ||
+          file.first.compare(0, source.size() + 1, source + "/") == 0) {
+        moved.push_back(file.first);
+      }
+    }
+    for (const auto& key : moved) {
+      auto file = std::move(files_.at(key));
+      files_.erase(key);
+      files_[target + key.substr(source.size())] = std::move(file);
+    }
+  }
+  if (dropped) {  // as in remove, what its handles wrote goes with it
+    std::lock_guard<std::mutex> lock(dropped->mutex);
+    dropped->dirty = false;
+    unstage(*dropped);
+  }
+}
+
+void blob_filesystem::permissions(const Path& path,
+                                  drivex::permissions permissions) {
+  update(path, [permissions](node& entry) {
+    entry.status.permissions(permissions);
+  });
+}
+
+bool blob_filesystem::is_empty(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& entry = resolve(path);
+  return entry.status.type() == file_type::directory ? entry.children.empty()
+                                                     : entry.size == 0;
+}
+
+void blob_filesystem::chown(const Path& path, uint32_t user_id,
+                            uint32_t group_id) {
+  update(path, [user_id, group_id](node& entry) {
+    entry.user_id = user_id;
+    entry.group_id = group_id;
+  });
+}
+
+void blob_filesystem::truncate(const Path& path, uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    stage(path, *file, offset != 0);
+    if (::ftruncate(file->staged, static_cast<off_t>(offset)) != 0) {
+      throw error(error_code::io_error, path.string());
+    }
+    file->present.truncate(offset);  // what grows back reads as zeros
+    file->object_size = std::min(file->object_size, offset);
+    file->dirty = true;
+    auto time = now();
+    update(path,
+           [offset, time](node& entry) {
+             entry.size = offset;
+             entry.last_write_time = time;
+           },
+           false);
+  }
+  done(path, file, false);
+}
+
+void blob_filesystem::set_attributes(const Path& path,
+                                     const attribute_update& update) {
+  if (update.size) {
+    truncate(path, *update.size);
+  }
+  this->update(path, [&update](node& entry) {
+    if (update.permissions) {
+      entry.status.permissions(*update.permissions);
+    }
+    if (update.user_id) {
+      entry.user_id = *update.user_id;
+    }
+    if (update.group_id) {
+      entry.group_id = *update.group_id;
+    }
+    if (update.last_read_time) {
+      entry.last_read_time = *update.last_read_time;
+    }
+    if (update.last_write_time) {
+      entry.last_write_time = *update.last_write_time;
+    }
+  });
+}
+
+void blob_filesystem::open(const Path& path, int flags) {
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+    const auto& entry = lookup(absolute(path).string());
+    if (entry.status.type() == file_type::directory &&
+        (flags & O_ACCMODE) != O_RDONLY) {
+      throw error(error_code::is_a_directory, path.string());
+    }
+  }
+  auto file = acquire(path, true);
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    truncate(path, 0);
+  }
+}
+
+int blob_filesystem::read(const Path& path, string_view& buffer,
+                          uint64_t offset) const {
+  auto file = acquire(path, false);
+  std::size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    auto output = const_cast<char*>(buffer.data());
+    if (file->staged >= 0) {
+      fill(*file, offset, buffer.size());
+      count = pread_all(file->staged, output, buffer.size(), offset);
+    } else {
+      std::string object;
+      std::uint64_t size;
+      {
+        std::shared_lock<std::shared_timed_mutex> index_lock(index_mutex_);
+        const auto& entry = resolve(path);
+        if (entry.status.type() == file_type::directory) {
+          throw error(error_code::is_a_directory, path.string());
+        }
+        object = entry.object;
+        size = entry.size;
+      }
+      if (offset < size) {
+        count = std::min<std::uint64_t>(buffer.size(), size - offset);
+      }
+      if (count > 0) {
+        const std::uint64_t range_size = settings_.range_size;
+        auto first = offset / range_size;
+        auto last = (offset + count - 1) / range_size;
+        std::vector<block_cache::block> ranges(last - first + 1);
+        parallel(ranges.size(), [&](std::size_t i) {
+          ranges[i] = range(object, size, first + i);
+        });
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+          auto start = (first + i) * range_size;
+          auto from = std::max<std::uint64_t>(offset, start);
+          auto to = std::min<std::uint64_t>(offset + count,
+                                            start + ranges[i]->size());
+          std::memcpy(output + (from - offset),
+                      ranges[i]->data() + (from - start), to - from);
+        }
+        if (offset == file->next_offset) {  // sequential, so read ahead
+          auto end = ceil_div(size, range_size) - 1;
+          prefetch(object, size, last + 1,
+                   std::min<std::uint64_t>(end, last + settings_.read_ahead));
+        }
+      }
+    }
+    file->next_offset = offset + count;
+  }
+  done(path, file, false);
+  return static_cast<int>(count);
+}
+
+int blob_filesystem::write(const Path& path, const string_view& buffer,
+                           uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    stage(path, *file, true);
+    pwrite_all(file->staged, buffer.data(), buffer.size(), offset);
+    file->present.insert(offset, buffer.size());
+    file->dirty = true;
+    auto end = offset + buffer.size();
+    auto time = now();
+    update(path,
+           [end, time](node& entry) {
+             entry.size = std::max(entry.size, end);
+             entry.last_write_time = time;
+           },
+           false);
+  }
+  done(path, file, false);
+  return static_cast<int>(buffer.size());
+}
+
+void blob_filesystem::flush(const Path& path) {
+  (void)path;  // data is uploaded on release and fsync
+}
+
+void blob_filesystem::release(const Path& path, int flags) {
+  (void)flags;
+  done(path, acquire(path, false), true);
+}
+
+void blob_filesystem::fsync(const Path& path, int fd) {
+  (void)fd;
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    upload(path, *file);
+  }
+  done(path, file, false);
+  sync();
+}
+
+void blob_filesystem::setxattr(
+    const Path& path, const std::pair<std::string, string_view>& attribute,
+    int flags) {
+  (void)flags;
+  update(path, [&attribute](node& entry) {
+    entry.xattrs[attribute.first] = attribute.second.to_string();
+  });
+}
+
+std::size_t blob_filesystem::getxattr(const Path& path,
+                                      const std::string& name,
+                                      string_view& buffer) {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& attributes = lookup(absolute(path).string()).xattrs;
+  auto found = attributes.find(name);
+  if (found == attributes.end()) {
+    throw error(error_code::no_message_available, name);
+  }
+  const auto& value = found->second;
+  if (!buffer.empty()) {
+    if (buffer.size() < value.size()) {
+      throw error(error_code::result_out_of_range);
+    }
+    std::copy(value.begin(), value.end(), const_cast<char*>(buffer.data()));
+  }
+  return value.size();
+}
+
+xattr_map blob_filesystem::getxattrs(const Path& path) {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return lookup(absolute(path).string()).xattrs;
+}
+
+std::vector<std::string> blob_filesystem::listxattr(const Path& path) {
+  std::vector<std::string> names;
+  for (const auto& attribute : getxattrs(path)) {
+    names.push_back(attribute.first);
+  }
+  return names;
+}
+
+void blob_filesystem::removexattr(const Path& path, const std::string& name) {
+  update(path, [&name](node& entry) {
+    if (entry.xattrs.erase(name) == 0) {
+      throw error(error_code::no_message_available, name);
+    }
+  });
+}
+
+std::vector<Path> blob_filesystem::read_directory(const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& directory = resolve(path);
+  if (directory.status.type() != file_type::directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  auto names = std::vector<Path>{".", ".."};
+  names.reserve(directory.children.size() + 2);
+  for (const auto& name : directory.children) {
+    names.emplace_back(name);
+  }
+  return names;
+}
+
+std::vector<directory_entry> blob_filesystem::read_directory_entries(
+    const Path& path) const {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& directory = resolve(path);
+  if (directory.status.type() != file_type::directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  auto base = absolute(path);
+  auto entries = std::vector<directory_entry>{};
+  entries.reserve(directory.children.size() + 2);
+  entries.emplace_back(*this, path / ".", directory.status);
+  entries.emplace_back(*this, path / "..", file_status(file_type::directory));
+  for (const auto& name : directory.children) {
+    const auto& child = lookup((base / name).string());
+    entries.emplace_back(*this, path / name, child.status, child.size,
+                         to_time_t(child.last_write_time));
+  }
+  return entries;
+}
+
+void blob_filesystem::fsyncdir(const Path& path, int datasync) {
+  (void)path;
+  (void)datasync;
+  sync();
+}
+
+void blob_filesystem::create_file(const Path& path) {
+  create_file(path, default_file_permissions);
+}
+
+void blob_filesystem::create_file(const Path& path,
+                                  drivex::permissions permissions) {
+  node entry;
+  entry.status = file_status(file_type::regular, permissions);
+  add(path, std::move(entry));
+}
+
+std::time_t blob_filesystem::last_read_time(const Path& path) {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return to_time_t(resolve(path).last_read_time);
+}
+
+void blob_filesystem::last_read_time(const Path& path, std::time_t new_time) {
+  update(path, [new_time](node& entry) {
+    entry.last_read_time = from_time_t(new_time);
+  });
+}
+
+std::time_t blob_filesystem::last_write_time(const Path& path) {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  return to_time_t(resolve(path).last_write_time);
+}
+
+void blob_filesystem::last_write_time(const Path& path,
+                                      std::time_t new_time) {
+  update(path, [new_time](node& entry) {
+    entry.last_write_time = from_time_t(new_time);
+  });
+}
+
+file_times blob_filesystem::times(const Path& path) {
+  std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+  const auto& entry = resolve(path);
+  return file_times{entry.last_read_time, entry.last_write_time};
+}
+
+block_cache& blob_filesystem::cache() noexcept { return cache_; }
+
+void blob_filesystem::save() const {
+  std::lock_guard<std::mutex> save_lock(save_mutex_);
+  if (!index_changed_.exchange(false)) {
+    return;
+  }
+  std::string buffer(index_magic, sizeof(index_magic));
+  std::uint64_t sequence;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+    sequence = journal_.last();  // records are appended under the lock
+    append(buffer, sequence);
+    append(buffer, static_cast<std::uint32_t>(nodes_.size()));
+    for (const auto& item : nodes_) {
+      append_node(buffer, item.first, item.second);
+    }
+  }
+  try {
+    write_durably(settings_.index, buffer);
+  } catch (const error&) {
+    index_changed_ = true;
+    throw;
+  }
+  journal_.checkpoint(sequence);
+  collect();
+}
+
+void blob_filesystem::sync() const {
+  journal_.commit(journal_.last());
+  if (journal_.checkpoint_due()) {
+    save();
+  } else {
+    collect();
+  }
+}
+
+void blob_filesystem::flush_if_due() const {
+  if (journal_.flush_due()) {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    flush_requested_ = true;
+    flush_wake_.notify_one();
+  }
+}
+
+void blob_filesystem::flush_journal() const {
+  const auto interval = settings_.journal.flush_interval;
+  auto woken = [this]() { return stopping_ || flush_requested_; };
+  std::unique_lock<std::mutex> lock(flush_mutex_);
+  while (!stopping_) {
+    if (interval.count() > 0) {
+      flush_wake_.wait_for(lock, interval, woken);
+    } else {
+      flush_wake_.wait(lock, woken);
+    }
+    if (stopping_) {
+      break;
+    }
+    flush_requested_ = false;
+    lock.unlock();
+    try {
+      sync();
+    } catch (const std::exception&) {  // the next fsync reports it
+    }
+    lock.lock();
+  }
+}
+
+blob_filesystem::state blob_filesystem::acquire(const Path& path,
+                                                bool open) const {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  auto& file = files_[absolute(path).string()];
+  if (!file) {
+    file = std::make_shared<file_state>();
+  }
+  if (open) {
+    ++file->opens;
+  }
+  return file;
+}
+
+void blob_filesystem::done(const Path& path, const state& file,
+                           bool close) const {
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    if (close && file->opens > 0) {
+      --file->opens;
+    }
+    if (file->opens != 0) {
+      return;
+    }
+  }
+  // uploads are slow, so other files stay available meanwhile
+  std::lock_guard<std::mutex> file_lock(file->mutex);
+  upload(path, *file);
+  unstage(*file);
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  auto found = files_.find(absolute(path).string());
+  if (found != files_.end() && found->second == file && file->opens == 0) {
+    files_.erase(found);
+  }
+}
+
+blob_filesystem::node& blob_filesystem::lookup(const std::string& key) const {
+  auto found = nodes_.find(key);
+  if (found == nodes_.end()) {
+    throw error(error_code::no_such_file_or_directory, key);
+  }
+  return found->second;
+}
+
+const blob_filesystem::node& blob_filesystem::resolve(const Path& path) const {
+  auto current = absolute(path);
+  const auto* entry = &lookup(current.string());
+  for (auto hops = 0; entry->status.type() == file_type::symlink; ++hops) {
+    if (hops == max_symlink_hops) {
+      throw error(error_code::too_many_symbolic_link_levels, path.string());
+    }
+    auto target = Path(entry->target);
+    current = absolute(target.is_absolute() ? target
+                                            : parent_path(current) / target);
+    entry = &lookup(current.string());
+  }
+  return *entry;
+}
+
+void blob_filesystem::add(const Path& path, node entry) {
+  auto key = absolute(path);
+  auto name = key.filename().string();
+  auto time = now();
+  entry.last_read_time = time;
+  entry.last_write_time = time;
+  std::unique_lock<std::shared_timed_mutex> lock(index_mutex_);
+  auto& parent = lookup(key.parent_path().string());
+  if (parent.status.type() != file_type::directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  if (!nodes_.emplace(key.string(), std::move(entry)).second) {
+    throw error(error_code::file_exists, path.string());
+  }
+  parent.children.insert(name);
+  parent.last_write_time = time;
+  log_put(key.string(), nodes_.at(key.string()));
+  log_put(key.parent_path().string(), parent);
+}
+
+void blob_filesystem::update(const Path& path,
+                             const std::function<void(node&)>& change,
+                             bool logged) {
+  auto key = absolute(path).string();
+  std::unique_lock<std::shared_timed_mutex> lock(index_mutex_);
+  auto& entry = lookup(key);
+  change(entry);
+  if (logged) {
+    log_put(key, entry);
+  } else {
+    index_changed_ = true;
+  }
+}
+
+std::uint64_t blob_filesystem::log_put(const std::string& key,
+                                       const node& entry) const {
+  std::string record(1, journal_put);
+  append_node(record, key, entry);
+  index_changed_ = true;
+  auto sequence = journal_.append(record);
+  flush_if_due();
+  return sequence;
+}
+
+std::uint64_t blob_filesystem::log_erase(const std::string& key) const {
+  std::string record(1, journal_erase);
+  append_string(record, key);
+  index_changed_ = true;
+  auto sequence = journal_.append(record);
+  flush_if_due();
+  return sequence;
+}
+
+void blob_filesystem::discard(std::uint64_t sequence,
+                              const std::string& object) const {
+  if (!object.empty()) {
+    std::lock_guard<std::mutex> lock(garbage_mutex_);
+    garbage_.emplace_back(sequence, object);
+  }
+}
+
+void blob_filesystem::collect() const {
+  std::vector<std::pair<std::uint64_t, std::string>> objects;
+  {
+    auto durable = journal_.durable();
+    std::lock_guard<std::mutex> lock(garbage_mutex_);
+    auto kept = std::partition(
+        garbage_.begin(), garbage_.end(),
+        [durable](const std::pair<std::uint64_t, std::string>& item) {
+          return item.first > durable;
+        });
+    std::move(kept, garbage_.end(), std::back_inserter(objects));
+    garbage_.erase(kept, garbage_.end());
+  }
+  for (std::size_t i = 0; i < objects.size(); ++i) {
+    cache_.invalidate(Path(objects[i].second));
+    try {
+      store_->remove(objects[i].second);
+    } catch (...) {  // keep what is left for the next commit
+      std::lock_guard<std::mutex> lock(garbage_mutex_);
+      std::move(objects.begin() + i, objects.end(),
+                std::back_inserter(garbage_));
+      throw;
+    }
+  }
+}
+
+void blob_filesystem::stage(const Path& path, file_state& file,
+                            bool download) const {
+  if (file.staged >= 0) {
+    return;
+  }
+  std::string object;
+  std::uint64_t size;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(index_mutex_);
+    const auto& entry = lookup(absolute(path).string());
+    if (entry.status.type() != file_type::regular) {
+      throw error(error_code::is_a_directory, path.string());
+    }
+    object = entry.object;
+    size = download ? entry.size : 0;
+  }
+  Path host;
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    host = settings_.staging / (std::to_string(::getpid()) + "." +
+                                std::to_string(next_staged_++));
+  }
+  auto fd = ::open(host.string().c_str(),
+                   O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw error(error_code::io_error, host.string());
+  }
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {  // a hole for now
+    ::close(fd);
+    ::unlink(host.string().c_str());
+    throw error(error_code::io_error, host.string());
+  }
+  file.staged = fd;
+  file.staged_path = host;
+  file.object = object;
+  file.object_size = object.empty() ? 0 : size;
+  file.present.clear();
+}
+
+void blob_filesystem::fill(file_state& file, std::uint64_t offset,
+                           std::uint64_t length) const {
+  auto end = std::min(offset + length, file.object_size);
+  if (offset >= end) {
+    return;
+  }
+  std::vector<extent_map::extent> gaps;
+  auto position = offset;
+  for (const auto& held : file.present.overlapping(offset, end - offset)) {
+    if (held.offset > position) {
+      gaps.push_back(extent_map::extent{position, held.offset - position});
+    }
+    position = held.end();
+  }
+  if (position < end) {
+    gaps.push_back(extent_map::extent{position, end - position});
+  }
+  const std::uint64_t range_size = settings_.range_size;
+  std::vector<std::uint64_t> numbers;  // of the ranges the gaps lie in
+  for (const auto& gap : gaps) {
+    for (auto number = gap.offset / range_size; number * range_size < gap.end();
+         ++number) {
+      if (numbers.empty() || numbers.back() != number) {
+        numbers.push_back(number);
+      }
+    }
+  }
+  parallel(numbers.size(), [&](std::size_t i) {
+    auto start = numbers[i] * range_size;
+    auto data = range(file.object, file.object_size, numbers[i]);
+    for (const auto& gap : gaps) {
+      auto from = std::max(gap.offset, start);
+      auto to = std::min(gap.end(), start + data->size());
+      if (from < to) {
+        pwrite_all(file.staged, data->data() + (from - start), to - from,
+                   from);
+      }
+    }
+  });
+  for (const auto& gap : gaps) {
+    file.present.insert(gap.offset, gap.length);
+  }
+}
+
+void blob_filesystem::upload(const Path& path, file_state& file) const {
+  if (!file.dirty || file.staged < 0) {
+    return;
+  }
+  fill(file, 0, file.object_size);
+  auto size = staged_size(file.staged);
+  auto key = size == 0 ? std::string() : new_key();
+  auto read_part = [&file](std::uint64_t offset, std::size_t length) {
+    std::string data(length, '\0');
+    data.resize(pread_all(file.staged, &data[0], length, offset));
+    return data;
+  };
+  if (size == 0) {
+  } else if (size <= settings_.part_size) {
+    store_->put(key, read_part(0, static_cast<std::size_t>(size)));
+  } else {
+    const std::uint64_t part_size = settings_.part_size;
+    auto parts = ceil_div(size, part_size);
+    auto upload = store_->start_upload(key);
+    try {
+      parallel(parts, [&](std::size_t number) {
+        auto offset = number * part_size;
+        auto data = read_part(
+            offset, static_cast<std::size_t>(
+                        std::min<std::uint64_t>(part_size, size - offset)));
+        store_->put_part(upload, static_cast<std::uint32_t>(number), data);
+      });
+      store_->complete_upload(upload, static_cast<std::uint32_t>(parts));
+    } catch (...) {
+      store_->abort_upload(upload);
+      throw;
+    }
+  }
+  auto orphan = !key.empty();  // if the file went away meanwhile
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(index_mutex_);
+    auto found = nodes_.find(absolute(path).string());
+    if (found != nodes_.end()) {
+      auto replaced = std::move(found->second.object);
+      found->second.object = key;
+      found->second.size = size;
+      // the old object goes once the index cannot refer to it after a crash
+      discard(log_put(found->first, found->second), replaced);
+      orphan = false;
+    }
+  }
+  file.dirty = false;
+  if (orphan) {
+    store_->remove(key);
+  }
+}
+
+void blob_filesystem::unstage(file_state& file) const {
+  if (file.staged >= 0) {
+    ::close(file.staged);
+    ::unlink(file.staged_path.string().c_str());
+    file.staged = -1;
+  }
+}
+
+block_cache::block blob_filesystem::range(const std::string& object,
+                                          std::uint64_t size,
+                                          std::uint64_t number) const {
+  auto key = Path(object);
+  auto cached = cache_.get(key, number);
+  if (cached) {
+    return cached;
+  }
+  const std::uint64_t range_size = settings_.range_size;
+  auto start = number * range_size;
+  auto length = std::min<std::uint64_t>(range_size, size - start);
+  auto data = std::make_shared<const std::string>(
+      store_->get(object, start, static_cast<std::size_t>(length)));
+  if (data->size() != length) {
+    throw error(error_code::io_error, object + ": short object");
+  }
+  cache_.put(key, number, data);
+  return data;
+}
+
+void blob_filesystem::prefetch(const std::string& object, std::uint64_t size,
+                               std::uint64_t first,
+                               std::uint64_t last) const {
+  if (settings_.pool == nullptr) {
+    return;
+  }
+  for (auto number = first; number <= last; ++number) {
+    if (cache_.get(Path(object), number)) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(prefetch_mutex_);
+      ++prefetching_;
+    }
+    settings_.pool->post([this, object, size, number]() {
+      try {
+        range(object, size, number);
+      } catch (...) {  // the reader fetches it again if it needs it
+      }
+      std::lock_guard<std::mutex> lock(prefetch_mutex_);
+      if (--prefetching_ == 0) {
+        prefetch_done_.notify_all();
+      }
+    });
+  }
+}
+
+void blob_filesystem::parallel(
+    std::size_t count, const std::function<void(std::size_t)>& work) const {
+  if (settings_.pool == nullptr || count < 2) {
+    for (std::size_t i = 0; i < count; ++i) {
+      work(i);
+    }
+    return;
+  }
+  task_group group(*settings_.pool);
+  for (std::size_t i = 0; i < count; ++i) {
+    group.run([&work, i]() { work(i); });
+  }
+  group.wait();
+}
+
+void blob_filesystem::load() {
+  std::uint64_t sequence = 0;
+  std::ifstream input(settings_.index.string(), std::ios::binary);
+  if (input) {
+    std::string data{std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>()};
+    auto nanoseconds =
+        data.compare(0, sizeof(index_magic),
+                     std::string(index_magic, sizeof(index_magic))) == 0;
+    if (!nanoseconds &&
+        data.compare(0, sizeof(index_magic_seconds),
+                     std::string(index_magic_seconds,
+                                 sizeof(index_magic_seconds))) != 0) {
+      throw error(error_code::io_error,
+                  settings_.index.string() + ": not a blob index");
+    }
+    index_reader reader(data);
+    for (std::size_t i = 0; i < sizeof(index_magic); ++i) {
+      reader.get<char>();
+    }
+    sequence = reader.get<std::uint64_t>();
+    for (auto count = reader.get<std::uint32_t>(); count != 0; --count) {
+      node entry;
+      auto key = read_node(reader, entry, nanoseconds);
+      nodes_.emplace(std::move(key), std::move(entry));
+    }
+  } else {  // a new filesystem, unless the journal says otherwise
+    node root;
+    root.status = file_status(file_type::directory,
+                              default_directory_permissions);
+    root.last_read_time = root.last_write_time = now();
+    nodes_.emplace("/", std::move(root));
+    index_changed_ = true;
+  }
+  journal_.replay(sequence, [this](const string_view& record) {
+    auto data = record.to_string();
+    index_reader reader(data);
+    auto kind = reader.get<char>();
+    if (kind == journal_put || kind == journal_put_seconds) {
+      node entry;
+      auto key = read_node(reader, entry, kind == journal_put);
+      nodes_[key] = std::move(entry);
+    } else {
+      nodes_.erase(reader.get_string());
+    }
+    index_changed_ = true;
+  });
+  for (const auto& item : nodes_) {
+    if (item.first != "/") {
+      auto path = Path(item.first);
+      lookup(path.parent_path().string())
+          .children.insert(path.filename().string());
+    }
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
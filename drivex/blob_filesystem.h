@@ -0,0 +1,226 @@
+#pragma once
+#include <drivex/blob_store.h>
+#include <drivex/block_cache.h>
+#include <drivex/extent_map.h>
+#include <drivex/filesystem.h>
+#include <drivex/journal.h>
+#include <drivex/thread_pool.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+struct blob_settings {
+  /** Host file holding the metadata index; its journal is kept in a
+   * directory of the same name with .journal appended */
+  Path index;
+  /** Host directory where files being written are staged */
+  Path staging;
+  /** Size of each part of a multipart upload; smaller files are put whole */
+  std::size_t part_size = 8u << 20u;
+  /** Size of the ranges objects are read and cached in */
+  std::size_t range_size = 1u << 20u;
+  /** Ranges fetched ahead of a sequential reader */
+  std::size_t read_ahead = 4;
+  /** Ranges kept in memory */
+  std::size_t cache_ranges = 64;
+  /** Pool for parallel part uploads, ranged gets and read-ahead, if any;
+   * not one that also runs filesystem requests, as waits lend it a hand */
+  thread_pool* pool = nullptr;
+  /** When the journal is folded into the index */
+  journal_settings journal;
+};
+
+/** Keeps file data in a blob store and metadata in a local index
+ *
+ * Every regular file with data is one object under a generated key, so
+ * rename and attribute changes never touch the store.  The tree, with
+ * types, permissions, ownership, sizes, times, symlink targets and
+ * extended attributes, is held in memory and saved to the index file, so
+ * status and read_directory are answered locally.
+ *
+ * A file that is written is first staged in a sparse host file.  The
+ * ranges of its old object are downloaded in parallel only when a read
+ * needs them or the file is uploaded, and an extent map records which bytes
+ * the staged copy holds, so a small write to a large file does not wait
+ * for all of it.  On release of its last open,
+ * or fsync, the staged file is uploaded as a new object, in parallel parts
+ * if it is larger than a part, the index is switched to it and the old
+ * object removed.  Reads of files that are not staged fetch the ranges
+ * they need in parallel and cache them; a reader that continues where it
+ * left off also has the next ranges fetched in the background.
+ *
+ * Each metadata change is appended to a journal without waiting for the
+ * disk.  fsync and fsyncdir commit the journal, sharing one sync between
+ * concurrent callers, and a background thread commits it every
+ * journal.flush_interval, or sooner once journal.flush_bytes are waiting.
+ * Once the journal grows past journal.checkpoint_bytes the whole index is
+ * saved as a checkpoint and the journal trimmed.  After a crash, changes
+ * committed since the last checkpoint are replayed.  Objects a change
+ * replaces are deleted by the next commit after the change is durable, so
+ * the index never refers to a missing object.  Hard links are not
+ * supported. */
+class blob_filesystem : public filesystem {
+ public:
+  blob_filesystem(std::shared_ptr<blob_store> store, blob_settings settings);
+
+  /** Upload staged files and save the index, ignoring errors */
+  ~blob_filesystem() override;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  file_status status(const Path& path) const override;
+  file_status symlink_status(const Path& path) const override;
+  Path read_symlink(const Path& path) const override;
+  void create_directory(const Path& path) override;
+  void create_directory(const Path& path,
+                        drivex::permissions permissions) override;
+  bool remove(const Path& path) override;
+  void create_symlink(const Path& target, const Path& link) override;
+  void rename(const Path& from, const Path& to) override;
+  void permissions(const Path& path,
+                   drivex::permissions permissions) override;
+  bool is_empty(const Path& path) const override;
+  void chown(const Path& path, uint32_t user_id, uint32_t group_id) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void release(const Path& path, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  void setxattr(const Path& path,
+                const std::pair<std::string, string_view>& attribute,
+                int flags) override;
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override;
+  xattr_map getxattrs(const Path& path) override;
+  std::vector<std::string> listxattr(const Path& path) override;
+  void removexattr(const Path& path, const std::string& name) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  void fsyncdir(const Path& path, int datasync) override;
+  void create_file(const Path& path) override;
+  void create_file(const Path& path,
+                   drivex::permissions permissions) override;
+  std::time_t last_read_time(const Path& path) override;
+  void last_read_time(const Path& path, std::time_t new_time) override;
+  std::time_t last_write_time(const Path& path) override;
+  void last_write_time(const Path& path, std::time_t new_time) override;
+  file_times times(const Path& path) override;
+
+  /** Cache of object ranges */
+  block_cache& cache() noexcept;
+
+  /** Save the index now, as a checkpoint of the journal */
+  void save() const;
+
+ private:
+  struct node {
+    file_status status;
+    std::uint32_t user_id = 0;
+    std::uint32_t group_id = 0;
+    std::uint64_t size = 0;
+    file_time last_read_time;
+    file_time last_write_time;
+    std::string object;  // key of the data; empty if there is none
+    std::string target;  // of a symlink
+    xattr_map xattrs;
+    std::set<std::string> children;  // names, of a directory
+  };
+
+  struct file_state {
+    std::mutex mutex;
+    int staged = -1;  // host file descriptor
+    Path staged_path;
+    std::string object;  // the data of the staged copy outside present
+    std::uint64_t object_size = 0;
+    extent_map present;  // bytes the staged copy holds
+    bool dirty = false;
+    std::uint64_t next_offset = 0;  // where a sequential read continues
+    std::size_t opens = 0;
+  };
+  using state = std::shared_ptr<file_state>;
+
+  state acquire(const Path& path, bool open) const;
+  void done(const Path& path, const state& file, bool close) const;
+
+  /** Find a node without following symlinks; the index lock is held */
+  node& lookup(const std::string& key) const;
+  /** Find a node, following symlinks; the index lock is held */
+  const node& resolve(const Path& path) const;
+  /** Add a node to its parent directory */
+  void add(const Path& path, node entry);
+  /** Apply a change to a node under the exclusive index lock, journaling
+   * it if logged */
+  void update(const Path& path, const std::function<void(node&)>& change,
+              bool logged = true);
+  /** Journal a node or its removal; the exclusive index lock is held */
+  std::uint64_t log_put(const std::string& key, const node& entry) const;
+  std::uint64_t log_erase(const std::string& key) const;
+  /** Delete an object once the journal record that dropped it is durable */
+  void discard(std::uint64_t sequence, const std::string& object) const;
+  void collect() const;
+  /** Commit the journal, checkpointing if due */
+  void sync() const;
+  /** Wake the background flush if enough of the journal is waiting */
+  void flush_if_due() const;
+  /** Body of the background flush thread */
+  void flush_journal() const;
+
+  /** Give a file a staged copy, backed by its data if download */
+  void stage(const Path& path, file_state& file, bool download) const;
+  /** Download what the staged copy lacks of a range */
+  void fill(file_state& file, std::uint64_t offset,
+            std::uint64_t length) const;
+  void upload(const Path& path, file_state& file) const;
+  void unstage(file_state& file) const;
+  /** Cached range of an object */
+  block_cache::block range(const std::string& object, std::uint64_t size,
+                           std::uint64_t number) const;
+  void prefetch(const std::string& object, std::uint64_t size,
+                std::uint64_t first, std::uint64_t last) const;
+  /** Run work(0) to work(count - 1), in parallel on the pool if any */
+  void parallel(std::size_t count,
+                const std::function<void(std::size_t)>& work) const;
+  void load();
+
+  std::shared_ptr<blob_store> store_;
+  blob_settings settings_;
+  mutable block_cache cache_;
+  mutable journal journal_;
+  mutable std::shared_timed_mutex index_mutex_;
+  mutable std::unordered_map<std::string, node> nodes_;
+  mutable std::atomic<bool> index_changed_;
+  mutable std::mutex save_mutex_;
+  mutable std::mutex garbage_mutex_;
+  mutable std::vector<std::pair<std::uint64_t, std::string>> garbage_;
+  mutable std::mutex files_mutex_;
+  mutable std::unordered_map<std::string, state> files_;
+  mutable std::uint64_t next_staged_;
+  mutable std::mutex prefetch_mutex_;
+  mutable std::condition_variable prefetch_done_;
+  mutable std::size_t prefetching_;
+  mutable std::mutex flush_mutex_;
+  mutable std::condition_variable flush_wake_;
+  mutable bool flush_requested_;
+  bool stopping_;
+  std::thread flusher_;
+};
+}  // namespace drivex
+}  // namespace lockblox
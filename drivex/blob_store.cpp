@@ -0,0 +1,192 @@
+#include <drivex/blob_store.h>
+#include <boost/filesystem/operations.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+void write_all(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    auto result = ::write(fd, data, size);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      throw error(error_code::io_error, "blob write failed");
+    }
+    data += result;
+    size -= result;
+  }
+}
+
+/** Read up to length bytes at offset of a host file */
+std::string read_range(const Path& path, std::uint64_t offset,
+                       std::size_t length) {
+  auto fd = ::open(path.string().c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw error(errno == ENOENT ? error_code::no_such_file_or_directory
+                                : error_code::io_error,
+                path.string());
+  }
+  std::string data;
+  if (length == std::string::npos) {
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      throw error(error_code::io_error, path.string());
+    }
+    auto size = static_cast<std::uint64_t>(file_stat.st_size);
+    length = offset < size ? static_cast<std::size_t>(size - offset) : 0;
+  }
+  data.resize(length);
+  std::size_t done = 0;
+  while (done < length) {
+    auto result = ::pread(fd, &data[done], length - done,
+                          static_cast<off_t>(offset + done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0) {
+      ::close(fd);
+      throw error(error_code::io_error, path.string());
+    }
+    if (result == 0) {
+      break;
+    }
+    done += result;
+  }
+  ::close(fd);
+  data.resize(done);
+  return data;
+}
+
+void check_key(const std::string& key) {
+  if (key.empty() || key[0] == '.' || key.find('/') != std::string::npos) {
+    throw error(error_code::invalid_argument, key);
+  }
+}
+
+}  // namespace
+
+directory_blob_store::directory_blob_store(const Path& root)
+    : root_(root), next_temporary_(0) {
+  boost::system::error_code code;
+  boost::filesystem::create_directories(root_ / "objects", code);
+  if (!code) {
+    boost::filesystem::create_directories(root_ / "uploads", code);
+  }
+  if (code) {
+    throw error(error_code::io_error, root_.string());
+  }
+}
+
+void directory_blob_store::put(const std::string& key,
+                               const string_view& data) {
+  publish(object(key), data);
+}
+
+std::string directory_blob_store::get(const std::string& key) const {
+  return read_range(object(key), 0, std::string::npos);
+}
+
+std::string directory_blob_store::get(const std::string& key,
+                                      std::uint64_t offset,
+                                      std::size_t length) const {
+  return read_range(object(key), offset, length);
+}
+
+std::string directory_blob_store::start_upload(const std::string& key) {
+  check_key(key);
+  auto upload = key + "." + std::to_string(::getpid()) + "." +
+                std::to_string(next_temporary_++);
+  if (::mkdir(upload_directory(upload).string().c_str(), 0755) != 0) {
+    throw error(error_code::io_error, upload);
+  }
+  return upload;
+}
+
+void directory_blob_store::put_part(const std::string& upload,
+                                    std::uint32_t number,
+                                    const string_view& data) {
+  publish(upload_directory(upload) / std::to_string(number), data);
+}
+
+void directory_blob_store::complete_upload(const std::string& upload,
+                                           std::uint32_t count) {
+  auto directory = upload_directory(upload);
+  auto suffix = upload.rfind('.', upload.rfind('.') - 1);  // .pid.number
+  auto key = upload.substr(0, suffix);
+  auto target = object(key);
+  auto temporary = target.string() + "." + std::to_string(::getpid()) + "." +
+                   std::to_string(next_temporary_++) + ".tmp";
+  auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    throw error(error_code::io_error, temporary);
+  }
+  try {
+    for (std::uint32_t number = 0; number < count; ++number) {
+      auto part = read_range(directory / std::to_string(number), 0,
+                             std::string::npos);
+      write_all(fd, part.data(), part.size());
+    }
+  } catch (...) {
+    ::close(fd);
+    ::unlink(temporary.c_str());
+    throw;
+  }
+  if (::close(fd) != 0 ||
+      std::rename(temporary.c_str(), target.string().c_str()) != 0) {
+    ::unlink(temporary.c_str());
+    throw error(error_code::io_error, target.string());
+  }
+  abort_upload(upload);
+}
+
+void directory_blob_store::abort_upload(const std::string& upload) {
+  boost::system::error_code code;
+  boost::filesystem::remove_all(upload_directory(upload), code);
+}
+
+bool directory_blob_store::remove(const std::string& key) {
+  return ::unlink(object(key).string().c_str()) == 0;
+}
+
+Path directory_blob_store::object(const std::string& key) const {
+  check_key(key);
+  return root_ / "objects" / key;
+}
+
+Path directory_blob_store::upload_directory(const std::string& upload) const {
+  check_key(upload);
+  return root_ / "uploads" / upload;
+}
+
+void directory_blob_store::publish(const Path& target,
+                                   const string_view& data) {
+  auto temporary = target.string() + "." + std::to_string(::getpid()) + "." +
+                   std::to_string(next_temporary_++) + ".tmp";
+  auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    throw error(error_code::io_error, temporary);
+  }
+  try {
+    write_all(fd, data.data(), data.size());
+  } catch (...) {
+    ::close(fd);
+    ::unlink(temporary.c_str());
+    throw;
+  }
+  if (::close(fd) != 0 ||
+      std::rename(temporary.c_str(), target.string().c_str()) != 0) {
+    ::unlink(temporary.c_str());
+    throw error(error_code::io_error, target.string());
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,83 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** An object store holding immutable blobs by key
+ *
+ * Objects are written whole, or in numbered parts of a multipart upload
+ * that become visible together, and read whole or by byte range.
+ * Implementations must allow concurrent calls. */
+class blob_store {
+ public:
+  virtual ~blob_store() = default;
+
+  /** Store an object, replacing any with the same key */
+  virtual void put(const std::string& key, const string_view& data) = 0;
+
+  /** Read a whole object
+   *
+   * @throws error(no_such_file_or_directory) if there is none */
+  virtual std::string get(const std::string& key) const = 0;
+
+  /** Read up to length bytes of an object from offset, fewer at its end */
+  virtual std::string get(const std::string& key, std::uint64_t offset,
+                          std::size_t length) const = 0;
+
+  /** Start a multipart upload to a key and return its identifier */
+  virtual std::string start_upload(const std::string& key) = 0;
+
+  /** Store part number of an upload, which is the range starting at the
+   * total size of the parts before it
+   *
+   * Parts may be put concurrently and in any order. */
+  virtual void put_part(const std::string& upload, std::uint32_t number,
+                        const string_view& data) = 0;
+
+  /** Join parts 0 to count - 1 into the object and end the upload */
+  virtual void complete_upload(const std::string& upload,
+                               std::uint32_t count) = 0;
+
+  /** Discard an upload and its parts */
+  virtual void abort_upload(const std::string& upload) = 0;
+
+  /** Delete an object; false if it was not there */
+  virtual bool remove(const std::string& key) = 0;
+};
+
+/** A blob store in a host directory, for testing and local use
+ *
+ * Objects are files under objects/ and parts of uploads in progress live
+ * under uploads/.  Keys may not contain '/' or start with '.'. */
+class directory_blob_store : public blob_store {
+ public:
+  /** @throws error(io_error) if the directories cannot be created */
+  explicit directory_blob_store(const Path& root);
+
+  void put(const std::string& key, const string_view& data) override;
+  std::string get(const std::string& key) const override;
+  std::string get(const std::string& key, std::uint64_t offset,
+                  std::size_t length) const override;
+  std::string start_upload(const std::string& key) override;
+  void put_part(const std::string& upload, std::uint32_t number,
+                const string_view& data) override;
+  void complete_upload(const std::string& upload,
+                       std::uint32_t count) override;
+  void abort_upload(const std::string& upload) override;
+  bool remove(const std::string& key) override;
+
+ private:
+  Path object(const std::string& key) const;
+  Path upload_directory(const std::string& upload) const;
+  /** Write data to a temporary file and rename it to target */
+  void publish(const Path& target, const string_view& data);
+
+  Path root_;
+  std::atomic<std::uint64_t> next_temporary_;
+};
+}  // namespace drivex
+}  // namespace lockblox
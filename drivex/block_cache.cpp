@@ -0,0 +1,166 @@
+#include <drivex/block_cache.h>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+/** Rough bytes held for a block, including the bookkeeping around it */
+std::size_t footprint(const std::string& path, const std::string& data) {
+  return data.size() + 2 * path.size() + 160;
+}
+
+}  // namespace
+
+block_cache::block_cache(std::size_t capacity)
+    : capacity_(capacity), budget_(nullptr) {}
+
+block_cache::~block_cache() { budget(nullptr); }
+
+std::size_t block_cache::capacity() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_;
+}
+
+void block_cache::capacity(std::size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  trim();
+}
+
+void block_cache::budget(memory_budget* budget) {
+  clear();
+  memory_budget* previous;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    previous = budget_;
+    budget_ = nullptr;
+  }
+  if (previous != nullptr) {
+    previous->remove(*this);
+  }
+  if (budget != nullptr) {
+    budget->add(*this);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = budget;
+}
+
+block_cache::block block_cache::get(const Path& path, std::uint64_t number) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key(path.string(), number));
+  if (found == index_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, found->second);
+  if (budget_ != nullptr) {
+    found->second->stamp = budget_->tick();
+  }
+  return found->second->data;
+}
+
+void block_cache::put(const Path& path, std::uint64_t number, block data) {
+  auto k = key(path.string(), number);
+  auto bytes = footprint(k.first, *data);
+  memory_budget* budget;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+      return;
+    }
+    budget = budget_;
+  }
+  // charging may evict from this cache too, so not under the mutex
+  if (budget != nullptr && !budget->charge(*this, bytes)) {
+    invalidate(path, number);  // an older version must not survive
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (budget != budget_) {
+    if (budget != nullptr) {
+      budget->release(*this, bytes);
+    }
+    return;  // the budget changed meanwhile
+  }
+  auto stamp = budget_ != nullptr ? budget_->tick() : 0;
+  auto found = index_.find(k);
+  if (found != index_.end()) {
+    drop(found->second);
+    index_.erase(found);
+  }
+  entries_.push_front({k, std::move(data), bytes, stamp});
+  index_.emplace(std::move(k), entries_.begin());
+  trim();
+}
+
+void block_cache::invalidate(const Path& path, std::uint64_t first) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto name = path.string();
+  auto it = index_.lower_bound(key(name, first));
+  while (it != index_.end() && it->first.first == name) {
+    drop(it->second);
+    it = index_.erase(it);
+  }
+}
+
+void block_cache::invalidate_tree(const Path& path) {
+  invalidate(path);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto prefix = path.string();
+  if (prefix.empty() || prefix.back() != '/') {
+    prefix += '/';
+  }
+  // paths beneath sort together, right after the prefix itself
+  auto it = index_.lower_bound(key(prefix, 0));
+  while (it != index_.end() &&
+         it->first.first.compare(0, prefix.size(), prefix) == 0) {
+    drop(it->second);
+    it = index_.erase(it);
+  }
+}
+
+void block_cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!entries_.empty()) {
+    drop(std::prev(entries_.end()));
+  }
+  index_.clear();
+}
+
+std::string block_cache::name() const { return "blocks"; }
+
+std::uint64_t block_cache::oldest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.empty() ? no_items : entries_.back().stamp;
+}
+
+std::size_t block_cache::evict(std::uint64_t until, std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t dropped = 0;
+  std::size_t released = 0;
+  while (!entries_.empty() &&
+         (dropped == 0 ||
+          (released < bytes && entries_.back().stamp < until))) {
+    released += entries_.back().bytes;
+    index_.erase(entries_.back().id);
+    drop(std::prev(entries_.end()));
+    ++dropped;
+  }
+  return dropped;
+}
+
+void block_cache::drop(lru_list::iterator it) {
+  if (budget_ != nullptr) {
+    budget_->release(*this, it->bytes);
+  }
+  entries_.erase(it);
+}
+
+void block_cache::trim() {
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().id);
+    drop(std::prev(entries_.end()));
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,79 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/memory_budget.h>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace lockblox {
+namespace drivex {
+
+/** Least-recently-used cache of decoded file blocks
+ *
+ * Blocks are identified by path and block number.  A capacity of zero
+ * disables the cache.  With a memory_budget the bytes held are charged to
+ * it as well, and blocks may be evicted to make room for other caches. */
+class block_cache : public memory_consumer {
+ public:
+  using block = std::shared_ptr<const std::string>;
+
+  explicit block_cache(std::size_t capacity = 0);
+  ~block_cache() override;
+
+  block_cache(const block_cache&) = delete;
+  block_cache& operator=(const block_cache&) = delete;
+
+  /** Maximum number of blocks held */
+  std::size_t capacity() const;
+  void capacity(std::size_t capacity);
+
+  /** Charge blocks to a budget from now on, or to none if null
+   *
+   * Blocks already held are dropped. */
+  void budget(memory_budget* budget);
+
+  /** Get a block, or nullptr */
+  block get(const Path& path, std::uint64_t number);
+
+  /** Add or replace a block; it is not kept if the budget is exhausted */
+  void put(const Path& path, std::uint64_t number, block data);
+
+  /** Forget the blocks of a path from first onwards */
+  void invalidate(const Path& path, std::uint64_t first = 0);
+
+  /** Forget the blocks of a path and of every path beneath it */
+  void invalidate_tree(const Path& path);
+
+  /** Forget everything */
+  void clear();
+
+  std::string name() const override;
+  std::uint64_t oldest() const override;
+  std::size_t evict(std::uint64_t until, std::size_t bytes) override;
+
+ private:
+  using key = std::pair<std::string, std::uint64_t>;
+
+  struct entry {
+    key id;
+    block data;
+    std::size_t bytes;    // charged to the budget
+    std::uint64_t stamp;  // of the last use
+  };
+  using lru_list = std::list<entry>;
+
+  void drop(lru_list::iterator it);
+  void trim();
+
+  mutable std::mutex mutex_;
+  std::size_t capacity_;
+  memory_budget* budget_;
+  lru_list entries_;
+  std::map<key, lru_list::iterator> index_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,562 @@
+#include <drivex/checksum_filesystem.h>
+#include <drivex/crc32c.h>
+#include <drivex/directory_entry.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+struct sums_header {
+  char magic[4];
+  std::uint32_t block_size;
+};
+
+const char sums_magic[4] = {'D', 'X', 'C', '1'};
+const std::string sidecar_suffix = ".crc32c";
+
+std::uint64_t block_count(std::uint64_t size, std::uint32_t block_size) {
+  return (size + block_size - 1) / block_size;
+}
+
+std::uint32_t zero_sum(std::size_t size) {
+  return crc32c(string_view(std::string(size, '\0')));
+}
+
+bool is_sidecar(const std::string& name) {
+  return name.size() > sidecar_suffix.size() + 1 && name[0] == '.' &&
+         name.compare(name.size() - sidecar_suffix.size(),
+                      sidecar_suffix.size(), sidecar_suffix) == 0;
+}
+
+bool has_code(const error& e, error_code code) {
+  return e.code().value() == static_cast<int>(code);
+}
+
+}  // namespace
+
+const std::string checksum_filesystem::attribute_name = "user.drivex.crc32c";
+
+checksum_filesystem::checksum_filesystem(std::shared_ptr<filesystem> inner,
+                                         checksum_settings settings)
+    : filesystem_decorator(std::move(inner)), settings_(settings) {
+  if (settings_.block_size == 0) {
+    throw error(error_code::invalid_argument, "block size must not be zero");
+  }
+}
+
+checksum_filesystem::~checksum_filesystem() {
+  for (auto& file : files_.all()) {
+    try {
+      std::lock_guard<std::shared_timed_mutex> lock(file.second->mutex);
+      commit(file.first, *file.second);
+    } catch (...) {  // nothing sensible to do with it here
+    }
+  }
+}
+
+Path checksum_filesystem::sidecar_path(const Path& path) {
+  return path.parent_path() /
+         ("." + path.filename().string() + sidecar_suffix);
+}
+
+bool checksum_filesystem::clone_file(const Path& from, const Path& to) {
+  auto file = acquire(from, false);
+  {
+    std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+    commit(from, *file);
+  }
+  done(from, file, false);
+  if (!inner().clone_file(from, to)) {
+    return false;
+  }
+  if (auto stored = fetch(from)) {
+    store(to, *stored);
+  }
+  return true;
+}
+
+bool checksum_filesystem::remove(const Path& path) {
+  files_.take(path);
+  auto removed = inner().remove(path);
+  if (removed && settings_.storage == checksum_storage::sidecar) {
+    try {
+      inner().remove(sidecar_path(path));
+    } catch (const error&) {  // it may never have been written
+    }
+  }
+  return removed;
+}
+
+void checksum_filesystem::rename(const Path& from, const Path& to) {
+  inner().rename(from, to);
+  if (settings_.storage == checksum_storage::sidecar) {
+    try {
+      inner().rename(sidecar_path(from), sidecar_path(to));
+    } catch (const error& e) {
+      if (!has_code(e, error_code::no_such_file_or_directory)) {
+        throw;
+      }
+      try {
+        inner().remove(sidecar_path(to));
+      } catch (const error&) {  // there was none to replace
+      }
+    }
+  }
+  files_.rename(from, to);
+}
+
+void checksum_filesystem::link(const Path& from, const Path& to) {
+  if (settings_.storage == checksum_storage::sidecar) {
+    throw error(error_code::function_not_supported);
+  }
+  inner().link(from, to);
+}
+
+void checksum_filesystem::truncate(const Path& path, uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+    resize(path, *file, offset);
+  }
+  done(path, file, false);
+}
+
+void checksum_filesystem::set_attributes(const Path& path,
+                                         const attribute_update& update) {
+  if (update.size) {
+    truncate(path, *update.size);
+  }
+  auto rest = update;
+  rest.size = boost::none;
+  if (rest.permissions || rest.user_id || rest.group_id ||
+      rest.last_read_time || rest.last_write_time) {
+    inner().set_attributes(path, rest);
+  }
+}
+
+void checksum_filesystem::open(const Path& path, int flags) {
+  inner().open(path, inner_flags(flags));
+  auto file = acquire(path, true);
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+    resize(path, *file, 0);
+  }
+}
+
+open_handle checksum_filesystem::open_file(const Path& path, int flags) {
+  open(path, flags);  // the inner handle would bypass this layer
+  return no_open_handle;
+}
+
+open_handle checksum_filesystem::create(const Path& path,
+                                        drivex::permissions permissions,
+                                        int flags) {
+  inner().create(path, permissions, inner_flags(flags));
+  auto file = acquire(path, true);
+  std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+  file->changed = true;  // an empty file still gets its checksums stored
+  return no_open_handle;
+}
+
+int checksum_filesystem::read(const Path& path, string_view& buffer,
+                              uint64_t offset) const {
+  auto file = acquire(path, false);
+  std::size_t count = 0;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(file->mutex);
+    if (offset < file->size) {
+      count = std::min<std::uint64_t>(buffer.size(), file->size - offset);
+      const auto block_size = file->block_size;
+      auto first = offset / block_size;
+      auto start = first * block_size;
+      auto stop = std::min<std::uint64_t>(
+          ((offset + count - 1) / block_size + 1) * block_size, file->size);
+      auto output = const_cast<char*>(buffer.data());
+      auto blocks = output;
+      std::string scratch;
+      if (start != offset || stop != offset + count) {  // not block aligned
+        scratch.resize(stop - start);
+        blocks = &scratch[0];
+      }
+      read_exact(path, blocks, stop - start, start);
+      verify(path, *file, blocks, first, stop - start);
+      if (blocks != output) {
+        std::memcpy(output, blocks + (offset - start), count);
+      }
+    }
+  }
+  done(path, file, false);
+  return static_cast<int>(count);
+}
+
+int checksum_filesystem::read(const Path& path, open_handle handle,
+                              string_view& buffer, uint64_t offset) const {
+  (void)handle;
+  return read(path, buffer, offset);
+}
+
+int checksum_filesystem::write(const Path& path, const string_view& buffer,
+                               uint64_t offset) {
+  if (buffer.empty()) {
+    return 0;
+  }
+  auto file = acquire(path, false);
+  auto written = 0;
+  {
+    std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+    const auto block_size = file->block_size;
+    const auto old_size = file->size;
+    const auto end = offset + buffer.size();
+    auto new_size = std::max(old_size, end);
+    // The old last block, if partial and wholly before the written range,
+    // is padded with zeros; blocks between it and the range are all zeros.
+    auto padded = false;
+    std::uint32_t padded_sum = 0;
+    auto first = offset / block_size;
+    auto last = (end - 1) / block_size;
+    std::string scratch(block_size, '\0');
+    if (old_size % block_size != 0 && old_size / block_size < first) {
+      auto number = old_size / block_size;
+      auto size = read_block(path, *file, number, &scratch[0]);
+      std::memset(&scratch[size], 0, block_size - size);
+      padded_sum = crc32c(string_view(scratch));
+      padded = true;
+    }
+    std::vector<std::uint32_t> sums;
+    for (auto number = first; number <= last; ++number) {
+      auto start = number * block_size;
+      auto size = std::min<std::uint64_t>(block_size, new_size - start);
+      if (start >= offset && start + size <= end) {  // wholly overwritten
+        sums.push_back(
+            crc32c(string_view(buffer.data() + (start - offset), size)));
+        continue;
+      }
+      std::memset(&scratch[0], 0, size);
+      if (start < old_size) {
+        read_block(path, *file, number, &scratch[0]);
+      }
+      auto from = std::max(start, offset);
+      auto to = std::min(start + size, end);
+      std::memcpy(&scratch[from - start], buffer.data() + (from - offset),
+                  to - from);
+      sums.push_back(crc32c(string_view(scratch.data(), size)));
+    }
+    written = inner().write(path, buffer, offset);
+    if (written < static_cast<int>(buffer.size())) {
+      // Only part of it reached the file, so sum what is there now
+      auto stop = offset + static_cast<std::uint64_t>(std::max(written, 0));
+      new_size = std::max(old_size, stop);
+      sums.clear();
+      for (auto number = first; number * block_size < stop; ++number) {
+        auto start = number * block_size;
+        auto size = std::min<std::uint64_t>(block_size, new_size - start);
+        read_exact(path, &scratch[0], size, start);
+        sums.push_back(crc32c(string_view(scratch.data(), size)));
+      }
+    }
+    if (new_size > old_size) {
+      file->sums.resize(block_count(new_size, block_size),
+                        zero_sum(block_size));
+    }
+    if (padded && new_size > old_size) {
+      file->sums[old_size / block_size] = padded_sum;
+    }
+    std::copy(sums.begin(), sums.end(), file->sums.begin() + first);
+    file->size = new_size;
+    file->changed = true;
+  }
+  done(path, file, false);
+  return written;
+}
+
+int checksum_filesystem::write(const Path& path, open_handle handle,
+                               const string_view& buffer, uint64_t offset) {
+  (void)handle;
+  return write(path, buffer, offset);
+}
+
+void checksum_filesystem::flush(const Path& path) {
+  if (auto file = files_.find(path)) {
+    std::lock_guard<std::shared_timed_mutex> file_lock(file->mutex);
+    commit(path, *file);
+  }
+  try {
+    inner().flush(path);
+  } catch (const error& e) {
+    if (!has_code(e, error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+void checksum_filesystem::flush(const Path& path, open_handle handle) {
+  (void)handle;
+  flush(path);
+}
+
+void checksum_filesystem::release(const Path& path, int flags) {
+  done(path, acquire(path, false), true);
+  inner().release(path, inner_flags(flags));
+}
+
+void checksum_filesystem::release(const Path& path, open_handle handle,
+                                  int flags) {
+  (void)handle;
+  release(path, flags);
+}
+
+void checksum_filesystem::fsync(const Path& path, int fd) {
+  flush(path);
+  inner().fsync(path, fd);
+}
+
+std::vector<Path> checksum_filesystem::read_directory(
+    const Path& path) const {
+  auto names = inner().read_directory(path);
+  if (settings_.storage == checksum_storage::sidecar) {
+    names.erase(std::remove_if(names.begin(), names.end(),
+                               [](const Path& name) {
+                                 return is_sidecar(name.string());
+                               }),
+                names.end());
+  }
+  return names;
+}
+
+std::vector<directory_entry> checksum_filesystem::read_directory_entries(
+    const Path& path) const {
+  auto entries = filesystem_decorator::read_directory_entries(path);
+  if (settings_.storage == checksum_storage::sidecar) {
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const directory_entry& entry) {
+                                   return is_sidecar(
+                                       entry.path().filename().string());
+                                 }),
+                  entries.end());
+  }
+  return entries;
+}
+
+void checksum_filesystem::rebuild(const Path& path) {
+  auto held = files_.find(path);
+  try {
+    if (settings_.storage == checksum_storage::xattr) {
+      inner().removexattr(path, attribute_name);
+    } else {
+      inner().remove(sidecar_path(path));
+    }
+  } catch (const error& e) {
+    if (!has_code(e, error_code::no_message_available) &&
+        !has_code(e, error_code::no_such_file_or_directory)) {
+      throw;
+    }
+  }
+  auto file = acquire(path, false);  // computes them unless already held
+  if (held) {
+    std::lock_guard<std::shared_timed_mutex> lock(file->mutex);
+    compute(path, *file);
+  }
+  done(path, file, false);
+}
+
+void checksum_filesystem::fallocate(const Path& path, int mode,
+                                    uint64_t offset, uint64_t length) {
+  (void)path;
+  (void)mode;
+  (void)offset;
+  (void)length;
+  throw error(error_code::function_not_supported);
+}
+
+checksum_filesystem::state checksum_filesystem::acquire(const Path& path,
+                                                        bool open) const {
+  return files_.acquire(path, open,
+                        [this, &path](file_state& file) { load(path, file); });
+}
+
+void checksum_filesystem::done(const Path& path, const state& file,
+                               bool close) const {
+  files_.done(path, file, close,
+              [this, &path](file_state& file) { commit(path, file); });
+}
+
+void checksum_filesystem::load(const Path& path, file_state& file) const {
+  file.size = inner().file_size(path);
+  if (auto stored = fetch(path)) {
+    sums_header header;
+    auto count = std::size_t{0};
+    auto current = stored->size() >= sizeof(header);
+    if (current) {
+      std::memcpy(&header, stored->data(), sizeof(header));
+      count = (stored->size() - sizeof(header)) / sizeof(std::uint32_t);
+      current =
+          std::memcmp(header.magic, sums_magic, sizeof(header.magic)) == 0 &&
+          header.block_size != 0 &&
+          count == block_count(file.size, header.block_size);
+    }
+    if (current) {
+      file.block_size = header.block_size;
+      file.sums.resize(count);
+      std::memcpy(file.sums.data(), stored->data() + sizeof(header),
+                  count * sizeof(std::uint32_t));
+      file.loaded = true;
+      return;
+    }
+    if (!settings_.rebuild_stale) {
+      throw error(error_code::io_error,
+                  path.string() + ": checksums out of date");
+    }
+  }
+  compute(path, file);  // trust what is there already
+  file.loaded = true;
+}
+
+void checksum_filesystem::compute(const Path& path, file_state& file) const {
+  file.block_size = settings_.block_size;
+  file.sums.clear();
+  const std::uint64_t piece = std::max<std::uint64_t>(
+      file.block_size, (1u << 20u) / file.block_size * file.block_size);
+  std::string data;
+  for (std::uint64_t offset = 0; offset < file.size; offset += piece) {
+    data.resize(std::min(piece, file.size - offset));
+    read_exact(path, &data[0], data.size(), offset);
+    for (std::size_t start = 0; start < data.size();
+         start += file.block_size) {
+      auto size = std::min<std::size_t>(file.block_size, data.size() - start);
+      file.sums.push_back(crc32c(string_view(data.data() + start, size)));
+    }
+  }
+  file.changed = true;
+}
+
+void checksum_filesystem::commit(const Path& path, file_state& file) const {
+  if (!file.changed) {
+    return;
+  }
+  sums_header header;
+  std::memcpy(header.magic, sums_magic, sizeof(header.magic));
+  header.block_size = file.block_size;
+  std::string stored(reinterpret_cast<const char*>(&header), sizeof(header));
+  stored.append(reinterpret_cast<const char*>(file.sums.data()),
+                file.sums.size() * sizeof(std::uint32_t));
+  store(path, stored);
+  file.changed = false;
+}
+
+boost::optional<std::string> checksum_filesystem::fetch(
+    const Path& path) const {
+  try {
+    if (settings_.storage == checksum_storage::xattr) {
+      string_view probe;
+      auto size = inner().getxattr(path, attribute_name, probe);
+      std::string value(size, '\0');
+      auto buffer = string_view(&value[0], size);
+      value.resize(inner().getxattr(path, attribute_name, buffer));
+      return value;
+    }
+    auto sidecar = sidecar_path(path);
+    std::string value(inner().file_size(sidecar), '\0');
+    read_exact(sidecar, &value[0], value.size(), 0);
+    return value;
+  } catch (const error& e) {
+    if (has_code(e, error_code::no_message_available) ||
+        has_code(e, error_code::no_such_file_or_directory)) {
+      return boost::none;
+    }
+    throw;
+  }
+}
+
+void checksum_filesystem::store(const Path& path,
+                                const std::string& sums) const {
+  if (settings_.storage == checksum_storage::xattr) {
+    inner().setxattr(path, std::make_pair(attribute_name, string_view(sums)),
+                     0);
+    return;
+  }
+  auto sidecar = sidecar_path(path);
+  try {
+    inner().symlink_status(sidecar);
+  } catch (const error& e) {
+    if (!has_code(e, error_code::no_such_file_or_directory)) {
+      throw;
+    }
+    inner().create_file(sidecar);
+  }
+  inner().write(sidecar, string_view(sums), 0);
+  inner().truncate(sidecar, sums.size());
+}
+
+std::size_t checksum_filesystem::read_block(const Path& path,
+                                            const file_state& file,
+                                            std::uint64_t number,
+                                            char* output) const {
+  auto start = number * file.block_size;
+  auto size = std::min<std::uint64_t>(file.block_size, file.size - start);
+  read_exact(path, output, size, start);
+  verify(path, file, output, number, size);
+  return size;
+}
+
+void checksum_filesystem::verify(const Path& path, const file_state& file,
+                                 const char* data, std::uint64_t first,
+                                 std::size_t size) const {
+  for (std::size_t start = 0; start < size; start += file.block_size) {
+    auto length = std::min<std::size_t>(file.block_size, size - start);
+    auto number = first + start / file.block_size;
+    if (crc32c(string_view(data + start, length)) != file.sums.at(number)) {
+      throw error(error_code::io_error,
+                  path.string() + ": checksum mismatch in block " +
+                      std::to_string(number));
+    }
+  }
+}
+
+void checksum_filesystem::resize(const Path& path, file_state& file,
+                                 std::uint64_t size) const {
+  const auto block_size = file.block_size;
+  const auto old_size = file.size;
+  auto boundary = std::min(size, old_size);
+  auto edge = size != old_size && boundary % block_size != 0;
+  auto number = boundary / block_size;
+  std::uint32_t edge_sum = 0;
+  if (edge) {  // the block where old and new size part ways changes length
+    std::string scratch(block_size, '\0');
+    read_block(path, file, number, &scratch[0]);
+    auto length = std::min<std::uint64_t>(block_size,
+                                          size - number * block_size);
+    edge_sum = crc32c(string_view(scratch.data(), length));
+  }
+  inner().truncate(path, size);
+  auto count = block_count(size, block_size);
+  file.sums.resize(count, zero_sum(block_size));
+  if (size > old_size && size % block_size != 0) {
+    file.sums.back() = zero_sum(size % block_size);
+  }
+  if (edge) {
+    file.sums[number] = edge_sum;
+  }
+  file.size = size;
+  file.changed = true;
+}
+
+void checksum_filesystem::read_exact(const Path& path, char* output,
+                                     std::size_t size,
+                                     std::uint64_t offset) const {
+  while (size > 0) {
+    auto buffer = string_view(output, size);
+    auto count = inner().read(path, buffer, offset);
+    if (count <= 0) {
+      throw error(error_code::io_error, path.string() + ": truncated");
+    }
+    output += count;
+    offset += count;
+    size -= count;
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,125 @@
+#pragma once
+#include <drivex/filesystem_decorator.h>
+#include <boost/optional.hpp>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Where checksum_filesystem keeps the checksums of a file */
+enum class checksum_storage {
+  xattr,   // in the user.drivex.crc32c extended attribute of the file
+  sidecar  // in a hidden .<name>.crc32c file next to it
+};
+
+struct checksum_settings {
+  /** Bytes covered by each checksum of new files */
+  std::uint32_t block_size = 4096;
+  checksum_storage storage = checksum_storage::xattr;
+  /** Compute checksums that do not cover the file again from its data
+   * instead of failing, as is needed after a crash that lost some */
+  bool rebuild_stale = false;
+};
+
+/** Verifies file data against per-block CRC-32C checksums
+ *
+ * A write updates the checksums of the blocks it touches, first verifying
+ * the parts of partially written blocks that it keeps.  A read covers whole
+ * blocks and fails with io_error if any of them does not match.  Checksums
+ * are held in memory while a file is in use and stored on flush, fsync and
+ * release, so data written since the last of those reads as corrupt after
+ * a crash.  Files without checksums get them computed from their contents
+ * when first used, as do files whose stored checksums no longer cover them
+ * if rebuild_stale is set; rebuild recomputes those of a single file.
+ *
+ * With sidecar storage, files named like sidecars are hidden from listings
+ * and hard links are not supported. */
+class checksum_filesystem : public filesystem_decorator {
+ public:
+  explicit checksum_filesystem(
+      std::shared_ptr<filesystem> inner,
+      checksum_settings settings = checksum_settings());
+
+  /** Store what is held in memory, ignoring errors */
+  ~checksum_filesystem() override;
+
+  bool clone_file(const Path& from, const Path& to) override;
+  bool remove(const Path& path) override;
+  void rename(const Path& from, const Path& to) override;
+  void link(const Path& from, const Path& to) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle open_file(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void flush(const Path& path, open_handle handle) override;
+  void release(const Path& path, int flags) override;
+  void release(const Path& path, open_handle handle, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+  /** Discard the checksums of a file and compute them from its data
+   *
+   * For recovering a file whose data is known good but whose checksums
+   * were lost or left behind by a crash. */
+  void rebuild(const Path& path);
+
+  /** Name of the extended attribute used with xattr storage */
+  static const std::string attribute_name;
+
+  /** Path of the sidecar of a file */
+  static Path sidecar_path(const Path& path);
+
+ private:
+  struct file_state {
+    std::shared_timed_mutex mutex;
+    std::uint32_t block_size = 0;
+    std::uint64_t size = 0;
+    std::vector<std::uint32_t> sums;
+    bool changed = false;
+    bool loaded = false;
+    std::size_t opens = 0;  // open files; guarded by files_
+    std::size_t users = 0;  // calls in progress; guarded by files_
+  };
+  using state = std::shared_ptr<file_state>;
+
+  state acquire(const Path& path, bool open) const;
+  void done(const Path& path, const state& file, bool close) const;
+  void load(const Path& path, file_state& file) const;
+  void compute(const Path& path, file_state& file) const;
+  void commit(const Path& path, file_state& file) const;
+  boost::optional<std::string> fetch(const Path& path) const;
+  void store(const Path& path, const std::string& sums) const;
+  std::size_t read_block(const Path& path, const file_state& file,
+                         std::uint64_t number, char* output) const;
+  void verify(const Path& path, const file_state& file, const char* data,
+              std::uint64_t first, std::size_t size) const;
+  void resize(const Path& path, file_state& file, std::uint64_t size) const;
+  void read_exact(const Path& path, char* output, std::size_t size,
+                  std::uint64_t offset) const;
+
+  checksum_settings settings_;
+  mutable file_table<file_state> files_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,174 @@
+#include <drivex/chunk_store.h>
+#include <boost/filesystem/operations.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+void write_all(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    auto result = ::write(fd, data, size);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      throw error(error_code::io_error, "chunk write failed");
+    }
+    data += result;
+    size -= result;
+  }
+}
+
+/** Make the entries of a directory durable */
+void sync_directory(const Path& directory) {
+  auto fd = ::open(directory.string().c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw error(error_code::io_error, directory.string());
+  }
+  auto synced = ::fsync(fd) == 0;
+  ::close(fd);
+  if (!synced) {
+    throw error(error_code::io_error, directory.string());
+  }
+}
+
+int hex_digit(char digit) {
+  if (digit >= '0' && digit <= '9') {
+    return digit - '0';
+  }
+  if (digit >= 'a' && digit <= 'f') {
+    return digit - 'a' + 10;
+  }
+  return -1;
+}
+
+/** Parse the lower-case hexadecimal name of a chunk */
+bool parse_hex(const std::string& name, chunk_id& id) {
+  if (name.size() != 2 * id.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < id.size(); ++i) {
+    auto high = hex_digit(name[2 * i]);
+    auto low = hex_digit(name[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    id[i] = static_cast<std::uint8_t>(high << 4 | low);
+  }
+  return true;
+}
+
+}  // namespace
+
+chunk_store::chunk_store(const Path& root) : root_(root), next_temporary_(0) {
+  boost::system::error_code code;
+  boost::filesystem::create_directories(root_, code);
+  if (code) {
+    throw error(error_code::io_error, root_.string());
+  }
+}
+
+const Path& chunk_store::root() const noexcept { return root_; }
+
+Path chunk_store::path(const chunk_id& id) const {
+  auto name = sha256::to_hex(id);
+  return root_ / name.substr(0, 2) / name.substr(2);
+}
+
+bool chunk_store::contains(const chunk_id& id) const {
+  struct stat chunk_stat;
+  return ::stat(path(id).string().c_str(), &chunk_stat) == 0;
+}
+
+bool chunk_store::put(const chunk_id& id, const string_view& data) {
+  if (contains(id)) {
+    return false;
+  }
+  auto target = path(id);
+  boost::system::error_code code;
+  if (boost::filesystem::create_directory(target.parent_path(), code)) {
+    sync_directory(root_);
+  }
+  auto temporary = target.string() + "." + std::to_string(::getpid()) + "." +
+                   std::to_string(next_temporary_++) + ".tmp";
+  auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    throw error(error_code::io_error, temporary);
+  }
+  try {
+    write_all(fd, data.data(), data.size());
+  } catch (...) {
+    ::close(fd);
+    ::unlink(temporary.c_str());
+    throw;
+  }
+  auto synced = ::fsync(fd) == 0;
+  if (::close(fd) != 0 || !synced ||
+      std::rename(temporary.c_str(), target.string().c_str()) != 0) {
+    ::unlink(temporary.c_str());
+    throw error(error_code::io_error, target.string());
+  }
+  sync_directory(target.parent_path());
+  return true;
+}
+
+std::string chunk_store::get(const chunk_id& id, std::size_t size) const {
+  auto source = path(id).string();
+  auto fd = ::open(source.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw error(error_code::io_error, source + ": missing chunk");
+  }
+  std::string data(size, '\0');
+  std::size_t done = 0;
+  while (done < size) {
+    auto result = ::pread(fd, &data[done], size - done,
+                          static_cast<off_t>(done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      break;
+    }
+    done += result;
+  }
+  ::close(fd);
+  if (done != size) {
+    throw error(error_code::io_error, source + ": short chunk");
+  }
+  return data;
+}
+
+bool chunk_store::remove(const chunk_id& id) {
+  return ::unlink(path(id).string().c_str()) == 0;
+}
+
+std::vector<chunk_id> chunk_store::list() const {
+  std::vector<chunk_id> result;
+  boost::system::error_code code;
+  for (boost::filesystem::directory_iterator it(root_, code), end;
+       !code && it != end; it.increment(code)) {
+    auto prefix = it->path().filename().string();
+    if (prefix.size() != 2 || !boost::filesystem::is_directory(it->status())) {
+      continue;
+    }
+    for (boost::filesystem::directory_iterator chunk(it->path(), code);
+         !code && chunk != end; chunk.increment(code)) {
+      chunk_id id;
+      if (parse_hex(prefix + chunk->path().filename().string(), id)) {
+        result.push_back(id);
+      }
+    }
+  }
+  if (code) {
+    throw error(error_code::io_error, root_.string());
+  }
+  return result;
+}
+}  // namespace drivex
+}  // namespace lockblox
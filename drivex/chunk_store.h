@@ -0,0 +1,53 @@
+#pragma once
+#include <drivex/sha256.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+using chunk_id = sha256::digest;
+
+/** Content-addressed store of chunks in a host directory
+ *
+ * Each chunk is a file named by the hex SHA-256 of its content, under a
+ * subdirectory named by the first two digits.  Chunks are written to a
+ * temporary file and renamed into place, so concurrent writers of the same
+ * chunk are harmless and a chunk is never seen half written.  The file and
+ * its directory are synced before put returns, so a chunk that put stored
+ * survives a crash. */
+class chunk_store {
+ public:
+  /** @throws error(io_error) if the directory cannot be created */
+  explicit chunk_store(const Path& root);
+
+  const Path& root() const noexcept;
+
+  /** Host path of a chunk */
+  Path path(const chunk_id& id) const;
+
+  bool contains(const chunk_id& id) const;
+
+  /** Store a chunk unless it is already present
+   *
+   * @return whether it was new */
+  bool put(const chunk_id& id, const string_view& data);
+
+  /** Read a chunk of known size
+   *
+   * @throws error(io_error) if it is missing or has another size */
+  std::string get(const chunk_id& id, std::size_t size) const;
+
+  /** Delete a chunk; false if it was not there */
+  bool remove(const chunk_id& id);
+
+  /** Every chunk in the store, in no particular order */
+  std::vector<chunk_id> list() const;
+
+ private:
+  Path root_;
+  std::atomic<std::uint64_t> next_temporary_;
+};
+}  // namespace drivex
+}  // namespace lockblox
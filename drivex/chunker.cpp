@@ -0,0 +1,118 @@
+#include <drivex/chunker.h>
+#include <algorithm>
+#include <array>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::size_t window = 64;  // bytes a gear hash depends on
+const std::size_t lanes = 4;
+
+/** Random values per byte, fixed since stored chunk boundaries depend on
+ * them */
+const std::array<std::uint64_t, 256>& gear_table() {
+  static const auto table = [] {
+    std::array<std::uint64_t, 256> values;
+    std::uint64_t seed = 0x64726976655863dcull;
+    for (auto& value : values) {  // splitmix64
+      auto z = (seed += 0x9e3779b97f4a7c15ull);
+      z = (z ^ z >> 30u) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ z >> 27u) * 0x94d049bb133111ebull;
+      value = z ^ z >> 31u;
+    }
+    return values;
+  }();
+  return table;
+}
+
+/** Mask of the top bits, which depend on the most bytes of the window */
+std::uint64_t top_bits(unsigned int count) {
+  return count == 0 ? 0 : ~std::uint64_t(0) << (64u - count);
+}
+
+unsigned int log2(std::uint32_t value) {
+  unsigned int result = 0;
+  while (value >>= 1u) {
+    ++result;
+  }
+  return result;
+}
+
+}  // namespace
+
+chunker::chunker(chunking sizes) : sizes_(sizes) {
+  if (sizes_.min_size < window || sizes_.average_size < sizes_.min_size ||
+      sizes_.max_size < sizes_.average_size) {
+    throw error(error_code::invalid_argument, "bad chunk sizes");
+  }
+  auto bits = log2(sizes_.average_size);
+  strict_mask_ = top_bits(std::min(bits + 2, 63u));
+  loose_mask_ = top_bits(bits > 2 ? bits - 2 : 0);
+}
+
+const chunking& chunker::sizes() const noexcept { return sizes_; }
+
+std::size_t chunker::cut(const string_view& data) const {
+  auto bytes = reinterpret_cast<const std::uint8_t*>(data.data());
+  if (data.size() <= sizes_.min_size) {
+    return data.size();
+  }
+  auto limit = std::min<std::size_t>(data.size(), sizes_.max_size);
+  auto normal = std::min<std::size_t>(sizes_.average_size, limit);
+  auto length = scan(bytes, sizes_.min_size, normal, strict_mask_);
+  if (length == 0) {
+    length = scan(bytes, normal, limit, loose_mask_);
+  }
+  return length == 0 ? limit : length;
+}
+
+std::size_t chunker::scan(const std::uint8_t* data, std::size_t first,
+                          std::size_t last, std::uint64_t mask) const {
+  const auto& gear = gear_table();
+  auto stride = (last - first) / lanes;
+  std::uint64_t hash[lanes] = {};
+  auto position = first;
+  if (stride >= window) {
+    std::size_t found[lanes] = {};
+    for (std::size_t i = 0; i < window; ++i) {
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        auto byte = data[first + lane * stride - window + i];
+        hash[lane] = (hash[lane] << 1u) + gear[byte];
+      }
+    }
+    for (std::size_t i = 0; i < stride; ++i) {
+      for (std::size_t lane = 0; lane < lanes; ++lane) {
+        auto at = first + lane * stride + i;
+        hash[lane] = (hash[lane] << 1u) + gear[data[at]];
+        if (found[lane] == 0 && (hash[lane] & mask) == 0) {
+          found[lane] = at + 1;
+        }
+      }
+      if (found[0] != 0) {
+        return found[0];
+      }
+    }
+    for (auto length : found) {
+      if (length != 0) {
+        return length;
+      }
+    }
+    position = first + lanes * stride;
+  } else {
+    for (auto at = first - window; at < first; ++at) {
+      hash[lanes - 1] = (hash[lanes - 1] << 1u) + gear[data[at]];
+    }
+  }
+  auto& tail = hash[lanes - 1];  // carries on from the end of the last lane
+  for (; position < last; ++position) {
+    tail = (tail << 1u) + gear[data[position]];
+    if ((tail & mask) == 0) {
+      return position + 1;
+    }
+  }
+  return 0;
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,53 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+struct chunking {
+  /** No chunk but the last is shorter than this; at least 64 */
+  std::uint32_t min_size = 2u << 10u;
+  /** Chunk size aimed for */
+  std::uint32_t average_size = 8u << 10u;
+  /** No chunk is longer than this */
+  std::uint32_t max_size = 64u << 10u;
+};
+
+/** Content-defined chunking with a gear rolling hash, as in FastCDC
+ *
+ * A cut is made after the first byte past the minimum size where the hash
+ * of the preceding 64 bytes matches a mask, which is stricter before the
+ * average size than after it so that sizes cluster around the average.  Cut
+ * points depend only on nearby content, so an edit moves the boundaries of
+ * the chunks around it and leaves the rest alone.
+ *
+ * Since the hash only covers a window, the candidate range is scanned in
+ * four interleaved lanes, each warmed up on the window before it; the lanes
+ * are independent, which keeps the processor's pipelines full where a single
+ * lane would wait on each addition. */
+class chunker {
+ public:
+  /** @throws error(invalid_argument) if the sizes are not ordered or
+   *          min_size is below 64 */
+  explicit chunker(chunking sizes = chunking());
+
+  const chunking& sizes() const noexcept;
+
+  /** Length of the chunk at the start of data
+   *
+   * data holds at least max_size bytes or the rest of the stream. */
+  std::size_t cut(const string_view& data) const;
+
+ private:
+  /** First length in (first, last] whose window hash matches mask, or 0 */
+  std::size_t scan(const std::uint8_t* data, std::size_t first,
+                   std::size_t last, std::uint64_t mask) const;
+
+  chunking sizes_;
+  std::uint64_t strict_mask_;
+  std::uint64_t loose_mask_;
+};
+}  // namespace drivex
+}  // namespace lockblox
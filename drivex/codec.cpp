@@ -0,0 +1,159 @@
+#include <drivex/codec.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::size_t min_match = 4;
+const std::size_t max_offset = 65535;
+const unsigned int hash_bits = 13;
+
+std::uint32_t load32(const char* p) {
+  std::uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+std::uint32_t hash(std::uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32u - hash_bits);
+}
+
+/** Write a length whose first 15 fit in a token nibble */
+char* write_length(char* output, std::size_t length) {
+  for (length -= 15; length >= 255; length -= 255) {
+    *output++ = static_cast<char>(255);
+  }
+  *output++ = static_cast<char>(length);
+  return output;
+}
+
+char* write_sequence(char* output, const char* literals,
+                     std::size_t literal_length, std::size_t offset,
+                     std::size_t match_length) {
+  auto token = output++;
+  auto literal_nibble = std::min<std::size_t>(literal_length, 15);
+  if (literal_length >= 15) {
+    output = write_length(output, literal_length);
+  }
+  std::memcpy(output, literals, literal_length);
+  output += literal_length;
+  auto match_nibble = std::size_t(0);
+  if (match_length != 0) {
+    *output++ = static_cast<char>(offset & 0xffu);
+    *output++ = static_cast<char>(offset >> 8u);
+    match_nibble = std::min<std::size_t>(match_length - min_match, 15);
+    if (match_length - min_match >= 15) {
+      output = write_length(output, match_length - min_match);
+    }
+  }
+  *token = static_cast<char>(literal_nibble << 4u | match_nibble);
+  return output;
+}
+
+void corrupt() { throw error(error_code::io_error, "corrupt lz block"); }
+
+/** Read the remainder of a length started in a token nibble */
+std::size_t read_length(const unsigned char*& input,
+                        const unsigned char* end, std::size_t length) {
+  if (length != 15) {
+    return length;
+  }
+  unsigned char byte;
+  do {
+    if (input == end) {
+      corrupt();
+    }
+    byte = *input++;
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+}  // namespace
+
+std::uint32_t lz_codec::id() const noexcept { return 1; }
+
+std::size_t lz_codec::bound(std::size_t size) const noexcept {
+  return size + size / 255 + 16;
+}
+
+std::size_t lz_codec::compress(const string_view& input, char* output) const {
+  auto data = input.data();
+  auto size = input.size();
+  auto start = output;
+  std::vector<std::uint32_t> table(std::size_t(1) << hash_bits, 0);
+  std::size_t anchor = 0;
+  std::size_t position = 0;
+  while (position + min_match <= size) {
+    auto sequence = load32(data + position);
+    auto& slot = table[hash(sequence)];
+    auto candidate = static_cast<std::size_t>(slot);  // position + 1
+    slot = static_cast<std::uint32_t>(position + 1);
+    if (candidate != 0 && position - (candidate - 1) <= max_offset &&
+        load32(data + candidate - 1) == sequence) {
+      auto match = candidate - 1;
+      auto length = min_match;
+      while (position + length < size &&
+             data[match + length] == data[position + length]) {
+        ++length;
+      }
+      output = write_sequence(output, data + anchor, position - anchor,
+                              position - match, length);
+      position += length;
+      anchor = position;
+    } else {
+      position += 1 + ((position - anchor) >> 6u);  // skip faster if stuck
+    }
+  }
+  output = write_sequence(output, data + anchor, size - anchor, 0, 0);
+  return static_cast<std::size_t>(output - start);
+}
+
+void lz_codec::decompress(const string_view& input, char* output,
+                          std::size_t size) const {
+  auto in = reinterpret_cast<const unsigned char*>(input.data());
+  auto in_end = in + input.size();
+  std::size_t produced = 0;
+  while (in < in_end) {
+    auto token = *in++;
+    auto literals = read_length(in, in_end, token >> 4u);
+    if (literals > static_cast<std::size_t>(in_end - in) ||
+        literals > size - produced) {
+      corrupt();
+    }
+    std::memcpy(output + produced, in, literals);
+    in += literals;
+    produced += literals;
+    if (in == in_end) {
+      break;  // the last sequence has no match
+    }
+    if (in_end - in < 2) {
+      corrupt();
+    }
+    std::size_t offset = in[0] | static_cast<std::size_t>(in[1]) << 8u;
+    in += 2;
+    auto length = read_length(in, in_end, token & 15u) + min_match;
+    if (offset == 0 || offset > produced || length > size - produced) {
+      corrupt();
+    }
+    auto from = output + produced - offset;
+    auto to = output + produced;
+    if (offset >= length) {
+      std::memcpy(to, from, length);
+    } else {
+      for (std::size_t i = 0; i < length; ++i) {  // overlapping run
+        to[i] = from[i];
+      }
+    }
+    produced += length;
+  }
+  if (produced != size) {
+    corrupt();
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
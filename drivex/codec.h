@@ -0,0 +1,46 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+/** A block compression algorithm */
+class codec {
+ public:
+  virtual ~codec() = default;
+
+  /** Identifier stored alongside compressed data */
+  virtual std::uint32_t id() const noexcept = 0;
+
+  /** Largest output compress may produce for size bytes of input */
+  virtual std::size_t bound(std::size_t size) const noexcept = 0;
+
+  /** Compress input into output, which holds at least bound(input.size())
+   * bytes, and return the compressed size */
+  virtual std::size_t compress(const string_view& input,
+                               char* output) const = 0;
+
+  /** Decompress input into exactly size bytes at output
+   *
+   * @throws error(io_error) if input is corrupt or does not decode to size
+   *         bytes */
+  virtual void decompress(const string_view& input, char* output,
+                          std::size_t size) const = 0;
+};
+
+/** Fast byte-oriented LZ77 codec in the style of LZ4
+ *
+ * Favours speed over ratio: one hash probe per position, literal runs and
+ * matches of at least four bytes within a 64 KiB window. */
+class lz_codec : public codec {
+ public:
+  std::uint32_t id() const noexcept override;
+  std::size_t bound(std::size_t size) const noexcept override;
+  std::size_t compress(const string_view& input, char* output) const override;
+  void decompress(const string_view& input, char* output,
+                  std::size_t size) const override;
+};
+}  // namespace drivex
+}  // namespace lockblox
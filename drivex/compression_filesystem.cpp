@@ -0,0 +1,627 @@
+#include <drivex/compression_filesystem.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+struct container_header {
+  char magic[8];
+  std::uint32_t block_size;
+  std::uint32_t codec;
+  std::uint64_t size;
+  std::uint64_t index_offset;
+};
+
+static_assert(sizeof(container_header) == 32, "header must be packed");
+
+const char container_magic[8] = {'D', 'R', 'V', 'X', 'C', 'M', 'P', '1'};
+
+/** Replaced blocks are reclaimed once they exceed both this and live data */
+const std::uint64_t min_garbage = 1u << 20u;
+
+std::uint64_t block_count(std::uint64_t size, std::uint32_t block_size) {
+  return (size + block_size - 1) / block_size;
+}
+
+bool is_zero(const std::string& data) {
+  return std::all_of(data.begin(), data.end(),
+                     [](char byte) { return byte == '\0'; });
+}
+
+}  // namespace
+
+compression_filesystem::compression_filesystem(
+    std::shared_ptr<filesystem> inner, compression_settings settings)
+    : filesystem_decorator(std::move(inner)),
+      settings_(std::move(settings)),
+      codec_(settings_.codec ? settings_.codec
+                             : std::make_shared<const lz_codec>()),
+      cache_(settings_.cache_blocks) {
+  if (settings_.block_size == 0) {
+    throw error(error_code::invalid_argument, "block size must not be zero");
+  }
+}
+
+compression_filesystem::~compression_filesystem() {
+  for (auto& file : files_.all()) {
+    try {
+      std::lock_guard<std::mutex> lock(file.second->mutex);
+      commit(file.first, *file.second);
+    } catch (...) {  // nothing sensible to do with it here
+    }
+  }
+}
+
+std::uintmax_t compression_filesystem::file_size(const Path& path) const {
+  if (auto file = files_.find(path)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    if (file->loaded) {
+      return file->size;
+    }
+  }
+  if (!is_regular_file(inner().symlink_status(path)) ||
+      inner().file_size(path) == 0) {
+    return inner().file_size(path);
+  }
+  container_header header;
+  read_exact(path, reinterpret_cast<char*>(&header), sizeof(header), 0);
+  if (std::memcmp(header.magic, container_magic, sizeof(header.magic)) != 0) {
+    throw error(error_code::io_error, path.string() + ": not compressed");
+  }
+  return header.size;
+}
+
+bool compression_filesystem::clone_file(const Path& from, const Path& to) {
+  if (auto file = files_.find(from)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    commit(from, *file);
+  }
+  return inner().clone_file(from, to);
+}
+
+bool compression_filesystem::remove(const Path& path) {
+  files_.take(path);
+  cache_.invalidate_tree(path);
+  return inner().remove(path);
+}
+
+void compression_filesystem::rename(const Path& from, const Path& to) {
+  inner().rename(from, to);
+  files_.rename(from, to);
+  // blocks are cached by path, and new files may take the old paths
+  cache_.invalidate_tree(from);
+  cache_.invalidate_tree(to);
+}
+
+void compression_filesystem::truncate(const Path& path, uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    resize(path, *file, offset);
+  }
+  done(path, file, false);
+}
+
+void compression_filesystem::set_attributes(const Path& path,
+                                            const attribute_update& update) {
+  if (update.size) {
+    truncate(path, *update.size);
+  }
+  auto rest = update;
+  rest.size = boost::none;
+  if (rest.permissions || rest.user_id || rest.group_id ||
+      rest.last_read_time || rest.last_write_time) {
+    inner().set_attributes(path, rest);
+  }
+}
+
+void compression_filesystem::open(const Path& path, int flags) {
+  inner().open(path, inner_flags(flags));
+  auto file = acquire(path, true);
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    resize(path, *file, 0);
+  }
+}
+
+open_handle compression_filesystem::open_file(const Path& path, int flags) {
+  open(path, flags);  // the inner handle would bypass this layer
+  return no_open_handle;
+}
+
+open_handle compression_filesystem::create(const Path& path,
+                                           drivex::permissions permissions,
+                                           int flags) {
+  inner().create(path, permissions, inner_flags(flags));
+  acquire(path, true);
+  return no_open_handle;
+}
+
+int compression_filesystem::read(const Path& path, string_view& buffer,
+                                 uint64_t offset) const {
+  auto file = acquire(path, false);
+  std::size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    if (offset < file->size) {
+      count = std::min<std::uint64_t>(buffer.size(), file->size - offset);
+    }
+    const auto block_size = file->block_size;
+    auto output = const_cast<char*>(buffer.data());
+    auto copy_block = [&](std::uint64_t number) {
+      auto start = number * block_size;
+      auto from = std::max<std::uint64_t>(offset, start);
+      auto to = std::min<std::uint64_t>(offset + count, start + block_size);
+      auto destination = output + (from - offset);
+      auto dirty = file->dirty.find(number);
+      auto held = block_cache::block();
+      const std::string* data = nullptr;
+      if (dirty != file->dirty.end()) {
+        data = &dirty->second;
+      } else {
+        held = cache_.get(path, number);
+        if (!held) {
+          held = std::make_shared<const std::string>(
+              block(path, *file, number));
+        }
+        data = held.get();
+      }
+      auto skip = from - start;
+      auto available = skip < data->size() ? data->size() - skip : 0;
+      auto copied = std::min<std::uint64_t>(to - from, available);
+      std::memcpy(destination, data->data() + skip, copied);
+      std::memset(destination + copied, 0, to - from - copied);
+    };
+    if (count > 0) {
+      auto first = offset / block_size;
+      auto last = (offset + count - 1) / block_size;
+      if (settings_.pool != nullptr && last > first) {
+        task_group group(*settings_.pool);
+        for (auto number = first; number <= last; ++number) {
+          group.run([&copy_block, number]() { copy_block(number); });
+        }
+        group.wait();
+      } else {
+        for (auto number = first; number <= last; ++number) {
+          copy_block(number);
+        }
+      }
+    }
+  }
+  done(path, file, false);
+  return static_cast<int>(count);
+}
+
+int compression_filesystem::read(const Path& path, open_handle handle,
+                                 string_view& buffer, uint64_t offset) const {
+  (void)handle;
+  return read(path, buffer, offset);
+}
+
+int compression_filesystem::write(const Path& path, const string_view& buffer,
+                                  uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    const auto block_size = file->block_size;
+    auto end = offset + buffer.size();
+    for (auto number = offset / block_size; number * block_size < end;
+         ++number) {
+      auto start = number * block_size;
+      auto from = std::max<std::uint64_t>(offset, start);
+      auto to = std::min<std::uint64_t>(end, start + block_size);
+      auto dirty = file->dirty.find(number);
+      if (dirty == file->dirty.end()) {
+        auto replaced = from == start &&
+                        (to == start + block_size || to >= file->size);
+        auto data = replaced || start >= file->size
+                        ? std::string()
+                        : block(path, *file, number);
+        dirty = file->dirty.emplace(number, std::move(data)).first;
+      }
+      auto& data = dirty->second;
+      if (data.size() < to - start) {
+        data.resize(to - start, '\0');
+      }
+      std::memcpy(&data[from - start], buffer.data() + (from - offset),
+                  to - from);
+    }
+    if (end > file->size) {
+      file->size = end;
+      file->blocks.resize(block_count(end, block_size), block_ref{0, 0, 0});
+    }
+    file->changed = true;
+    if (file->dirty.size() >= settings_.dirty_blocks) {
+      write_back(path, *file);
+    }
+  }
+  done(path, file, false);
+  return static_cast<int>(buffer.size());
+}
+
+int compression_filesystem::write(const Path& path, open_handle handle,
+                                  const string_view& buffer, uint64_t offset) {
+  (void)handle;
+  return write(path, buffer, offset);
+}
+
+void compression_filesystem::flush(const Path& path) {
+  if (auto file = files_.find(path)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    commit(path, *file);
+  }
+  try {
+    inner().flush(path);
+  } catch (const error& e) {
+    if (e.code().value() !=
+        static_cast<int>(error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+void compression_filesystem::flush(const Path& path, open_handle handle) {
+  (void)handle;
+  flush(path);
+}
+
+void compression_filesystem::release(const Path& path, int flags) {
+  done(path, acquire(path, false), true);
+  inner().release(path, inner_flags(flags));
+}
+
+void compression_filesystem::release(const Path& path, open_handle handle,
+                                     int flags) {
+  (void)handle;
+  release(path, flags);
+}
+
+void compression_filesystem::fsync(const Path& path, int fd) {
+  flush(path);
+  inner().fsync(path, fd);
+}
+
+uint64_t compression_filesystem::bmap(const Path& path, size_t blocksize) {
+  (void)path;
+  (void)blocksize;
+  throw error(error_code::function_not_supported);
+}
+
+void compression_filesystem::fallocate(const Path& path, int mode,
+                                       uint64_t offset, uint64_t length) {
+  const auto known =
+      fallocate_keep_size | fallocate_punch_hole | fallocate_zero_range;
+  if ((mode & ~known) != 0) {
+    throw error(error_code::function_not_supported);
+  }
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    auto end = offset + length;
+    if ((mode & fallocate_keep_size) == 0 && end > file->size) {
+      resize(path, *file, end);
+    }
+    if ((mode & (fallocate_punch_hole | fallocate_zero_range)) != 0) {
+      zero(path, *file, offset, std::min(end, file->size));
+    }
+  }
+  done(path, file, false);
+}
+
+block_cache& compression_filesystem::cache() noexcept { return cache_; }
+
+compression_filesystem::state compression_filesystem::acquire(const Path& path,
+                                                              bool open) const {
+  return files_.acquire(path, open,
+                        [this, &path](file_state& file) { load(path, file); });
+}
+
+void compression_filesystem::done(const Path& path, const state& file,
+                                  bool close) const {
+  files_.done(path, file, close,
+              [this, &path](file_state& file) { commit(path, file); });
+}
+
+void compression_filesystem::load(const Path& path, file_state& file) const {
+  file.block_size = settings_.block_size;
+  file.end = sizeof(container_header);
+  if (inner().file_size(path) == 0) {
+    file.loaded = true;
+    return;
+  }
+  container_header header;
+  read_exact(path, reinterpret_cast<char*>(&header), sizeof(header), 0);
+  if (std::memcmp(header.magic, container_magic, sizeof(header.magic)) != 0 ||
+      header.block_size == 0) {
+    throw error(error_code::io_error, path.string() + ": not compressed");
+  }
+  if (header.codec != codec_->id()) {
+    throw error(error_code::io_error, path.string() + ": unknown codec");
+  }
+  file.block_size = header.block_size;
+  file.size = header.size;
+  file.blocks.resize(block_count(header.size, header.block_size));
+  auto index_size = file.blocks.size() * sizeof(block_ref);
+  read_exact(path, reinterpret_cast<char*>(file.blocks.data()), index_size,
+             header.index_offset);
+  file.end = header.index_offset + index_size;
+  std::uint64_t live = 0;
+  for (const auto& ref : file.blocks) {
+    live += ref.length == 0 ? 0 : ref.stored_size;
+  }
+  file.garbage = file.end - sizeof(container_header) - live;
+  file.loaded = true;
+}
+
+std::string compression_filesystem::block(const Path& path, file_state& file,
+                                          std::uint64_t number) const {
+  auto dirty = file.dirty.find(number);
+  if (dirty != file.dirty.end()) {
+    return dirty->second;
+  }
+  if (auto cached = cache_.get(path, number)) {
+    return *cached;
+  }
+  const auto& ref = file.blocks.at(number);
+  auto data = std::string(ref.length, '\0');
+  if (ref.length > file.block_size) {
+    throw error(error_code::io_error, path.string() + ": corrupt block");
+  }
+  if (ref.length != 0) {
+    auto stored = std::string(ref.stored_size, '\0');
+    read_exact(path, &stored[0], stored.size(), ref.offset);
+    if (ref.stored_size == ref.length) {
+      data = std::move(stored);
+    } else {
+      codec_->decompress(stored, &data[0], data.size());
+    }
+  }
+  if (ref.length != 0) {
+    cache_.put(path, number, std::make_shared<const std::string>(data));
+  }
+  return data;
+}
+
+void compression_filesystem::write_back(const Path& path,
+                                        file_state& file) const {
+  if (file.dirty.empty()) {
+    return;
+  }
+  std::vector<std::pair<std::uint64_t, std::string*>> pending;
+  for (auto& dirty : file.dirty) {
+    pending.emplace_back(dirty.first, &dirty.second);
+  }
+  std::vector<std::string> encoded(pending.size());
+  auto encode = [&](std::size_t i) {
+    const auto& data = *pending[i].second;
+    if (is_zero(data)) {
+      return;  // stored as a hole
+    }
+    auto output = std::string(codec_->bound(data.size()), '\0');
+    auto size = codec_->compress(data, &output[0]);
+    if (size < data.size()) {
+      output.resize(size);
+      encoded[i] = std::move(output);
+    } else {
+      encoded[i] = data;
+    }
+  };
+  if (settings_.pool != nullptr && pending.size() > 1) {
+    task_group group(*settings_.pool);
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+      group.run([&encode, i]() { encode(i); });
+    }
+    group.wait();
+  } else {
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+      encode(i);
+    }
+  }
+  std::string batch;
+  for (std::size_t i = 0; i < pending.size(); ++i) {
+    auto& ref = file.blocks.at(pending[i].first);
+    file.garbage += ref.length == 0 ? 0 : ref.stored_size;
+    const auto& data = *pending[i].second;
+    if (encoded[i].empty()) {
+      ref = block_ref{0, 0, 0};
+    } else {
+      ref = block_ref{file.end + batch.size(),
+                      static_cast<std::uint32_t>(encoded[i].size()),
+                      static_cast<std::uint32_t>(data.size())};
+      batch += encoded[i];
+    }
+  }
+  if (!batch.empty()) {
+    write_exact(path, string_view(batch), file.end);
+    file.end += batch.size();
+  }
+  for (auto& dirty : file.dirty) {
+    cache_.put(path, dirty.first,
+               std::make_shared<const std::string>(std::move(dirty.second)));
+  }
+  file.dirty.clear();
+  file.changed = true;
+}
+
+void compression_filesystem::commit(const Path& path,
+                                    file_state& file) const {
+  write_back(path, file);
+  if (!file.changed) {
+    return;
+  }
+  auto index_size = file.blocks.size() * sizeof(block_ref);
+  if (file.garbage > min_garbage && file.garbage > file.end / 2 &&
+      file.garbage >= index_size) {
+    compact(path, file);
+  } else {
+    publish(path, file);
+  }
+  file.changed = false;
+}
+
+void compression_filesystem::publish(const Path& path,
+                                     file_state& file) const {
+  container_header header;
+  std::memcpy(header.magic, container_magic, sizeof(header.magic));
+  header.block_size = file.block_size;
+  header.codec = codec_->id();
+  header.size = file.size;
+  header.index_offset = file.end;
+  auto index_size = file.blocks.size() * sizeof(block_ref);
+  if (index_size != 0) {  // the new index goes after everything still used
+    write_exact(path,
+                string_view(reinterpret_cast<const char*>(file.blocks.data()),
+                            index_size),
+                file.end);
+  }
+  write_exact(
+      path, string_view(reinterpret_cast<const char*>(&header), sizeof(header)),
+      0);
+  file.end += index_size;
+  file.garbage += index_size;  // once the next index replaces it
+}
+
+void compression_filesystem::compact(const Path& path,
+                                     file_state& file) const {
+  std::vector<block_ref*> live;
+  for (auto& ref : file.blocks) {
+    if (ref.length != 0) {
+      live.push_back(&ref);
+    }
+  }
+  std::sort(live.begin(), live.end(), [](const block_ref* a,
+                                         const block_ref* b) {
+    return a->offset < b->offset;
+  });
+  // Copy the live blocks past everything the header refers to and switch
+  // to them; the old header stays valid until the new one is durable
+  auto published = file.blocks;
+  try {
+    file.end = relocate(path, live, file.end);
+  } catch (...) {  // appends would overwrite the copies
+    file.blocks = std::move(published);
+    throw;
+  }
+  sync(path);
+  publish(path, file);
+  sync(path);
+
+  // Nothing refers to the front any more, and the caller made sure that the
+  // blocks and index moved there end before the copies just made
+  file.end = relocate(path, live, sizeof(container_header));
+  file.garbage = 0;
+  sync(path);
+  publish(path, file);
+  sync(path);
+  inner().truncate(path, file.end);
+}
+
+std::uint64_t compression_filesystem::relocate(
+    const Path& path, const std::vector<block_ref*>& live,
+    std::uint64_t position) const {
+  std::string stored;
+  for (auto ref : live) {
+    stored.resize(ref->stored_size);
+    read_exact(path, &stored[0], stored.size(), ref->offset);
+    write_exact(path, string_view(stored), position);
+    ref->offset = position;
+    position += ref->stored_size;
+  }
+  return position;
+}
+
+void compression_filesystem::sync(const Path& path) const {
+  try {
+    inner().fsync(path, 0);
+  } catch (const error& e) {
+    if (e.code().value() !=
+        static_cast<int>(error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+void compression_filesystem::read_exact(const Path& path, char* output,
+                                        std::size_t size,
+                                        std::uint64_t offset) const {
+  while (size > 0) {
+    auto buffer = string_view(output, size);
+    auto count = inner().read(path, buffer, offset);
+    if (count <= 0) {
+      throw error(error_code::io_error, path.string() + ": truncated");
+    }
+    output += count;
+    offset += count;
+    size -= count;
+  }
+}
+
+void compression_filesystem::write_exact(const Path& path,
+                                         const string_view& data,
+                                         std::uint64_t offset) const {
+  auto rest = data;
+  while (!rest.empty()) {
+    auto count = inner().write(path, rest, offset);
+    if (count <= 0) {
+      throw error(error_code::io_error, path.string() + ": short write");
+    }
+    rest.remove_prefix(static_cast<std::size_t>(count));
+    offset += count;
+  }
+}
+
+void compression_filesystem::zero(const Path& path, file_state& file,
+                                  std::uint64_t offset,
+                                  std::uint64_t end) const {
+  const auto block_size = file.block_size;
+  for (auto number = offset / block_size; number * block_size < end;
+       ++number) {
+    auto start = number * block_size;
+    auto stop = std::min<std::uint64_t>(start + block_size, file.size);
+    if (offset <= start && end >= stop) {  // becomes a hole
+      auto& ref = file.blocks[number];
+      file.garbage += ref.length == 0 ? 0 : ref.stored_size;
+      ref = block_ref{0, 0, 0};
+      file.dirty.erase(number);
+      continue;
+    }
+    auto data = block(path, file, number);
+    auto from = std::max(offset, start) - start;
+    auto to = std::min<std::uint64_t>(end - start, data.size());
+    if (from < to) {
+      std::memset(&data[from], 0, to - from);
+    }
+    file.dirty[number] = std::move(data);
+  }
+  cache_.invalidate(path, offset / block_size);
+  file.changed = true;
+}
+
+void compression_filesystem::resize(const Path& path, file_state& file,
+                                    std::uint64_t size) const {
+  const auto block_size = file.block_size;
+  auto count = block_count(size, block_size);
+  if (size < file.size) {
+    for (auto number = count; number < file.blocks.size(); ++number) {
+      const auto& ref = file.blocks[number];
+      file.garbage += ref.length == 0 ? 0 : ref.stored_size;
+    }
+    file.dirty.erase(file.dirty.lower_bound(count), file.dirty.end());
+    if (size % block_size != 0) {  // cut the new last block short
+      auto number = count - 1;
+      auto data = block(path, file, number);
+      data.resize(std::min<std::uint64_t>(data.size(), size % block_size));
+      file.dirty[number] = std::move(data);
+    }
+    cache_.invalidate(path, size / block_size);
+  }
+  file.size = size;
+  file.blocks.resize(count, block_ref{0, 0, 0});
+  file.changed = true;
+}
+}  // namespace drivex
+}  // namespace lockblox
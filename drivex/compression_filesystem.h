@@ -0,0 +1,136 @@
+#pragma once
+#include <drivex/block_cache.h>
+#include <drivex/codec.h>
+#include <drivex/filesystem_decorator.h>
+#include <drivex/thread_pool.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+struct compression_settings {
+  /** Uncompressed size of each block of new files */
+  std::uint32_t block_size = 64u << 10u;
+  /** Codec for new blocks; lz_codec if null */
+  std::shared_ptr<const drivex::codec> codec;
+  /** Pool to compress and decompress blocks on in parallel, if any */
+  thread_pool* pool = nullptr;
+  /** Decoded blocks kept in memory */
+  std::size_t cache_blocks = 256;
+  /** Modified blocks buffered per file before they are written back */
+  std::size_t dirty_blocks = 64;
+};
+
+/** Stores file data as independently compressed blocks
+ *
+ * Each regular file of the inner filesystem holds a header, the compressed
+ * blocks and an index of them.  A read decodes only the blocks it touches,
+ * and blocks that do not shrink are stored as is.  Modified blocks are
+ * buffered and appended on flush, release or when too many are pending,
+ * after which a new index is written and the header switched to it; the
+ * space of replaced blocks is reclaimed once it exceeds the live data.
+ * Reclaiming first copies the live blocks past the end of the file and
+ * switches to them, then moves them to the front and switches again,
+ * syncing the inner file around each switch, so a crash at any point leaves
+ * a header that describes intact blocks.
+ * Blocks of zeros, including ranges punched or zeroed with fallocate, are
+ * stored as holes that take no space and are read without touching the
+ * inner file.  Directories, symlinks and attributes pass through unchanged.
+ *
+ * Open handles of the inner filesystem are not kept, and hard links to a
+ * file that is open under another name are not kept coherent. */
+class compression_filesystem : public filesystem_decorator {
+ public:
+  explicit compression_filesystem(
+      std::shared_ptr<filesystem> inner,
+      compression_settings settings = compression_settings());
+
+  /** Write back what is buffered, ignoring errors */
+  ~compression_filesystem() override;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  bool clone_file(const Path& from, const Path& to) override;
+  bool remove(const Path& path) override;
+  void rename(const Path& from, const Path& to) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle open_file(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void flush(const Path& path, open_handle handle) override;
+  void release(const Path& path, int flags) override;
+  void release(const Path& path, open_handle handle, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  uint64_t bmap(const Path& path, size_t blocksize) override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+  /** Cache of decoded blocks */
+  block_cache& cache() noexcept;
+
+ private:
+  struct block_ref {
+    std::uint64_t offset;
+    std::uint32_t stored_size;
+    std::uint32_t length;  // decoded; zero for a hole
+  };
+
+  struct file_state {
+    std::mutex mutex;
+    std::uint32_t block_size = 0;
+    std::uint64_t size = 0;
+    std::vector<block_ref> blocks;
+    std::map<std::uint64_t, std::string> dirty;  // decoded, by block
+    std::uint64_t end = 0;  // where the next block is appended
+    std::uint64_t garbage = 0;
+    bool changed = false;
+    bool loaded = false;
+    std::size_t opens = 0;  // open files; guarded by files_
+    std::size_t users = 0;  // calls in progress; guarded by files_
+  };
+  using state = std::shared_ptr<file_state>;
+
+  state acquire(const Path& path, bool open) const;
+  void done(const Path& path, const state& file, bool close) const;
+  void load(const Path& path, file_state& file) const;
+  std::string block(const Path& path, file_state& file,
+                    std::uint64_t number) const;
+  void write_back(const Path& path, file_state& file) const;
+  void commit(const Path& path, file_state& file) const;
+  void publish(const Path& path, file_state& file) const;
+  void compact(const Path& path, file_state& file) const;
+  std::uint64_t relocate(const Path& path,
+                         const std::vector<block_ref*>& live,
+                         std::uint64_t position) const;
+  void sync(const Path& path) const;
+  void read_exact(const Path& path, char* output, std::size_t size,
+                  std::uint64_t offset) const;
+  void write_exact(const Path& path, const string_view& data,
+                   std::uint64_t offset) const;
+  void zero(const Path& path, file_state& file, std::uint64_t offset,
+            std::uint64_t end) const;
+  void resize(const Path& path, file_state& file, std::uint64_t size) const;
+
+  compression_settings settings_;
+  std::shared_ptr<const codec> codec_;
+  mutable block_cache cache_;
+  mutable file_table<file_state> files_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,278 @@
+#include <drivex/copy.h>
+#include <drivex/directory_entry.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+bool is_unsupported(const error& e) {
+  return e.code().value() ==
+         static_cast<int>(error_code::function_not_supported);
+}
+
+/** Run an operation the backend is allowed not to implement */
+template <typename F>
+bool optional_call(F f) {
+  try {
+    f();
+    return true;
+  } catch (const error& e) {
+    if (!is_unsupported(e)) {
+      throw;
+    }
+  }
+  return false;
+}
+
+/** Get the status of a path, mapping a missing file onto not_found */
+file_status lookup(const filesystem& fs, const Path& p) {
+  try {
+    return fs.symlink_status(p);
+  } catch (const error& e) {
+    if (e.code().value() !=
+        static_cast<int>(error_code::no_such_file_or_directory)) {
+      throw;
+    }
+  }
+  return file_status(file_type::not_found);
+}
+
+/** Make room for a new non-directory at the destination */
+void prepare_target(filesystem& fs, const Path& to, CopyOptions options) {
+  auto status = lookup(fs, to);
+  if (!fs.exists(status)) {
+    return;
+  }
+  if (options != CopyOptions::overwrite_if_exists) {
+    throw error(error_code::file_exists, to.string());
+  }
+  if (fs.is_directory(status)) {
+    throw error(error_code::is_a_directory, to.string());
+  }
+  fs.remove(to);
+}
+
+class copier {
+ public:
+  copier(filesystem& source, filesystem& destination, CopyOptions options,
+         const copy_settings& settings)
+      : source_(source),
+        destination_(destination),
+        options_(options),
+        chunk_size_(std::max<std::size_t>(settings.chunk_size, 1)),
+        depth_(std::max<std::size_t>(settings.pipeline_depth, 1)),
+        own_pool_(settings.pool ? nullptr : new thread_pool),
+        group_(settings.pool ? *settings.pool : *own_pool_),
+        files_(0),
+        directories_(0),
+        symlinks_(0),
+        bytes_(0) {}
+
+  copy_statistics run(const Path& from, const Path& to) {
+    auto start = std::chrono::steady_clock::now();
+    copy_entry(directory_entry(source_, from), to);
+    group_.wait();
+    auto stats = copy_statistics{};
+    stats.files = files_;
+    stats.directories = directories_;
+    stats.symlinks = symlinks_;
+    stats.bytes = bytes_;
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+  }
+
+ private:
+  struct file_job {
+    Path from;
+    Path to;
+    std::uintmax_t size;
+    std::atomic<std::size_t> lanes;
+    std::atomic<bool> failed{false};  // by any lane
+  };
+
+  void copy_entry(const directory_entry& entry, const Path& to) {
+    const auto& from = entry.path();
+    auto status = entry.symlink_status();
+    switch (status.type()) {
+      case file_type::directory:
+        copy_directory(from, to, status);
+        break;
+      case file_type::symlink:
+        drivex::copy_symlink(source_, from, destination_, to, options_);
+        ++symlinks_;
+        break;
+      case file_type::regular:
+        copy_file(entry, to, status);
+        break;
+      default:
+        throw error(error_code::function_not_supported,
+                    "copy(" + from.string() + ") special file");
+    }
+  }
+
+  void copy_directory(const Path& from, const Path& to, file_status status) {
+    auto target = lookup(destination_, to);
+    if (!destination_.exists(target)) {
+      destination_.create_directory(to);
+      optional_call([&]() {
+        destination_.permissions(to, status.permissions());
+      });
+      ++directories_;
+    } else if (!destination_.is_directory(target)) {
+      throw error(error_code::not_a_directory, to.string());
+    }
+    for (auto& child : source_.read_directory_entries(from)) {
+      auto name = child.path().filename();
+      if (name == "." || name == "..") {
+        continue;
+      }
+      auto child_to = to / name;
+      group_.run([this, child, child_to]() { copy_entry(child, child_to); });
+    }
+  }
+
+  void copy_file(const directory_entry& entry, const Path& to,
+                 file_status status) {
+    const auto& from = entry.path();
+    prepare_target(destination_, to, options_);
+    auto size = entry.file_size();
+    if (&source_ == &destination_ && source_.clone_file(from, to)) {
+      ++files_;
+      bytes_ += size;
+      return;
+    }
+    try {
+      destination_.create_file(to, status.permissions());
+    } catch (const error& e) {  // may be created with default permissions
+      if (!is_unsupported(e) ||
+          !destination_.exists(lookup(destination_, to))) {
+        throw;
+      }
+    }
+    optional_call([&]() { source_.open(from, O_RDONLY); });
+    optional_call([&]() { destination_.open(to, O_WRONLY); });
+    auto chunks = (size + chunk_size_ - 1) / chunk_size_;
+    auto lanes = static_cast<std::size_t>(
+        std::max<std::uintmax_t>(std::min<std::uintmax_t>(depth_, chunks), 1));
+    auto job = std::make_shared<file_job>();
+    job->from = from;
+    job->to = to;
+    job->size = size;
+    job->lanes = lanes;
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+      group_.run([this, job, lane, lanes]() { copy_lane(*job, lane, lanes); });
+    }
+  }
+
+  /** Copy every lanes'th chunk of a file, starting at chunk lane */
+  void copy_lane(file_job& job, std::size_t lane, std::size_t lanes) {
+    auto failure = std::exception_ptr{};
+    try {
+      auto buffer = std::vector<char>(
+          static_cast<std::size_t>(std::min<std::uintmax_t>(chunk_size_,
+                                                            job.size)));
+      auto stride = static_cast<std::uintmax_t>(chunk_size_) * lanes;
+      for (auto offset = static_cast<std::uintmax_t>(chunk_size_) * lane;
+           offset < job.size && !job.failed; offset += stride) {
+        auto wanted = static_cast<std::size_t>(
+            std::min<std::uintmax_t>(chunk_size_, job.size - offset));
+        auto view = string_view(buffer.data(), wanted);
+        auto count = source_.read(job.from, view, offset);
+        if (count <= 0) {
+          break;  // source shrank underneath us
+        }
+        write_all(job.to, string_view(buffer.data(), count), offset);
+        bytes_ += count;
+        if (static_cast<std::size_t>(count) < wanted) {
+          break;
+        }
+      }
+    } catch (...) {
+      failure = std::current_exception();
+      job.failed = true;
+    }
+    if (--job.lanes == 0) {  // last lane out closes both files
+      try {
+        optional_call([&]() { destination_.release(job.to, O_WRONLY); });
+        optional_call([&]() { source_.release(job.from, O_RDONLY); });
+      } catch (...) {
+        if (!failure) {
+          failure = std::current_exception();
+        }
+        job.failed = true;
+      }
+      if (job.failed) {
+        try {  // leave no partial copy behind
+          destination_.remove(job.to);
+        } catch (const error&) {
+        }
+      } else {
+        ++files_;
+      }
+    }
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+  }
+
+  void write_all(const Path& to, string_view data, std::uintmax_t offset) {
+    while (!data.empty()) {
+      auto count = destination_.write(to, data, offset);
+      if (count <= 0) {
+        throw error(error_code::io_error, "copy: short write to " +
+                                              to.string());
+      }
+      data.remove_prefix(count);
+      offset += count;
+    }
+  }
+
+  filesystem& source_;
+  filesystem& destination_;
+  const CopyOptions options_;
+  const std::size_t chunk_size_;
+  const std::size_t depth_;
+  std::unique_ptr<thread_pool> own_pool_;
+  task_group group_;
+  std::atomic<std::uintmax_t> files_;
+  std::atomic<std::uintmax_t> directories_;
+  std::atomic<std::uintmax_t> symlinks_;
+  std::atomic<std::uintmax_t> bytes_;
+};
+
+}  // namespace
+
+double copy_statistics::throughput() const noexcept {
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0 ? static_cast<double>(bytes) / seconds : 0.0;
+}
+
+copy_statistics copy(filesystem& source, const Path& from,
+                     filesystem& destination, const Path& to,
+                     CopyOptions options, const copy_settings& settings) {
+  auto origin = source.absolute(from);
+  auto target = destination.absolute(to);
+  if (&source == &destination) {
+    auto inside = std::mismatch(origin.begin(), origin.end(), target.begin(),
+                                target.end());
+    if (inside.first == origin.end()) {
+      throw error(error_code::invalid_argument,
+                  "copy(" + from.string() + ") into itself");
+    }
+  }
+  return copier(source, destination, options, settings).run(origin, target);
+}
+
+void copy_symlink(const filesystem& source, const Path& from,
+                  filesystem& destination, const Path& to,
+                  CopyOptions options) {
+  auto target = source.read_symlink(from);
+  prepare_target(destination, to, options);
+  destination.create_symlink(target, to);
+}
+}  // namespace drivex
+}  // namespace lockblox
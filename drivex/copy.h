@@ -0,0 +1,51 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/thread_pool.h>
+#include <chrono>
+
+namespace lockblox {
+namespace drivex {
+
+/** Tuning knobs for a recursive copy */
+struct copy_settings {
+  /** Bytes moved by each read/write request */
+  std::size_t chunk_size = 4u << 20u;
+
+  /** Chunks of a single file in flight at once */
+  std::size_t pipeline_depth = 4;
+
+  /** Pool to run on; a private pool is created when null */
+  thread_pool* pool = nullptr;
+};
+
+/** Work done by a recursive copy */
+struct copy_statistics {
+  std::uintmax_t files = 0;
+  std::uintmax_t directories = 0;
+  std::uintmax_t symlinks = 0;
+  std::uintmax_t bytes = 0;
+  std::chrono::steady_clock::duration elapsed{};
+
+  /** Average data rate in bytes per second */
+  double throughput() const noexcept;
+};
+
+/** Copy a file, symlink or directory tree, possibly between filesystems
+ *
+ * Directories are walked in parallel and file data is moved in pipelined
+ * chunks.  When source and destination are the same filesystem, regular files
+ * are first offered to filesystem::clone_file so the backend can copy them
+ * without moving bytes through drivex.  Existing destination files are
+ * replaced only when options is overwrite_if_exists; existing directories are
+ * merged into.  Both filesystems must tolerate concurrent calls. */
+copy_statistics copy(filesystem& source, const Path& from,
+                     filesystem& destination, const Path& to,
+                     CopyOptions options = CopyOptions::none,
+                     const copy_settings& settings = copy_settings());
+
+/** Recreate a symbolic link, possibly on another filesystem */
+void copy_symlink(const filesystem& source, const Path& from,
+                  filesystem& destination, const Path& to,
+                  CopyOptions options = CopyOptions::none);
+}  // namespace drivex
+}  // namespace lockblox
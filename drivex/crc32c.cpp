@@ -0,0 +1,114 @@
+#include <drivex/crc32c.h>
+#include <array>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define DRIVEX_CRC32C_SSE42 1
+#endif
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint32_t polynomial = 0x82f63b78;  // reversed Castagnoli
+
+using table = std::array<std::array<std::uint32_t, 256>, 8>;
+
+const table& slicing_table() {
+  static const auto tables = [] {
+    table result;
+    for (std::uint32_t byte = 0; byte < 256; ++byte) {
+      auto crc = byte;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = crc & 1u ? crc >> 1u ^ polynomial : crc >> 1u;
+      }
+      result[0][byte] = crc;
+    }
+    for (std::size_t slice = 1; slice < result.size(); ++slice) {
+      for (std::size_t byte = 0; byte < 256; ++byte) {
+        auto previous = result[slice - 1][byte];
+        result[slice][byte] = previous >> 8u ^ result[0][previous & 0xffu];
+      }
+    }
+    return result;
+  }();
+  return tables;
+}
+
+std::uint32_t portable(const unsigned char* data, std::size_t size,
+                       std::uint32_t crc) {
+  const auto& t = slicing_table();
+  for (; size >= 8; size -= 8, data += 8) {
+    std::uint32_t low;
+    std::uint32_t high;
+    std::memcpy(&low, data, sizeof(low));  // assumes little endian
+    std::memcpy(&high, data + 4, sizeof(high));
+    low ^= crc;
+    crc = t[7][low & 0xffu] ^ t[6][low >> 8u & 0xffu] ^
+          t[5][low >> 16u & 0xffu] ^ t[4][low >> 24u] ^
+          t[3][high & 0xffu] ^ t[2][high >> 8u & 0xffu] ^
+          t[1][high >> 16u & 0xffu] ^ t[0][high >> 24u];
+  }
+  for (; size > 0; --size) {
+    crc = crc >> 8u ^ t[0][(crc ^ *data++) & 0xffu];
+  }
+  return crc;
+}
+
+#ifdef DRIVEX_CRC32C_SSE42
+__attribute__((target("sse4.2"))) std::uint32_t hardware(
+    const unsigned char* data, std::size_t size, std::uint32_t crc) {
+#ifdef __x86_64__
+  std::uint64_t wide = crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    wide = _mm_crc32_u64(wide, word);
+  }
+  crc = static_cast<std::uint32_t>(wide);
+#endif
+  for (; size >= 4; size -= 4, data += 4) {
+    std::uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    crc = _mm_crc32_u32(crc, word);
+  }
+  for (; size > 0; --size) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+#endif
+
+using implementation = std::uint32_t (*)(const unsigned char*, std::size_t,
+                                         std::uint32_t);
+
+implementation selected() noexcept {
+  static const auto chosen = []() -> implementation {
+#ifdef DRIVEX_CRC32C_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+      return hardware;
+    }
+#endif
+    return portable;
+  }();
+  return chosen;
+}
+
+}  // namespace
+
+std::uint32_t crc32c(const string_view& data, std::uint32_t crc) {
+  auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+  return ~selected()(bytes, data.size(), ~crc);
+}
+
+std::uint32_t crc32c_portable(const string_view& data, std::uint32_t crc) {
+  auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+  return ~portable(bytes, data.size(), ~crc);
+}
+
+bool crc32c_hardware() noexcept { return selected() != portable; }
+}  // namespace drivex
+}  // namespace lockblox
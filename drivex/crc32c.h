@@ -0,0 +1,20 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+/** CRC-32C (Castagnoli) of data, continuing from a previous result
+ *
+ * Uses the SSE 4.2 crc32 instruction where the processor has it and a
+ * slicing-by-8 table otherwise. */
+std::uint32_t crc32c(const string_view& data, std::uint32_t crc = 0);
+
+/** CRC-32C computed without hardware support, for comparison */
+std::uint32_t crc32c_portable(const string_view& data, std::uint32_t crc = 0);
+
+/** Whether crc32c uses a hardware instruction on this processor */
+bool crc32c_hardware() noexcept;
+}  // namespace drivex
+}  // namespace lockblox
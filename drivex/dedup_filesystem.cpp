@@ -0,0 +1,597 @@
+#include <drivex/dedup_filesystem.h>
+#include <drivex/directory_iterator.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <set>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+struct recipe_header {
+  char magic[8];
+  std::uint64_t size;
+  std::uint64_t chunk_count;
+  std::uint64_t reserved;
+};
+
+static_assert(sizeof(recipe_header) == 32, "header must be packed");
+
+const char recipe_magic[8] = {'D', 'R', 'V', 'X', 'D', 'D', 'P', '1'};
+
+const char work_suffix[] = ".drivex-recipe";
+
+/** Where a new chunk list is written before it replaces the old one */
+Path work_path(const Path& path) {
+  return path.parent_path() / ("." + path.filename().string() + work_suffix);
+}
+
+bool is_work_path(const Path& path) {
+  auto name = path.filename().string();
+  auto suffix = sizeof(work_suffix) - 1;
+  return name.size() > suffix + 1 && name[0] == '.' &&
+         name.compare(name.size() - suffix, suffix, work_suffix) == 0;
+}
+
+bool has_code(const error& e, error_code code) {
+  return e.code().value() == static_cast<int>(code);
+}
+
+/** Run an optional call, which a backend may not support */
+void unless_unsupported(const std::function<void()>& call) {
+  try {
+    call();
+  } catch (const error& e) {
+    if (!has_code(e, error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+}  // namespace
+
+dedup_filesystem::dedup_filesystem(std::shared_ptr<filesystem> inner,
+                                   const Path& store, dedup_settings settings)
+    : filesystem_decorator(std::move(inner)),
+      settings_(settings),
+      chunker_(settings_.sizes),
+      store_(store),
+      cache_(settings_.cache_chunks) {}
+
+dedup_filesystem::~dedup_filesystem() {
+  for (auto& file : files_.all()) {
+    try {
+      std::lock_guard<std::mutex> lock(file.second->mutex);
+      commit(file.first, *file.second);
+    } catch (...) {  // nothing sensible to do with it here
+    }
+  }
+}
+
+std::uintmax_t dedup_filesystem::file_size(const Path& path) const {
+  if (auto file = files_.find(path)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    if (file->loaded) {
+      return file->size;
+    }
+  }
+  if (!is_regular_file(inner().symlink_status(path)) ||
+      inner().file_size(path) == 0) {
+    return inner().file_size(path);
+  }
+  recipe_header header;
+  read_exact(path, reinterpret_cast<char*>(&header), sizeof(header), 0);
+  if (std::memcmp(header.magic, recipe_magic, sizeof(header.magic)) != 0) {
+    throw error(error_code::io_error, path.string() + ": not a chunk list");
+  }
+  return header.size;
+}
+
+bool dedup_filesystem::clone_file(const Path& from, const Path& to) {
+  if (auto file = files_.find(from)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    commit(from, *file);
+  }
+  std::shared_lock<std::shared_timed_mutex> collecting(collect_mutex_);
+  return inner().clone_file(from, to);
+}
+
+bool dedup_filesystem::remove(const Path& path) {
+  auto file = files_.take(path);
+  std::unique_lock<std::mutex> file_lock;
+  if (file) {  // wait for a write back, which must not bring it back
+    file_lock = std::unique_lock<std::mutex>(file->mutex);
+    file->removed = true;
+  }
+  return inner().remove(path);
+}
+
+void dedup_filesystem::rename(const Path& from, const Path& to) {
+  {
+    std::shared_lock<std::shared_timed_mutex> collecting(collect_mutex_);
+    inner().rename(from, to);
+  }
+  if (auto replaced = files_.rename(from, to)) {  // as when removed
+    std::lock_guard<std::mutex> file_lock(replaced->mutex);
+    replaced->removed = true;
+  }
+}
+
+void dedup_filesystem::truncate(const Path& path, uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    resize(*file, offset);
+  }
+  done(path, file, false);
+}
+
+void dedup_filesystem::set_attributes(const Path& path,
+                                      const attribute_update& update) {
+  if (update.size) {
+    truncate(path, *update.size);
+  }
+  auto rest = update;
+  rest.size = boost::none;
+  if (rest.permissions || rest.user_id || rest.group_id ||
+      rest.last_read_time || rest.last_write_time) {
+    inner().set_attributes(path, rest);
+  }
+}
+
+void dedup_filesystem::open(const Path& path, int flags) {
+  inner().open(path, inner_flags(flags));
+  auto file = acquire(path, true);
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    resize(*file, 0);
+  }
+}
+
+open_handle dedup_filesystem::open_file(const Path& path, int flags) {
+  open(path, flags);  // the inner handle would bypass this layer
+  return no_open_handle;
+}
+
+open_handle dedup_filesystem::create(const Path& path,
+                                     drivex::permissions permissions,
+                                     int flags) {
+  inner().create(path, permissions, inner_flags(flags));
+  acquire(path, true);
+  return no_open_handle;
+}
+
+int dedup_filesystem::read(const Path& path, string_view& buffer,
+                           uint64_t offset) const {
+  auto file = acquire(path, false);
+  std::size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    if (offset < file->size) {
+      count = std::min<std::uint64_t>(buffer.size(), file->size - offset);
+      fill(*file, const_cast<char*>(buffer.data()), offset, count);
+    }
+  }
+  done(path, file, false);
+  return static_cast<int>(count);
+}
+
+int dedup_filesystem::read(const Path& path, open_handle handle,
+                           string_view& buffer, uint64_t offset) const {
+  (void)handle;
+  return read(path, buffer, offset);
+}
+
+int dedup_filesystem::write(const Path& path, const string_view& buffer,
+                            uint64_t offset) {
+  auto file = acquire(path, false);
+  {
+    std::lock_guard<std::mutex> lock(file->mutex);
+    auto end = offset + buffer.size();
+    auto& pending = file->pending;
+    auto first = pending.upper_bound(offset);
+    if (first != pending.begin() &&
+        std::prev(first)->first + std::prev(first)->second.size() >= offset) {
+      --first;
+    }
+    auto last = first;
+    auto start = offset;
+    auto stop = end;
+    for (; last != pending.end() && last->first <= end; ++last) {
+      start = std::min(start, last->first);
+      stop = std::max<std::uint64_t>(stop,
+                                     last->first + last->second.size());
+    }
+    if (first != last && std::next(first) == last && first->first == start) {
+      auto& data = first->second;  // extend in place, as sequential writes do
+      file->pending_bytes += stop - start - data.size();
+      data.resize(stop - start);
+      std::memcpy(&data[offset - start], buffer.data(), buffer.size());
+    } else {
+      std::string merged(stop - start, '\0');
+      for (auto it = first; it != last; ++it) {
+        std::memcpy(&merged[it->first - start], it->second.data(),
+                    it->second.size());
+        file->pending_bytes -= it->second.size();
+      }
+      std::memcpy(&merged[offset - start], buffer.data(), buffer.size());
+      pending.erase(first, last);
+      pending.emplace(start, std::move(merged));
+      file->pending_bytes += stop - start;
+    }
+    file->size = std::max(file->size, end);
+    file->changed = true;
+    if (file->pending_bytes >= settings_.pending_bytes) {
+      commit(path, *file);
+    }
+  }
+  done(path, file, false);
+  return static_cast<int>(buffer.size());
+}
+
+int dedup_filesystem::write(const Path& path, open_handle handle,
+                            const string_view& buffer, uint64_t offset) {
+  (void)handle;
+  return write(path, buffer, offset);
+}
+
+void dedup_filesystem::flush(const Path& path) {
+  if (auto file = files_.find(path)) {
+    std::lock_guard<std::mutex> file_lock(file->mutex);
+    commit(path, *file);
+  }
+  unless_unsupported([&] { inner().flush(path); });
+}
+
+void dedup_filesystem::flush(const Path& path, open_handle handle) {
+  (void)handle;
+  flush(path);
+}
+
+void dedup_filesystem::release(const Path& path, int flags) {
+  done(path, acquire(path, false), true);
+  inner().release(path, inner_flags(flags));
+}
+
+void dedup_filesystem::release(const Path& path, open_handle handle,
+                               int flags) {
+  (void)handle;
+  release(path, flags);
+}
+
+void dedup_filesystem::fsync(const Path& path, int fd) {
+  flush(path);
+  inner().fsync(path, fd);
+}
+
+uint64_t dedup_filesystem::bmap(const Path& path, size_t blocksize) {
+  (void)path;
+  (void)blocksize;
+  throw error(error_code::function_not_supported);
+}
+
+void dedup_filesystem::fallocate(const Path& path, int mode, uint64_t offset,
+                                 uint64_t length) {
+  (void)path;
+  (void)mode;
+  (void)offset;
+  (void)length;
+  throw error(error_code::function_not_supported);
+}
+
+std::size_t dedup_filesystem::gc() {
+  std::unique_lock<std::shared_timed_mutex> collecting(collect_mutex_);
+  std::set<chunk_id> used;
+  for (auto it = recursive_directory_iterator(inner(), "/"); it != end(it);
+       ++it) {
+    if (it->symlink_status().type() != file_type::regular ||
+        is_work_path(it->path())) {
+      continue;  // a list left by a crash was never in use
+    }
+    file_state file;
+    load(it->path(), file);
+    for (const auto& ref : file.chunks) {
+      used.insert(ref.id);
+    }
+  }
+  std::size_t removed = 0;
+  for (const auto& id : store_.list()) {
+    if (used.count(id) == 0 && store_.remove(id)) {
+      cache_.invalidate(Path(sha256::to_hex(id)));
+      ++removed;
+    }
+  }
+  return removed;
+}
+
+chunk_store& dedup_filesystem::store() noexcept { return store_; }
+
+block_cache& dedup_filesystem::cache() noexcept { return cache_; }
+
+dedup_filesystem::state dedup_filesystem::acquire(const Path& path,
+                                                  bool open) const {
+  return files_.acquire(path, open,
+                        [this, &path](file_state& file) { load(path, file); });
+}
+
+void dedup_filesystem::done(const Path& path, const state& file,
+                            bool close) const {
+  files_.done(path, file, close,
+              [this, &path](file_state& file) { commit(path, file); });
+}
+
+void dedup_filesystem::load(const Path& path, file_state& file) const {
+  file.stored_size = inner().file_size(path);
+  if (file.stored_size == 0) {
+    file.loaded = true;
+    return;
+  }
+  recipe_header header;
+  read_exact(path, reinterpret_cast<char*>(&header), sizeof(header), 0);
+  if (std::memcmp(header.magic, recipe_magic, sizeof(header.magic)) != 0 ||
+      header.chunk_count > file.stored_size / sizeof(chunk_ref)) {
+    throw error(error_code::io_error, path.string() + ": not a chunk list");
+  }
+  file.chunks.resize(header.chunk_count);
+  read_exact(path, reinterpret_cast<char*>(file.chunks.data()),
+             file.chunks.size() * sizeof(chunk_ref), sizeof(header));
+  for (const auto& ref : file.chunks) {
+    file.offsets.push_back(file.offsets.back() + ref.size);
+  }
+  if (file.offsets.back() != header.size) {
+    throw error(error_code::io_error, path.string() + ": corrupt chunk list");
+  }
+  file.size = file.base_size = header.size;
+  file.loaded = true;
+}
+
+block_cache::block dedup_filesystem::chunk(const chunk_ref& ref) const {
+  auto key = Path(sha256::to_hex(ref.id));
+  auto data = cache_.get(key, 0);
+  if (!data) {
+    data = std::make_shared<const std::string>(store_.get(ref.id, ref.size));
+    cache_.put(key, 0, data);
+  }
+  return data;
+}
+
+void dedup_filesystem::fill(const file_state& file, char* output,
+                            std::uint64_t offset, std::size_t count) const {
+  std::memset(output, 0, count);
+  auto end = offset + count;
+  auto base_end = std::min<std::uint64_t>(end, file.base_size);
+  if (offset < base_end) {
+    const auto& offsets = file.offsets;
+    auto first = static_cast<std::size_t>(
+        std::upper_bound(offsets.begin(), offsets.end(), offset) -
+        offsets.begin() - 1);
+    auto last = static_cast<std::size_t>(
+        std::lower_bound(offsets.begin(), offsets.end(), base_end) -
+        offsets.begin());
+    auto copy_chunk = [&](std::size_t i) {
+      auto data = chunk(file.chunks[i]);
+      auto from = std::max(offset, offsets[i]);
+      auto to = std::min(base_end, offsets[i + 1]);
+      std::memcpy(output + (from - offset), data->data() + (from - offsets[i]),
+                  to - from);
+    };
+    if (settings_.pool != nullptr && last - first > 1) {
+      task_group group(*settings_.pool);
+      for (auto i = first; i < last; ++i) {
+        group.run([&copy_chunk, i]() { copy_chunk(i); });
+      }
+      group.wait();
+    } else {
+      for (auto i = first; i < last; ++i) {
+        copy_chunk(i);
+      }
+    }
+  }
+  auto it = file.pending.upper_bound(offset);
+  if (it != file.pending.begin()) {
+    --it;
+  }
+  for (; it != file.pending.end() && it->first < end; ++it) {
+    auto from = std::max(offset, it->first);
+    auto to = std::min<std::uint64_t>(end, it->first + it->second.size());
+    if (from < to) {
+      std::memcpy(output + (from - offset),
+                  it->second.data() + (from - it->first), to - from);
+    }
+  }
+}
+
+void dedup_filesystem::commit(const Path& path, file_state& file) const {
+  if (!file.changed || file.removed) {
+    return;
+  }
+  std::shared_lock<std::shared_timed_mutex> collecting(collect_mutex_);
+  // Find the range that differs from the chunks and start over from the
+  // chunk it begins in, or the last one if it lies past them all.
+  const auto& offsets = file.offsets;
+  auto old_size = offsets.back();
+  auto low = file.size;
+  std::uint64_t high = 0;
+  if (!file.pending.empty()) {
+    low = file.pending.begin()->first;
+    high = file.pending.rbegin()->first + file.pending.rbegin()->second.size();
+  }
+  if (file.base_size < old_size || file.size != old_size) {
+    low = std::min(low, std::min(file.base_size, old_size));
+    high = std::max(high, file.size);
+  }
+  auto first = static_cast<std::size_t>(
+      std::upper_bound(offsets.begin(), offsets.end(), low) -
+      offsets.begin() - 1);
+  first = std::min(first, file.chunks.size());
+  if (first == file.chunks.size() && first > 0) {
+    --first;  // it was cut short by the end of the file
+  }
+  auto resume = file.chunks.size();
+  std::deque<chunk_ref> fresh;
+  auto position = offsets[first];
+  std::string buffer;
+  auto buffer_start = position;
+  const std::size_t max_size = chunker_.sizes().max_size;
+  const auto segment = std::max<std::size_t>(1u << 20u, 4 * max_size);
+  auto store_chunk = [this](chunk_ref* ref,
+                            std::shared_ptr<const std::string> data) {
+    ref->id = sha256::hash(*data);
+    ref->size = static_cast<std::uint32_t>(data->size());
+    ref->reserved = 0;
+    store_.put(ref->id, *data);
+    cache_.put(Path(sha256::to_hex(ref->id)), 0, std::move(data));
+  };
+  {
+    std::unique_ptr<task_group> group;
+    if (settings_.pool != nullptr) {
+      group.reset(new task_group(*settings_.pool));
+    }
+    while (position < file.size) {
+      auto buffered_end = buffer_start + buffer.size();
+      if (buffered_end < file.size && buffered_end - position < max_size) {
+        buffer.erase(0, position - buffer_start);
+        buffer_start = position;
+        auto count = std::min<std::uint64_t>(segment, file.size - buffered_end);
+        auto used = buffer.size();
+        buffer.resize(used + count);
+        fill(file, &buffer[used], buffered_end, count);
+      }
+      auto skip = position - buffer_start;
+      auto length =
+          chunker_.cut(string_view(buffer.data() + skip, buffer.size() - skip));
+      auto data = std::make_shared<const std::string>(buffer, skip, length);
+      fresh.emplace_back();
+      auto ref = &fresh.back();
+      if (group) {
+        group->run([&store_chunk, ref, data]() { store_chunk(ref, data); });
+      } else {
+        store_chunk(ref, data);
+      }
+      position += length;
+      if (position >= high && position < file.size) {  // back in step?
+        auto match = std::lower_bound(offsets.begin() + first, offsets.end(),
+                                      position);
+        if (match != offsets.end() && *match == position) {
+          resume = static_cast<std::size_t>(match - offsets.begin());
+          break;
+        }
+      }
+    }
+    if (group) {
+      group->wait();
+    }
+  }
+  std::vector<chunk_ref> chunks(file.chunks.begin(),
+                                file.chunks.begin() + first);
+  chunks.insert(chunks.end(), fresh.begin(), fresh.end());
+  chunks.insert(chunks.end(), file.chunks.begin() + resume, file.chunks.end());
+  recipe_header header;
+  std::memcpy(header.magic, recipe_magic, sizeof(header.magic));
+  header.size = file.size;
+  header.chunk_count = chunks.size();
+  header.reserved = 0;
+  std::string recipe(reinterpret_cast<const char*>(&header), sizeof(header));
+  recipe.append(reinterpret_cast<const char*>(chunks.data()),
+                chunks.size() * sizeof(chunk_ref));
+  replace(path, recipe);
+  file.stored_size = recipe.size();
+  file.chunks = std::move(chunks);
+  file.offsets.assign(1, 0);
+  for (const auto& ref : file.chunks) {
+    file.offsets.push_back(file.offsets.back() + ref.size);
+  }
+  file.base_size = file.size;
+  file.pending.clear();
+  file.pending_bytes = 0;
+  file.changed = false;
+}
+
+void dedup_filesystem::replace(const Path& path,
+                               const std::string& recipe) const {
+  auto work = work_path(path);
+  auto permissions = inner().status(path).permissions();
+  auto flags = O_WRONLY | O_TRUNC;
+  auto handle = no_open_handle;
+  try {
+    handle = inner().create(work, permissions, flags);
+  } catch (const error& e) {  // left by a crash
+    if (!has_code(e, error_code::file_exists)) {
+      throw;
+    }
+    inner().remove(work);
+    handle = inner().create(work, permissions, flags);
+  }
+  auto open = true;
+  try {
+    auto rest = string_view(recipe);
+    std::uint64_t offset = 0;
+    while (!rest.empty()) {
+      auto count = inner().write(work, handle, rest, offset);
+      if (count <= 0) {
+        throw error(error_code::io_error, work.string() + ": short write");
+      }
+      rest.remove_prefix(static_cast<std::size_t>(count));
+      offset += count;
+    }
+    unless_unsupported([&] { inner().fsync(work, 0); });
+    open = false;
+    inner().release(work, handle, flags);
+    unless_unsupported([&] {
+      for (const auto& attribute : inner().getxattrs(path)) {
+        inner().setxattr(work, {attribute.first, attribute.second}, 0);
+      }
+    });
+    inner().rename(work, path);
+  } catch (...) {
+    try {
+      if (open) {
+        inner().release(work, handle, flags);
+      }
+      inner().remove(work);
+    } catch (...) {  // the first error matters more
+    }
+    throw;
+  }
+  unless_unsupported([&] { inner().fsyncdir(path.parent_path(), 0); });
+}
+
+void dedup_filesystem::resize(file_state& file, std::uint64_t size) const {
+  if (size < file.size) {
+    file.base_size = std::min(file.base_size, size);
+    auto& pending = file.pending;
+    for (auto it = pending.lower_bound(size); it != pending.end();) {
+      file.pending_bytes -= it->second.size();
+      it = pending.erase(it);
+    }
+    if (!pending.empty()) {
+      auto& last = *pending.rbegin();
+      if (last.first + last.second.size() > size) {
+        file.pending_bytes -= last.first + last.second.size() - size;
+        last.second.resize(size - last.first);
+      }
+    }
+  }
+  file.size = size;
+  file.changed = true;
+}
+
+void dedup_filesystem::read_exact(const Path& path, char* output,
+                                  std::size_t size,
+                                  std::uint64_t offset) const {
+  while (size > 0) {
+    auto buffer = string_view(output, size);
+    auto count = inner().read(path, buffer, offset);
+    if (count <= 0) {
+      throw error(error_code::io_error, path.string() + ": truncated");
+    }
+    output += count;
+    offset += count;
+    size -= count;
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,139 @@
+#pragma once
+#include <drivex/block_cache.h>
+#include <drivex/chunk_store.h>
+#include <drivex/chunker.h>
+#include <drivex/filesystem_decorator.h>
+#include <drivex/thread_pool.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+struct dedup_settings {
+  /** Chunk size bounds; they must stay the same for a store to dedup well */
+  chunking sizes;
+  /** Pool to hash, store and fetch chunks on in parallel, if any */
+  thread_pool* pool = nullptr;
+  /** Chunks kept in memory */
+  std::size_t cache_chunks = 1024;
+  /** Written bytes buffered per file before they are chunked */
+  std::size_t pending_bytes = 64u << 20u;
+};
+
+/** Stores file data once per distinct content-defined chunk
+ *
+ * Each regular file of the inner filesystem holds the list of chunks that
+ * make up its data, while the chunks themselves live in a chunk_store on a
+ * host directory, so identical data in any files is stored once.  Writes
+ * are buffered and, on flush, release or when too much is pending, the
+ * changed range is chunked again from the chunk it starts in until the cut
+ * points fall back in line with the old ones.  New chunks are hashed and
+ * stored in parallel while the chunker moves on, and a read fetches only
+ * the chunks covering its range.  Directories, symlinks and attributes pass
+ * through unchanged.
+ *
+ * New chunks are durable before a chunk list refers to them, and a new list
+ * is written to a hidden .<name>.drivex-recipe file beside the old one and
+ * renamed over it, so a crash leaves either list intact.  Chunks that no
+ * file refers to any more stay in the store until gc removes them.  Hard
+ * links to a file that is open under another name are not kept coherent,
+ * and a link is split off when its list is rewritten. */
+class dedup_filesystem : public filesystem_decorator {
+ public:
+  dedup_filesystem(std::shared_ptr<filesystem> inner, const Path& store,
+                   dedup_settings settings = dedup_settings());
+
+  /** Write back what is buffered, ignoring errors */
+  ~dedup_filesystem() override;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  bool clone_file(const Path& from, const Path& to) override;
+  bool remove(const Path& path) override;
+  void rename(const Path& from, const Path& to) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle open_file(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void flush(const Path& path, open_handle handle) override;
+  void release(const Path& path, int flags) override;
+  void release(const Path& path, open_handle handle, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  uint64_t bmap(const Path& path, size_t blocksize) override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+  /** Delete the chunks that no file refers to
+   *
+   * Reads the chunk list of every file of the inner filesystem, so it is
+   * slow; lists are not written back and renames wait while it runs.
+   * @return the number of chunks deleted */
+  std::size_t gc();
+
+  chunk_store& store() noexcept;
+
+  /** Cache of chunk contents */
+  block_cache& cache() noexcept;
+
+ private:
+  struct chunk_ref {
+    chunk_id id;
+    std::uint32_t size;
+    std::uint32_t reserved;
+  };
+
+  struct file_state {
+    std::mutex mutex;
+    std::uint64_t size = 0;
+    std::vector<chunk_ref> chunks;
+    std::vector<std::uint64_t> offsets{0};  // of each chunk, then the end
+    std::uint64_t base_size = 0;  // bytes still taken from the chunks
+    std::map<std::uint64_t, std::string> pending;  // disjoint written ranges
+    std::size_t pending_bytes = 0;
+    std::uint64_t stored_size = 0;  // of the chunk list
+    bool changed = false;
+    bool loaded = false;
+    bool removed = false;
+    std::size_t opens = 0;  // open files; guarded by files_
+    std::size_t users = 0;  // calls in progress; guarded by files_
+  };
+  using state = std::shared_ptr<file_state>;
+
+  state acquire(const Path& path, bool open) const;
+  void done(const Path& path, const state& file, bool close) const;
+  void load(const Path& path, file_state& file) const;
+  block_cache::block chunk(const chunk_ref& ref) const;
+  void fill(const file_state& file, char* output, std::uint64_t offset,
+            std::size_t count) const;
+  void commit(const Path& path, file_state& file) const;
+  void replace(const Path& path, const std::string& recipe) const;
+  void resize(file_state& file, std::uint64_t size) const;
+  void read_exact(const Path& path, char* output, std::size_t size,
+                  std::uint64_t offset) const;
+
+  dedup_settings settings_;
+  chunker chunker_;
+  mutable chunk_store store_;
+  mutable block_cache cache_;
+  mutable std::shared_timed_mutex collect_mutex_;  // held alone by gc
+  mutable file_table<file_state> files_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,463 @@
+#include <drivex/dentry_cache.h>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::size_t min_buckets = 64;
+
+/** 64-bit FNV-1a */
+std::uint64_t hash_bytes(const char* data, std::size_t size,
+                         std::uint64_t hash = 14695981039346656037ull) {
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+  }
+  return hash;
+}
+
+std::uint64_t hash_path(const std::string& path) {
+  return hash_bytes(path.data(), path.size());
+}
+
+std::uint64_t hash_child(std::uint64_t parent, const string_view& name) {
+  return hash_bytes(name.data(), name.size(),
+                    hash_bytes(reinterpret_cast<const char*>(&parent),
+                               sizeof(parent)));
+}
+
+/** Rough bytes held for an entry, including its links and list node */
+std::size_t footprint(const std::string& path) { return path.size() + 200; }
+
+/** Stripe of reader counters for the calling thread */
+std::size_t stripe_index(std::size_t stripes) {
+  static std::atomic<std::size_t> next(0);
+  thread_local std::size_t index = next++;
+  return index % stripes;
+}
+
+}  // namespace
+
+struct dentry_cache::entry {
+  std::string path;
+  std::size_t name_offset;
+  node_id node;
+  std::shared_ptr<entry> parent;  // keeps ancestors readable
+  std::uint64_t path_hash;
+  std::uint64_t child_hash;
+  std::atomic<bool> valid{true};
+  // invalidations_ when the ancestors were last found live
+  mutable std::atomic<std::uint64_t> checked{0};
+  // written only under the writer mutex
+  std::size_t children = 0;
+  std::size_t bytes = 0;    // charged to the budget
+  std::uint64_t stamp = 0;  // of the insertion
+  std::list<std::shared_ptr<entry>>::iterator position;
+
+  string_view name() const {
+    return string_view(path).substr(name_offset);
+  }
+};
+
+struct dentry_cache::link {
+  link(const entry* item, link* next) : item(item), next(next) {}
+
+  const entry* item;
+  std::atomic<link*> next;
+};
+
+struct dentry_cache::table {
+  explicit table(std::size_t buckets)
+      : mask(buckets - 1), buckets(new std::atomic<link*>[buckets]) {
+    for (std::size_t i = 0; i < buckets; ++i) {
+      this->buckets[i].store(nullptr);
+    }
+  }
+
+  std::size_t mask;
+  std::unique_ptr<std::atomic<link*>[]> buckets;
+};
+
+/** Membership of the current epoch for the duration of a lookup */
+class dentry_cache::reader {
+ public:
+  explicit reader(const dentry_cache& cache)
+      : stripe_(cache.stripes_[stripe_index(stripes)]) {
+    for (;;) {
+      epoch_ = cache.epoch_.load();
+      stripe_.readers[epoch_ & 1u].fetch_add(1);
+      if (cache.epoch_.load() == epoch_) {
+        return;
+      }
+      stripe_.readers[epoch_ & 1u].fetch_sub(1);  // raced an advance
+    }
+  }
+
+  ~reader() { stripe_.readers[epoch_ & 1u].fetch_sub(1); }
+
+  reader(const reader&) = delete;
+  reader& operator=(const reader&) = delete;
+
+ private:
+  stripe& stripe_;
+  std::uint64_t epoch_;
+};
+
+const std::size_t dentry_cache::stripes;
+
+dentry_cache::dentry_cache(std::size_t capacity)
+    : capacity_(capacity),
+      budget_(nullptr),
+      paths_(new table(min_buckets)),
+      children_(new table(min_buckets)),
+      size_(0),
+      invalidations_(0),
+      epoch_(0) {
+  for (auto& s : stripes_) {
+    s.readers[0].store(0);
+    s.readers[1].store(0);
+  }
+}
+
+dentry_cache::~dentry_cache() {
+  budget(nullptr);
+  for (auto tables : {paths_.load(), children_.load()}) {
+    for (std::size_t i = 0; i <= tables->mask; ++i) {
+      for (auto l = tables->buckets[i].load(); l != nullptr;) {
+        auto next = l->next.load();
+        delete l;
+        l = next;
+      }
+    }
+    delete tables;
+  }
+}
+
+bool dentry_cache::insert(const Path& path, node_id node) {
+  const auto& key = path.string();
+  if (key.empty() || key[0] != '/' || (key.size() > 1 && key.back() == '/')) {
+    return false;
+  }
+  auto slash = key.rfind('/');
+  auto bytes = footprint(key);
+  memory_budget* budget;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget = budget_;
+  }
+  // charging may evict from this cache too, so not under the mutex
+  if (budget != nullptr && !budget->charge(*this, bytes)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto refund = [this, budget, bytes]() {
+    if (budget != nullptr) {
+      budget->release(*this, bytes);
+    }
+  };
+  if (budget != budget_) {
+    refund();  // the budget changed meanwhile
+    return false;
+  }
+  std::shared_ptr<entry> parent;
+  if (key.size() > 1) {
+    auto parent_key = slash == 0 ? std::string("/") : key.substr(0, slash);
+    auto found = find_path(*paths_.load(), parent_key, hash_path(parent_key));
+    if (found == nullptr || !usable(*found)) {
+      refund();
+      return false;
+    }
+    parent = *found->position;
+  }
+  auto path_hash = hash_path(key);
+  auto existing = find_path(*paths_.load(), key, path_hash);
+  if (existing != nullptr) {
+    if (existing->valid.load() && existing->node == node &&
+        existing->parent == parent) {
+      refund();
+      return true;
+    }
+    remove(*existing);
+  }
+  auto e = std::make_shared<entry>();
+  e->path = key;
+  e->name_offset = slash + 1;
+  e->node = node;
+  e->path_hash = path_hash;
+  e->child_hash = 0;
+  e->bytes = budget != nullptr ? bytes : 0;
+  e->stamp = budget != nullptr ? budget->tick() : 0;
+  if (parent) {
+    e->child_hash = hash_child(parent->node, e->name());
+    auto sibling =
+        find_child(*children_.load(), parent->node, e->name(), e->child_hash);
+    if (sibling != nullptr) {
+      remove(*sibling);  // a stale entry under the same directory node
+    }
+  }
+  e->parent = std::move(parent);
+  e->checked.store(invalidations_.load());
+  add(e);
+  if (size_.load() > capacity_) {
+    shrink();
+  }
+  reclaim();
+  return true;
+}
+
+boost::optional<dentry_cache::node_id> dentry_cache::find(
+    const Path& path) const {
+  const auto& key = path.string();
+  auto hash = hash_path(key);
+  reader guard(*this);
+  auto e = find_path(*paths_.load(), key, hash);
+  if (e == nullptr || !usable(*e)) {
+    return boost::none;
+  }
+  return e->node;
+}
+
+boost::optional<dentry_cache::node_id> dentry_cache::find(
+    node_id parent, const string_view& name) const {
+  auto hash = hash_child(parent, name);
+  reader guard(*this);
+  auto e = find_child(*children_.load(), parent, name, hash);
+  if (e == nullptr || !usable(*e)) {
+    return boost::none;
+  }
+  return e->node;
+}
+
+void dentry_cache::invalidate(const Path& path) {
+  const auto& key = path.string();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto e = find_path(*paths_.load(), key, hash_path(key));
+  if (e != nullptr) {
+    remove(*e);
+  }
+  reclaim();
+}
+
+void dentry_cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!entries_.empty()) {
+    remove(*entries_.back());
+  }
+  reclaim();
+}
+
+std::size_t dentry_cache::size() const { return size_.load(); }
+
+void dentry_cache::budget(memory_budget* budget) {
+  clear();
+  memory_budget* previous;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    previous = budget_;
+    budget_ = nullptr;
+  }
+  if (previous != nullptr) {
+    previous->remove(*this);
+  }
+  if (budget != nullptr) {
+    budget->add(*this);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = budget;
+}
+
+std::string dentry_cache::name() const { return "dentries"; }
+
+std::uint64_t dentry_cache::oldest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& e : entries_) {
+    if (e->children == 0) {
+      return e->stamp;
+    }
+  }
+  return no_items;
+}
+
+std::size_t dentry_cache::evict(std::uint64_t until, std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t dropped = 0;
+  std::size_t released = 0;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto& e = **it++;
+    if (e.children != 0) {
+      continue;  // leaves go first, so that their ancestors stay
+    }
+    if (dropped != 0 && (released >= bytes || e.stamp >= until)) {
+      break;
+    }
+    released += e.bytes;
+    remove(e);
+    ++dropped;
+  }
+  reclaim();
+  return dropped;
+}
+
+const dentry_cache::entry* dentry_cache::find_path(const table& paths,
+                                                   const std::string& path,
+                                                   std::uint64_t hash) const {
+  for (auto l = paths.buckets[hash & paths.mask].load(); l != nullptr;
+       l = l->next.load()) {
+    if (l->item->path_hash == hash && l->item->path == path) {
+      return l->item;
+    }
+  }
+  return nullptr;
+}
+
+const dentry_cache::entry* dentry_cache::find_child(const table& children,
+                                                    node_id parent,
+                                                    const string_view& name,
+                                                    std::uint64_t hash) const {
+  for (auto l = children.buckets[hash & children.mask].load(); l != nullptr;
+       l = l->next.load()) {
+    const auto& e = *l->item;
+    if (e.child_hash == hash && e.parent->node == parent &&
+        e.name() == name) {
+      return l->item;
+    }
+  }
+  return nullptr;
+}
+
+bool dentry_cache::usable(const entry& e) const {
+  auto invalidations = invalidations_.load();
+  if (!e.valid.load()) {
+    return false;
+  }
+  if (e.checked.load() == invalidations) {
+    return true;  // no directory with children died since the last check
+  }
+  for (auto p = e.parent.get(); p != nullptr; p = p->parent.get()) {
+    if (!p->valid.load()) {
+      return false;
+    }
+  }
+  e.checked.store(invalidations);
+  return true;
+}
+
+void dentry_cache::add(const std::shared_ptr<entry>& e) {
+  e->position = entries_.insert(entries_.end(), e);
+  attach(paths_, e.get(), e->path_hash);
+  if (e->parent) {
+    ++e->parent->children;
+    attach(children_, e.get(), e->child_hash);
+  }
+  ++size_;
+}
+
+void dentry_cache::remove(const entry& e) {
+  auto owned = *e.position;
+  owned->valid.store(false);
+  if (owned->children != 0) {
+    ++invalidations_;  // after marking, so that checks see it dead
+  }
+  detach(paths_, owned.get(), owned->path_hash);
+  if (owned->parent) {
+    --owned->parent->children;
+    detach(children_, owned.get(), owned->child_hash);
+  }
+  entries_.erase(owned->position);
+  --size_;
+  if (budget_ != nullptr) {
+    budget_->release(*this, owned->bytes);
+  }
+  retire(std::move(owned));
+}
+
+void dentry_cache::attach(std::atomic<table*>& tables, const entry* e,
+                          std::uint64_t hash) {
+  if (size_.load() > tables.load()->mask) {
+    grow(tables);
+  }
+  auto& bucket = tables.load()->buckets[hash & tables.load()->mask];
+  bucket.store(new link(e, bucket.load()));
+}
+
+void dentry_cache::detach(std::atomic<table*>& tables, const entry* e,
+                          std::uint64_t hash) {
+  auto& bucket = tables.load()->buckets[hash & tables.load()->mask];
+  link* previous = nullptr;
+  for (auto l = bucket.load(); l != nullptr; l = l->next.load()) {
+    if (l->item == e) {
+      // readers standing on l still find the rest of the chain through it
+      if (previous == nullptr) {
+        bucket.store(l->next.load());
+      } else {
+        previous->next.store(l->next.load());
+      }
+      retire(std::shared_ptr<link>(l));
+      return;
+    }
+    previous = l;
+  }
+}
+
+void dentry_cache::grow(std::atomic<table*>& tables) {
+  auto old = tables.load();
+  std::unique_ptr<table> fresh(new table((old->mask + 1) * 2));
+  for (std::size_t i = 0; i <= old->mask; ++i) {
+    for (auto l = old->buckets[i].load(); l != nullptr; l = l->next.load()) {
+      auto hash = &tables == &paths_ ? l->item->path_hash
+                                     : l->item->child_hash;
+      auto& bucket = fresh->buckets[hash & fresh->mask];
+      bucket.store(new link(l->item, bucket.load()));
+    }
+  }
+  tables.store(fresh.release());
+  for (std::size_t i = 0; i <= old->mask; ++i) {
+    for (auto l = old->buckets[i].load(); l != nullptr; l = l->next.load()) {
+      retire(std::shared_ptr<link>(l));  // next stays readable until freed
+    }
+  }
+  retire(std::shared_ptr<table>(old));
+}
+
+void dentry_cache::shrink() {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto& e = **it++;
+    if (!usable(e)) {
+      remove(e);  // beneath an invalidated directory
+    }
+  }
+  auto target = capacity_ - capacity_ / 4;
+  for (auto it = entries_.begin();
+       it != entries_.end() && size_.load() > target;) {
+    auto& e = **it++;
+    if (e.children == 0) {
+      remove(e);  // oldest leaves first, so that their ancestors stay
+    }
+  }
+}
+
+void dentry_cache::retire(std::shared_ptr<void> garbage) {
+  retired_.push_back({epoch_.load(), std::move(garbage)});
+}
+
+void dentry_cache::reclaim() {
+  if (retired_.empty()) {
+    return;
+  }
+  // the next epoch reuses the counters of the one before the current one
+  auto epoch = epoch_.load();
+  auto idle = true;
+  for (const auto& s : stripes_) {
+    idle = idle && s.readers[(epoch + 1) & 1u].load() == 0;
+  }
+  if (idle) {
+    epoch_.store(++epoch);
+  }
+  // readers that could have seen garbage retired in an epoch have all left
+  // once the epoch after it has ended
+  while (!retired_.empty() && retired_.front().epoch + 2 <= epoch) {
+    retired_.pop_front();
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,123 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/memory_budget.h>
+#include <boost/optional.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** Concurrent cache of the nodes that paths resolve to
+ *
+ * A backend that walks to a node one component at a time caches each step,
+ * after which a full path, or a name within a cached directory, resolves
+ * with a single hash lookup.  A path is only cached once its parent is, so
+ * the root is inserted first.
+ *
+ * Lookups take no lock and never wait: they follow atomic hash chains
+ * within an epoch, and memory unlinked by writers is only freed once every
+ * reader that could still see it has left.  Writers are serialized.
+ * Invalidating a directory takes constant time however much lies beneath
+ * it: its entry is marked dead, and descendants are checked against their
+ * ancestors on their next use and swept out once the cache is full.
+ *
+ * With a memory_budget the entries held are charged to it as well.  As
+ * lookups take no lock they leave no trace, so entries are stamped when
+ * inserted, and eviction drops the oldest entries without children. */
+class dentry_cache : public memory_consumer {
+ public:
+  using node_id = std::uint64_t;
+
+  explicit dentry_cache(std::size_t capacity = 1u << 16u);
+  ~dentry_cache() override;
+
+  dentry_cache(const dentry_cache&) = delete;
+  dentry_cache& operator=(const dentry_cache&) = delete;
+
+  /** Cache the node of an absolute path, replacing any entry for it
+   *
+   * @return false if the parent directory is not cached or the budget has
+   *         no room */
+  bool insert(const Path& path, node_id node);
+
+  /** Node of an absolute path */
+  boost::optional<node_id> find(const Path& path) const;
+
+  /** Node of a name in the directory with node parent */
+  boost::optional<node_id> find(node_id parent,
+                                const string_view& name) const;
+
+  /** Forget a path and everything beneath it, as after rename or remove */
+  void invalidate(const Path& path);
+
+  void clear();
+
+  /** Entries held, counting those beneath invalidated directories that are
+   * yet to be swept */
+  std::size_t size() const;
+
+  /** Charge entries to a budget from now on, or to none if null
+   *
+   * Entries already held are dropped. */
+  void budget(memory_budget* budget);
+
+  std::string name() const override;
+  std::uint64_t oldest() const override;
+  std::size_t evict(std::uint64_t until, std::size_t bytes) override;
+
+ private:
+  struct entry;
+  struct link;
+  struct table;
+  class reader;
+
+  /** Raw lookups, valid or not; readers must be inside an epoch */
+  const entry* find_path(const table& paths, const std::string& path,
+                         std::uint64_t hash) const;
+  const entry* find_child(const table& children, node_id parent,
+                          const string_view& name, std::uint64_t hash) const;
+  /** Whether an entry and all its ancestors are live */
+  bool usable(const entry& e) const;
+
+  void add(const std::shared_ptr<entry>& e);
+  void remove(const entry& e);
+  void attach(std::atomic<table*>& tables, const entry* e,
+              std::uint64_t hash);
+  void detach(std::atomic<table*>& tables, const entry* e,
+              std::uint64_t hash);
+  void grow(std::atomic<table*>& tables);
+  void shrink();
+  void retire(std::shared_ptr<void> garbage);
+  void reclaim();
+
+  struct stripe {
+    std::atomic<std::uint64_t> readers[2];  // by epoch parity
+    char padding[48];  // one cache line each
+  };
+  static const std::size_t stripes = 16;
+
+  struct retired {
+    std::uint64_t epoch;
+    std::shared_ptr<void> garbage;
+  };
+
+  mutable std::mutex mutex_;  // for writers
+  std::size_t capacity_;
+  memory_budget* budget_;
+  std::atomic<table*> paths_;
+  std::atomic<table*> children_;
+  std::atomic<std::size_t> size_;
+  std::atomic<std::uint64_t> invalidations_;  // of directories with children
+  std::atomic<std::uint64_t> epoch_;
+  mutable stripe stripes_[stripes];
+  std::list<std::shared_ptr<entry>> entries_;  // oldest first
+  std::deque<retired> retired_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -3,23 +3,133 @@
 namespace lockblox {
 namespace drivex {
 
+namespace {
+
+bool has_code(const error& e, error_code code) {
+  return e.code().value() == static_cast<int>(code);
+}
+
+}  // namespace
+
 directory_entry::directory_entry(const filesystem& filesystem, Path p)
     : filesystem_(&filesystem), p_(std::move(p)) {}
 
-void directory_entry::assign(const Path& p) { p_ = p; }
+directory_entry::directory_entry(const filesystem& filesystem, Path p,
+                                 file_status symlink_status)
+    : filesystem_(&filesystem),
+      p_(std::move(p)),
+      symlink_status_(symlink_status) {}
+
+directory_entry::directory_entry(const filesystem& filesystem, Path p,
+                                 file_status symlink_status,
+                                 std::uintmax_t file_size,
+                                 std::time_t last_write_time)
+    : filesystem_(&filesystem),
+      p_(std::move(p)),
+      symlink_status_(symlink_status),
+      file_size_(file_size),
+      last_write_time_(last_write_time) {}
+
+void directory_entry::assign(const Path& p) {
+  p_ = p;
+  clear_cache();
+}
 
 void directory_entry::replace_filename(const Path& p) {
   p_ = p_.parent_path() / p;
+  clear_cache();
+}
+
+void directory_entry::refresh() {
+  clear_cache();
+  symlink_status_ = filesystem_->symlink_status(p_);
+  if (symlink_status_->type() == file_type::symlink) {
+    try {
+      status_ = filesystem_->status(p_);
+    } catch (const error& e) {  // dangling or looping link
+      if (!has_code(e, error_code::no_such_file_or_directory) &&
+          !has_code(e, error_code::too_many_symbolic_link_levels)) {
+        throw;
+      }
+      status_ = file_status(file_type::not_found);
+    }
+  } else {
+    status_ = symlink_status_;
+  }
+  if (status_->type() == file_type::regular) {
+    file_size_ = filesystem_->file_size(p_);
+  }
+  if (status_->type() == file_type::not_found) {
+    return;
+  }
+  try {
+    last_write_time_ = filesystem_->last_write_time(p_);
+  } catch (const error& e) {
+    if (!has_code(e, error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+void directory_entry::clear_cache() noexcept {
+  symlink_status_ = boost::none;
+  status_ = boost::none;
+  file_size_ = boost::none;
+  last_write_time_ = boost::none;
 }
 
 const Path& directory_entry::path() const noexcept { return p_; }
 
 directory_entry::operator const Path&() const noexcept { return p_; }
 
-file_status directory_entry::status() const { return filesystem_->status(p_); }
+file_status directory_entry::status() const {
+  if (status_) {
+    return *status_;
+  }
+  if (symlink_status_ && symlink_status_->type() != file_type::symlink) {
+    return *symlink_status_;
+  }
+  return filesystem_->status(p_);
+}
 
 file_status directory_entry::symlink_status() const {
-  return filesystem_->symlink_status(p_);
+  return symlink_status_ ? *symlink_status_ : filesystem_->symlink_status(p_);
+}
+
+std::uintmax_t directory_entry::file_size() const {
+  return file_size_ ? *file_size_ : filesystem_->file_size(p_);
+}
+
+std::time_t directory_entry::last_write_time() const {
+  return last_write_time_ ? *last_write_time_
+                          : filesystem_->last_write_time(p_);
+}
+
+bool directory_entry::exists() const {
+  try {
+    return status().type() != file_type::not_found;
+  } catch (const error& e) {
+    if (!has_code(e, error_code::no_such_file_or_directory)) {
+      throw;
+    }
+  }
+  return false;
+}
+
+bool directory_entry::is_directory() const {
+  return status().type() == file_type::directory;
+}
+
+bool directory_entry::is_regular_file() const {
+  return status().type() == file_type::regular;
+}
+
+bool directory_entry::is_symlink() const {
+  return symlink_status().type() == file_type::symlink;
+}
+
+bool directory_entry::status_known() const noexcept {
+  return static_cast<bool>(symlink_status_);
 }
 
 bool directory_entry::operator<(const directory_entry& rhs) const noexcept {
@@ -1,9 +1,15 @@
 #pragma once
 #include <drivex/filesystem.h>
+#include <boost/optional.hpp>
 
 namespace lockblox {
 namespace drivex {
 
+/** A path within a filesystem together with any attributes already known
+ *
+ * Attributes supplied when the entry is constructed, typically by a backend's
+ * read_directory_entries, or fetched by refresh() are answered without calling
+ * back into the filesystem, as with std::filesystem::directory_entry. */
 class directory_entry {
  public: /** Constructors */
   directory_entry() = default;
@@ -11,6 +17,11 @@ class directory_entry {
 
   directory_entry(directory_entry&&) = default;
   directory_entry(const filesystem& filesystem, Path p);
+  directory_entry(const filesystem& filesystem, Path p,
+                  file_status symlink_status);
+  directory_entry(const filesystem& filesystem, Path p,
+                  file_status symlink_status, std::uintmax_t file_size,
+                  std::time_t last_write_time);
   ~directory_entry() = default;
 
  public: /** Modifiers */
@@ -20,11 +31,23 @@ class directory_entry {
   void assign(const Path& p);
   void replace_filename(const Path& p);
 
+  /** Fetch and cache the attributes of the entry */
+  void refresh();
+
  public: /** Accessors */
   const Path& path() const noexcept;
   operator const Path&() const noexcept;
   file_status status() const;
   file_status symlink_status() const;
+  std::uintmax_t file_size() const;
+  std::time_t last_write_time() const;
+  bool exists() const;
+  bool is_directory() const;
+  bool is_regular_file() const;
+  bool is_symlink() const;
+
+  /** Whether symlink_status() is answered without a filesystem call */
+  bool status_known() const noexcept;
 
  public: /** Operators */
   bool operator<(const directory_entry& rhs) const noexcept;
@@ -34,9 +57,16 @@ class directory_entry {
   bool operator>(const directory_entry& rhs) const noexcept;
   bool operator>=(const directory_entry& rhs) const noexcept;
 
+ private:
+  void clear_cache() noexcept;
+
  private: /** Data */
   const filesystem* filesystem_;
   Path p_;
+  boost::optional<file_status> symlink_status_;
+  boost::optional<file_status> status_;
+  boost::optional<std::uintmax_t> file_size_;
+  boost::optional<std::time_t> last_write_time_;
 };
 }  // namespace drivex
 }  // namespace lockblox
@@ -0,0 +1,248 @@
+#include <drivex/directory_index.h>
+#include <algorithm>
+#include <mutex>
+#include <random>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint32_t empty_slot = 0;
+const std::uint32_t removed_slot = 1;
+const std::size_t min_buckets = 16;
+
+std::uint64_t rotate(std::uint64_t x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+void sip_round(std::uint64_t v[4]) {
+  v[0] += v[1];
+  v[1] = rotate(v[1], 13) ^ v[0];
+  v[0] = rotate(v[0], 32);
+  v[2] += v[3];
+  v[3] = rotate(v[3], 16) ^ v[2];
+  v[0] += v[3];
+  v[3] = rotate(v[3], 21) ^ v[0];
+  v[2] += v[1];
+  v[1] = rotate(v[1], 17) ^ v[2];
+  v[2] = rotate(v[2], 32);
+}
+
+/** SipHash-2-4 of data under a 128-bit key */
+std::uint64_t siphash(const std::uint64_t key[2], const string_view& data) {
+  std::uint64_t v[4] = {key[0] ^ 0x736f6d6570736575ull,
+                        key[1] ^ 0x646f72616e646f6dull,
+                        key[0] ^ 0x6c7967656e657261ull,
+                        key[1] ^ 0x7465646279746573ull};
+  auto size = data.size();
+  auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+  auto end = bytes + (size & ~std::size_t{7});
+  for (; bytes != end; bytes += 8) {
+    std::uint64_t m = 0;
+    for (int i = 7; i >= 0; --i) {  // little-endian, whatever the host
+      m = (m << 8u) | bytes[i];
+    }
+    v[3] ^= m;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= m;
+  }
+  auto last = static_cast<std::uint64_t>(size) << 56u;
+  for (auto i = size & 7u; i > 0; --i) {
+    last |= static_cast<std::uint64_t>(bytes[i - 1]) << (8 * (i - 1));
+  }
+  v[3] ^= last;
+  sip_round(v);
+  sip_round(v);
+  v[0] ^= last;
+  v[2] ^= 0xff;
+  for (int i = 0; i < 4; ++i) {
+    sip_round(v);
+  }
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+std::uint64_t random_seed() {
+  static std::mutex mutex;
+  static std::mt19937_64 engine{std::random_device{}()};
+  std::lock_guard<std::mutex> lock(mutex);
+  return engine();
+}
+
+}  // namespace
+
+directory_index::directory_index()
+    : seed_{random_seed(), random_seed()},
+      slots_(min_buckets, empty_slot),
+      live_(0),
+      removed_slots_(0),
+      next_(0) {}
+
+bool directory_index::insert(const string_view& name, std::uint64_t value) {
+  auto hash = hash_name(name);
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  auto slot = probe(name, hash);
+  if (slots_[slot] != empty_slot) {
+    return false;
+  }
+  if ((live_ + removed_slots_ + 1) * 2 > slots_.size()) {
+    auto buckets = slots_.size();  // kept if only tombstones need clearing
+    while ((live_ + 1) * 4 > buckets) {
+      buckets *= 2;
+    }
+    rehash(buckets);
+    slot = probe(name, hash);
+  }
+  slots_[slot] = static_cast<std::uint32_t>(entries_.size() + 2);
+  entries_.push_back({hash, names_.size(),
+                      static_cast<std::uint32_t>(name.size()), true, ++next_,
+                      value});
+  names_.append(name.data(), name.size());
+  ++live_;
+  return true;
+}
+
+bool directory_index::assign(const string_view& name, std::uint64_t value) {
+  auto hash = hash_name(name);
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  auto slot = slots_[probe(name, hash)];
+  if (slot == empty_slot) {
+    return false;
+  }
+  entries_[slot - 2].value = value;
+  return true;
+}
+
+bool directory_index::erase(const string_view& name) {
+  auto hash = hash_name(name);
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  auto slot = probe(name, hash);
+  if (slots_[slot] == empty_slot) {
+    return false;
+  }
+  entries_[slots_[slot] - 2].live = false;
+  slots_[slot] = removed_slot;
+  ++removed_slots_;
+  --live_;
+  auto dead = entries_.size() - live_;
+  if (dead > live_ && dead >= min_buckets) {
+    compact();
+  }
+  return true;
+}
+
+boost::optional<std::uint64_t> directory_index::find(
+    const string_view& name) const {
+  auto hash = hash_name(name);
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  auto slot = slots_[probe(name, hash)];
+  if (slot == empty_slot) {
+    return boost::none;
+  }
+  return entries_[slot - 2].value;
+}
+
+bool directory_index::contains(const string_view& name) const {
+  return static_cast<bool>(find(name));
+}
+
+std::vector<directory_index::entry> directory_index::list(
+    cursor after, std::size_t limit) const {
+  std::vector<entry> result;
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  auto it = std::upper_bound(
+      entries_.begin(), entries_.end(), after,
+      [](cursor c, const slot_entry& e) { return c < e.position; });
+  for (; it != entries_.end() && result.size() < limit; ++it) {
+    if (it->live) {
+      auto n = name(*it);
+      result.push_back({std::string(n.data(), n.size()), it->value,
+                        it->position});
+    }
+  }
+  return result;
+}
+
+std::size_t directory_index::size() const {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return live_;
+}
+
+bool directory_index::empty() const { return size() == 0; }
+
+void directory_index::clear() {
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  names_.clear();
+  names_.shrink_to_fit();
+  entries_.clear();
+  entries_.shrink_to_fit();
+  slots_.assign(min_buckets, empty_slot);
+  live_ = 0;
+  removed_slots_ = 0;  // cursors keep counting up, so old ones stay valid
+}
+
+std::uint64_t directory_index::hash_name(const string_view& name) const {
+  return siphash(seed_, name);
+}
+
+std::size_t directory_index::probe(const string_view& name,
+                                   std::uint64_t hash) const {
+  auto mask = slots_.size() - 1;
+  for (auto slot = static_cast<std::size_t>(hash) & mask;;
+       slot = (slot + 1) & mask) {
+    auto value = slots_[slot];
+    if (value == empty_slot) {
+      return slot;
+    }
+    if (value != removed_slot) {
+      const auto& e = entries_[value - 2];
+      if (e.hash == hash && this->name(e) == name) {
+        return slot;
+      }
+    }
+  }
+}
+
+string_view directory_index::name(const slot_entry& entry) const {
+  return string_view(names_.data() + entry.offset, entry.length);
+}
+
+void directory_index::rehash(std::size_t buckets) {
+  slots_.assign(buckets, empty_slot);
+  removed_slots_ = 0;
+  auto mask = buckets - 1;
+  for (std::size_t i = 0; i < entries_.size(); ++i) {
+    if (!entries_[i].live) {
+      continue;
+    }
+    auto slot = static_cast<std::size_t>(entries_[i].hash) & mask;
+    while (slots_[slot] != empty_slot) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = static_cast<std::uint32_t>(i + 2);
+  }
+}
+
+void directory_index::compact() {
+  std::string names;
+  names.reserve(names_.size() / 2);
+  std::vector<slot_entry> entries;
+  entries.reserve(live_);
+  for (const auto& e : entries_) {
+    if (e.live) {
+      entries.push_back(e);
+      entries.back().offset = names.size();
+      names.append(names_.data() + e.offset, e.length);
+    }
+  }
+  names_.swap(names);
+  entries_.swap(entries);
+  auto buckets = min_buckets;
+  while (buckets < live_ * 4) {
+    buckets *= 2;
+  }
+  rehash(buckets);
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,87 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** The names of a directory, mapped to a value such as an inode number
+ *
+ * Built for directories of millions of entries: lookup hashes into an open
+ * addressed table, keyed with SipHash-2-4 under a random seed of each index
+ * so that names chosen to collide cannot degrade it to a linear scan,
+ * names are packed into one shared buffer rather than
+ * allocated one by one, and removal leaves a tombstone that is compacted
+ * away once tombstones outnumber the live entries.  Each entry is given a
+ * cursor larger than any before it, and listing resumes after a cursor, so
+ * an enumeration interrupted by inserts and removes returns every entry
+ * present throughout exactly once.  Readers share a lock; writers take it
+ * exclusively for amortized constant time. */
+class directory_index {
+ public:
+  /** Position in an enumeration; zero starts from the beginning */
+  using cursor = std::uint64_t;
+
+  struct entry {
+    std::string name;
+    std::uint64_t value;
+    cursor position;  // resume listing after this to continue
+  };
+
+  directory_index();
+
+  /** Add a name
+   *
+   * @return false, leaving the index unchanged, if it is present */
+  bool insert(const string_view& name, std::uint64_t value);
+
+  /** Change the value of a name, keeping its cursor
+   *
+   * @return false if it is absent */
+  bool assign(const string_view& name, std::uint64_t value);
+
+  /** @return false if the name was absent */
+  bool erase(const string_view& name);
+
+  boost::optional<std::uint64_t> find(const string_view& name) const;
+  bool contains(const string_view& name) const;
+
+  /** Up to limit entries after a cursor, in the order they were inserted */
+  std::vector<entry> list(cursor after, std::size_t limit) const;
+
+  std::size_t size() const;
+  bool empty() const;
+  void clear();
+
+ private:
+  struct slot_entry {
+    std::uint64_t hash;
+    std::uint64_t offset;  // of the name in names_
+    std::uint32_t length;
+    bool live;
+    cursor position;
+    std::uint64_t value;
+  };
+
+  std::uint64_t hash_name(const string_view& name) const;
+  /** Slot of the name's entry, or of the empty slot where it would go */
+  std::size_t probe(const string_view& name, std::uint64_t hash) const;
+  string_view name(const slot_entry& entry) const;
+  void rehash(std::size_t buckets);
+  void compact();
+
+  const std::uint64_t seed_[2];
+  mutable std::shared_timed_mutex mutex_;
+  std::string names_;
+  std::vector<slot_entry> entries_;  // by cursor, tombstones included
+  std::vector<std::uint32_t> slots_;  // entry index + 2, or empty or removed
+  std::size_t live_;
+  std::size_t removed_slots_;
+  cursor next_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,216 @@
+#include <drivex/directory_iterator.h>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+bool is_permission_denied(const error& e) {
+  return e.code().value() == static_cast<int>(error_code::permission_denied);
+}
+
+bool is_dot(const Path& name) { return name == "." || name == ".."; }
+
+}  // namespace
+
+directory_options operator|(directory_options lhs, directory_options rhs) {
+  return static_cast<directory_options>(static_cast<unsigned int>(lhs) |
+                                        static_cast<unsigned int>(rhs));
+}
+
+directory_options operator&(directory_options lhs, directory_options rhs) {
+  return static_cast<directory_options>(static_cast<unsigned int>(lhs) &
+                                        static_cast<unsigned int>(rhs));
+}
+
+struct directory_iterator::state {
+  std::vector<directory_entry> entries;
+  std::size_t index;
+};
+
+directory_iterator::directory_iterator(const filesystem& filesystem,
+                                       const Path& p,
+                                       directory_options options)
+    : state_(std::make_shared<state>()) {
+  state_->index = 0;
+  try {
+    state_->entries = filesystem.read_directory_entries(p);
+  } catch (const error& e) {
+    auto skip = (options & directory_options::skip_permission_denied) !=
+                directory_options::none;
+    if (!skip || !is_permission_denied(e)) {
+      throw;
+    }
+  }
+  load_entry();
+}
+
+void directory_iterator::load_entry() {
+  const auto& entries = state_->entries;
+  auto& index = state_->index;
+  while (index < entries.size() && is_dot(entries[index].path().filename())) {
+    ++index;
+  }
+  if (index == entries.size()) {
+    state_.reset();  // become the end iterator
+  }
+}
+
+directory_iterator::reference directory_iterator::operator*() const {
+  return state_->entries[state_->index];
+}
+
+directory_iterator::pointer directory_iterator::operator->() const {
+  return &state_->entries[state_->index];
+}
+
+directory_iterator& directory_iterator::operator++() { return increment(); }
+
+directory_iterator& directory_iterator::increment() {
+  ++state_->index;
+  load_entry();
+  return *this;
+}
+
+bool directory_iterator::operator==(const directory_iterator& rhs) const
+    noexcept {
+  return state_ == rhs.state_;
+}
+
+bool directory_iterator::operator!=(const directory_iterator& rhs) const
+    noexcept {
+  return state_ != rhs.state_;
+}
+
+directory_iterator begin(directory_iterator it) noexcept { return it; }
+
+directory_iterator end(const directory_iterator&) noexcept {
+  return directory_iterator();
+}
+
+struct recursive_directory_iterator::state {
+  const filesystem* source;
+  directory_options options;
+  std::vector<directory_iterator> stack;
+  bool recursion_pending;
+};
+
+recursive_directory_iterator::recursive_directory_iterator(
+    const filesystem& filesystem, const Path& p, directory_options options) {
+  auto top = directory_iterator(filesystem, p, options);
+  if (top != directory_iterator()) {
+    state_ = std::make_shared<state>();
+    state_->source = &filesystem;
+    state_->options = options;
+    state_->stack.push_back(std::move(top));
+    state_->recursion_pending = true;
+  }
+}
+
+recursive_directory_iterator::reference recursive_directory_iterator::
+operator*() const {
+  return *state_->stack.back();
+}
+
+recursive_directory_iterator::pointer recursive_directory_iterator::
+operator->() const {
+  return &*state_->stack.back();
+}
+
+directory_options recursive_directory_iterator::options() const {
+  return state_->options;
+}
+
+int recursive_directory_iterator::depth() const {
+  return static_cast<int>(state_->stack.size()) - 1;
+}
+
+bool recursive_directory_iterator::recursion_pending() const {
+  return state_->recursion_pending;
+}
+
+recursive_directory_iterator& recursive_directory_iterator::operator++() {
+  return increment();
+}
+
+recursive_directory_iterator& recursive_directory_iterator::increment() {
+  if (!(state_->recursion_pending && descend())) {
+    advance();
+  }
+  if (state_) {
+    state_->recursion_pending = true;
+  }
+  return *this;
+}
+
+void recursive_directory_iterator::pop() {
+  state_->stack.pop_back();
+  if (state_->stack.empty()) {
+    state_.reset();
+  } else {
+    advance();
+  }
+  if (state_) {
+    state_->recursion_pending = true;
+  }
+}
+
+void recursive_directory_iterator::disable_recursion_pending() {
+  state_->recursion_pending = false;
+}
+
+bool recursive_directory_iterator::descend() {
+  const auto& entry = **this;
+  auto status = entry.symlink_status();
+  auto follow =
+      (state_->options & directory_options::follow_directory_symlink) !=
+      directory_options::none;
+  if (follow && status.type() == file_type::symlink) {
+    try {
+      status = entry.status();
+    } catch (const error&) {  // dangling links are not directories
+      return false;
+    }
+  }
+  if (status.type() != file_type::directory) {
+    return false;
+  }
+  auto child =
+      directory_iterator(*state_->source, entry.path(), state_->options);
+  if (child == directory_iterator()) {
+    return false;
+  }
+  state_->stack.push_back(std::move(child));
+  return true;
+}
+
+void recursive_directory_iterator::advance() {
+  auto& stack = state_->stack;
+  while (!stack.empty()) {
+    if (++stack.back() != directory_iterator()) {
+      return;
+    }
+    stack.pop_back();
+  }
+  state_.reset();
+}
+
+bool recursive_directory_iterator::operator==(
+    const recursive_directory_iterator& rhs) const noexcept {
+  return state_ == rhs.state_;
+}
+
+bool recursive_directory_iterator::operator!=(
+    const recursive_directory_iterator& rhs) const noexcept {
+  return state_ != rhs.state_;
+}
+
+recursive_directory_iterator begin(recursive_directory_iterator it) noexcept {
+  return it;
+}
+
+recursive_directory_iterator end(const recursive_directory_iterator&) noexcept {
+  return recursive_directory_iterator();
+}
+}  // namespace drivex
+}  // namespace lockblox
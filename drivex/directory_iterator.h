@@ -0,0 +1,105 @@
+#pragma once
+#include <drivex/directory_entry.h>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+enum class directory_options : unsigned int {
+  none = 0,
+  follow_directory_symlink = 1, /**< Recurse into symlinked directories */
+  skip_permission_denied = 2    /**< Skip directories that cannot be read */
+};
+
+directory_options operator|(directory_options lhs, directory_options rhs);
+directory_options operator&(directory_options lhs, directory_options rhs);
+
+/** Iterate over the entries of one directory, skipping "." and ".."
+ *
+ * Copies of an iterator share their position, as with
+ * std::filesystem::directory_iterator */
+class directory_iterator {
+ public: /** Types */
+  using iterator_category = std::input_iterator_tag;
+  using value_type = directory_entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const directory_entry*;
+  using reference = const directory_entry&;
+
+ public: /** Constructors */
+  directory_iterator() noexcept = default;
+  directory_iterator(const filesystem& filesystem, const Path& p,
+                     directory_options options = directory_options::none);
+
+ public: /** Accessors */
+  reference operator*() const;
+  pointer operator->() const;
+
+ public: /** Modifiers */
+  directory_iterator& operator++();
+  directory_iterator& increment();
+
+ public: /** Operators */
+  bool operator==(const directory_iterator& rhs) const noexcept;
+  bool operator!=(const directory_iterator& rhs) const noexcept;
+
+ private: /** Data */
+  struct state;
+  void load_entry();
+  std::shared_ptr<state> state_;
+};
+
+directory_iterator begin(directory_iterator it) noexcept;
+directory_iterator end(const directory_iterator&) noexcept;
+
+/** Iterate depth-first over a directory tree */
+class recursive_directory_iterator {
+ public: /** Types */
+  using iterator_category = std::input_iterator_tag;
+  using value_type = directory_entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const directory_entry*;
+  using reference = const directory_entry&;
+
+ public: /** Constructors */
+  recursive_directory_iterator() noexcept = default;
+  recursive_directory_iterator(
+      const filesystem& filesystem, const Path& p,
+      directory_options options = directory_options::none);
+
+ public: /** Accessors */
+  reference operator*() const;
+  pointer operator->() const;
+  directory_options options() const;
+
+  /** Number of directories descended into from the starting directory */
+  int depth() const;
+  bool recursion_pending() const;
+
+ public: /** Modifiers */
+  recursive_directory_iterator& operator++();
+  recursive_directory_iterator& increment();
+
+  /** Move to the next entry of the parent directory */
+  void pop();
+
+  /** Do not descend into the current entry on the next increment */
+  void disable_recursion_pending();
+
+ public: /** Operators */
+  bool operator==(const recursive_directory_iterator& rhs) const noexcept;
+  bool operator!=(const recursive_directory_iterator& rhs) const noexcept;
+
+ private: /** Data */
+  struct state;
+  bool descend();
+  void advance();
+  std::shared_ptr<state> state_;
+};
+
+recursive_directory_iterator begin(recursive_directory_iterator it) noexcept;
+recursive_directory_iterator end(const recursive_directory_iterator&) noexcept;
+}  // namespace drivex
+}  // namespace lockblox
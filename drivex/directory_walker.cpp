@@ -0,0 +1,286 @@
+#include <drivex/directory_walker.h>
+#include <algorithm>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+/** Entries whose status is fetched by a single task */
+const std::size_t batch_size = 64;
+
+/** Symbolic links resolved in one path before giving up, as Linux does */
+const int max_symlink_depth = 40;
+
+/** Resolve every symbolic link in an absolute path, ala POSIX realpath */
+Path real_path(const filesystem& filesystem, const Path& path, int& links) {
+  auto output = Path("/");
+  for (const auto& part : path.relative_path()) {
+    if (part == "." || part.empty()) {
+      continue;
+    }
+    if (part == "..") {
+      output = filesystem::parent_path(output);
+      continue;
+    }
+    output /= part;
+    if (filesystem.symlink_status(output).type() == file_type::symlink) {
+      if (++links > max_symlink_depth) {
+        throw error(error_code::too_many_symbolic_link_levels, path.string());
+      }
+      auto target = filesystem.read_symlink(output);
+      output = real_path(filesystem,
+                         target.is_absolute()
+                             ? target
+                             : filesystem::parent_path(output) / target,
+                         links);
+    }
+  }
+  return output;
+}
+
+Path real_path(const filesystem& filesystem, const Path& path) {
+  auto links = 0;
+  return real_path(filesystem, filesystem.absolute(path), links);
+}
+}  // namespace
+
+parallel_directory_walker::parallel_directory_walker(
+    const filesystem& filesystem, const Path& root, thread_pool& pool,
+    directory_options options, std::size_t prefetch)
+    : filesystem_(filesystem),
+      pool_(pool),
+      options_(options),
+      capacity_(std::max<std::size_t>(prefetch, 1)),
+      queue_(std::make_shared<task_queue>()),
+      outstanding_(0),
+      cancelled_(false) {
+  auto follow = (options_ & directory_options::follow_directory_symlink) !=
+                directory_options::none;
+  spawn([this, root, follow]() {
+    auto ancestors = ancestry_ptr{};
+    if (follow) {
+      ancestors = std::make_shared<const ancestry>(
+          ancestry{real_path(filesystem_, root), nullptr});
+    }
+    read(root, ancestors);
+  });
+}
+
+parallel_directory_walker::~parallel_directory_walker() {
+  cancel();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (outstanding_ > 0) {
+    drain(lock);
+  }
+}
+
+bool parallel_directory_walker::next(directory_entry& entry) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (ready_.empty() && outstanding_ > 0 && !error_) {
+    drain(lock);
+  }
+  if (error_) {
+    auto error = error_;
+    error_ = nullptr;
+    lock.unlock();
+    cancel();
+    std::rethrow_exception(error);
+  }
+  if (ready_.empty()) {
+    return false;
+  }
+  entry = std::move(ready_.front());
+  ready_.pop_front();
+  auto resumed = std::vector<std::function<void()>>{};
+  while (!parked_.empty() && ready_.size() + resumed.size() < capacity_) {
+    resumed.push_back(std::move(parked_.front()));
+    parked_.pop_front();
+  }
+  lock.unlock();
+  for (auto& task : resumed) {
+    start(std::move(task));
+  }
+  return true;
+}
+
+void parallel_directory_walker::cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  ready_.clear();
+  outstanding_ -= parked_.size() + queue_->clear();
+  parked_.clear();
+  not_empty_.notify_all();
+}
+
+void parallel_directory_walker::spawn(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_) {
+      return;
+    }
+    ++outstanding_;
+  }
+  start(std::move(task));
+}
+
+void parallel_directory_walker::park(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_) {
+      return;
+    }
+    ++outstanding_;
+    if (ready_.size() >= capacity_) {
+      parked_.push_back(std::move(task));
+      return;
+    }
+  }
+  start(std::move(task));  // the consumer made room meanwhile
+}
+
+void parallel_directory_walker::start(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(queue_->mutex);
+    queue_->tasks.push_back([this, task]() { run(task); });
+  }
+  auto queue = queue_;
+  pool_.post([queue]() {
+    auto task = queue->take();  // unless the consumer got there first
+    if (task) {
+      task();
+    }
+  });
+  std::lock_guard<std::mutex> lock(mutex_);
+  not_empty_.notify_all();  // a consumer waiting in next() may run the task
+}
+
+void parallel_directory_walker::run(const std::function<void()>& task) {
+  auto failure = std::exception_ptr{};
+  try {
+    task();
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failure && !error_ && !cancelled_) {
+    error_ = failure;
+  }
+  --outstanding_;
+  not_empty_.notify_all();
+}
+
+void parallel_directory_walker::drain(std::unique_lock<std::mutex>& lock) {
+  auto task = queue_->take();
+  if (!task) {  // the rest are running; each start and completion wakes us
+    not_empty_.wait(lock);
+    return;
+  }
+  lock.unlock();
+  task();
+  lock.lock();
+}
+
+std::function<void()> parallel_directory_walker::task_queue::take() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (tasks.empty()) {
+    return nullptr;
+  }
+  auto task = std::move(tasks.front());
+  tasks.pop_front();
+  return task;
+}
+
+std::size_t parallel_directory_walker::task_queue::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto count = tasks.size();
+  tasks.clear();
+  return count;
+}
+
+void parallel_directory_walker::read(const Path& directory,
+                                     ancestry_ptr ancestors) {
+  auto entries = std::make_shared<std::vector<directory_entry>>();
+  try {
+    *entries = filesystem_.read_directory_entries(directory);
+  } catch (const error& e) {
+    auto skip = (options_ & directory_options::skip_permission_denied) !=
+                directory_options::none;
+    if (!skip || e.code().value() !=
+                     static_cast<int>(error_code::permission_denied)) {
+      throw;
+    }
+  }
+  for (std::size_t first = 0; first < entries->size(); first += batch_size) {
+    auto last = std::min(first + batch_size, entries->size());
+    spawn([this, entries, first, last, ancestors]() {
+      visit(entries, first, last, ancestors);
+    });
+  }
+}
+
+void parallel_directory_walker::visit(
+    std::shared_ptr<std::vector<directory_entry>> entries, std::size_t first,
+    std::size_t last, ancestry_ptr ancestors) {
+  auto follow = (options_ & directory_options::follow_directory_symlink) !=
+                directory_options::none;
+  for (auto i = first; i < last; ++i) {
+    auto& entry = (*entries)[i];
+    auto name = entry.path().filename();
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (!entry.status_known()) {
+      entry = directory_entry(filesystem_, entry.path(),
+                              filesystem_.symlink_status(entry.path()));
+    }
+    auto target = entry.symlink_status();
+    if (follow && target.type() == file_type::symlink) {
+      try {
+        target = entry.status();
+      } catch (const error&) {  // dangling links are not directories
+      }
+    }
+    if (target.type() == file_type::directory) {
+      auto p = entry.path();
+      auto below = follow ? descend(entry, ancestors) : nullptr;
+      if (!follow || below) {
+        spawn([this, p, below]() { read(p, below); });
+      }
+    }
+    if (!push(std::move(entry))) {
+      if (i + 1 < last) {
+        park([this, entries, i, last, ancestors]() {
+          visit(entries, i + 1, last, ancestors);
+        });
+      }
+      return;
+    }
+  }
+}
+
+parallel_directory_walker::ancestry_ptr parallel_directory_walker::descend(
+    const directory_entry& entry, const ancestry_ptr& ancestors) const {
+  auto location = ancestors->real_path / entry.path().filename();
+  if (entry.symlink_status().type() == file_type::symlink) {
+    location = real_path(filesystem_, location);
+  }
+  for (auto a = ancestors.get(); a != nullptr; a = a->parent.get()) {
+    if (a->real_path == location) {
+      return nullptr;  // entering it again would never end
+    }
+  }
+  return std::make_shared<const ancestry>(ancestry{location, ancestors});
+}
+
+bool parallel_directory_walker::push(directory_entry entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cancelled_) {
+    return false;
+  }
+  ready_.push_back(std::move(entry));
+  not_empty_.notify_all();
+  return ready_.size() < capacity_;
+}
+}  // namespace drivex
+}  // namespace lockblox
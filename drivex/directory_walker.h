@@ -0,0 +1,95 @@
+#pragma once
+#include <drivex/directory_iterator.h>
+#include <drivex/thread_pool.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+
+namespace lockblox {
+namespace drivex {
+
+/** Walk a directory tree on a thread pool
+ *
+ * Directory reads are fanned out across the pool and, unless the backend's
+ * read_directory_entries already supplied it, the symlink_status of each
+ * entry is fetched by the workers and cached in the entry before it is handed
+ * to the consumer, so next() seldom waits on the backend.  About `prefetch`
+ * entries are buffered ahead of the consumer; a worker that finds the buffer
+ * full parks the rest of its batch and returns to the pool rather than
+ * blocking, and next() resumes parked batches as it drains the buffer.  While
+ * nothing is ready next() runs the walker's own queued tasks, never unrelated
+ * pool work, so the consumer may itself run on the pool.  Entries arrive in
+ * no particular order.
+ *
+ * With follow_directory_symlink, a directory is not entered again below
+ * itself: a link to one of the directories the walk came through is reported
+ * but not followed, as find -L does.  The filesystem must tolerate concurrent
+ * calls. */
+class parallel_directory_walker {
+ public:
+  parallel_directory_walker(const filesystem& filesystem, const Path& root,
+                            thread_pool& pool,
+                            directory_options options = directory_options::none,
+                            std::size_t prefetch = 1024);
+  parallel_directory_walker(const parallel_directory_walker&) = delete;
+  parallel_directory_walker& operator=(const parallel_directory_walker&) =
+      delete;
+  ~parallel_directory_walker();
+
+  /** Take the next entry, with its symlink status already cached
+   *
+   * @return false once the whole tree has been visited
+   * @throws the first error raised while walking */
+  bool next(directory_entry& entry);
+
+  /** Stop walking; entries already buffered are discarded */
+  void cancel();
+
+ private:
+  /** Resolved location of a directory and of those the walk came through */
+  struct ancestry {
+    Path real_path;
+    std::shared_ptr<const ancestry> parent;
+  };
+  using ancestry_ptr = std::shared_ptr<const ancestry>;
+
+  /** Tasks started but not yet taken by a pool thread or the consumer
+   *
+   * Shared with the pool tasks that drain it, which may outlive the walker
+   * once it has been emptied. */
+  struct task_queue {
+    std::function<void()> take();
+    std::size_t clear();
+
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void spawn(std::function<void()> task);
+  void park(std::function<void()> task);
+  void start(std::function<void()> task);
+  void run(const std::function<void()>& task);
+  void drain(std::unique_lock<std::mutex>& lock);
+  void read(const Path& directory, ancestry_ptr ancestors);
+  void visit(std::shared_ptr<std::vector<directory_entry>> entries,
+             std::size_t first, std::size_t last, ancestry_ptr ancestors);
+  ancestry_ptr descend(const directory_entry& entry,
+                       const ancestry_ptr& ancestors) const;
+  bool push(directory_entry entry);
+
+  const filesystem& filesystem_;
+  thread_pool& pool_;
+  const directory_options options_;
+  const std::size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<directory_entry> ready_;
+  std::deque<std::function<void()>> parked_;
+  std::shared_ptr<task_queue> queue_;
+  std::size_t outstanding_;
+  bool cancelled_;
+  std::exception_ptr error_;
+};
+}  // namespace drivex
+}  // namespace lockblox
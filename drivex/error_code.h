@@ -5,16 +5,28 @@ namespace lockblox {
 namespace drivex {
 
 enum class error_code {
+  cross_device_link = boost::system::errc::cross_device_link,
   directory_not_empty = boost::system::errc::directory_not_empty,
   file_exists = boost::system::errc::file_exists,
   file_too_large = boost::system::errc::file_too_large,
   filename_too_long = boost::system::errc::filename_too_long,
   function_not_supported = boost::system::errc::function_not_supported,
+  interrupted = boost::system::errc::interrupted,
+  invalid_argument = boost::system::errc::invalid_argument,
   io_error = boost::system::errc::io_error,
+  no_message_available = boost::system::errc::no_message_available,  // ENOATTR
   no_such_file_or_directory = boost::system::errc::no_such_file_or_directory,
   not_a_directory = boost::system::errc::not_a_directory,
   is_a_directory = boost::system::errc::is_a_directory,
-  permission_denied = boost::system::errc::permission_denied
+  permission_denied = boost::system::errc::permission_denied,
+  read_only_file_system = boost::system::errc::read_only_file_system,
+  resource_deadlock_would_occur =
+      boost::system::errc::resource_deadlock_would_occur,
+  resource_unavailable_try_again =
+      boost::system::errc::resource_unavailable_try_again,
+  result_out_of_range = boost::system::errc::result_out_of_range,
+  too_many_symbolic_link_levels =
+      boost::system::errc::too_many_symbolic_link_levels
 };
 }  // namespace drivex
 }  // namespace lockblox
@@ -0,0 +1,130 @@
+#include <drivex/extent_map.h>
+#include <algorithm>
+
+namespace lockblox {
+namespace drivex {
+
+void extent_map::insert(std::uint64_t offset, std::uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+  auto start = offset;
+  auto stop = offset + length;
+  auto it = extents_.upper_bound(start);
+  if (it != extents_.begin() && std::prev(it)->second >= start) {
+    --it;  // touches the range from the left
+  }
+  while (it != extents_.end() && it->first <= stop) {
+    start = std::min(start, it->first);
+    stop = std::max(stop, it->second);
+    allocated_ -= it->second - it->first;
+    it = extents_.erase(it);
+  }
+  extents_.emplace_hint(it, start, stop);
+  allocated_ += stop - start;
+}
+
+void extent_map::erase(std::uint64_t offset, std::uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+  auto stop = offset + length;
+  auto it = extents_.upper_bound(offset);
+  if (it != extents_.begin() && std::prev(it)->second > offset) {
+    --it;
+  }
+  while (it != extents_.end() && it->first < stop) {
+    auto first = it->first;
+    auto last = it->second;
+    allocated_ -= last - first;
+    it = extents_.erase(it);
+    if (first < offset) {  // keep the part before the hole
+      extents_.emplace_hint(it, first, offset);
+      allocated_ += offset - first;
+    }
+    if (last > stop) {  // and the part after it
+      it = extents_.emplace_hint(it, stop, last);
+      allocated_ += last - stop;
+      break;
+    }
+  }
+}
+
+void extent_map::truncate(std::uint64_t size) {
+  auto it = extents_.lower_bound(size);
+  for (auto rest = it; rest != extents_.end(); ++rest) {
+    allocated_ -= rest->second - rest->first;
+  }
+  extents_.erase(it, extents_.end());
+  if (!extents_.empty() && extents_.rbegin()->second > size) {
+    allocated_ -= extents_.rbegin()->second - size;
+    extents_.rbegin()->second = size;
+  }
+}
+
+void extent_map::clear() noexcept {
+  extents_.clear();
+  allocated_ = 0;
+}
+
+bool extent_map::contains(std::uint64_t offset) const {
+  return find(offset) != extents_.end();
+}
+
+std::vector<extent_map::extent> extent_map::overlapping(
+    std::uint64_t offset, std::uint64_t length) const {
+  std::vector<extent> result;
+  auto stop = offset + length;
+  auto it = extents_.upper_bound(offset);
+  if (it != extents_.begin() && std::prev(it)->second > offset) {
+    --it;
+  }
+  for (; it != extents_.end() && it->first < stop; ++it) {
+    auto first = std::max(it->first, offset);
+    auto last = std::min(it->second, stop);
+    result.push_back(extent{first, last - first});
+  }
+  return result;
+}
+
+boost::optional<std::uint64_t> extent_map::next_data(
+    std::uint64_t offset) const {
+  auto found = find(offset);
+  if (found != extents_.end()) {
+    return offset;
+  }
+  auto next = extents_.upper_bound(offset);
+  if (next == extents_.end()) {
+    return boost::none;
+  }
+  return next->first;
+}
+
+std::uint64_t extent_map::next_hole(std::uint64_t offset) const {
+  auto found = find(offset);
+  return found == extents_.end() ? offset : found->second;
+}
+
+std::uint64_t extent_map::allocated() const noexcept { return allocated_; }
+
+std::size_t extent_map::size() const noexcept { return extents_.size(); }
+
+bool extent_map::empty() const noexcept { return extents_.empty(); }
+
+extent_map::const_iterator extent_map::begin() const noexcept {
+  return extents_.begin();
+}
+
+extent_map::const_iterator extent_map::end() const noexcept {
+  return extents_.end();
+}
+
+extent_map::const_iterator extent_map::find(std::uint64_t offset) const {
+  auto it = extents_.upper_bound(offset);
+  if (it == extents_.begin() || std::prev(it)->second <= offset) {
+    return extents_.end();
+  }
+  return std::prev(it);
+}
+}  // namespace drivex
+}  // namespace lockblox
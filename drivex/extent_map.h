@@ -0,0 +1,69 @@
+#pragma once
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** The allocated ranges of a sparse file
+ *
+ * Ranges are kept ordered and coalesced, so adjacent or overlapping
+ * allocations merge into one extent and a lookup is a single O(log n)
+ * search.  Everything outside an extent is a hole.  Not synchronized. */
+class extent_map {
+ public:
+  struct extent {
+    std::uint64_t offset;
+    std::uint64_t length;
+
+    std::uint64_t end() const noexcept { return offset + length; }
+  };
+
+  /** Extents by offset, mapped to their end */
+  using const_iterator = std::map<std::uint64_t, std::uint64_t>::const_iterator;
+
+  /** Mark a range allocated */
+  void insert(std::uint64_t offset, std::uint64_t length);
+
+  /** Make a range a hole, splitting the extents it cuts through */
+  void erase(std::uint64_t offset, std::uint64_t length);
+
+  /** Make everything from size on a hole */
+  void truncate(std::uint64_t size);
+
+  void clear() noexcept;
+
+  /** Whether the byte at offset is allocated */
+  bool contains(std::uint64_t offset) const;
+
+  /** The allocated parts of a range, in order */
+  std::vector<extent> overlapping(std::uint64_t offset,
+                                  std::uint64_t length) const;
+
+  /** First allocated offset at or after offset, as SEEK_DATA finds */
+  boost::optional<std::uint64_t> next_data(std::uint64_t offset) const;
+
+  /** First hole offset at or after offset, as SEEK_HOLE finds */
+  std::uint64_t next_hole(std::uint64_t offset) const;
+
+  /** Total length of all extents */
+  std::uint64_t allocated() const noexcept;
+
+  /** Number of extents */
+  std::size_t size() const noexcept;
+  bool empty() const noexcept;
+
+  const_iterator begin() const noexcept;
+  const_iterator end() const noexcept;
+
+ private:
+  /** The extent containing offset, or end() */
+  const_iterator find(std::uint64_t offset) const;
+
+  std::map<std::uint64_t, std::uint64_t> extents_;
+  std::uint64_t allocated_ = 0;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+enum class lock_type { read, write, unlock };
+
+/** A byte-range lock, the drivex counterpart of struct flock
+ *
+ * The range always starts at an absolute offset; a length of zero extends it
+ * to the end of the file, however large that becomes. */
+struct file_lock {
+  lock_type type = lock_type::unlock;
+  std::uint64_t start = 0;
+  std::uint64_t length = 0;
+  std::int64_t pid = 0;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -1,4 +1,8 @@
+#include <drivex/copy.h>
+#include <drivex/directory_entry.h>
+#include <drivex/lock_manager.h>
 #include <drivex/filesystem.h>
+#include <algorithm>
 #include <system_error>
 
 namespace errc = boost::system::errc;
@@ -63,22 +67,19 @@ void filesystem::current_path(const Path& p) {  // POSIX chdir
   current_path_ = next_path;
 }
 
-// TODO default implementation
 void filesystem::copy(const Path& from, const Path& to, CopyOptions options) {
-  (void)from;
-  (void)to;
-  (void)options;
-  unsupported();
+  drivex::copy(*this, from, *this, to, options);
 }
 
-/* TODO default implementation, read symlink create another symlink with same
- */
 void filesystem::copy_symlink(const Path& from, const Path& to,
                               CopyOptions options) {
+  drivex::copy_symlink(*this, from, *this, to, options);
+}
+
+bool filesystem::clone_file(const Path& from, const Path& to) {
   (void)from;
   (void)to;
-  (void)options;
-  unsupported();
+  return false;
 }
 
 bool filesystem::is_empty(const drivex::Path& p) const {
@@ -97,6 +98,12 @@ std::uintmax_t filesystem::file_size(const Path& path) const {
   return 0;
 }
 
+space_info filesystem::space(const Path& path) const {
+  (void)path;
+  unsupported();
+  return space_info{};
+}
+
 file_status filesystem::status(const Path& path) const {
   (void)path;
   unsupported();
@@ -122,6 +129,12 @@ void filesystem::create_directory(const Path& path) {
   unsupported();
 }
 
+void filesystem::create_directory(const Path& path,
+                                  drivex::permissions permissions) {
+  create_directory(path);
+  this->permissions(path, permissions);
+}
+
 void filesystem::create_directories(const Path& p) {
   auto fullpath = Path();
   for (auto& dir : p) {
@@ -194,6 +207,45 @@ void filesystem::open(const Path& path, int flags) {
   unsupported();
 }
 
+open_handle filesystem::open_file(const Path& path, int flags) {
+  open(path, flags);
+  return no_open_handle;
+}
+
+open_handle filesystem::create(const Path& path,
+                               drivex::permissions permissions, int flags) {
+  create_file(path, permissions);
+  try {
+    open(path, flags);
+  } catch (const error& e) {
+    if (e.code().value() !=
+        static_cast<int>(error_code::function_not_supported)) {
+      throw;
+    }
+  }
+  return no_open_handle;
+}
+
+void filesystem::set_attributes(const Path& path,
+                                const attribute_update& update) {
+  if (update.permissions) {
+    permissions(path, *update.permissions);
+  }
+  if (update.user_id || update.group_id) {  // -1 leaves an id unchanged
+    chown(path, update.user_id.value_or(static_cast<uint32_t>(-1)),
+          update.group_id.value_or(static_cast<uint32_t>(-1)));
+  }
+  if (update.size) {
+    truncate(path, *update.size);
+  }
+  if (update.last_read_time) {
+    last_read_time(path, to_time_t(*update.last_read_time));
+  }
+  if (update.last_write_time) {
+    last_write_time(path, to_time_t(*update.last_write_time));
+  }
+}
+
 int filesystem::read(const Path& path, string_view& buffer,
                      uint64_t offset) const {
   (void)path;
@@ -203,6 +255,12 @@ int filesystem::read(const Path& path, string_view& buffer,
   return 0;
 }
 
+int filesystem::read(const Path& path, open_handle handle,
+                     string_view& buffer, uint64_t offset) const {
+  (void)handle;
+  return read(path, buffer, offset);
+}
+
 int filesystem::write(const Path& path, const string_view& buffer,
                       uint64_t offset) {
   (void)path;
@@ -212,6 +270,12 @@ int filesystem::write(const Path& path, const string_view& buffer,
   return 0;
 }
 
+int filesystem::write(const Path& path, open_handle handle,
+                      const string_view& buffer, uint64_t offset) {
+  (void)handle;
+  return write(path, buffer, offset);
+}
+
 bool filesystem::exists(const drivex::Path& p) const {
   return exists(status(p));
 }
@@ -225,12 +289,22 @@ void filesystem::flush(const Path& path) {
   unsupported();
 }
 
+void filesystem::flush(const Path& path, open_handle handle) {
+  (void)handle;
+  flush(path);
+}
+
 void filesystem::release(const Path& path, int flags) {
   (void)path;
   (void)flags;
   unsupported();
 }
 
+void filesystem::release(const Path& path, open_handle handle, int flags) {
+  (void)handle;
+  release(path, flags);
+}
+
 void filesystem::fsync(const Path& path, int fd) {
   (void)path;
   (void)fd;
@@ -254,12 +328,51 @@ std::pair<std::string, string_view> filesystem::getxattr(
   return std::pair<std::string, string_view>{};
 }
 
+std::size_t filesystem::getxattr(const Path& path, const std::string& name,
+                                 string_view& buffer) {
+  auto value = getxattr(path, name).second;
+  if (!buffer.empty()) {
+    if (buffer.size() < value.size()) {
+      throw error(drivex::error_code::result_out_of_range);
+    }
+    std::copy(value.begin(), value.end(), const_cast<char*>(buffer.data()));
+  }
+  return value.size();
+}
+
+xattr_map filesystem::getxattrs(const Path& path) {
+  auto attributes = xattr_map{};
+  for (const auto& name : listxattr(path)) {
+    attributes.emplace(name, getxattr(path, name).second.to_string());
+  }
+  return attributes;
+}
+
 std::vector<std::string> filesystem::listxattr(const Path& path) {
   (void)path;
   unsupported();
   return std::vector<std::string>{};
 }
 
+std::size_t filesystem::listxattr(const Path& path, string_view& buffer) {
+  auto names = listxattr(path);
+  std::size_t length = 0;
+  for (const auto& name : names) {
+    length += name.size() + 1;
+  }
+  if (!buffer.empty()) {
+    if (buffer.size() < length) {
+      throw error(drivex::error_code::result_out_of_range);
+    }
+    auto output = const_cast<char*>(buffer.data());
+    for (const auto& name : names) {
+      output = std::copy(name.begin(), name.end(), output);
+      *output++ = '\0';
+    }
+  }
+  return length;
+}
+
 void filesystem::removexattr(const Path& path, const std::string& name) {
   (void)path;
   (void)name;
@@ -272,6 +385,17 @@ std::vector<Path> filesystem::read_directory(const Path& path) const {
   return std::vector<Path>{};
 }
 
+std::vector<directory_entry> filesystem::read_directory_entries(
+    const Path& path) const {
+  auto names = read_directory(path);
+  auto entries = std::vector<directory_entry>{};
+  entries.reserve(names.size());
+  for (auto& name : names) {
+    entries.emplace_back(*this, path / name);
+  }
+  return entries;
+}
+
 void filesystem::fsyncdir(const Path& path, int datasync) {
   (void)path;
   (void)datasync;
@@ -290,12 +414,31 @@ void filesystem::create_file(const Path& path) {
   unsupported();
 }
 
-void filesystem::lock(const Path& path, int command) {
-  (void)path;
-  (void)command;
-  unsupported();
+void filesystem::create_file(const Path& path,
+                             drivex::permissions permissions) {
+  create_file(path);
+  this->permissions(path, permissions);
+}
+
+void filesystem::lock(const Path& path, int command, file_lock& lock,
+                      std::uint64_t owner) {
+  auto manager = locks();
+  if (manager == nullptr) {
+    unsupported();
+  }
+  manager->lock(path, command, lock, owner);
+}
+
+void filesystem::flock(const Path& path, int operation, std::uint64_t owner) {
+  auto manager = locks();
+  if (manager == nullptr) {
+    unsupported();
+  }
+  manager->flock(path, operation, owner);
 }
 
+lock_manager* filesystem::locks() { return nullptr; }
+
 std::time_t filesystem::last_read_time(const Path& path) {
   (void)path;
   unsupported();
@@ -320,6 +463,29 @@ void filesystem::last_write_time(const Path& path, std::time_t new_time) {
   unsupported();
 }
 
+file_times filesystem::times(const Path& path) {
+  auto result = file_times();
+  auto supported = [](const error& e) {
+    return e.code().value() !=
+           static_cast<int>(error_code::function_not_supported);
+  };
+  try {
+    result.last_read_time = from_time_t(last_read_time(path));
+  } catch (const error& e) {
+    if (supported(e)) {
+      throw;
+    }
+  }
+  try {
+    result.last_write_time = from_time_t(last_write_time(path));
+  } catch (const error& e) {
+    if (supported(e)) {
+      throw;
+    }
+  }
+  return result;
+}
+
 uint64_t filesystem::bmap(const Path& path, size_t blocksize) {
   (void)path;
   (void)blocksize;
@@ -2,9 +2,12 @@
 
 #include <drivex/Error.h>
 #include <drivex/Permissions.h>
+#include <drivex/attribute_update.h>
+#include <drivex/file_lock.h>
 #include <drivex/file_status.h>
 #include <boost/filesystem.hpp>
 #include <boost/utility/string_ref.hpp>
+#include <map>
 
 namespace lockblox {
 namespace drivex {
@@ -13,6 +16,22 @@ using Path = boost::filesystem::path;
 using string_view = boost::string_ref;
 using boost::filesystem::is_directory;
 using CopyOptions = boost::filesystem::copy_option;
+using xattr_map = std::map<std::string, std::string>;
+using space_info = boost::filesystem::space_info;
+
+/** Backend-defined identifier of an open file, passed back on each access
+ *
+ * Backends that do not track open files use no_open_handle. */
+using open_handle = std::uint64_t;
+const open_handle no_open_handle = 0;
+
+/** fallocate mode flags, with the values of Linux's FALLOC_FL_* */
+const int fallocate_keep_size = 0x01;
+const int fallocate_punch_hole = 0x02;
+const int fallocate_zero_range = 0x10;
+
+class directory_entry;
+class lock_manager;
 
 class filesystem {
  public:
@@ -39,16 +58,31 @@ class filesystem {
   /** Get the size of a file */
   virtual std::uintmax_t file_size(const Path& path) const;
 
+  /** Get the capacity, free and available bytes of the filesystem holding
+   * a path, ala boost::filesystem::space */
+  virtual space_info space(const Path& path) const;
+
   /** Get file attributes, following symlinks */
   virtual file_status status(const Path& path) const;
 
-  /** Copy a file or directory */
+  /** Copy a file or directory tree
+   *
+   * The default implementation is a parallel drivex::copy within this
+   * filesystem */
   virtual void copy(const Path& from, const Path& to, CopyOptions options);
 
   /** Copy a symbolic link */
   virtual void copy_symlink(const Path& from, const Path& to,
                             CopyOptions options);
 
+  /** Server-side copy of a regular file's contents
+   *
+   * Backends that can clone, reflink or otherwise copy data without
+   * transferring it through drivex should create the file at `to` and return
+   * true.  The destination does not exist when this is called.  The default
+   * implementation returns false and the data is copied chunk by chunk. */
+  virtual bool clone_file(const Path& from, const Path& to);
+
   bool status_known(file_status s) const noexcept;
 
   /** Get file attributes without following symlinks */
@@ -60,6 +94,13 @@ class filesystem {
   /** Create a directory */
   virtual void create_directory(const Path& path);
 
+  /** Create a directory with the given permissions in one operation
+   *
+   * The default implementation calls create_directory and then
+   * permissions. */
+  virtual void create_directory(const Path& path,
+                                drivex::permissions permissions);
+
   /** Create all directories in the given path */
   virtual void create_directories(const Path& p);
 
@@ -106,11 +147,35 @@ class filesystem {
   /** Change the size of a file */
   virtual void truncate(const Path& path, uint64_t offset);
 
+  /** Apply several attribute changes in one operation
+   *
+   * Backends that can update mode, ownership, size and nanosecond times
+   * together should override this.  The default implementation applies
+   * each present attribute with permissions, chown, truncate,
+   * last_read_time and last_write_time in turn, rounding times down to
+   * seconds. */
+  virtual void set_attributes(const Path& path, const attribute_update& update);
+
   /** Path open operation
    *
    * Implementation should check if open is permitted for the given flags */
   virtual void open(const Path& path, int flags);
 
+  /** Open an existing file and return a handle to it
+   *
+   * The handle is used like one returned by create.  The default
+   * implementation calls open and returns no_open_handle. */
+  virtual open_handle open_file(const Path& path, int flags);
+
+  /** Create a file with the given permissions and open it in one operation
+   *
+   * The returned handle is passed to the handle-taking read, write, flush
+   * and release overloads for as long as the file stays open.  The default
+   * implementation calls create_file and then open, tolerating backends
+   * that do not support open, and returns no_open_handle. */
+  virtual open_handle create(const Path& path,
+                             drivex::permissions permissions, int flags);
+
   /** Read data from an open file
    *
    * Read should return exactly the number of bytes requested except
@@ -119,6 +184,12 @@ class filesystem {
   virtual int read(const Path& path, string_view& buffer,
                    uint64_t offset) const;
 
+  /** Read data from a file opened by create or open_file
+   *
+   * The default implementation ignores the handle and calls read. */
+  virtual int read(const Path& path, open_handle handle, string_view& buffer,
+                   uint64_t offset) const;
+
   /** Write data to an open file
    *
    * Write should return exactly the number of bytes requested
@@ -126,6 +197,12 @@ class filesystem {
   virtual int write(const Path& path, const string_view& buffer,
                     uint64_t offset);
 
+  /** Write data to a file opened by create or open_file
+   *
+   * The default implementation ignores the handle and calls write. */
+  virtual int write(const Path& path, open_handle handle,
+                    const string_view& buffer, uint64_t offset);
+
   /** Possibly flush cached data
    *
    * BIG NOTE: This is not equivalent to fsync().  It's not a
@@ -149,6 +226,9 @@ class filesystem {
    */
   virtual void flush(const Path& path);
 
+  /** Possibly flush cached data of a file opened with a handle */
+  virtual void flush(const Path& path, open_handle handle);
+
   /** Release an open file
    *
    * Release is called when there are no more references to an open
@@ -163,6 +243,9 @@ class filesystem {
    */
   virtual void release(const Path& path, int flags);
 
+  /** Release a file opened with a handle, invalidating the handle */
+  virtual void release(const Path& path, open_handle handle, int flags);
+
   /** Synchronize file contents
    *
    * If the datasync parameter is non-zero, then only the user data
@@ -187,15 +270,50 @@ class filesystem {
   virtual std::pair<std::string, string_view> getxattr(const Path& path,
                                                        const std::string& name);
 
+  /** Get an extended attribute value into a caller supplied buffer
+   *
+   * An empty buffer asks only for the size of the value, which should be
+   * answered without materializing it where possible.  The default
+   * implementation is built on the pair-returning getxattr.
+   *
+   * @return the size of the value
+   * @throws error(result_out_of_range) if the buffer is too small */
+  virtual std::size_t getxattr(const Path& path, const std::string& name,
+                               string_view& buffer);
+
+  /** Get every extended attribute of a path in one call
+   *
+   * Backends that store attributes together should override this; the
+   * default implementation calls listxattr and then getxattr per name. */
+  virtual xattr_map getxattrs(const Path& path);
+
   /** List extended attributes */
   virtual std::vector<std::string> listxattr(const Path& path);
 
+  /** List extended attribute names into a caller supplied buffer
+   *
+   * Names are written back to back, each terminated by a NUL.  An empty
+   * buffer asks only for the space required.
+   *
+   * @return the length of the name list
+   * @throws error(result_out_of_range) if the buffer is too small */
+  virtual std::size_t listxattr(const Path& path, string_view& buffer);
+
   /** Remove extended attributes */
   virtual void removexattr(const Path& path, const std::string& name);
 
   /** Read directory */
   virtual std::vector<Path> read_directory(const Path& path) const;
 
+  /** Read directory along with whatever attributes are known for free
+   *
+   * Backends whose directory listing already carries type, size or times
+   * should override this and construct entries with those attributes so that
+   * callers need not look each entry up again.  The default implementation
+   * wraps read_directory and caches nothing. */
+  virtual std::vector<directory_entry> read_directory_entries(
+      const Path& path) const;
+
   /** Synchronize directory contents
    *
    * If the datasync parameter is non-zero, then only the user data
@@ -220,49 +338,85 @@ class filesystem {
   virtual void create_file(const Path& path);
 
   /**
-   * Perform POSIX file locking operation
+   * Create a file with the given permissions in one operation
    *
-   * The cmd argument will be either F_GETLK, F_SETLK or F_SETLKW.
+   * The default implementation calls create_file and then permissions.
+   */
+  virtual void create_file(const Path& path, drivex::permissions permissions);
+
+  /**
+   * Perform POSIX file locking operation
    *
-   * For the meaning of fields in 'struct flock' see the man page
-   * for fcntl(2).  The l_whence field will always be set to
-   * SEEK_SET.
+   * The command argument will be either F_GETLK, F_SETLK or F_SETLKW, and
+   * owner identifies the lock owner as fuse_file_info::lock_owner does.
    *
-   * For checking lock ownership, the 'fuse_file_info->owner'
-   * argument must be used.
+   * For F_GETLK, lock describes the lock that would be taken; replace it with
+   * a conflicting lock, or set its type to lock_type::unlock if there is
+   * none.  For F_SETLK and F_SETLKW the pid field will be set to the pid of
+   * the process performing the locking operation.  F_SETLK should throw
+   * error(resource_unavailable_try_again) on conflict and F_SETLKW should
+   * wait.
    *
-   * For F_GETLK operation, the library will first check currently
-   * held locks, and if a conflicting lock is found it will return
-   * information without calling this method.	 This ensures, that
-   * for local locks the l_pid field is correctly filled in.	The
-   * results may not be accurate in case of race conditions and in
-   * the presence of hard links, but it's unlikely that an
-   * application would rely on accurate GETLK results in these
-   * cases.  If a conflicting lock is not found, this method will be
-   * called, and the filesystem may fill out l_pid by a meaningful
-   * value, or it may leave this field zero.
+   * The default implementation hands the request to locks(), if it returns
+   * a lock manager, and is otherwise unsupported.  Note: if this method is
+   * not implemented, the kernel will still allow file locking to work
+   * locally.  Hence it is only interesting for network filesystems and
+   * similar.
+   */
+  virtual void lock(const Path& path, int command, file_lock& lock,
+                    std::uint64_t owner);
+
+  /**
+   * Perform BSD file locking operation
    *
-   * For F_SETLK and F_SETLKW the l_pid field will be set to the pid
-   * of the process performing the locking operation.
+   * The operation argument is LOCK_SH, LOCK_EX or LOCK_UN, possibly combined
+   * with LOCK_NB.  Like lock(), the default implementation uses locks().
+   */
+  virtual void flock(const Path& path, int operation, std::uint64_t owner);
+
+  /**
+   * Built-in lock manager used by the default lock() and flock()
    *
-   * Note: if this method is not implemented, the kernel will still
-   * allow file locking to work locally.  Hence it is only
-   * interesting for network filesystems and similar.
+   * Backends opt in to drivex-managed locking by holding a lock_manager and
+   * returning it here.  The FUSE glue then calls the manager directly, so
+   * that blocked F_SETLKW and flock requests can be interrupted.  The default
+   * implementation returns null.
    */
-  virtual void lock(const Path& path, int command);
+  virtual lock_manager* locks();
 
   /** Get the last read time for a given path */
   virtual std::time_t last_read_time(const Path& path);
 
+  /** Get the last read time for a given path through a const filesystem
+   *
+   * Not an override point: backends override the non-const overload. */
+  std::time_t last_read_time(const Path& path) const {
+    return const_cast<filesystem*>(this)->last_read_time(path);
+  }
+
   /** Set the last read time for a given path */
   virtual void last_read_time(const Path& path, std::time_t new_time);
 
   /** Get the write time for a given path */
   virtual std::time_t last_write_time(const Path& path);
 
+  /** Get the write time for a given path through a const filesystem
+   *
+   * Not an override point: backends override the non-const overload. */
+  std::time_t last_write_time(const Path& path) const {
+    return const_cast<filesystem*>(this)->last_write_time(path);
+  }
+
   /** Set the write time for a given path */
   virtual void last_write_time(const Path& path, std::time_t new_time);
 
+  /** Get the last read and write times of a path with nanoseconds
+   *
+   * Backends that keep times finer than seconds should override this.  The
+   * default implementation returns last_read_time and last_write_time in
+   * whole seconds, leaving at zero a time the backend does not support. */
+  virtual file_times times(const Path& path);
+
   /**
    * Map block index within file to block index within device
    *
@@ -293,6 +447,12 @@ class filesystem {
    * file.  If this function returns success then any subsequent write
    * request to specified range is guaranteed not to fail because of lack
    * of space on the file system media.
+   *
+   * The file grows to cover the range unless mode has fallocate_keep_size.
+   * With fallocate_punch_hole, which always comes with fallocate_keep_size,
+   * the range is deallocated instead and reads back as zeros; with
+   * fallocate_zero_range it reads back as zeros but may stay allocated.
+   * Backends should throw function_not_supported for modes they lack.
    */
   virtual void fallocate(const Path& path, int mode, uint64_t offset,
                          uint64_t length);
@@ -0,0 +1,264 @@
+#include <drivex/directory_entry.h>
+#include <drivex/filesystem_decorator.h>
+#include <fcntl.h>
+
+namespace lockblox {
+namespace drivex {
+
+filesystem_decorator::filesystem_decorator(std::shared_ptr<filesystem> inner)
+    : filesystem(inner->current_path()), inner_(std::move(inner)) {}
+
+filesystem& filesystem_decorator::inner() const noexcept { return *inner_; }
+
+int filesystem_decorator::inner_flags(int flags) {
+  auto access = (flags & O_ACCMODE) == O_RDONLY ? O_RDONLY : O_RDWR;
+  return (flags & ~(O_ACCMODE | O_APPEND | O_TRUNC)) | access;
+}
+
+std::uintmax_t filesystem_decorator::file_size(const Path& path) const {
+  return inner_->file_size(path);
+}
+
+space_info filesystem_decorator::space(const Path& path) const {
+  return inner_->space(path);
+}
+
+file_status filesystem_decorator::status(const Path& path) const {
+  return inner_->status(path);
+}
+
+bool filesystem_decorator::clone_file(const Path& from, const Path& to) {
+  return inner_->clone_file(from, to);
+}
+
+file_status filesystem_decorator::symlink_status(const Path& path) const {
+  return inner_->symlink_status(path);
+}
+
+Path filesystem_decorator::read_symlink(const Path& path) const {
+  return inner_->read_symlink(path);
+}
+
+void filesystem_decorator::create_directory(const Path& path) {
+  inner_->create_directory(path);
+}
+
+void filesystem_decorator::create_directory(const Path& path,
+                                            drivex::permissions permissions) {
+  inner_->create_directory(path, permissions);
+}
+
+bool filesystem_decorator::remove(const Path& path) {
+  return inner_->remove(path);
+}
+
+void filesystem_decorator::create_symlink(const Path& target,
+                                          const Path& link) {
+  inner_->create_symlink(target, link);
+}
+
+void filesystem_decorator::rename(const Path& from, const Path& to) {
+  inner_->rename(from, to);
+}
+
+void filesystem_decorator::link(const Path& from, const Path& to) {
+  inner_->link(from, to);
+}
+
+void filesystem_decorator::permissions(const Path& path,
+                                       drivex::permissions permissions) {
+  inner_->permissions(path, permissions);
+}
+
+bool filesystem_decorator::is_empty(const Path& p) const {
+  return inner_->is_empty(p);
+}
+
+void filesystem_decorator::chown(const Path& path, uint32_t user_id,
+                                 uint32_t group_id) {
+  inner_->chown(path, user_id, group_id);
+}
+
+void filesystem_decorator::truncate(const Path& path, uint64_t offset) {
+  inner_->truncate(path, offset);
+}
+
+void filesystem_decorator::set_attributes(const Path& path,
+                                          const attribute_update& update) {
+  inner_->set_attributes(path, update);
+}
+
+void filesystem_decorator::open(const Path& path, int flags) {
+  inner_->open(path, flags);
+}
+
+open_handle filesystem_decorator::open_file(const Path& path, int flags) {
+  return inner_->open_file(path, flags);
+}
+
+open_handle filesystem_decorator::create(const Path& path,
+                                         drivex::permissions permissions,
+                                         int flags) {
+  return inner_->create(path, permissions, flags);
+}
+
+int filesystem_decorator::read(const Path& path, string_view& buffer,
+                               uint64_t offset) const {
+  return inner_->read(path, buffer, offset);
+}
+
+int filesystem_decorator::read(const Path& path, open_handle handle,
+                               string_view& buffer, uint64_t offset) const {
+  return inner_->read(path, handle, buffer, offset);
+}
+
+int filesystem_decorator::write(const Path& path, const string_view& buffer,
+                                uint64_t offset) {
+  return inner_->write(path, buffer, offset);
+}
+
+int filesystem_decorator::write(const Path& path, open_handle handle,
+                                const string_view& buffer, uint64_t offset) {
+  return inner_->write(path, handle, buffer, offset);
+}
+
+void filesystem_decorator::flush(const Path& path) {
+  inner_->flush(path);
+}
+
+void filesystem_decorator::flush(const Path& path, open_handle handle) {
+  inner_->flush(path, handle);
+}
+
+void filesystem_decorator::release(const Path& path, int flags) {
+  inner_->release(path, flags);
+}
+
+void filesystem_decorator::release(const Path& path, open_handle handle,
+                                   int flags) {
+  inner_->release(path, handle, flags);
+}
+
+void filesystem_decorator::fsync(const Path& path, int fd) {
+  inner_->fsync(path, fd);
+}
+
+void filesystem_decorator::setxattr(
+    const Path& path, const std::pair<std::string, string_view>& attribute,
+    int flags) {
+  inner_->setxattr(path, attribute, flags);
+}
+
+std::pair<std::string, string_view> filesystem_decorator::getxattr(
+    const Path& path, const std::string& name) {
+  return inner_->getxattr(path, name);
+}
+
+std::size_t filesystem_decorator::getxattr(const Path& path,
+                                           const std::string& name,
+                                           string_view& buffer) {
+  return inner_->getxattr(path, name, buffer);
+}
+
+xattr_map filesystem_decorator::getxattrs(const Path& path) {
+  return inner_->getxattrs(path);
+}
+
+std::vector<std::string> filesystem_decorator::listxattr(const Path& path) {
+  return inner_->listxattr(path);
+}
+
+std::size_t filesystem_decorator::listxattr(const Path& path,
+                                            string_view& buffer) {
+  return inner_->listxattr(path, buffer);
+}
+
+void filesystem_decorator::removexattr(const Path& path,
+                                       const std::string& name) {
+  inner_->removexattr(path, name);
+}
+
+std::vector<Path> filesystem_decorator::read_directory(const Path& path) const {
+  return inner_->read_directory(path);
+}
+
+std::vector<directory_entry> filesystem_decorator::read_directory_entries(
+    const Path& path) const {  // rebind to this, keeping only the type
+  auto entries = inner_->read_directory_entries(path);
+  for (auto& entry : entries) {
+    entry = entry.status_known()
+                ? directory_entry(*this, entry.path(), entry.symlink_status())
+                : directory_entry(*this, entry.path());
+  }
+  return entries;
+}
+
+void filesystem_decorator::fsyncdir(const Path& path, int datasync) {
+  inner_->fsyncdir(path, datasync);
+}
+
+void filesystem_decorator::access(const Path& path,
+                                  const drivex::permissions& permissions) {
+  inner_->access(path, permissions);
+}
+
+void filesystem_decorator::create_file(const Path& path) {
+  inner_->create_file(path);
+}
+
+void filesystem_decorator::create_file(const Path& path,
+                                       drivex::permissions permissions) {
+  inner_->create_file(path, permissions);
+}
+
+void filesystem_decorator::lock(const Path& path, int command, file_lock& lock,
+                                std::uint64_t owner) {
+  inner_->lock(path, command, lock, owner);
+}
+
+void filesystem_decorator::flock(const Path& path, int operation,
+                                 std::uint64_t owner) {
+  inner_->flock(path, operation, owner);
+}
+
+lock_manager* filesystem_decorator::locks() {
+  return inner_->locks();
+}
+
+std::time_t filesystem_decorator::last_read_time(const Path& path) {
+  return inner_->last_read_time(path);
+}
+
+void filesystem_decorator::last_read_time(const Path& path,
+                                          std::time_t new_time) {
+  inner_->last_read_time(path, new_time);
+}
+
+std::time_t filesystem_decorator::last_write_time(const Path& path) {
+  return inner_->last_write_time(path);
+}
+
+void filesystem_decorator::last_write_time(const Path& path,
+                                           std::time_t new_time) {
+  inner_->last_write_time(path, new_time);
+}
+
+file_times filesystem_decorator::times(const Path& path) {
+  return inner_->times(path);
+}
+
+uint64_t filesystem_decorator::bmap(const Path& path, size_t blocksize) {
+  return inner_->bmap(path, blocksize);
+}
+
+void filesystem_decorator::ioctl(const Path& path, int cmd, void* arg,
+                                 unsigned int flags, void* data) {
+  inner_->ioctl(path, cmd, arg, flags, data);
+}
+
+void filesystem_decorator::fallocate(const Path& path, int mode,
+                                     uint64_t offset, uint64_t length) {
+  inner_->fallocate(path, mode, offset, length);
+}
+}  // namespace drivex
+}  // namespace lockblox
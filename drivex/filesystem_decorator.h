@@ -0,0 +1,285 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** A filesystem that forwards every operation to another one
+ *
+ * Derive from this to change some operations of a backend and pass the rest
+ * through.  Operations whose default implementation is written in terms of
+ * other operations, such as copy and create_directories, are not forwarded so
+ * that they see the overrides.  A decorator that changes file contents must
+ * override open_file, create and the open_handle overloads of read, write,
+ * flush and release as well, since handles of the decorated filesystem are
+ * passed through. */
+class filesystem_decorator : public filesystem {
+ public:
+  explicit filesystem_decorator(std::shared_ptr<filesystem> inner);
+
+  /** The decorated filesystem */
+  filesystem& inner() const noexcept;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  space_info space(const Path& path) const override;
+  file_status status(const Path& path) const override;
+  bool clone_file(const Path& from, const Path& to) override;
+  file_status symlink_status(const Path& path) const override;
+  Path read_symlink(const Path& path) const override;
+  void create_directory(const Path& path) override;
+  void create_directory(const Path& path,
+                        drivex::permissions permissions) override;
+  bool remove(const Path& path) override;
+  void create_symlink(const Path& target, const Path& link) override;
+  void rename(const Path& from, const Path& to) override;
+  void link(const Path& from, const Path& to) override;
+  void permissions(const Path& path, drivex::permissions permissions) override;
+  bool is_empty(const Path& p) const override;
+  void chown(const Path& path, uint32_t user_id, uint32_t group_id) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle open_file(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void flush(const Path& path, open_handle handle) override;
+  void release(const Path& path, int flags) override;
+  void release(const Path& path, open_handle handle, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  void setxattr(const Path& path,
+                const std::pair<std::string, string_view>& attribute,
+                int flags) override;
+  std::pair<std::string, string_view> getxattr(
+      const Path& path, const std::string& name) override;
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override;
+  xattr_map getxattrs(const Path& path) override;
+  std::vector<std::string> listxattr(const Path& path) override;
+  std::size_t listxattr(const Path& path, string_view& buffer) override;
+  void removexattr(const Path& path, const std::string& name) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  void fsyncdir(const Path& path, int datasync) override;
+  void access(const Path& path,
+              const drivex::permissions& permissions) override;
+  void create_file(const Path& path) override;
+  void create_file(const Path& path, drivex::permissions permissions) override;
+  void lock(const Path& path, int command, file_lock& lock,
+            std::uint64_t owner) override;
+  void flock(const Path& path, int operation, std::uint64_t owner) override;
+  lock_manager* locks() override;
+  std::time_t last_read_time(const Path& path) override;
+  void last_read_time(const Path& path, std::time_t new_time) override;
+  std::time_t last_write_time(const Path& path) override;
+  void last_write_time(const Path& path, std::time_t new_time) override;
+  file_times times(const Path& path) override;
+  uint64_t bmap(const Path& path, size_t blocksize) override;
+  void ioctl(const Path& path, int cmd, void* arg, unsigned int flags,
+             void* data) override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+ protected:
+  /** Flags for an inner file that the decorator reads as well as writes,
+   * whatever the caller asked for */
+  static int inner_flags(int flags);
+
+  /** State of the files a decorator has open or calls in progress on
+   *
+   * State needs a lockable mutex, counters opens and users, and a flag
+   * loaded that the load function sets.  acquire() counts a caller in,
+   * loading the state of a path on first use while holding its mutex, and
+   * done() counts it out; the last one out commits the state and forgets
+   * it.  rename() carries along the state of every file at or beneath the
+   * source, as open files under a renamed directory stay open. */
+  template <typename State>
+  class file_table {
+   public:
+    using state = std::shared_ptr<State>;
+
+    /** State of a path, loading it with load(State&) if it is not held
+     *
+     * @param open whether this opens the file, rather than being a call
+     *        that done() ends */
+    template <typename Load>
+    state acquire(const Path& path, bool open, Load load);
+
+    /** End a call, or close the file as well, committing the state with
+     * commit(State&) if nobody holds it any more */
+    template <typename Commit>
+    void done(const Path& path, const state& file, bool close, Commit commit);
+
+    /** State of a path if held, or null */
+    state find(const Path& path) const;
+
+    /** Forget the state of a path, as after remove
+     *
+     * @return the state, or null if none was held */
+    state take(const Path& path);
+
+    /** Move the state of a path and of everything beneath it
+     *
+     * @return the state of a file the rename replaces, now forgotten */
+    state rename(const Path& from, const Path& to);
+
+    /** Every path and state held, as for writing them back */
+    std::vector<std::pair<Path, state>> all() const;
+
+   private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, state> files_;
+  };
+
+ private:
+  std::shared_ptr<filesystem> inner_;
+};
+
+template <typename State>
+template <typename Load>
+typename filesystem_decorator::file_table<State>::state
+filesystem_decorator::file_table<State>::acquire(const Path& path, bool open,
+                                                 Load load) {
+  using file_lock = std::unique_lock<decltype(std::declval<State>().mutex)>;
+  auto key = path.string();
+  for (;;) {
+    state file;
+    file_lock loading;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = files_.find(key);
+      if (found == files_.end()) {  // load it below, holding others off
+        file = std::make_shared<State>();
+        loading = file_lock(file->mutex);
+        files_.emplace(key, file);
+      } else {
+        file = found->second;
+      }
+      ++(open ? file->opens : file->users);
+    }
+    if (loading) {
+      try {
+        load(*file);
+      } catch (...) {
+        loading.unlock();
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = files_.find(key);
+        if (found != files_.end() && found->second == file) {
+          files_.erase(found);
+        }
+        throw;
+      }
+      return file;
+    }
+    file_lock waiting(file->mutex);
+    if (file->loaded) {
+      return file;
+    }
+  }  // the load failed and was dropped, so try it again
+}
+
+template <typename State>
+template <typename Commit>
+void filesystem_decorator::file_table<State>::done(const Path& path,
+                                                   const state& file,
+                                                   bool close, Commit commit) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (close && file->opens > 0) {
+      --file->opens;
+    }
+    --file->users;
+    if (file->opens != 0 || file->users != 0) {
+      return;
+    }
+  }
+  {  // nobody holds the file open, so write it out
+    std::lock_guard<decltype(file->mutex)> file_lock(file->mutex);
+    commit(*file);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = files_.find(path.string());
+  if (found != files_.end() && found->second == file && file->opens == 0 &&
+      file->users == 0) {
+    files_.erase(found);
+  }
+}
+
+template <typename State>
+typename filesystem_decorator::file_table<State>::state
+filesystem_decorator::file_table<State>::find(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = files_.find(path.string());
+  return found != files_.end() ? found->second : state();
+}
+
+template <typename State>
+typename filesystem_decorator::file_table<State>::state
+filesystem_decorator::file_table<State>::take(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  state file;
+  auto found = files_.find(path.string());
+  if (found != files_.end()) {
+    file = std::move(found->second);
+    files_.erase(found);
+  }
+  return file;
+}
+
+template <typename State>
+typename filesystem_decorator::file_table<State>::state
+filesystem_decorator::file_table<State>::rename(const Path& from,
+                                                const Path& to) {
+  const auto& source = from.string();
+  const auto& target = to.string();
+  std::lock_guard<std::mutex> lock(mutex_);
+  state replaced;
+  auto found = files_.find(target);
+  if (found != files_.end()) {
+    replaced = std::move(found->second);
+    files_.erase(found);
+  }
+  std::vector<std::string> moved;
+  for (const auto& file : files_) {
+    if (file.first == source ||
+        file.first.compare(0, source.size() + 1, source + "/") == 0) {
+      moved.push_back(file.first);
+    }
+  }
+  for (const auto& key : moved) {
+    auto file = std::move(files_.at(key));
+    files_.erase(key);
+    files_[target + key.substr(source.size())] = std::move(file);
+  }
+  return replaced;
+}
+
+template <typename State>
+std::vector<std::pair<Path, typename filesystem_decorator::file_table<
+                                State>::state>>
+filesystem_decorator::file_table<State>::all() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<Path, state>> files;
+  for (const auto& file : files_) {
+    files.emplace_back(Path(file.first), file.second);
+  }
+  return files;
+}
+}  // namespace drivex
+}  // namespace lockblox
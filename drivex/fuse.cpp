@@ -1,6 +1,24 @@
 #include <drivex/Fuse.h>
+#include <drivex/arena.h>
+#include <drivex/directory_entry.h>
+#include <drivex/lock_manager.h>
+#include <fuse/fuse_lowlevel.h>
 #include <iostream>
-#include <numeric>
+
+#ifdef __linux__
+#include <linux/falloc.h>
+#endif
+
+#if !WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#endif
 
 #if WIN32
 #define S_IFIFO 0x1000;
@@ -17,10 +35,29 @@ namespace errc = boost::system::errc;
 namespace lockblox {
 namespace drivex {
 
-drivex::filesystem* get_impl_from_context() {
+Fuse* get_fuse_from_context() {
   struct fuse_context* context = fuse_get_context();
-  auto impl = static_cast<drivex::filesystem*>(context->private_data);
-  return impl;
+  return static_cast<Fuse*>(context->private_data);
+}
+
+#ifdef __linux__
+static_assert(FALLOC_FL_KEEP_SIZE == fallocate_keep_size &&
+                  FALLOC_FL_PUNCH_HOLE == fallocate_punch_hole &&
+                  FALLOC_FL_ZERO_RANGE == fallocate_zero_range,
+              "fallocate flags are passed through as is");
+#endif
+
+drivex::filesystem* get_impl_from_context() {
+  return &get_fuse_from_context()->backend();
+}
+
+/** Convert a file_time for struct stat */
+static struct timespec to_timespec(drivex::file_time time) {
+  struct timespec result = {};
+  result.tv_sec = drivex::to_time_t(time);
+  result.tv_nsec =
+      static_cast<long>((time - drivex::from_time_t(result.tv_sec)).count());
+  return result;
 }
 
 static int drivex_getattr(const char* path, FUSE_STAT* stbuf) {
@@ -33,6 +70,9 @@ static int drivex_getattr(const char* path, FUSE_STAT* stbuf) {
     auto mode = static_cast<mode_t>(status);
     stbuf->st_mode = mode;
     stbuf->st_size = impl->file_size(p);
+    auto times = impl->times(p);
+    stbuf->st_atim = to_timespec(times.last_read_time);
+    stbuf->st_mtim = to_timespec(times.last_write_time);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -55,9 +95,8 @@ static int drivex_mkdir(const char* path, mode_t mode) {
   int result = 0;
   auto impl = get_impl_from_context();
   try {
-    auto p = drivex::Path(path);
-    impl->create_directory(p);
-    impl->permissions(p, drivex::permissions(mode));
+    impl->create_directory(drivex::Path(path),
+                           drivex::permissions(mode & 07777));
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -68,7 +107,9 @@ static int drivex_unlink(const char* path) {
   int result = 0;
   auto impl = get_impl_from_context();
   try {
-    impl->remove(drivex::Path(path));
+    auto p = drivex::Path(path);
+    impl->remove(p);
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -79,7 +120,9 @@ static int drivex_rmdir(const char* path) {
   int result = 0;
   auto impl = get_impl_from_context();
   try {
-    impl->remove(drivex::Path(path));
+    auto p = drivex::Path(path);
+    impl->remove(p);
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -101,7 +144,12 @@ static int drivex_rename(const char* oldpath, const char* newpath) {
   int result = 0;
   auto impl = get_impl_from_context();
   try {
-    impl->rename(drivex::Path(oldpath), drivex::Path(newpath));
+    auto from = drivex::Path(oldpath);
+    auto to = drivex::Path(newpath);
+    impl->rename(from, to);
+    auto& xattrs = get_fuse_from_context()->xattrs();
+    xattrs.invalidate_tree(from);
+    xattrs.invalidate_tree(to);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -122,8 +170,12 @@ static int drivex_link(const char* oldpath, const char* newpath) {
 static int drivex_chmod(const char* path, mode_t mode) {
   int result = 0;
   auto impl = get_impl_from_context();
-  try {
-    impl->permissions(drivex::Path(path), drivex::permissions(mode));
+  try {  // ACLs live in xattrs and follow the mode
+    auto update = drivex::attribute_update{};
+    update.permissions = drivex::permissions(mode);
+    auto p = drivex::Path(path);
+    impl->set_attributes(p, update);
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -133,8 +185,17 @@ static int drivex_chmod(const char* path, mode_t mode) {
 static int drivex_chown(const char* path, uid_t user_id, gid_t group_id) {
   int result = 0;
   auto impl = get_impl_from_context();
-  try {
-    impl->chown(drivex::Path(path), user_id, group_id);
+  try {  // chown drops security.capability
+    auto update = drivex::attribute_update{};
+    if (user_id != static_cast<uid_t>(-1)) {
+      update.user_id = user_id;
+    }
+    if (group_id != static_cast<gid_t>(-1)) {
+      update.group_id = group_id;
+    }
+    auto p = drivex::Path(path);
+    impl->set_attributes(p, update);
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -145,7 +206,28 @@ static int drivex_truncate(const char* path, OFF_T length) {
   int result = 0;
   auto impl = get_impl_from_context();
   try {
-    impl->truncate(drivex::Path(path), length);
+    auto update = drivex::attribute_update{};
+    update.size = length;
+    impl->set_attributes(drivex::Path(path), update);
+  } catch (const drivex::error& e) {
+    result = -e.code().value();
+  }
+  return result;
+}
+
+static int drivex_statfs(const char* path, struct statvfs* stbuf) {
+  const auto block_size = 4096u;
+  memset(stbuf, 0, sizeof(struct statvfs));
+  auto fuse = get_fuse_from_context();
+  int result = 0;
+  try {
+    auto space = fuse->space().space(fuse->backend(), drivex::Path(path));
+    stbuf->f_bsize = block_size;
+    stbuf->f_frsize = block_size;
+    stbuf->f_blocks = space.capacity / block_size;
+    stbuf->f_bfree = space.free / block_size;
+    stbuf->f_bavail = space.available / block_size;
+    stbuf->f_namemax = 255;
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -153,11 +235,10 @@ static int drivex_truncate(const char* path, OFF_T length) {
 }
 
 static int drivex_open(const char* path, struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    impl->open(drivex::Path(path), fi->flags);
+    fi->fh = impl->open_file(drivex::Path(path), fi->flags);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -166,12 +247,11 @@ static int drivex_open(const char* path, struct fuse_file_info* fi) {
 
 static int drivex_read(const char* path, char* buf, size_t size, OFF_T offset,
                        struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   auto buffer = string_view(buf, size);
   int result = 0;
   try {
-    result = impl->read(drivex::Path(path), buffer, offset);
+    result = impl->read(drivex::Path(path), fi->fh, buffer, offset);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -180,12 +260,11 @@ static int drivex_read(const char* path, char* buf, size_t size, OFF_T offset,
 
 static int drivex_write(const char* path, const char* buf, size_t size,
                         OFF_T offset, struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   auto buffer = string_view(buf, size);
   int result = 0;
   try {
-    result = impl->write(drivex::Path(path), buffer, offset);
+    result = impl->write(drivex::Path(path), fi->fh, buffer, offset);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -193,11 +272,10 @@ static int drivex_write(const char* path, const char* buf, size_t size,
 }
 
 static int drivex_flush(const char* path, struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   int result = 0;
   try {
-    impl->flush(drivex::Path(path));
+    impl->flush(drivex::Path(path), fi->fh);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -205,11 +283,10 @@ static int drivex_flush(const char* path, struct fuse_file_info* fi) {
 }
 
 static int drivex_release(const char* path, struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   int result = 0;
   try {
-    impl->release(drivex::Path(path), fi->flags);
+    impl->release(drivex::Path(path), fi->fh, fi->flags);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -234,7 +311,9 @@ static int drivex_setxattr(const char* path, const char* name,
   int result = 0;
   try {
     auto attribute = std::make_pair(name, string_view(value, size));
-    impl->setxattr(drivex::Path(path), attribute, flags);
+    auto p = drivex::Path(path);
+    impl->setxattr(p, attribute, flags);
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -245,9 +324,10 @@ static int drivex_getxattr(const char* path, const char* name, char* value,
                            size_t size) {
   auto impl = get_impl_from_context();
   int result = 0;
-  try {
-    auto attribute = impl->getxattr(drivex::Path(path), std::string(name));
-    memcpy(value, attribute.second.data(), size);
+  try {  // size 0 is a probe for the length of the value
+    auto buffer = string_view(value, size);
+    result = get_fuse_from_context()->xattrs().getxattr(
+        *impl, drivex::Path(path), std::string(name), buffer);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -257,19 +337,10 @@ static int drivex_getxattr(const char* path, const char* name, char* value,
 static int drivex_listxattr(const char* path, char* list, size_t size) {
   auto impl = get_impl_from_context();
   int result = 0;
-  try {  // get attribute list then compute concatenated length
-    auto attributes = impl->listxattr(drivex::Path(path));
-    result = std::accumulate(
-        attributes.begin(), attributes.end(), 0,
-        [](int s, const std::string& attr) { return s + attr.size() + 1; });
-    if (size != 0) {
-      std::vector<char> attribute_array;
-      attribute_array.reserve(result);
-      for (const auto& attr : attributes) {
-        attribute_array.insert(attribute_array.end(), attr.begin(), attr.end());
-      }
-      memcpy(list, attribute_array.data(), size);
-    }  // else just return length of array
+  try {  // size 0 is a probe for the length of the list
+    auto buffer = string_view(list, size);
+    result = get_fuse_from_context()->xattrs().listxattr(
+        *impl, drivex::Path(path), buffer);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -280,7 +351,9 @@ static int drivex_removexattr(const char* path, const char* name) {
   auto impl = get_impl_from_context();
   int result = 0;
   try {
-    impl->removexattr(drivex::Path(path), std::string(name));
+    auto p = drivex::Path(path);
+    impl->removexattr(p, std::string(name));
+    get_fuse_from_context()->xattrs().invalidate(p);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -292,11 +365,12 @@ int drivex_opendir(const char* path, struct fuse_file_info* fi) {
   auto impl = get_impl_from_context();
   int result = 0;
   try {
-    auto status = symlink_status(drivex::Path(path));
+    auto p = drivex::Path(path);
+    auto status = symlink_status(p);
     if (!drivex::is_directory(status)) {
       throw drivex::error(drivex::error_code::not_a_directory);
     }
-    impl->open(drivex::Path(path), fi->flags);
+    impl->open(p, fi->flags);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -310,9 +384,26 @@ static int drivex_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    auto entries = impl->read_directory(drivex::Path(path));
+    auto entries = impl->read_directory_entries(drivex::Path(path));
+    // FUSE threads never reset their arena, so each name is rewound instead
+    auto& temporaries = arena::local();
     for (const auto& entry : entries) {
-      filler(buf, entry.string().c_str(), nullptr, 0);
+      arena::scope scope(temporaries);
+      const auto& full = entry.path().native();
+      auto start = full.rfind('/');
+      start = start == std::string::npos ? 0 : start + 1;
+      auto length = full.size() - start;
+      auto name = static_cast<char*>(temporaries.allocate(length + 1, 1));
+      memcpy(name, full.data() + start, length);
+      name[length] = '\0';
+      if (entry.status_known()) {  // spare the kernel a lookup per entry
+        FUSE_STAT stbuf;
+        memset(&stbuf, 0, sizeof(stbuf));
+        stbuf.st_mode = static_cast<mode_t>(entry.symlink_status());
+        filler(buf, name, &stbuf, 0);
+      } else {
+        filler(buf, name, nullptr, 0);
+      }
     }
   } catch (const drivex::error& e) {
     result = -e.code().value();
@@ -325,11 +416,12 @@ static int drivex_releasedir(const char* path, struct fuse_file_info* fi) {
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    auto status = symlink_status(drivex::Path(path));
+    auto p = drivex::Path(path);
+    auto status = symlink_status(p);
     if (!drivex::is_directory(status)) {
       throw drivex::error(drivex::error_code::not_a_directory);
     }
-    impl->release(drivex::Path(path), fi->flags);
+    impl->release(p, fi->flags);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -362,13 +454,12 @@ static int drivex_access(const char* path, int mode) {
 
 static int drivex_create(const char* path, mode_t mode,
                          struct fuse_file_info* fi) {
-  (void)fi;
   auto impl = get_impl_from_context();
   auto result = 0;
-  try {
-    auto p = drivex::Path(path);
-    impl->create_file(p);
-    impl->permissions(p, static_cast<drivex::permissions>(mode));
+  try {  // the kernel does not follow create with open
+    fi->fh = impl->create(drivex::Path(path),
+                          static_cast<drivex::permissions>(mode & 07777),
+                          fi->flags);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -381,7 +472,9 @@ static int drivex_ftruncate(const char* path, OFF_T offset,
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    impl->truncate(drivex::Path(path), offset);
+    auto update = drivex::attribute_update{};
+    update.size = offset;
+    impl->set_attributes(drivex::Path(path), update);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -394,27 +487,190 @@ static int drivex_fgetattr(const char* path, FUSE_STAT* attr,
   return drivex_getattr(path, attr);
 }
 
+static bool drivex_interrupted() { return fuse_interrupted() != 0; }
+
+#if !WIN32
+namespace {
+
+/** The lock wait a FUSE worker thread is blocked in, if any */
+struct blocked_lock {
+  drivex::lock_manager* manager;
+  std::uint64_t owner;
+};
+
+thread_local blocked_lock current_lock = {nullptr, 0};
+
+/** Turns FUSE interrupts into lock_manager::interrupt() calls
+ *
+ * Mounted with -o intr, libfuse answers FUSE_INTERRUPT by sending SIGUSR1 to
+ * the thread serving the request, once a second until it returns.  A signal
+ * handler may not take locks, so ours writes the lock wait its thread is in
+ * to a pipe, and a relay thread wakes that wait, which then checks
+ * fuse_interrupted() for its own request.  The relay lives as long as the
+ * process, like the handler it installs. */
+class interrupt_relay {
+ public:
+  static interrupt_relay& instance() {
+    static auto relay = new interrupt_relay;
+    return *relay;
+  }
+
+  /** Marks the calling thread as blocked in manager for owner */
+  void enter(drivex::lock_manager& manager, std::uint64_t owner) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    waits_.emplace(&manager, owner);
+    current_lock = blocked_lock{&manager, owner};
+  }
+
+  void leave() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    waits_.erase(waits_.find({current_lock.manager, current_lock.owner}));
+    current_lock = blocked_lock{nullptr, 0};
+  }
+
+ private:
+  interrupt_relay() {
+    if (::pipe(pipe_) != 0) {
+      throw drivex::error(drivex::error_code::io_error, "interrupt pipe");
+    }
+    ::fcntl(pipe_[1], F_SETFL, O_NONBLOCK);  // the handler must never block
+    ::fcntl(pipe_[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(pipe_[1], F_SETFD, FD_CLOEXEC);
+    write_end = pipe_[1];
+    struct sigaction action {};
+    action.sa_handler = on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGUSR1, &action, nullptr);  // libfuse keeps a set handler
+    std::thread([this] { relay(); }).detach();
+  }
+
+  static void on_signal(int) {
+    if (current_lock.manager != nullptr) {
+      auto saved = errno;  // a dropped write is resent by libfuse
+      auto written = ::write(write_end, &current_lock, sizeof current_lock);
+      (void)written;
+      errno = saved;
+    }
+  }
+
+  void relay() {
+    auto wait = blocked_lock{};
+    for (;;) {
+      auto got = ::read(pipe_[0], &wait, sizeof wait);  // writes are atomic
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got != sizeof wait) {
+        return;
+      }
+      std::lock_guard<std::mutex> guard(mutex_);  // keeps manager alive
+      if (waits_.count({wait.manager, wait.owner}) != 0) {
+        wait.manager->interrupt(wait.owner);
+      }
+    }
+  }
+
+  static int write_end;
+  int pipe_[2];
+  std::mutex mutex_;
+  std::multiset<std::pair<drivex::lock_manager*, std::uint64_t>> waits_;
+};
+
+int interrupt_relay::write_end = -1;
+
+/** Run a blocking lock_manager call that FUSE interrupts can wake */
+template <typename Call>
+void interruptible(drivex::lock_manager& manager, std::uint64_t owner,
+                   const Call& call) {
+  auto& relay = interrupt_relay::instance();
+  relay.enter(manager, owner);
+  try {
+    call();
+  } catch (...) {
+    relay.leave();
+    throw;
+  }
+  relay.leave();
+}
+}  // namespace
+#else
+namespace {
+template <typename Call>
+void interruptible(drivex::lock_manager&, std::uint64_t, const Call& call) {
+  call();
+}
+}  // namespace
+#endif
+
 static int drivex_lock(const char* path, struct fuse_file_info* fi, int cmd,
                        struct flock* file_lock) {
-  (void)fi;
-  (void)file_lock;
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    impl->lock(drivex::Path(path), cmd);
+    auto lock = drivex::file_lock{};
+    lock.type = file_lock->l_type == F_RDLCK
+                    ? drivex::lock_type::read
+                    : file_lock->l_type == F_WRLCK ? drivex::lock_type::write
+                                                   : drivex::lock_type::unlock;
+    lock.start = file_lock->l_start;
+    lock.length = file_lock->l_len;
+    lock.pid = file_lock->l_pid;
+    auto p = drivex::Path(path);
+    auto manager = impl->locks();
+    if (!manager) {
+      impl->lock(p, cmd, lock, fi->lock_owner);
+    } else if (cmd == F_SETLKW) {
+      interruptible(*manager, fi->lock_owner, [&] {
+        manager->lock(p, cmd, lock, fi->lock_owner, drivex_interrupted);
+      });
+    } else {
+      manager->lock(p, cmd, lock, fi->lock_owner);
+    }
+    if (cmd == F_GETLK) {
+      file_lock->l_type = lock.type == drivex::lock_type::read
+                              ? F_RDLCK
+                              : lock.type == drivex::lock_type::write
+                                    ? F_WRLCK
+                                    : F_UNLCK;
+      file_lock->l_whence = SEEK_SET;
+      file_lock->l_start = lock.start;
+      file_lock->l_len = lock.length;
+      file_lock->l_pid = lock.pid;
+    }
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
   return result;
 }
 
+/** Convert a utimens timestamp, which may be UTIME_NOW or UTIME_OMIT */
+static boost::optional<drivex::file_time> to_file_time(
+    const struct timespec& time) {
+  if (time.tv_nsec == UTIME_OMIT) {
+    return boost::none;
+  }
+  if (time.tv_nsec == UTIME_NOW) {
+    return drivex::file_time(std::chrono::system_clock::now());
+  }
+  return drivex::file_time(std::chrono::seconds(time.tv_sec) +
+                           std::chrono::nanoseconds(time.tv_nsec));
+}
+
 int drivex_utimens(const char* path, const struct timespec tv[2]) {
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    auto p = drivex::Path(path);
-    impl->last_read_time(p, tv[0].tv_sec);
-    impl->last_write_time(p, tv[1].tv_sec);
+    auto update = drivex::attribute_update{};
+    if (tv == nullptr) {  // both set to the current time
+      auto now = drivex::file_time(std::chrono::system_clock::now());
+      update.last_read_time = now;
+      update.last_write_time = now;
+    } else {
+      update.last_read_time = to_file_time(tv[0]);
+      update.last_write_time = to_file_time(tv[1]);
+    }
+    impl->set_attributes(drivex::Path(path), update);
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -446,11 +702,17 @@ int drivex_ioctl(const char* path, int cmd, void* arg,
 }
 
 int drivex_flock(const char* path, struct fuse_file_info* fi, int op) {
-  (void)fi;
   auto impl = get_impl_from_context();
   auto result = 0;
   try {
-    impl->lock(drivex::Path(path), op);
+    auto p = drivex::Path(path);
+    if (auto manager = impl->locks()) {
+      interruptible(*manager, fi->lock_owner, [&] {
+        manager->flock(p, op, fi->lock_owner, drivex_interrupted);
+      });
+    } else {
+      impl->flock(p, op, fi->lock_owner);
+    }
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -460,10 +722,22 @@ int drivex_flock(const char* path, struct fuse_file_info* fi, int op) {
 int drivex_fallocate(const char* path, int mode, OFF_T offset, OFF_T len,
                      struct fuse_file_info* fi) {
   (void)fi;
-  auto impl = get_impl_from_context();
+  const auto known =
+      fallocate_keep_size | fallocate_punch_hole | fallocate_zero_range;
+  if ((mode & ~known) != 0) {
+    return -EOPNOTSUPP;
+  }
+  auto punch = (mode & fallocate_punch_hole) != 0;
+  if (offset < 0 || len <= 0 ||
+      (punch && ((mode & fallocate_keep_size) == 0 ||
+                 (mode & fallocate_zero_range) != 0))) {
+    return -EINVAL;
+  }
+  auto fuse = get_fuse_from_context();
   auto result = 0;
   try {
-    impl->fallocate(drivex::Path(path), mode, offset, len);
+    fuse->backend().fallocate(drivex::Path(path), mode, offset, len);
+    fuse->space().clear();  // allocation changed the free space
   } catch (const drivex::error& e) {
     result = -e.code().value();
   }
@@ -481,11 +755,47 @@ Fuse::~Fuse() { unmount(); }
 
 bool Fuse::is_mounted() const { return is_mounted_; }
 
+filesystem& Fuse::backend() const { return *pImpl; }
+
+xattr_cache& Fuse::xattrs() { return xattrs_; }
+
+space_cache& Fuse::space() { return space_; }
+
+void Fuse::invalidate_data(std::uint64_t node) {
+  if (invalidations_) {
+    invalidations_->invalidate_data(node);
+  }
+}
+
+void Fuse::invalidate_entry(std::uint64_t parent, const std::string& name) {
+  if (invalidations_) {
+    invalidations_->invalidate_entry(parent, name);
+  }
+}
+
+void Fuse::invalidate(const Path& path) {
+  xattrs_.invalidate_tree(path);
+  space_.clear();
+  auto top = path.begin();  // the root directory, then the top ancestor
+  if (top == path.end() || ++top == path.end() || *top == ".") {
+    invalidate_data(root_node);
+  } else {
+    invalidate_entry(root_node, top->string());
+  }
+}
+
+void Fuse::flush_invalidations() {
+  if (invalidations_) {
+    invalidations_->flush();
+  }
+}
+
 void Fuse::mount() {
   if (!is_mounted() && nullptr != channel_) {
     auto operations = fuse_operations{};
     operations.getattr = drivex_getattr;
     operations.readlink = drivex_readlink;
+    operations.statfs = drivex_statfs;
     operations.mkdir = drivex_mkdir;
     operations.unlink = drivex_unlink;
     operations.rmdir = drivex_rmdir;
@@ -522,10 +832,32 @@ void Fuse::mount() {
 #endif
 
     auto ops_size = sizeof(operations);
-    auto user_data = reinterpret_cast<void*>(pImpl.get());
-    auto args = nullptr;
-    fuse_ = fuse_new(channel_, args, &operations, ops_size, user_data);
+    auto user_data = reinterpret_cast<void*>(this);
+    char program[] = "drivex";
+    char interruptible_locks[] = "-ointr";
+    char* argv[] = {program, interruptible_locks};
+    struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+#if !WIN32
+    if (pImpl->locks()) {  // lock waits must hear about FUSE_INTERRUPT
+      interrupt_relay::instance();
+      args.argc = 2;
+    }
+#endif
+    fuse_ = fuse_new(channel_, &args, &operations, ops_size, user_data);
+    fuse_opt_free_args(&args);
     is_mounted_ = nullptr != fuse_;
+    if (is_mounted_) {  // the kernel may not know a node; that is fine
+      auto channel = channel_;
+      invalidations_.reset(new invalidation_queue(
+          [channel](std::uint64_t node, std::int64_t offset,
+                    std::int64_t length) {
+            fuse_lowlevel_notify_inval_inode(channel, node, offset, length);
+          },
+          [channel](std::uint64_t parent, const std::string& name) {
+            fuse_lowlevel_notify_inval_entry(channel, parent, name.c_str(),
+                                             name.size());
+          }));
+    }
   }
 }
 
@@ -535,7 +867,12 @@ void Fuse::run() {
   }
 }
 
+fuse_session* Fuse::session() const {
+  return is_mounted() ? fuse_get_session(fuse_) : nullptr;
+}
+
 void Fuse::unmount() {
+  invalidations_.reset();
   if (is_mounted() && nullptr != channel_) {
     fuse_unmount(mountpoint_.string().c_str(), channel_);
   }
@@ -3,7 +3,11 @@
 #define FUSE_USE_VERSION 26
 
 #include <drivex/filesystem.h>
+#include <drivex/invalidation_queue.h>
+#include <drivex/space_cache.h>
+#include <drivex/xattr_cache.h>
 #include <fuse/fuse.h>
+#include <memory>
 
 namespace lockblox {
 namespace drivex {
@@ -20,12 +24,54 @@ class Fuse {
   void unmount();
   void run();
 
+  /** libfuse session of the mount, or null while unmounted
+   *
+   * Lets a session_manager serve the mount instead of run(). */
+  fuse_session* session() const;
+
+  /** Backend served by this mount */
+  filesystem& backend() const;
+
+  /** Extended attribute cache, disabled until given a capacity */
+  xattr_cache& xattrs();
+
+  /** Free space cache, disabled until given a time to live */
+  space_cache& space();
+
+  /** Drop what drivex and the kernel cache about a path and its subtree
+   *
+   * Drivex caches are invalidated immediately.  Kernel invalidations are
+   * batched, coalesced and sent from a background thread while mounted, and
+   * ignored otherwise; they let a mount use long attribute and entry
+   * timeouts and kernel_cache while data changes behind its back.
+   *
+   * libfuse 2's high-level API does not reveal the node ids it hands the
+   * kernel, so the root is the only node drivex can name.  For a deeper
+   * path the kernel is told to drop the entry of its ancestor below the
+   * root, which evicts that ancestor's whole subtree from the dentry cache:
+   * the path is looked up again and gets fresh attributes, along with its
+   * neighbours.  Data the kernel caches for a file held open stays until
+   * the file is reopened. */
+  void invalidate(const Path& path);
+
+  /** Send pending kernel invalidations now */
+  void flush_invalidations();
+
  private:
+  /** Node id of the mount root */
+  static const std::uint64_t root_node = 1;
+
+  void invalidate_data(std::uint64_t node);
+  void invalidate_entry(std::uint64_t parent, const std::string& name);
+
   std::shared_ptr<filesystem> pImpl;
+  xattr_cache xattrs_;
+  space_cache space_;
   bool is_mounted_;
   const Path mountpoint_;
   fuse_chan* channel_;
   fuse_handle* fuse_;
+  std::unique_ptr<invalidation_queue> invalidations_;
 };
 }  // namespace drivex
 }  // namespace lockblox
@@ -0,0 +1,283 @@
+#include <drivex/directory_entry.h>
+#include <drivex/image_builder.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint64_t extent_alignment = 4096;
+const std::size_t chunk_size = 1u << 20u;
+const unsigned int default_directory_mode = 0040755;
+
+std::uint64_t align(std::uint64_t offset, std::uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+bool has_code(const error& e, error_code code) {
+  return e.code().value() == static_cast<int>(code);
+}
+
+bool is_unsupported(const error& e) {
+  return has_code(e, error_code::function_not_supported);
+}
+
+std::time_t write_time(const filesystem& source, const Path& path) {
+  try {
+    return source.last_write_time(path);
+  } catch (const error& e) {
+    if (!is_unsupported(e)) {
+      throw;
+    }
+  }
+  return 0;
+}
+
+/** Time for a symlink entry
+ *
+ * Backends only report the time of the target, so a dangling or looping
+ * link gets zero. */
+std::time_t link_time(const filesystem& source, const Path& path) {
+  try {
+    return write_time(source, path);
+  } catch (const error& e) {
+    if (!has_code(e, error_code::no_such_file_or_directory) &&
+        !has_code(e, error_code::too_many_symbolic_link_levels)) {
+      throw;
+    }
+  }
+  return 0;
+}
+
+void pad(std::ostream& output, std::uint64_t from, std::uint64_t to) {
+  static const char zeros[4096] = {};
+  while (from < to) {
+    auto count = std::min<std::uint64_t>(to - from, sizeof(zeros));
+    output.write(zeros, count);
+    from += count;
+  }
+}
+
+struct pending_file {
+  Path path;
+  std::uint64_t size;
+  std::uint64_t offset;
+};
+
+/** Append the data of one file, zero-filling if it shrank meanwhile */
+void write_data(filesystem& source, const pending_file& file,
+                std::vector<char>& chunk, std::ostream& output) {
+  auto opened = true;
+  try {
+    source.open(file.path, O_RDONLY);
+  } catch (const error& e) {
+    if (!is_unsupported(e)) {
+      throw;
+    }
+    opened = false;
+  }
+  std::uint64_t done = 0;
+  while (done < file.size) {
+    auto want = std::min<std::uint64_t>(file.size - done, chunk.size());
+    auto buffer = string_view(chunk.data(), want);
+    auto count = source.read(file.path, buffer, done);
+    if (count <= 0) {
+      break;
+    }
+    output.write(chunk.data(), count);
+    done += count;
+  }
+  pad(output, done, file.size);
+  if (opened) {
+    try {
+      source.release(file.path, O_RDONLY);
+    } catch (const error& e) {
+      if (!is_unsupported(e)) {
+        throw;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+image_builder::image_builder() {
+  root_.entry.mode = default_directory_mode;
+}
+
+void image_builder::add_directory(const Path& path, file_status status,
+                                  std::time_t last_write_time) {
+  auto& entry = insert(path).entry;
+  entry.mode = static_cast<unsigned int>(status);
+  entry.last_write_time = last_write_time;
+}
+
+void image_builder::add_file(const Path& path, file_status status,
+                             std::time_t last_write_time, std::uint64_t size,
+                             std::uint64_t data_offset) {
+  auto& entry = insert(path).entry;
+  entry.mode = static_cast<unsigned int>(status);
+  entry.last_write_time = last_write_time;
+  entry.size = size;
+  entry.data_offset = data_offset;
+}
+
+void image_builder::add_symlink(const Path& path, std::time_t last_write_time,
+                                const Path& target) {
+  auto& added = insert(path);
+  added.entry.mode = 0120777;
+  added.entry.last_write_time = last_write_time;
+  added.entry.size = target.string().size();
+  added.target = target.string();
+}
+
+std::uint64_t image_builder::metadata_size() const {
+  std::uint64_t count = 0;
+  std::uint64_t strings = 0;
+  std::deque<const node*> queue{&root_};
+  while (!queue.empty()) {
+    const auto& current = *queue.front();
+    queue.pop_front();
+    ++count;
+    strings += current.target.size();
+    for (const auto& child : current.children) {
+      strings += child.first.size();
+      queue.push_back(child.second.get());
+    }
+  }
+  return sizeof(image_header) + count * sizeof(image_entry) + strings;
+}
+
+void image_builder::write(std::ostream& output, std::uint64_t data_offset,
+                          std::uint64_t data_size, std::uint64_t source_size,
+                          std::int64_t source_time) const {
+  std::vector<const node*> order{&root_};
+  std::vector<const std::string*> names{nullptr};
+  std::vector<image_entry> entries;
+  std::string strings;
+  for (std::size_t i = 0; i < order.size(); ++i) {  // breadth first
+    const auto& current = *order[i];
+    if (order.size() + current.children.size() >
+        std::numeric_limits<std::uint32_t>::max()) {
+      throw error(error_code::file_too_large, "too many image entries");
+    }
+    auto entry = current.entry;
+    if (names[i] != nullptr) {
+      entry.name_offset = strings.size();
+      entry.name_size = static_cast<std::uint32_t>(names[i]->size());
+      strings += *names[i];
+    }
+    if ((entry.mode & 0170000u) == 0120000u) {
+      entry.data_offset = strings.size();
+      strings += current.target;
+    } else if ((entry.mode & 0170000u) != 0040000u) {
+      entry.data_offset += data_offset;
+    }
+    entry.first_child = static_cast<std::uint32_t>(order.size());
+    entry.child_count = static_cast<std::uint32_t>(current.children.size());
+    for (const auto& child : current.children) {
+      order.push_back(child.second.get());
+      names.push_back(&child.first);
+    }
+    entries.push_back(entry);
+  }
+  image_header header{};
+  std::copy(image_index::magic, image_index::magic + sizeof(header.magic),
+            header.magic);
+  header.version = image_index::version;
+  header.entry_count = static_cast<std::uint32_t>(entries.size());
+  header.entries_offset = sizeof(image_header);
+  header.strings_offset =
+      header.entries_offset + entries.size() * sizeof(image_entry);
+  header.strings_size = strings.size();
+  header.data_offset = data_offset;
+  header.data_size = data_size;
+  header.source_size = source_size;
+  header.source_time = source_time;
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(image_entry));
+  output.write(strings.data(), strings.size());
+}
+
+image_builder::node& image_builder::insert(const Path& path) {
+  auto* current = &root_;
+  for (const auto& component : path.relative_path()) {
+    if (component == ".") {
+      continue;
+    }
+    auto& child = current->children[component.string()];
+    if (!child) {
+      child.reset(new node);
+      child->entry.mode = default_directory_mode;
+    }
+    current = child.get();
+  }
+  return *current;
+}
+
+void build_image(filesystem& source, const Path& root, const Path& output) {
+  image_builder builder;
+  std::vector<pending_file> files;
+  std::uint64_t data_size = 0;
+  std::deque<std::pair<Path, Path>> directories{{root, Path()}};
+  builder.add_directory(Path(), source.status(root),
+                        write_time(source, root));
+  while (!directories.empty()) {
+    auto directory = directories.front();
+    directories.pop_front();
+    for (auto& entry : source.read_directory_entries(directory.first)) {
+      auto name = entry.path().filename();
+      if (name == "." || name == "..") {
+        continue;
+      }
+      auto relative = directory.second / name;
+      auto status = entry.symlink_status();
+      auto time = status.type() == file_type::symlink
+                      ? link_time(source, entry.path())
+                      : write_time(source, entry.path());
+      switch (status.type()) {
+        case file_type::directory:
+          builder.add_directory(relative, status, time);
+          directories.emplace_back(entry.path(), relative);
+          break;
+        case file_type::symlink:
+          builder.add_symlink(relative, time,
+                              source.read_symlink(entry.path()));
+          break;
+        case file_type::regular: {
+          auto size = entry.file_size();
+          data_size = align(data_size, extent_alignment);
+          builder.add_file(relative, status, time, size, data_size);
+          files.push_back(pending_file{entry.path(), size, data_size});
+          data_size += size;
+          break;
+        }
+        default:
+          builder.add_file(relative, status, time, 0, 0);
+          break;
+      }
+    }
+  }
+  auto data_offset = align(builder.metadata_size(), extent_alignment);
+  std::ofstream stream(output.string(), std::ios::binary | std::ios::trunc);
+  builder.write(stream, data_offset, data_size);
+  auto position = builder.metadata_size();
+  std::vector<char> chunk(chunk_size);
+  for (const auto& file : files) {
+    pad(stream, position, data_offset + file.offset);
+    write_data(source, file, chunk, stream);
+    position = data_offset + file.offset + file.size;
+  }
+  if (!stream.flush()) {
+    throw error(error_code::io_error, output.string());
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,69 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/image_index.h>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** Collects a tree of entries and serializes it as image metadata
+ *
+ * Missing parent directories are created implicitly, so entries may be added
+ * in any order. */
+class image_builder {
+ public:
+  image_builder();
+
+  /** Add a directory, or update one created implicitly */
+  void add_directory(const Path& path, file_status status,
+                     std::time_t last_write_time);
+
+  /** Add a regular or special file whose data starts at data_offset
+   *
+   * The offset is relative to the data_offset later passed to write. */
+  void add_file(const Path& path, file_status status,
+                std::time_t last_write_time, std::uint64_t size,
+                std::uint64_t data_offset);
+
+  /** Add a symbolic link */
+  void add_symlink(const Path& path, std::time_t last_write_time,
+                   const Path& target);
+
+  /** Number of bytes write will produce */
+  std::uint64_t metadata_size() const;
+
+  /** Write header, entries and string table
+   *
+   * @param data_offset Added to the data offset of every file
+   * @param data_size Recorded in the header
+   * @param source_size,source_time Describe the file the data lives in, when
+   *        it is not part of the image
+   * @throws error(file_too_large) if the tree has too many entries */
+  void write(std::ostream& output, std::uint64_t data_offset,
+             std::uint64_t data_size, std::uint64_t source_size = 0,
+             std::int64_t source_time = 0) const;
+
+ private:
+  struct node {
+    image_entry entry{};
+    std::string target;
+    std::map<std::string, std::unique_ptr<node>> children;
+  };
+
+  node& insert(const Path& path);
+
+  node root_;
+};
+
+/** Serialize the tree at root of source into an image file
+ *
+ * File data is stored after the metadata in extents aligned to 4 KiB.
+ *
+ * @param output Path of the image on the host */
+void build_image(filesystem& source, const Path& root, const Path& output);
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,170 @@
+#include <drivex/directory_entry.h>
+#include <drivex/image_filesystem.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+bool is_type(const image_entry& entry, unsigned int type) {
+  return (entry.mode & 0170000u) == type;
+}
+
+}  // namespace
+
+image_filesystem::image_filesystem(const Path& image)
+    : image_filesystem(metadata{map(image), std::string()}) {}
+
+image_filesystem::image_filesystem(metadata source)
+    : metadata_(std::move(source)),
+      index_(metadata_.buffer.empty()
+                 ? static_cast<const char*>(metadata_.region.get_address())
+                 : metadata_.buffer.data(),
+             metadata_.buffer.empty() ? metadata_.region.get_size()
+                                      : metadata_.buffer.size()) {}
+
+boost::interprocess::mapped_region image_filesystem::map(const Path& file) {
+  namespace ipc = boost::interprocess;
+  try {  // the mapping outlives the file_mapping
+    ipc::file_mapping mapping(file.string().c_str(), ipc::read_only);
+    return ipc::mapped_region(mapping, ipc::read_only);
+  } catch (const ipc::interprocess_exception& e) {
+    throw error(error_code::io_error, file.string() + ": " + e.what());
+  }
+}
+
+void image_filesystem::read_data(const image_entry& entry, char* output,
+                                 std::size_t count,
+                                 std::uint64_t offset) const {
+  const auto& region = metadata_.region;
+  if (entry.data_offset > region.get_size() ||
+      entry.size > region.get_size() - entry.data_offset) {
+    throw error(error_code::io_error, "image data out of range");
+  }
+  auto data = static_cast<const char*>(region.get_address());
+  std::memcpy(output, data + entry.data_offset + offset, count);
+}
+
+const image_index& image_filesystem::index() const noexcept { return index_; }
+
+std::uintmax_t image_filesystem::file_size(const Path& path) const {
+  return lookup(path).size;
+}
+
+space_info image_filesystem::space(const Path& path) const {
+  (void)path;
+  auto info = space_info{};
+  const auto& header = index_.header();
+  info.capacity = header.source_size != 0 ? header.source_size
+                                          : metadata_.region.get_size();
+  return info;
+}
+
+file_status image_filesystem::status(const Path& path) const {
+  return image_index::status(resolve(path));
+}
+
+file_status image_filesystem::symlink_status(const Path& path) const {
+  return image_index::status(lookup(path));
+}
+
+Path image_filesystem::read_symlink(const Path& path) const {
+  const auto& entry = lookup(path);
+  if (!is_type(entry, 0120000u)) {
+    throw error(error_code::invalid_argument, path.string());
+  }
+  return Path(index_.symlink_target(entry).to_string());
+}
+
+void image_filesystem::open(const Path& path, int flags) {
+  lookup(path);
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC) != 0) {
+    throw error(error_code::read_only_file_system, path.string());
+  }
+}
+
+int image_filesystem::read(const Path& path, string_view& buffer,
+                           uint64_t offset) const {
+  const auto& entry = lookup(path);
+  if (is_type(entry, 0040000u)) {
+    throw error(error_code::is_a_directory, path.string());
+  }
+  if (offset >= entry.size) {
+    return 0;
+  }
+  auto count = std::min<std::uint64_t>(buffer.size(), entry.size - offset);
+  read_data(entry, const_cast<char*>(buffer.data()), count, offset);
+  return static_cast<int>(count);
+}
+
+void image_filesystem::flush(const Path& path) { (void)path; }
+
+void image_filesystem::release(const Path& path, int flags) {
+  (void)path;
+  (void)flags;
+}
+
+std::vector<Path> image_filesystem::read_directory(const Path& path) const {
+  const auto& directory = resolve(path);
+  if (!is_type(directory, 0040000u)) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  auto names = std::vector<Path>{".", ".."};
+  names.reserve(directory.child_count + 2);
+  auto last = index_.children_end(directory);
+  for (auto child = index_.children_begin(directory); child != last;
+       ++child) {
+    names.emplace_back(index_.name(*child).to_string());
+  }
+  return names;
+}
+
+std::vector<directory_entry> image_filesystem::read_directory_entries(
+    const Path& path) const {
+  const auto& directory = resolve(path);
+  if (!is_type(directory, 0040000u)) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  auto entries = std::vector<directory_entry>{};
+  entries.reserve(directory.child_count + 2);
+  entries.emplace_back(*this, path / ".", image_index::status(directory));
+  entries.emplace_back(*this, path / "..",
+                       file_status(file_type::directory));
+  auto last = index_.children_end(directory);
+  for (auto child = index_.children_begin(directory); child != last;
+       ++child) {
+    entries.emplace_back(*this, path / index_.name(*child).to_string(),
+                         image_index::status(*child), child->size,
+                         child->last_write_time);
+  }
+  return entries;
+}
+
+std::time_t image_filesystem::last_write_time(const Path& path) {
+  return lookup(path).last_write_time;
+}
+
+const image_entry& image_filesystem::lookup(const Path& path) const {
+  return find(path, false);
+}
+
+const image_entry& image_filesystem::resolve(const Path& path) const {
+  return find(path, true);
+}
+
+const image_entry& image_filesystem::find(const Path& path,
+                                          bool follow) const {
+  const auto* entry = path.is_absolute()
+                          ? index_.find(path.native(), follow)
+                          : index_.find("/" + path.native(), follow);
+  if (entry == nullptr) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  return *entry;
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,71 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/image_index.h>
+#include <boost/interprocess/mapped_region.hpp>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** Read-only backend serving an image written by build_image
+ *
+ * The image is mapped into memory and used in place: mounting reads nothing
+ * but the header, and status, read and read_symlink resolve paths by binary
+ * search in the mapping and copy straight out of it without allocating. */
+class image_filesystem : public filesystem {
+ public:
+  /** Map the image at a host path
+   *
+   * @throws error(io_error) if it cannot be mapped or is not an image */
+  explicit image_filesystem(const Path& image);
+
+  std::uintmax_t file_size(const Path& path) const override;
+  space_info space(const Path& path) const override;
+  file_status status(const Path& path) const override;
+  file_status symlink_status(const Path& path) const override;
+  Path read_symlink(const Path& path) const override;
+  void open(const Path& path, int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  void flush(const Path& path) override;
+  void release(const Path& path, int flags) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  std::time_t last_write_time(const Path& path) override;
+
+ protected:
+  /** Image metadata, either mapped or held in memory */
+  struct metadata {
+    boost::interprocess::mapped_region region;
+    std::string buffer;
+  };
+
+  /** Serve metadata whose file data lives elsewhere, see read_data */
+  explicit image_filesystem(metadata source);
+
+  /** Map the file at a host path read-only */
+  static boost::interprocess::mapped_region map(const Path& file);
+
+  /** Copy count bytes of the data of a file, starting at offset
+   *
+   * The default implementation copies from the mapped image. */
+  virtual void read_data(const image_entry& entry, char* output,
+                         std::size_t count, std::uint64_t offset) const;
+
+  const image_index& index() const noexcept;
+
+ private:
+  /** Find an entry without following a final symlink */
+  const image_entry& lookup(const Path& path) const;
+
+  /** Find an entry, following symlinks */
+  const image_entry& resolve(const Path& path) const;
+
+  const image_entry& find(const Path& path, bool follow) const;
+
+  metadata metadata_;
+  image_index index_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,174 @@
+#include <drivex/image_index.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const auto directory_mode = 0040000u;
+const auto symlink_mode = 0120000u;
+const auto max_symlink_hops = 40;
+
+bool is_type(const image_entry& entry, unsigned int type) {
+  return (entry.mode & 0170000u) == type;
+}
+
+bool fits(std::uint64_t offset, std::uint64_t size, std::uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+}  // namespace
+
+const char image_index::magic[8] = {'D', 'R', 'V', 'X', 'I', 'M', 'G', '\0'};
+
+image_index::image_index(const char* data, std::size_t size)
+    : data_(data),
+      size_(size),
+      header_(reinterpret_cast<const image_header*>(data)),
+      entries_(nullptr) {
+  if (size < sizeof(image_header) ||
+      std::memcmp(header_->magic, magic, sizeof(magic)) != 0) {
+    throw error(error_code::io_error, "not a drivex image");
+  }
+  if (header_->version != version) {
+    throw error(error_code::io_error, "unsupported drivex image version");
+  }
+  const auto& h = *header_;
+  if (h.entry_count == 0 || h.entries_offset % alignof(image_entry) != 0 ||
+      !fits(h.entries_offset,
+            std::uint64_t(h.entry_count) * sizeof(image_entry), size) ||
+      !fits(h.strings_offset, h.strings_size, size)) {
+    throw error(error_code::io_error, "corrupt drivex image");
+  }
+  entries_ = reinterpret_cast<const image_entry*>(data + h.entries_offset);
+  if (!is_type(root(), directory_mode)) {
+    throw error(error_code::io_error, "corrupt drivex image");
+  }
+}
+
+const image_header& image_index::header() const noexcept { return *header_; }
+
+const image_entry& image_index::root() const noexcept { return entries_[0]; }
+
+const image_entry* image_index::find(string_view path, bool follow) const {
+  const auto whole = path;
+  const auto* entry = &root();
+  while (!path.empty()) {
+    auto separator = path.find('/');
+    auto component = path.substr(0, separator);
+    path = separator == string_view::npos ? string_view()
+                                          : path.substr(separator + 1);
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    if (component == "..") {
+      return walk(whole, follow);
+    }
+    if (!is_type(*entry, directory_mode)) {
+      throw error(error_code::not_a_directory);
+    }
+    entry = find_child(*entry, component);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+    if (is_type(*entry, symlink_mode) &&
+        (follow || separator != string_view::npos)) {
+      return walk(whole, follow);
+    }
+  }
+  return entry;
+}
+
+const image_entry* image_index::walk(string_view path, bool follow) const {
+  auto ancestors = std::vector<const image_entry*>{&root()};
+  auto pending = path.to_string();
+  auto position = std::size_t{0};
+  auto hops = 0;
+  while (position < pending.size()) {
+    auto separator = pending.find('/', position);
+    auto last = separator == std::string::npos;
+    auto end = last ? pending.size() : separator;
+    auto component = string_view(pending).substr(position, end - position);
+    position = last ? end : end + 1;
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    if (!is_type(*ancestors.back(), directory_mode)) {
+      throw error(error_code::not_a_directory);
+    }
+    if (component == "..") {
+      if (ancestors.size() > 1) {
+        ancestors.pop_back();
+      }
+      continue;
+    }
+    const auto* entry = find_child(*ancestors.back(), component);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+    if (!is_type(*entry, symlink_mode) || (last && !follow)) {
+      ancestors.push_back(entry);
+      continue;
+    }
+    if (++hops > max_symlink_hops) {
+      throw error(error_code::too_many_symbolic_link_levels);
+    }
+    auto target = symlink_target(*entry);
+    if (!target.empty() && target.front() == '/') {
+      ancestors.resize(1);
+    }
+    pending = target.to_string() + "/" + pending.substr(position);
+    position = 0;
+  }
+  return ancestors.back();
+}
+
+const image_entry* image_index::find_child(const image_entry& directory,
+                                           string_view name) const {
+  auto first = children_begin(directory);
+  auto last = children_end(directory);
+  auto found = std::lower_bound(
+      first, last, name, [this](const image_entry& entry, string_view key) {
+        return this->name(entry) < key;
+      });
+  return found != last && this->name(*found) == name ? found : nullptr;
+}
+
+const image_entry* image_index::children_begin(
+    const image_entry& directory) const {
+  if (!fits(directory.first_child, directory.child_count,
+            header_->entry_count)) {
+    throw error(error_code::io_error, "corrupt drivex image");
+  }
+  return entries_ + directory.first_child;
+}
+
+const image_entry* image_index::children_end(
+    const image_entry& directory) const {
+  return children_begin(directory) + directory.child_count;
+}
+
+string_view image_index::name(const image_entry& entry) const {
+  return string_at(entry.name_offset, entry.name_size);
+}
+
+string_view image_index::symlink_target(const image_entry& entry) const {
+  return string_at(entry.data_offset, entry.size);
+}
+
+file_status image_index::status(const image_entry& entry) {
+  return file_status(entry.mode);
+}
+
+string_view image_index::string_at(std::uint64_t offset,
+                                   std::uint64_t size) const {
+  if (!fits(offset, size, header_->strings_size)) {
+    throw error(error_code::io_error, "corrupt drivex image");
+  }
+  return string_view(data_ + header_->strings_offset + offset, size);
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,95 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <cstdint>
+
+namespace lockblox {
+namespace drivex {
+
+/** Fixed-size header at the start of an image or image index
+ *
+ * All integers are stored in host byte order.  Offsets are relative to the
+ * start of the header. */
+struct image_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t entry_count;
+  std::uint64_t entries_offset;
+  std::uint64_t strings_offset;
+  std::uint64_t strings_size;
+  std::uint64_t data_offset;  // first data extent, if the data is embedded
+  std::uint64_t data_size;
+  std::uint64_t source_size;  // of the file the entries describe, if any
+  std::int64_t source_time;
+};
+
+/** One file, directory or symlink
+ *
+ * Entries are stored breadth first with the root at index zero, so the
+ * children of a directory are contiguous; they are sorted by name. */
+struct image_entry {
+  std::uint64_t name_offset;  // into the string table
+  std::uint64_t data_offset;  // file data, or symlink target in the strings
+  std::uint64_t size;         // of the data or symlink target
+  std::int64_t last_write_time;
+  std::uint32_t name_size;
+  std::uint32_t mode;  // as in st_mode
+  std::uint32_t first_child;
+  std::uint32_t child_count;
+};
+
+static_assert(sizeof(image_header) == 72, "image_header must be packed");
+static_assert(sizeof(image_entry) == 48, "image_entry must be packed");
+
+/** Read-only view of image metadata held in memory, typically a mapping
+ *
+ * Lookups binary search each path component among the children of the
+ * previous one.  They allocate nothing unless the path goes through a
+ * symlink or "..", which take a slower walk that keeps the ancestors. */
+class image_index {
+ public:
+  static const char magic[8];
+  static const std::uint32_t version = 1;
+
+  /** Wrap size bytes at data, which must outlive the index
+   *
+   * @throws error(io_error) if data does not hold a valid index */
+  image_index(const char* data, std::size_t size);
+
+  const image_header& header() const noexcept;
+  const image_entry& root() const noexcept;
+
+  /** Find an absolute path
+   *
+   * Symlinks in leading components are followed, and so is one in the last
+   * component if follow is set or the path ends in a slash.
+   *
+   * @return nullptr if the path does not exist
+   * @throws error(not_a_directory) if a leading component is not one
+   * @throws error(too_many_symbolic_link_levels) after 40 symlinks */
+  const image_entry* find(string_view path, bool follow = false) const;
+
+  /** Find a direct child of a directory, or nullptr */
+  const image_entry* find_child(const image_entry& directory,
+                                string_view name) const;
+
+  /** Children of a directory, in name order */
+  const image_entry* children_begin(const image_entry& directory) const;
+  const image_entry* children_end(const image_entry& directory) const;
+
+  string_view name(const image_entry& entry) const;
+  string_view symlink_target(const image_entry& entry) const;
+
+  static file_status status(const image_entry& entry);
+
+ private:
+  string_view string_at(std::uint64_t offset, std::uint64_t size) const;
+  /** find() for paths that need symlinks or ".." resolved */
+  const image_entry* walk(string_view path, bool follow) const;
+
+  const char* data_;
+  std::size_t size_;
+  const image_header* header_;
+  const image_entry* entries_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,117 @@
+#include <drivex/invalidation_queue.h>
+#include <algorithm>
+#include <limits>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const auto end_of_file = std::numeric_limits<std::uint64_t>::max();
+
+}  // namespace
+
+invalidation_queue::invalidation_queue(inode_sink inode, entry_sink entry,
+                                       std::chrono::milliseconds delay,
+                                       std::size_t batch_limit)
+    : inode_sink_(std::move(inode)),
+      entry_sink_(std::move(entry)),
+      delay_(delay),
+      batch_limit_(std::max<std::size_t>(batch_limit, 1)),
+      stopping_(false),
+      thread_([this]() { run(); }) {}
+
+invalidation_queue::~invalidation_queue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+  flush();
+}
+
+void invalidation_queue::invalidate_attributes(std::uint64_t node) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  inodes_[node];  // an existing data invalidation already covers this
+  added();
+}
+
+void invalidation_queue::invalidate_data(std::uint64_t node,
+                                         std::uint64_t offset,
+                                         std::uint64_t length) {
+  auto end = length == 0 || length > end_of_file - offset ? end_of_file
+                                                          : offset + length;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& pending = inodes_[node];
+  if (pending.data) {  // over-invalidating the gap is harmless
+    pending.start = std::min(pending.start, offset);
+    pending.end = std::max(pending.end, end);
+  } else {
+    pending.data = true;
+    pending.start = offset;
+    pending.end = end;
+  }
+  added();
+}
+
+void invalidation_queue::invalidate_entry(std::uint64_t parent,
+                                          const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.emplace(parent, name);
+  added();
+}
+
+void invalidation_queue::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  deliver(lock);
+}
+
+std::size_t invalidation_queue::pending() const {
+  return inodes_.size() + entries_.size();
+}
+
+void invalidation_queue::added() {
+  auto count = pending();
+  if (count == 1 || count >= batch_limit_) {  // start the delay, or cut it
+    wake_.notify_one();
+  }
+}
+
+void invalidation_queue::deliver(std::unique_lock<std::mutex>& lock) {
+  inode_map inodes;
+  entry_set entries;
+  inodes.swap(inodes_);
+  entries.swap(entries_);
+  lock.unlock();
+  for (const auto& entry : entries) {
+    entry_sink_(entry.first, entry.second);
+  }
+  for (const auto& inode : inodes) {
+    const auto& pending = inode.second;
+    if (!pending.data) {
+      inode_sink_(inode.first, -1, 0);
+    } else if (pending.end == end_of_file) {
+      inode_sink_(inode.first, pending.start, 0);
+    } else {
+      inode_sink_(inode.first, pending.start, pending.end - pending.start);
+    }
+  }
+  lock.lock();
+}
+
+void invalidation_queue::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    if (pending() == 0) {
+      wake_.wait(lock);
+      continue;
+    }
+    wake_.wait_for(lock, delay_, [this]() {
+      return stopping_ || pending() >= batch_limit_;
+    });
+    deliver(lock);
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
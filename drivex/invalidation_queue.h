@@ -0,0 +1,84 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace lockblox {
+namespace drivex {
+
+/** Batches and coalesces kernel cache invalidations
+ *
+ * Invalidations are collected for a short delay, or until batch_limit are
+ * pending, and then delivered from a background thread.  Repeated requests for
+ * the same inode merge into one covering range, invalidating data implies
+ * invalidating attributes, and duplicate entry requests are dropped.  Sending
+ * from a dedicated thread also keeps notifications out of request handlers,
+ * where the kernel may be waiting on the very inode being invalidated. */
+class invalidation_queue {
+ public:
+  /** Receives (node, offset, length) with the fuse_lowlevel_notify_inval_inode
+   * meaning: a negative offset invalidates attributes only, a zero length
+   * extends to the end of the file */
+  using inode_sink =
+      std::function<void(std::uint64_t, std::int64_t, std::int64_t)>;
+  /** Receives (parent node, name) */
+  using entry_sink = std::function<void(std::uint64_t, const std::string&)>;
+
+  invalidation_queue(inode_sink inode, entry_sink entry,
+                     std::chrono::milliseconds delay =
+                         std::chrono::milliseconds(10),
+                     std::size_t batch_limit = 1024);
+  invalidation_queue(const invalidation_queue&) = delete;
+  invalidation_queue& operator=(const invalidation_queue&) = delete;
+
+  /** Deliver whatever is pending and stop */
+  ~invalidation_queue();
+
+  /** Drop cached attributes of node */
+  void invalidate_attributes(std::uint64_t node);
+
+  /** Drop cached attributes and data of node; a length of zero extends to the
+   * end of the file */
+  void invalidate_data(std::uint64_t node, std::uint64_t offset = 0,
+                       std::uint64_t length = 0);
+
+  /** Drop the cached lookup of name in parent */
+  void invalidate_entry(std::uint64_t parent, const std::string& name);
+
+  /** Deliver everything pending now, on the calling thread */
+  void flush();
+
+ private:
+  struct pending_inode {
+    bool data = false;  // else attributes only
+    std::uint64_t start = 0;
+    std::uint64_t end = 0;  // exclusive
+  };
+  using inode_map = std::unordered_map<std::uint64_t, pending_inode>;
+  using entry_set = std::set<std::pair<std::uint64_t, std::string>>;
+
+  std::size_t pending() const;
+  void added();
+  void deliver(std::unique_lock<std::mutex>& lock);
+  void run();
+
+  const inode_sink inode_sink_;
+  const entry_sink entry_sink_;
+  const std::chrono::milliseconds delay_;
+  const std::size_t batch_limit_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  inode_map inodes_;
+  entry_set entries_;
+  bool stopping_;
+  std::thread thread_;
+};
+}  // namespace drivex
+}  // namespace lockblox
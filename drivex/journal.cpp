@@ -0,0 +1,302 @@
+#include <drivex/crc32c.h>
+#include <drivex/journal.h>
+#include <boost/filesystem/operations.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+struct record_header {
+  std::uint64_t sequence;
+  std::uint32_t size;
+  std::uint32_t crc;  // of sequence, size and data
+};
+
+static_assert(sizeof(record_header) == 16, "record_header must be packed");
+
+std::uint32_t record_crc(const record_header& header, const string_view& data) {
+  auto crc = crc32c(string_view(reinterpret_cast<const char*>(&header),
+                                offsetof(record_header, crc)));
+  return crc32c(data, crc);
+}
+
+void write_all(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    auto result = ::write(fd, data, size);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      throw error(error_code::io_error, "journal write failed");
+    }
+    data += result;
+    size -= result;
+  }
+}
+
+void sync_directory(const Path& directory) {
+  auto fd = ::open(directory.string().c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+std::uint64_t host_size(const Path& path) {
+  struct stat file_stat;
+  if (::stat(path.string().c_str(), &file_stat) != 0) {
+    return 0;
+  }
+  return static_cast<std::uint64_t>(file_stat.st_size);
+}
+
+}  // namespace
+
+journal::journal(const Path& directory, journal_settings settings)
+    : directory_(directory),
+      settings_(settings),
+      fd_(-1),
+      next_(1),
+      durable_(0),
+      size_(0),
+      unsynced_(0),
+      flushed_(0),
+      writing_(false),
+      failed_(false) {
+  boost::system::error_code code;
+  boost::filesystem::create_directories(directory_, code);
+  if (code) {
+    throw error(error_code::io_error, directory_.string());
+  }
+}
+
+journal::~journal() {
+  if (fd_ >= 0) {
+    try {
+      commit(next_ - 1);
+    } catch (const error&) {  // nothing sensible to do with it here
+    }
+    ::close(fd_);
+  }
+}
+
+void journal::replay(std::uint64_t after,
+                     const std::function<void(const string_view&)>& apply) {
+  std::vector<std::uint64_t> found;
+  boost::system::error_code code;
+  for (boost::filesystem::directory_iterator it(directory_, code), end;
+       !code && it != end; it.increment(code)) {
+    auto name = it->path().filename().string();
+    if (name.size() == 20 && name.compare(16, 4, ".log") == 0 &&
+        name.find_first_not_of("0123456789abcdef") == 16) {
+      found.push_back(std::stoull(name.substr(0, 16), nullptr, 16));
+    }
+  }
+  std::sort(found.begin(), found.end());
+  auto last = after;
+  std::uint64_t expected = 0;  // next record number, once one is seen
+  auto torn = false;
+  for (auto first : found) {
+    auto path = segment(first);
+    if (torn) {  // nothing after a torn record can be trusted
+      ::unlink(path.string().c_str());
+      continue;
+    }
+    std::ifstream input(path.string(), std::ios::binary);
+    std::string data{std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>()};
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+      record_header header;
+      if (data.size() - offset < sizeof(header)) {
+        torn = true;
+        break;
+      }
+      std::memcpy(&header, data.data() + offset, sizeof(header));
+      if (header.size > data.size() - offset - sizeof(header) ||
+          (expected != 0 && header.sequence != expected)) {
+        torn = true;
+        break;
+      }
+      auto record = string_view(data.data() + offset + sizeof(header),
+                                header.size);
+      if (record_crc(header, record) != header.crc) {
+        torn = true;
+        break;
+      }
+      if (header.sequence > after) {
+        apply(record);
+        last = header.sequence;
+      }
+      expected = header.sequence + 1;
+      offset += sizeof(header) + header.size;
+    }
+    if (torn &&
+        ::truncate(path.string().c_str(), static_cast<off_t>(offset)) != 0) {
+      throw error(error_code::io_error, path.string());
+    }
+    segments_.push_back(first);
+    size_ += offset;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  next_ = std::max(last, expected == 0 ? 0 : expected - 1) + 1;
+  durable_ = next_ - 1;
+  start_segment();
+}
+
+std::uint64_t journal::append(const string_view& record) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (failed_) {
+    throw error(error_code::io_error, "journal failed");
+  }
+  if (fd_ < 0) {
+    throw error(error_code::invalid_argument, "journal not replayed");
+  }
+  record_header header;
+  header.sequence = next_++;
+  header.size = static_cast<std::uint32_t>(record.size());
+  header.crc = record_crc(header, record);
+  pending_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  pending_.append(record.data(), record.size());
+  size_ += sizeof(header) + record.size();
+  unsynced_ += sizeof(header) + record.size();
+  if (pending_.size() >= settings_.buffer_bytes) {
+    written_.wait(lock, [this]() { return !writing_; });
+    if (!failed_ && !pending_.empty()) {
+      write_pending(lock, false);
+    }
+  }
+  return header.sequence;
+}
+
+std::uint64_t journal::last() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return next_ - 1;
+}
+
+std::uint64_t journal::durable() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return durable_;
+}
+
+void journal::commit(std::uint64_t sequence) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (failed_) {
+      throw error(error_code::io_error, "journal failed");
+    }
+    if (durable_ >= sequence) {
+      return;
+    }
+    if (writing_) {  // join the batch being written, or the next one
+      written_.wait(lock);
+    } else {
+      write_pending(lock, true);
+    }
+  }
+}
+
+void journal::checkpoint(std::uint64_t sequence) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  written_.wait(lock, [this]() { return !writing_; });
+  if (segments_.empty()) {
+    return;
+  }
+  if (!pending_.empty()) {
+    write_pending(lock, true);
+  }
+  if (fd_ >= 0 && next_ > segments_.back()) {  // later records go elsewhere
+    ::close(fd_);
+    fd_ = -1;
+    start_segment();
+  }
+  while (segments_.size() > 1 && segments_[1] - 1 <= sequence) {
+    ::unlink(segment(segments_.front()).string().c_str());
+    segments_.erase(segments_.begin());
+  }
+  size_ = 0;
+  for (auto first : segments_) {
+    size_ += host_size(segment(first));
+  }
+}
+
+std::uint64_t journal::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+bool journal::checkpoint_due() const {
+  return size() >= settings_.checkpoint_bytes;
+}
+
+bool journal::flush_due() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return unsynced_ >= settings_.flush_bytes;
+}
+
+Path journal::segment(std::uint64_t first) const {
+  char name[21];
+  std::snprintf(name, sizeof(name), "%016llx.log",
+                static_cast<unsigned long long>(first));
+  return directory_ / name;
+}
+
+void journal::start_segment() {
+  auto path = segment(next_);
+  fd_ = ::open(path.string().c_str(),
+               O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    failed_ = true;
+    throw error(error_code::io_error, path.string());
+  }
+  if (segments_.empty() || segments_.back() != next_) {
+    segments_.push_back(next_);
+  }
+  sync_directory(directory_);
+}
+
+void journal::write_pending(std::unique_lock<std::mutex>& lock,
+                            bool synced) {
+  writing_ = true;
+  auto batch = std::move(pending_);
+  pending_.clear();
+  auto last = next_ - 1;
+  auto bytes = flushed_ + batch.size();
+  auto fd = fd_;
+  lock.unlock();
+  auto written = true;
+  try {
+    write_all(fd, batch.data(), batch.size());
+    written = !synced || ::fdatasync(fd) == 0;
+  } catch (const error&) {
+    written = false;
+  }
+  lock.lock();
+  writing_ = false;
+  if (!written) {
+    failed_ = true;  // the batch is lost, so later records cannot follow it
+  } else if (synced) {
+    durable_ = last;
+    unsynced_ -= bytes;
+    flushed_ = 0;
+  } else {
+    flushed_ = bytes;
+  }
+  written_.notify_all();
+  if (!written) {
+    throw error(error_code::io_error, directory_.string());
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
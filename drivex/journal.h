@@ -0,0 +1,115 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+struct journal_settings {
+  /** Log size after which checkpoint_due becomes true */
+  std::uint64_t checkpoint_bytes = 64u << 20u;
+  /** Records buffered in memory before append writes them out, unsynced */
+  std::size_t buffer_bytes = 1u << 20u;
+  /** Bytes logged but not yet durable after which flush_due becomes true */
+  std::uint64_t flush_bytes = 16u << 20u;
+  /** How often an owner commits in the background; zero to wait for
+   * flush_due */
+  std::chrono::milliseconds flush_interval = std::chrono::seconds(5);
+};
+
+/** Append-only write-ahead log of opaque records in a host directory
+ *
+ * Records are numbered from one and buffered in memory by append, which
+ * writes the buffer out without syncing once it holds buffer_bytes.  commit
+ * writes them out and syncs them; concurrent commits are grouped, so that
+ * one thread writes and syncs everything appended so far while the others
+ * wait for it, and a burst of operations costs a single sync.  Owners that
+ * do not wait for every commit flush in the background, every
+ * flush_interval or sooner once flush_due.
+ *
+ * The log is kept in segments, one file per range of records.  Once the
+ * owner has saved a checkpoint of its state covering records up to some
+ * number, checkpoint drops the segments it makes redundant.  After a crash
+ * replay hands back the records that follow the checkpoint; a record torn
+ * by the crash ends the log.
+ *
+ * Each record is stored as its number, size and CRC-32C, then the data,
+ * in host byte order. */
+class journal {
+ public:
+  /** @throws error(io_error) if the directory cannot be created */
+  explicit journal(const Path& directory,
+                   journal_settings settings = journal_settings());
+
+  ~journal();
+
+  journal(const journal&) = delete;
+  journal& operator=(const journal&) = delete;
+
+  /** Pass each intact record numbered after `after` to apply, in order,
+   * then start a new segment for appends
+   *
+   * Must be called once, before anything is appended. */
+  void replay(std::uint64_t after,
+              const std::function<void(const string_view&)>& apply);
+
+  /** Buffer a record, which is not durable until committed
+   *
+   * @return its number */
+  std::uint64_t append(const string_view& record);
+
+  /** Number of the last record appended */
+  std::uint64_t last() const;
+
+  /** Number of the last record known to be durable */
+  std::uint64_t durable() const;
+
+  /** Make the records up to a number durable
+   *
+   * @throws error(io_error) if the log cannot be written, after which
+   *         every commit fails */
+  void commit(std::uint64_t sequence);
+
+  /** Note a durable checkpoint of the records up to a number and delete
+   * the segments holding only those */
+  void checkpoint(std::uint64_t sequence);
+
+  /** Bytes logged since the last checkpoint */
+  std::uint64_t size() const;
+
+  /** Whether enough has been logged that a checkpoint is worthwhile */
+  bool checkpoint_due() const;
+
+  /** Whether enough is waiting to be made durable that a commit is */
+  bool flush_due() const;
+
+ private:
+  Path segment(std::uint64_t first) const;
+  /** Open a new segment whose first record is next_ */
+  void start_segment();
+  /** Write pending records and sync the log if synced; the mutex is held */
+  void write_pending(std::unique_lock<std::mutex>& lock, bool synced);
+
+  Path directory_;
+  journal_settings settings_;
+  mutable std::mutex mutex_;
+  std::condition_variable written_;
+  std::vector<std::uint64_t> segments_;  // first record of each, ascending
+  int fd_;
+  std::string pending_;
+  std::uint64_t next_;
+  std::uint64_t durable_;
+  std::uint64_t size_;
+  std::uint64_t unsynced_;  // bytes appended after the last durable record
+  std::uint64_t flushed_;   // of those, bytes written out
+  bool writing_;
+  bool failed_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,354 @@
+#include <drivex/lock_manager.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+#if !WIN32
+#include <sys/file.h>
+#endif
+
+#ifndef LOCK_SH
+#define LOCK_SH 1
+#define LOCK_EX 2
+#define LOCK_NB 4
+#define LOCK_UN 8
+#endif
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const auto end_of_file = std::numeric_limits<std::uint64_t>::max();
+
+std::uint64_t range_end(const file_lock& lock) {
+  if (lock.length == 0 || lock.length > end_of_file - lock.start) {
+    return end_of_file;
+  }
+  return lock.start + lock.length;
+}
+
+}  // namespace
+
+lock_manager::lock_manager(std::size_t shard_count) {
+  shard_count = std::max<std::size_t>(shard_count, 1);
+  for (std::size_t i = 0; i < shard_count; ++i) {
+    shards_.emplace_back(new shard);
+  }
+}
+
+void lock_manager::lock(const Path& path, int command, file_lock& lock,
+                        std::uint64_t owner,
+                        const interrupt_check& interrupted) {
+  auto key = path.string();
+  auto& s = shard_for(key);
+  std::unique_lock<std::mutex> guard(s.mutex);
+  auto& slot = s.files[key];
+  if (!slot) {
+    slot.reset(new file_locks);
+  }
+  auto& file = *slot;
+  auto start = lock.start;
+  auto end = range_end(lock);
+  switch (command) {
+    case F_GETLK:
+      if (!find_conflict(file, owner, lock.type, start, end, &lock)) {
+        lock.type = lock_type::unlock;
+      }
+      break;
+    case F_SETLK:
+    case F_SETLKW:
+      if (lock.type == lock_type::unlock) {
+        auto owned = file.records.find(owner);
+        if (owned != file.records.end()) {
+          remove_range(owned->second, start, end);
+          if (owned->second.empty()) {
+            file.records.erase(owned);
+          }
+          file.released.notify_all();
+        }
+        break;
+      }
+      {
+        waiter self;
+        self.owner = owner;
+        self.key = &key;
+        wait_scope scope(*this, self);
+        while (find_conflict(file, owner, lock.type, start, end, nullptr)) {
+          if (command == F_SETLK) {
+            collect(s, key);
+            throw error(error_code::resource_unavailable_try_again);
+          }
+          if (!block_on(self, conflicting_owners(file, owner, lock.type,
+                                                 start, end))) {
+            collect(s, key);
+            throw error(error_code::resource_deadlock_would_occur);
+          }
+          if (!wait(guard, file, self, interrupted)) {
+            collect(s, key);
+            throw error(error_code::interrupted);
+          }
+        }
+      }
+      {
+        auto& owned = file.records[owner];
+        remove_range(owned, start, end);
+        insert_range(owned, start, end, lock.type, lock.pid);
+      }
+      file.released.notify_all();  // a downgrade may admit readers
+      break;
+    default:
+      collect(s, key);
+      throw error(error_code::invalid_argument);
+  }
+  collect(s, key);
+}
+
+void lock_manager::flock(const Path& path, int operation, std::uint64_t owner,
+                         const interrupt_check& interrupted) {
+  auto key = path.string();
+  auto& s = shard_for(key);
+  std::unique_lock<std::mutex> guard(s.mutex);
+  auto& slot = s.files[key];
+  if (!slot) {
+    slot.reset(new file_locks);
+  }
+  auto& file = *slot;
+  auto type = lock_type::unlock;
+  switch (operation & ~LOCK_NB) {
+    case LOCK_SH:
+      type = lock_type::read;
+      break;
+    case LOCK_EX:
+      type = lock_type::write;
+      break;
+    case LOCK_UN:
+      file.flocks.erase(owner);
+      file.released.notify_all();
+      collect(s, key);
+      return;
+    default:
+      collect(s, key);
+      throw error(error_code::invalid_argument);
+  }
+  waiter self;
+  self.owner = owner;
+  self.key = &key;
+  wait_scope scope(*this, self);
+  while (flock_conflict(file, owner, type)) {
+    if ((operation & LOCK_NB) != 0) {
+      collect(s, key);
+      throw error(error_code::resource_unavailable_try_again);
+    }
+    block_on(self, {});  // flock(2) does not detect deadlocks
+    if (!wait(guard, file, self, interrupted)) {
+      collect(s, key);
+      throw error(error_code::interrupted);
+    }
+  }
+  file.flocks[owner] = type;
+  file.released.notify_all();
+}
+
+void lock_manager::release(const Path& path, std::uint64_t owner) {
+  auto key = path.string();
+  auto& s = shard_for(key);
+  std::lock_guard<std::mutex> guard(s.mutex);
+  auto found = s.files.find(key);
+  if (found != s.files.end() && found->second->records.erase(owner) > 0) {
+    found->second->released.notify_all();
+    collect(s, key);
+  }
+}
+
+void lock_manager::interrupt(std::uint64_t owner) {
+  auto keys = std::vector<std::string>{};
+  {
+    std::lock_guard<std::mutex> guard(waits_mutex_);
+    auto found = waits_.equal_range(owner);
+    for (auto it = found.first; it != found.second; ++it) {
+      it->second->woken = true;
+      keys.push_back(*it->second->key);
+    }
+  }
+  // The waiter holds its shard mutex from registering until it sleeps, so
+  // this notification cannot slip in before the wait starts
+  for (const auto& key : keys) {
+    auto& s = shard_for(key);
+    std::lock_guard<std::mutex> guard(s.mutex);
+    auto found = s.files.find(key);
+    if (found != s.files.end()) {
+      found->second->released.notify_all();
+    }
+  }
+}
+
+lock_manager::wait_scope::wait_scope(lock_manager& manager, waiter& self)
+    : manager_(manager), self_(self) {}
+
+lock_manager::wait_scope::~wait_scope() {
+  if (!self_.registered) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(manager_.waits_mutex_);
+  auto found = manager_.waits_.equal_range(self_.owner);
+  for (auto it = found.first; it != found.second; ++it) {
+    if (it->second == &self_) {
+      manager_.waits_.erase(it);
+      break;
+    }
+  }
+}
+
+lock_manager::shard& lock_manager::shard_for(const std::string& key) {
+  return *shards_[std::hash<std::string>()(key) % shards_.size()];
+}
+
+bool lock_manager::find_conflict(const file_locks& file, std::uint64_t owner,
+                                 lock_type type, std::uint64_t start,
+                                 std::uint64_t end, file_lock* conflict) {
+  for (const auto& held : file.records) {
+    if (held.first != owner &&
+        owned_conflict(held.second, type, start, end, conflict)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool lock_manager::owned_conflict(const ranges& owned, lock_type type,
+                                  std::uint64_t start, std::uint64_t end,
+                                  file_lock* conflict) {
+  auto it = owned.upper_bound(start);
+  if (it != owned.begin() && std::prev(it)->second.end > start) {
+    --it;
+  }
+  for (; it != owned.end() && it->first < end; ++it) {
+    const auto& r = it->second;
+    if (r.type == lock_type::write || type == lock_type::write) {
+      if (conflict) {
+        conflict->type = r.type;
+        conflict->start = it->first;
+        conflict->length = r.end == end_of_file ? 0 : r.end - it->first;
+        conflict->pid = r.pid;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::uint64_t> lock_manager::conflicting_owners(
+    const file_locks& file, std::uint64_t owner, lock_type type,
+    std::uint64_t start, std::uint64_t end) {
+  auto result = std::vector<std::uint64_t>{};
+  for (const auto& held : file.records) {
+    if (held.first != owner &&
+        owned_conflict(held.second, type, start, end, nullptr)) {
+      result.push_back(held.first);
+    }
+  }
+  return result;
+}
+
+bool lock_manager::flock_conflict(const file_locks& file, std::uint64_t owner,
+                                  lock_type type) {
+  for (const auto& held : file.flocks) {
+    if (held.first != owner &&
+        (held.second == lock_type::write || type == lock_type::write)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void lock_manager::remove_range(ranges& owned, std::uint64_t start,
+                                std::uint64_t end) {
+  auto it = owned.lower_bound(start);
+  if (it != owned.begin() && std::prev(it)->second.end > start) {
+    --it;
+  }
+  while (it != owned.end() && it->first < end) {
+    auto head = it->first;
+    auto r = it->second;
+    it = owned.erase(it);
+    if (head < start) {
+      owned.emplace(head, range{start, r.type, r.pid});
+    }
+    if (r.end > end) {  // ranges of one owner never overlap, so we are done
+      owned.emplace(end, r);
+    }
+  }
+}
+
+void lock_manager::insert_range(ranges& owned, std::uint64_t start,
+                                std::uint64_t end, lock_type type,
+                                std::int64_t pid) {
+  auto next = owned.lower_bound(start);
+  if (next != owned.begin()) {
+    auto previous = std::prev(next);
+    if (previous->second.end == start && previous->second.type == type) {
+      start = previous->first;
+      owned.erase(previous);
+    }
+  }
+  if (next != owned.end() && next->first == end && next->second.type == type) {
+    end = next->second.end;
+    owned.erase(next);
+  }
+  owned.emplace(start, range{end, type, pid});
+}
+
+bool lock_manager::wait(std::unique_lock<std::mutex>& guard, file_locks& file,
+                        waiter& self, const interrupt_check& interrupted) {
+  if (interrupted && interrupted()) {
+    return false;
+  }
+  ++file.waiters;
+  file.released.wait(guard);
+  --file.waiters;
+  if (!self.woken.exchange(false)) {
+    return true;
+  }
+  return interrupted && !interrupted();
+}
+
+bool lock_manager::block_on(waiter& self,
+                            std::vector<std::uint64_t> holders) {
+  std::lock_guard<std::mutex> guard(waits_mutex_);
+  auto pending = holders;
+  auto seen = std::unordered_set<std::uint64_t>{};
+  while (!pending.empty()) {
+    auto next = pending.back();
+    pending.pop_back();
+    if (next == self.owner) {
+      return false;
+    }
+    if (!seen.insert(next).second) {
+      continue;
+    }
+    auto found = waits_.equal_range(next);
+    for (auto it = found.first; it != found.second; ++it) {
+      const auto& theirs = it->second->holders;
+      pending.insert(pending.end(), theirs.begin(), theirs.end());
+    }
+  }
+  self.holders = std::move(holders);
+  if (!self.registered) {
+    waits_.emplace(self.owner, &self);
+    self.registered = true;
+  }
+  return true;
+}
+
+void lock_manager::collect(shard& s, const std::string& key) {
+  auto found = s.files.find(key);
+  if (found != s.files.end()) {
+    const auto& file = *found->second;
+    if (file.records.empty() && file.flocks.empty() && file.waiters == 0) {
+      s.files.erase(found);
+    }
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
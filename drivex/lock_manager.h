@@ -0,0 +1,132 @@
+#pragma once
+#include <drivex/file_lock.h>
+#include <drivex/filesystem.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** POSIX record locks and BSD flocks for backends that opt in
+ *
+ * Backends return a lock_manager from filesystem::locks() to have lock() and
+ * flock() handled for them.  Record locks are kept per file and per owner as
+ * ordered, coalesced ranges, so finding conflicts and splitting ranges costs
+ * O(log n) per owner holding locks on the file.  Files are spread over
+ * independently locked shards, and blocked requests sleep on a condition
+ * variable belonging to their file until a lock there is released or
+ * interrupt() wakes them; nothing polls.
+ *
+ * Blocked F_SETLKW requests also record which owners they wait for.  A request
+ * that would close a cycle in that graph, across any files, fails with
+ * EDEADLK instead of sleeping forever, as it would on a local filesystem. */
+class lock_manager {
+ public:
+  using interrupt_check = std::function<bool()>;
+
+  explicit lock_manager(std::size_t shard_count = 64);
+
+  /** Perform F_GETLK, F_SETLK or F_SETLKW on behalf of owner
+   *
+   * F_GETLK replaces lock with the first conflicting lock, or sets its type
+   * to unlock if there is none.  F_SETLKW waits until the lock can be taken.
+   * If interrupted is given it is checked before sleeping and whenever
+   * interrupt() wakes the wait.
+   *
+   * @throws error(resource_unavailable_try_again) if F_SETLK conflicts
+   * @throws error(resource_deadlock_would_occur) if F_SETLKW would wait on
+   *         an owner that, directly or not, waits on this one
+   * @throws error(interrupted) if a wait was interrupted */
+  void lock(const Path& path, int command, file_lock& lock,
+            std::uint64_t owner, const interrupt_check& interrupted = nullptr);
+
+  /** Perform LOCK_SH, LOCK_EX or LOCK_UN, optionally with LOCK_NB */
+  void flock(const Path& path, int operation, std::uint64_t owner,
+             const interrupt_check& interrupted = nullptr);
+
+  /** Drop every record lock owner holds on path, as on close(2) */
+  void release(const Path& path, std::uint64_t owner);
+
+  /** Wake the blocked waits of owner
+   *
+   * A woken wait fails with error(interrupted) if it has no interrupt_check
+   * or its check now reports an interruption; otherwise it sleeps again.
+   * Does nothing if owner is not waiting. */
+  void interrupt(std::uint64_t owner);
+
+ private:
+  struct range {
+    std::uint64_t end;  // exclusive
+    lock_type type;
+    std::int64_t pid;
+  };
+  using ranges = std::map<std::uint64_t, range>;  // keyed by start
+
+  struct file_locks {
+    std::map<std::uint64_t, ranges> records;    // by owner
+    std::map<std::uint64_t, lock_type> flocks;  // by owner
+    std::condition_variable released;
+    std::size_t waiters = 0;
+  };
+
+  struct shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<file_locks>> files;
+  };
+
+  /** A blocked request, registered in waits_ for as long as it sleeps */
+  struct waiter {
+    std::uint64_t owner;
+    const std::string* key;
+    std::vector<std::uint64_t> holders;  // owners it waits for
+    std::atomic<bool> woken{false};      // set by interrupt()
+    bool registered = false;
+  };
+
+  /** Removes a waiter from waits_ when its request returns or throws */
+  class wait_scope {
+   public:
+    wait_scope(lock_manager& manager, waiter& self);
+    ~wait_scope();
+
+   private:
+    lock_manager& manager_;
+    waiter& self_;
+  };
+
+  shard& shard_for(const std::string& key);
+  static bool find_conflict(const file_locks& file, std::uint64_t owner,
+                            lock_type type, std::uint64_t start,
+                            std::uint64_t end, file_lock* conflict);
+  static bool owned_conflict(const ranges& owned, lock_type type,
+                             std::uint64_t start, std::uint64_t end,
+                             file_lock* conflict);
+  static std::vector<std::uint64_t> conflicting_owners(
+      const file_locks& file, std::uint64_t owner, lock_type type,
+      std::uint64_t start, std::uint64_t end);
+  static bool flock_conflict(const file_locks& file, std::uint64_t owner,
+                             lock_type type);
+  static void remove_range(ranges& owned, std::uint64_t start,
+                           std::uint64_t end);
+  static void insert_range(ranges& owned, std::uint64_t start,
+                           std::uint64_t end, lock_type type,
+                           std::int64_t pid);
+  /** Sleep until a lock on file is released; false if interrupted */
+  static bool wait(std::unique_lock<std::mutex>& lock, file_locks& file,
+                   waiter& self, const interrupt_check& interrupted);
+  /** Record who self waits for, unless that closes a cycle of waiters */
+  bool block_on(waiter& self, std::vector<std::uint64_t> holders);
+  static void collect(shard& s, const std::string& key);
+
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::mutex waits_mutex_;  // taken after a shard mutex, never before
+  std::unordered_multimap<std::uint64_t, waiter*> waits_;  // by owner
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,154 @@
+#include <drivex/memory_budget.h>
+#include <algorithm>
+#include <set>
+
+namespace lockblox {
+namespace drivex {
+
+const std::uint64_t memory_consumer::no_items;
+
+memory_budget::memory_budget(std::size_t limit)
+    : limit_(limit),
+      used_(0),
+      peak_(0),
+      charges_(0),
+      refusals_(0),
+      evictions_(0),
+      evicted_bytes_(0),
+      clock_(0) {}
+
+std::size_t memory_budget::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+void memory_budget::limit(std::size_t limit) {
+  std::lock_guard<std::mutex> eviction(eviction_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+  }
+  reclaim(0);
+}
+
+void memory_budget::add(memory_consumer& consumer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  accounts_.emplace(&consumer, 0);
+}
+
+void memory_budget::remove(memory_consumer& consumer) {
+  std::lock_guard<std::mutex> eviction(eviction_mutex_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = accounts_.find(&consumer);
+  if (found != accounts_.end()) {
+    used_ -= found->second;
+    accounts_.erase(found);
+  }
+}
+
+bool memory_budget::charge(memory_consumer& consumer, std::size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes > limit_) {  // evicting everything would not help
+      ++refusals_;
+      return false;
+    }
+    if (used_ + bytes <= limit_) {
+      used_ += bytes;
+      peak_ = std::max(peak_, used_);
+      accounts_[&consumer] += bytes;
+      ++charges_;
+      return true;
+    }
+  }
+  std::lock_guard<std::mutex> eviction(eviction_mutex_);
+  auto fits = reclaim(bytes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fits && used_ + bytes <= limit_) {
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+    accounts_[&consumer] += bytes;
+    ++charges_;
+    return true;
+  }
+  ++refusals_;
+  return false;
+}
+
+void memory_budget::release(memory_consumer& consumer, std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = accounts_.find(&consumer);
+  if (found != accounts_.end()) {
+    bytes = std::min(bytes, found->second);
+    found->second -= bytes;
+    used_ -= bytes;
+  }
+}
+
+std::uint64_t memory_budget::tick() noexcept { return ++clock_; }
+
+memory_budget::statistics memory_budget::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  statistics result{limit_,    used_,      peak_,          charges_,
+                    refusals_, evictions_, evicted_bytes_, {}};
+  for (const auto& account : accounts_) {
+    result.consumers.push_back({account.first->name(), account.second});
+  }
+  return result;
+}
+
+bool memory_budget::reclaim(std::size_t bytes) {
+  std::set<memory_consumer*> exhausted;
+  for (;;) {
+    std::vector<memory_consumer*> candidates;
+    std::size_t excess;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (bytes > limit_) {
+        return false;
+      }
+      if (used_ + bytes <= limit_) {
+        return true;
+      }
+      excess = used_ + bytes - limit_;
+      for (const auto& account : accounts_) {
+        if (account.second > 0 && exhausted.count(account.first) == 0) {
+          candidates.push_back(account.first);
+        }
+      }
+    }
+    // consumers lock themselves to answer, so ask without the mutex held;
+    // the eviction mutex keeps them registered meanwhile
+    memory_consumer* victim = nullptr;
+    auto victim_stamp = memory_consumer::no_items;
+    auto next_stamp = memory_consumer::no_items;  // oldest of the others
+    for (auto candidate : candidates) {
+      auto stamp = candidate->oldest();
+      if (stamp < victim_stamp || victim == nullptr) {
+        next_stamp = victim_stamp;
+        victim = candidate;
+        victim_stamp = stamp;
+      } else {
+        next_stamp = std::min(next_stamp, stamp);
+      }
+    }
+    if (victim == nullptr) {
+      return false;
+    }
+    std::size_t before;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      before = accounts_[victim];
+    }
+    auto dropped = victim->evict(next_stamp, excess);
+    if (dropped == 0) {
+      exhausted.insert(victim);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    evictions_ += dropped;
+    evicted_bytes_ += before - std::min(before, accounts_[victim]);
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+class memory_budget;
+
+/** A cache whose memory is accounted against a memory_budget
+ *
+ * Items are stamped with memory_budget::tick() when used, and the cache
+ * keeps them in order of use, so that the budget can compare the least
+ * recently used items of all its consumers. */
+class memory_consumer {
+ public:
+  virtual ~memory_consumer() = default;
+
+  /** Name reported in memory_budget statistics */
+  virtual std::string name() const = 0;
+
+  /** Stamp of the least recently used item, or no_items if empty */
+  virtual std::uint64_t oldest() const = 0;
+
+  /** Drop least recently used items, releasing their bytes to the budget
+   *
+   * Drops the oldest item, then more while they are stamped before until
+   * and fewer than bytes have been released, so that one call makes room
+   * for a large charge without reordering items across consumers.
+   *
+   * @return the number of items dropped, zero if there was nothing to drop */
+  virtual std::size_t evict(std::uint64_t until, std::size_t bytes) = 0;
+
+  static const std::uint64_t no_items =
+      std::numeric_limits<std::uint64_t>::max();
+};
+
+/** One memory limit shared by caches
+ *
+ * Consumers charge the bytes of an item before they keep it and release
+ * them when they drop it.  A charge that would exceed the limit first
+ * evicts the least recently used items across all consumers, a batch from
+ * one consumer at a time, and is refused if that cannot make room; one
+ * larger than the whole limit is refused without evicting anything.
+ * Consumers must not hold their own
+ * locks while charging, as eviction may call back into them, but may while
+ * releasing. */
+class memory_budget {
+ public:
+  struct consumer_statistics {
+    std::string name;
+    std::size_t bytes;
+  };
+
+  struct statistics {
+    std::size_t limit;
+    std::size_t used;
+    std::size_t peak;
+    std::uint64_t charges;
+    std::uint64_t refusals;  // charges that could not be met
+    std::uint64_t evictions;
+    std::uint64_t evicted_bytes;
+    std::vector<consumer_statistics> consumers;
+  };
+
+  explicit memory_budget(std::size_t limit);
+
+  memory_budget(const memory_budget&) = delete;
+  memory_budget& operator=(const memory_budget&) = delete;
+
+  /** Bytes that may be charged in all */
+  std::size_t limit() const;
+
+  /** Change the limit, evicting down to it */
+  void limit(std::size_t limit);
+
+  void add(memory_consumer& consumer);
+
+  /** Stop accounting for a consumer, forgetting its charges */
+  void remove(memory_consumer& consumer);
+
+  /** Account for bytes a consumer is about to keep
+   *
+   * @return false, with nothing charged, if they exceed the limit or do not
+   *         fit even after evicting everything that can be */
+  bool charge(memory_consumer& consumer, std::size_t bytes);
+
+  /** Account for bytes a consumer has dropped */
+  void release(memory_consumer& consumer, std::size_t bytes);
+
+  /** A stamp later than any returned before, for ordering items by use */
+  std::uint64_t tick() noexcept;
+
+  statistics stats() const;
+
+ private:
+  /** Evict until bytes more fit; the eviction mutex is held */
+  bool reclaim(std::size_t bytes);
+
+  mutable std::mutex mutex_;
+  std::mutex eviction_mutex_;  // one reclaimer at a time; guards removal
+  std::size_t limit_;
+  std::size_t used_;
+  std::size_t peak_;
+  std::uint64_t charges_;
+  std::uint64_t refusals_;
+  std::uint64_t evictions_;
+  std::uint64_t evicted_bytes_;
+  std::unordered_map<memory_consumer*, std::size_t> accounts_;
+  std::atomic<std::uint64_t> clock_;
+};
+}  // namespace drivex
+}  // namespace lockblox
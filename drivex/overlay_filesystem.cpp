@@ -0,0 +1,733 @@
+#include <drivex/directory_entry.h>
+#include <drivex/overlay_filesystem.h>
+#include <fcntl.h>
+#include <set>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::string whiteout_prefix = ".wh.";
+const std::string opaque_marker = ".wh..wh..opq";
+const std::string work_prefix = ".wh..wh.copy.";
+const int max_symlink_hops = 40;
+
+bool is_marker(const std::string& name) {
+  return name.compare(0, whiteout_prefix.size(), whiteout_prefix) == 0;
+}
+
+Path whiteout(const Path& path) {
+  return path.parent_path() / (whiteout_prefix + path.filename().string());
+}
+
+bool has_code(const error& e, error_code code) {
+  return e.code().value() == static_cast<int>(code);
+}
+
+/** Status of a path in one layer, or false if it is not there */
+bool probe(const filesystem& layer, const Path& path, file_status& status) {
+  try {
+    status = layer.symlink_status(path);
+    return layer.exists(status);
+  } catch (const error& e) {
+    if (has_code(e, error_code::no_such_file_or_directory) ||
+        has_code(e, error_code::not_a_directory)) {
+      return false;
+    }
+    throw;
+  }
+}
+
+bool present(const filesystem& layer, const Path& path) {
+  file_status status;
+  return probe(layer, path, status);
+}
+
+/** Rough bytes held for a cached resolution, including the bookkeeping */
+std::size_t footprint(const std::string& path, std::size_t layers) {
+  return 2 * path.size() + layers * sizeof(std::size_t) + 160;
+}
+
+/** Run an optional operation, ignoring function_not_supported */
+template <typename F>
+void optional(F f) {
+  try {
+    f();
+  } catch (const error& e) {
+    if (!has_code(e, error_code::function_not_supported)) {
+      throw;
+    }
+  }
+}
+
+}  // namespace
+
+overlay_filesystem::overlay_filesystem(
+    std::shared_ptr<filesystem> upper,
+    std::vector<std::shared_ptr<filesystem>> lowers,
+    std::size_t cache_capacity)
+    : filesystem(upper->current_path()),
+      cache_capacity_(cache_capacity),
+      generation_(0),
+      consumer_(*this),
+      budget_(nullptr) {
+  layers_.push_back(std::move(upper));
+  for (auto& lower : lowers) {
+    layers_.push_back(std::move(lower));
+  }
+}
+
+overlay_filesystem::~overlay_filesystem() { budget(nullptr); }
+
+std::uintmax_t overlay_filesystem::file_size(const Path& path) const {
+  return top(path).file_size(path);
+}
+
+space_info overlay_filesystem::space(const Path& path) const {
+  (void)path;
+  return layer(0).space(Path("/"));  // only the upper layer can fill up
+}
+
+file_status overlay_filesystem::status(const Path& path) const {
+  auto current = absolute(path);
+  for (auto hops = 0; hops <= max_symlink_hops; ++hops) {
+    auto result = symlink_status(current);
+    if (!is_symlink(result)) {
+      return result;
+    }
+    auto target = read_symlink(current);
+    current = absolute(target.is_absolute() ? target
+                                            : parent_path(current) / target);
+  }
+  throw error(error_code::too_many_symbolic_link_levels, path.string());
+}
+
+file_status overlay_filesystem::symlink_status(const Path& path) const {
+  return top(path).symlink_status(path);
+}
+
+Path overlay_filesystem::read_symlink(const Path& path) const {
+  return top(path).read_symlink(path);
+}
+
+void overlay_filesystem::create_directory(const Path& path) {
+  add(path, [&path](filesystem& upper) { upper.create_directory(path); });
+}
+
+void overlay_filesystem::create_directory(const Path& path,
+                                          drivex::permissions permissions) {
+  add(path, [&path, permissions](filesystem& upper) {
+    upper.create_directory(path, permissions);
+  });
+}
+
+bool overlay_filesystem::remove(const Path& path) {
+  auto found = resolve(path);
+  if (found.layers.empty()) {
+    return false;
+  }
+  if (found.directory && !is_empty(path)) {
+    throw error(error_code::directory_not_empty, path.string());
+  }
+  if (found.layers.front() == 0) {
+    if (found.directory) {
+      clear_markers(path);
+    }
+    layer(0).remove(path);
+  }
+  invalidate(path);
+  hide(path);
+  return true;
+}
+
+void overlay_filesystem::create_symlink(const Path& target, const Path& link) {
+  add(link, [&target, &link](filesystem& upper) {
+    upper.create_symlink(target, link);
+  });
+}
+
+void overlay_filesystem::rename(const Path& from, const Path& to) {
+  auto source = resolve(from);
+  if (source.layers.empty()) {
+    throw error(error_code::no_such_file_or_directory, from.string());
+  }
+  if (source.directory &&
+      (source.layers.size() > 1 || source.layers.front() != 0)) {
+    throw error(error_code::cross_device_link, from.string());
+  }
+  auto target = resolve(to);
+  auto opaque = false;
+  if (!target.layers.empty() && target.directory) {
+    if (!source.directory) {
+      throw error(error_code::is_a_directory, to.string());
+    }
+    if (!is_empty(to)) {
+      throw error(error_code::directory_not_empty, to.string());
+    }
+    if (target.layers.front() == 0) {
+      clear_markers(to);
+    }
+    opaque = target.layers.back() != 0;
+  }
+  copy_up(from);
+  copy_up(to.parent_path());
+  if (present(layer(0), whiteout(to))) {
+    layer(0).remove(whiteout(to));
+    opaque = opaque || source.directory;
+  }
+  layer(0).rename(from, to);
+  if (opaque) {  // keep what lower layers have under the name out of sight
+    layer(0).create_file(to / opaque_marker);
+  }
+  invalidate(from);
+  invalidate(to);
+  hide(from);
+}
+
+void overlay_filesystem::link(const Path& from, const Path& to) {
+  copy_up(from);
+  add(to, [&from, &to](filesystem& upper) { upper.link(from, to); });
+}
+
+void overlay_filesystem::permissions(const Path& path,
+                                     drivex::permissions permissions) {
+  copy_up(path).permissions(path, permissions);
+}
+
+bool overlay_filesystem::is_empty(const Path& path) const {
+  for (const auto& name : read_directory(path)) {
+    if (name != "." && name != "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+void overlay_filesystem::chown(const Path& path, uint32_t user_id,
+                               uint32_t group_id) {
+  copy_up(path).chown(path, user_id, group_id);
+}
+
+void overlay_filesystem::truncate(const Path& path, uint64_t offset) {
+  copy_up(path).truncate(path, offset);
+}
+
+void overlay_filesystem::set_attributes(const Path& path,
+                                        const attribute_update& update) {
+  copy_up(path).set_attributes(path, update);
+}
+
+void overlay_filesystem::open(const Path& path, int flags) {
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC) != 0) {
+    copy_up(path).open(path, flags);
+  } else {
+    top(path).open(path, flags);
+  }
+}
+
+open_handle overlay_filesystem::create(const Path& path,
+                                       drivex::permissions permissions,
+                                       int flags) {
+  auto handle = no_open_handle;
+  add(path, [&](filesystem& upper) {
+    handle = upper.create(path, permissions, flags);
+  });
+  return handle;
+}
+
+int overlay_filesystem::read(const Path& path, string_view& buffer,
+                             uint64_t offset) const {
+  return top(path).read(path, buffer, offset);
+}
+
+int overlay_filesystem::write(const Path& path, const string_view& buffer,
+                              uint64_t offset) {
+  return copy_up(path).write(path, buffer, offset);
+}
+
+void overlay_filesystem::flush(const Path& path) { top(path).flush(path); }
+
+void overlay_filesystem::release(const Path& path, int flags) {
+  top(path).release(path, flags);
+}
+
+void overlay_filesystem::fsync(const Path& path, int fd) {
+  top(path).fsync(path, fd);
+}
+
+void overlay_filesystem::setxattr(
+    const Path& path, const std::pair<std::string, string_view>& attribute,
+    int flags) {
+  copy_up(path).setxattr(path, attribute, flags);
+}
+
+std::pair<std::string, string_view> overlay_filesystem::getxattr(
+    const Path& path, const std::string& name) {
+  return top(path).getxattr(path, name);
+}
+
+std::size_t overlay_filesystem::getxattr(const Path& path,
+                                         const std::string& name,
+                                         string_view& buffer) {
+  return top(path).getxattr(path, name, buffer);
+}
+
+xattr_map overlay_filesystem::getxattrs(const Path& path) {
+  return top(path).getxattrs(path);
+}
+
+std::vector<std::string> overlay_filesystem::listxattr(const Path& path) {
+  return top(path).listxattr(path);
+}
+
+std::size_t overlay_filesystem::listxattr(const Path& path,
+                                          string_view& buffer) {
+  return top(path).listxattr(path, buffer);
+}
+
+void overlay_filesystem::removexattr(const Path& path,
+                                     const std::string& name) {
+  copy_up(path).removexattr(path, name);
+}
+
+std::vector<Path> overlay_filesystem::read_directory(const Path& path) const {
+  std::vector<Path> names;
+  for (const auto& entry : read_directory_entries(path)) {
+    names.push_back(entry.path().filename());
+  }
+  return names;
+}
+
+std::vector<directory_entry> overlay_filesystem::read_directory_entries(
+    const Path& path) const {
+  auto found = resolve(path);
+  if (found.layers.empty()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  if (!found.directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  std::vector<directory_entry> entries;
+  std::set<std::string> seen;
+  std::set<std::string> hidden;  // by whiteouts of the layers above
+  for (auto index : found.layers) {
+    std::vector<std::string> whiteouts;
+    for (auto& entry : layer(index).read_directory_entries(path)) {
+      auto name = entry.path().filename().string();
+      if (is_marker(name)) {
+        if (name != opaque_marker) {
+          whiteouts.push_back(name.substr(whiteout_prefix.size()));
+        }
+        continue;
+      }
+      if (hidden.count(name) != 0 || !seen.insert(name).second) {
+        continue;
+      }
+      if (entry.status_known()) {  // the topmost layer with it resolves it
+        entries.emplace_back(*this, entry.path(), entry.symlink_status());
+      } else {
+        entries.emplace_back(*this, entry.path());
+      }
+    }
+    hidden.insert(whiteouts.begin(), whiteouts.end());
+  }
+  return entries;
+}
+
+void overlay_filesystem::fsyncdir(const Path& path, int datasync) {
+  auto found = resolve(path);
+  if (!found.layers.empty() && found.layers.front() == 0) {
+    layer(0).fsyncdir(path, datasync);
+  }
+}
+
+void overlay_filesystem::access(const Path& path,
+                                const drivex::permissions& permissions) {
+  top(path).access(path, permissions);
+}
+
+void overlay_filesystem::create_file(const Path& path) {
+  add(path, [&path](filesystem& upper) { upper.create_file(path); });
+}
+
+void overlay_filesystem::create_file(const Path& path,
+                                     drivex::permissions permissions) {
+  add(path, [&path, permissions](filesystem& upper) {
+    upper.create_file(path, permissions);
+  });
+}
+
+std::time_t overlay_filesystem::last_read_time(const Path& path) {
+  return top(path).last_read_time(path);
+}
+
+void overlay_filesystem::last_read_time(const Path& path,
+                                        std::time_t new_time) {
+  copy_up(path).last_read_time(path, new_time);
+}
+
+std::time_t overlay_filesystem::last_write_time(const Path& path) {
+  return top(path).last_write_time(path);
+}
+
+void overlay_filesystem::last_write_time(const Path& path,
+                                         std::time_t new_time) {
+  copy_up(path).last_write_time(path, new_time);
+}
+
+file_times overlay_filesystem::times(const Path& path) {
+  return top(path).times(path);
+}
+
+void overlay_filesystem::fallocate(const Path& path, int mode,
+                                   uint64_t offset, uint64_t length) {
+  copy_up(path).fallocate(path, mode, offset, length);
+}
+
+void overlay_filesystem::invalidate(const Path& path) {
+  auto key = path.string();
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  ++generation_;  // lookups already under way must not cache their result
+  if (!path.has_relative_path()) {
+    for (auto it = cache_.begin(); it != cache_.end();) {
+      it = forget(it);
+    }
+    return;
+  }
+  auto it = cache_.lower_bound(key);
+  auto last = cache_.lower_bound(key + '0');  // '0' follows '/'
+  while (it != last) {
+    auto& name = it->first;
+    if (name.size() == key.size() || name[key.size()] == '/') {
+      it = forget(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void overlay_filesystem::budget(memory_budget* budget) {
+  invalidate(Path("/"));
+  memory_budget* previous;
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    previous = budget_;
+    budget_ = nullptr;
+  }
+  if (previous != nullptr) {
+    previous->remove(consumer_);
+  }
+  if (budget != nullptr) {
+    budget->add(consumer_);
+  }
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  budget_ = budget;
+}
+
+overlay_filesystem::cache_map::iterator overlay_filesystem::forget(
+    cache_map::iterator it) const {
+  if (budget_ != nullptr) {
+    budget_->release(consumer_, it->second.bytes);
+  }
+  recency_.erase(it->second.recency);
+  return cache_.erase(it);
+}
+
+std::string overlay_filesystem::cache_consumer::name() const {
+  return "overlay";
+}
+
+std::uint64_t overlay_filesystem::cache_consumer::oldest() const {
+  std::lock_guard<std::mutex> lock(owner_.cache_mutex_);
+  return owner_.recency_.empty()
+             ? no_items
+             : owner_.cache_.find(*owner_.recency_.back())->second.stamp;
+}
+
+std::size_t overlay_filesystem::cache_consumer::evict(std::uint64_t until,
+                                                      std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(owner_.cache_mutex_);
+  std::size_t dropped = 0;
+  std::size_t released = 0;
+  while (!owner_.recency_.empty()) {
+    auto victim = owner_.cache_.find(*owner_.recency_.back());
+    if (dropped != 0 && (released >= bytes || victim->second.stamp >= until)) {
+      break;
+    }
+    released += victim->second.bytes;
+    owner_.forget(victim);
+    ++dropped;
+  }
+  return dropped;
+}
+
+filesystem& overlay_filesystem::layer(std::size_t index) const {
+  return *layers_[index];
+}
+
+overlay_filesystem::resolution overlay_filesystem::resolve(
+    const Path& path) const {
+  auto key = path.string();
+  std::uint64_t generation;
+  memory_budget* budget;
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto found = cache_.find(key);
+    if (found != cache_.end()) {
+      recency_.splice(recency_.begin(), recency_, found->second.recency);
+      if (budget_ != nullptr) {
+        found->second.stamp = budget_->tick();
+      }
+      return found->second.value;
+    }
+    generation = generation_;
+    budget = budget_;
+  }
+  resolution result;
+  if (!path.has_relative_path()) {  // the root is in every layer
+    for (std::size_t index = 0; index < layers_.size(); ++index) {
+      result.layers.push_back(index);
+    }
+    result.directory = true;
+  } else {
+    auto parent = resolve(path.parent_path());
+    if (parent.directory) {
+      result = lookup(parent, path);
+    }
+  }
+  if (cache_capacity_ == 0) {
+    return result;
+  }
+  auto bytes = budget != nullptr ? footprint(key, result.layers.size()) : 0;
+  // charging may evict from the cache, so not under the mutex
+  if (budget != nullptr && !budget->charge(consumer_, bytes)) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto inserted = false;
+  if (generation == generation_ && budget == budget_) {
+    auto stamp = budget != nullptr ? budget->tick() : 0;
+    auto added = cache_.emplace(key, cache_entry{result, {}, bytes, stamp});
+    inserted = added.second;
+    if (inserted) {
+      recency_.push_front(&added.first->first);
+      added.first->second.recency = recency_.begin();
+      if (cache_.size() > cache_capacity_) {
+        forget(cache_.find(*recency_.back()));
+      }
+    }
+  }
+  if (!inserted && budget != nullptr) {
+    budget->release(consumer_, bytes);
+  }
+  return result;
+}
+
+overlay_filesystem::resolution overlay_filesystem::lookup(
+    const resolution& parent, const Path& path) const {
+  resolution result;
+  for (auto index : parent.layers) {
+    const auto& candidate = layer(index);
+    file_status status;
+    if (!probe(candidate, path, status)) {
+      if (present(candidate, whiteout(path))) {
+        break;  // hides the name in the layers below
+      }
+      continue;
+    }
+    auto directory = is_directory(status);
+    if (!result.layers.empty() && !directory) {
+      break;  // a file below a directory is covered by it
+    }
+    if (result.layers.empty()) {
+      result.directory = directory;
+    }
+    result.layers.push_back(index);
+    if (!directory || present(candidate, path / opaque_marker)) {
+      break;
+    }
+  }
+  return result;
+}
+
+filesystem& overlay_filesystem::top(const Path& path) const {
+  auto found = resolve(path);
+  if (found.layers.empty()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  return layer(found.layers.front());
+}
+
+filesystem& overlay_filesystem::copy_up(const Path& path) {
+  auto found = resolve(path);
+  if (found.layers.empty()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  auto& upper = layer(0);
+  if (found.layers.front() == 0) {
+    return upper;
+  }
+  copy_up(path.parent_path());
+  auto key = path.string();
+  std::shared_ptr<std::mutex> gate;
+  {
+    std::lock_guard<std::mutex> lock(copy_mutex_);
+    auto& slot = copying_[key];
+    if (!slot) {
+      slot = std::make_shared<std::mutex>();
+    }
+    gate = slot;
+  }
+  auto leave = [&] {
+    std::lock_guard<std::mutex> lock(copy_mutex_);
+    if (gate.use_count() == 2) {  // nobody else waits to copy the path
+      copying_.erase(key);
+    }
+  };
+  try {
+    std::lock_guard<std::mutex> copying(*gate);
+    copy(path);
+  } catch (...) {
+    leave();
+    throw;
+  }
+  leave();
+  return upper;
+}
+
+void overlay_filesystem::copy(const Path& path) {
+  auto found = resolve(path);  // another caller may have copied it meanwhile
+  if (found.layers.empty()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  auto& upper = layer(0);
+  if (found.layers.front() == 0) {
+    return;
+  }
+  auto& lower = layer(found.layers.front());
+  auto status = lower.symlink_status(path);
+  if (is_directory(status)) {
+    upper.create_directory(path, status.permissions());
+  } else if (is_symlink(status)) {
+    upper.create_symlink(lower.read_symlink(path), path);
+  } else if (is_regular_file(status)) {
+    copy_file(lower, path, status.permissions());
+  } else {
+    throw error(error_code::function_not_supported, path.string());
+  }
+  if (is_directory(status)) {
+    optional([&] {
+      for (const auto& attribute : lower.getxattrs(path)) {
+        upper.setxattr(path,
+                       std::make_pair(attribute.first,
+                                      string_view(attribute.second)),
+                       0);
+      }
+    });
+    optional([&] {
+      upper.last_write_time(path, lower.last_write_time(path));
+    });
+  }
+  invalidate(path);
+}
+
+void overlay_filesystem::copy_file(filesystem& lower, const Path& path,
+                                   drivex::permissions permissions) {
+  auto& upper = layer(0);
+  auto work = path.parent_path() / (work_prefix + path.filename().string());
+  try {
+    upper.create_file(work, permissions);
+  } catch (const error& e) {
+    if (!has_code(e, error_code::file_exists)) {
+      throw;
+    }
+    upper.remove(work);  // left by a copy that crashed
+    upper.create_file(work, permissions);
+  }
+  auto opened = false;
+  try {
+    optional([&] { lower.open(path, O_RDONLY); });
+    opened = true;
+    std::string buffer(1u << 20u, '\0');
+    std::uint64_t offset = 0;
+    for (;;) {
+      auto view = string_view(&buffer[0], buffer.size());
+      auto count = lower.read(path, view, offset);
+      if (count <= 0) {
+        break;
+      }
+      auto data = string_view(buffer.data(), count);
+      while (!data.empty()) {
+        auto written = upper.write(work, data, offset);
+        if (written <= 0) {
+          throw error(error_code::io_error, work.string());
+        }
+        data.remove_prefix(written);
+        offset += written;
+      }
+    }
+    opened = false;
+    optional([&] { lower.release(path, O_RDONLY); });
+    optional([&] {
+      for (const auto& attribute : lower.getxattrs(path)) {
+        upper.setxattr(work,
+                       std::make_pair(attribute.first,
+                                      string_view(attribute.second)),
+                       0);
+      }
+    });
+    optional([&] {
+      upper.last_write_time(work, lower.last_write_time(path));
+    });
+    optional([&] { upper.fsync(work, 0); });
+    upper.rename(work, path);
+  } catch (...) {
+    try {
+      if (opened) {
+        optional([&] { lower.release(path, O_RDONLY); });
+      }
+      upper.remove(work);
+    } catch (const error&) {
+    }
+    throw;
+  }
+}
+
+void overlay_filesystem::add(const Path& path,
+                             const std::function<void(filesystem&)>& make) {
+  if (is_marker(path.filename().string())) {
+    throw error(error_code::invalid_argument, path.string());
+  }
+  if (!resolve(path).layers.empty()) {
+    throw error(error_code::file_exists, path.string());
+  }
+  auto& upper = copy_up(path.parent_path());
+  auto covered = present(upper, whiteout(path));
+  if (covered) {
+    upper.remove(whiteout(path));
+  }
+  make(upper);
+  if (covered && is_directory(upper.symlink_status(path))) {
+    upper.create_file(path / opaque_marker);  // lower contents stay removed
+  }
+  invalidate(path);
+}
+
+void overlay_filesystem::clear_markers(const Path& directory) {
+  auto& upper = layer(0);
+  for (const auto& name : upper.read_directory(directory)) {
+    if (is_marker(name.string())) {
+      upper.remove(directory / name);
+    }
+  }
+}
+
+void overlay_filesystem::hide(const Path& path) {
+  if (!resolve(path).layers.empty()) {  // a lower layer still provides it
+    copy_up(path.parent_path()).create_file(whiteout(path));
+    invalidate(path);
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,162 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/memory_budget.h>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Stacks a writable upper filesystem over read-only lower ones
+ *
+ * A name resolves to the topmost layer that has it, and directories found
+ * in several layers are merged, top first.  Removing a name that a lower
+ * layer provides leaves a whiteout, a .wh.<name> file, in the upper layer,
+ * and a directory whose lower contents must stay hidden holds a
+ * .wh..wh..opq marker; neither is listed, and names starting with .wh.
+ * cannot be created.  Changing a file or directory of a lower layer first
+ * copies it up, along with its parent directories.  Copies of one path are
+ * serialized, and a regular file is copied into a hidden work file,
+ * .wh..wh.copy.<name>, that is renamed over the name only once complete, so
+ * the upper layer never shows a partial copy.
+ *
+ * Which layers resolve each path is cached, so after the first lookup an
+ * operation goes straight to the layer that holds the path.  Changes made
+ * through the overlay keep the cache current; call invalidate after
+ * changing a layer directly.  With a memory_budget the cached resolutions
+ * are charged to it.  Renaming a directory that lower layers
+ * contribute to fails with cross_device_link, as in overlayfs without
+ * redirects. */
+class overlay_filesystem : public filesystem {
+ public:
+  /** @param lowers read-only layers, topmost first
+   *  @param cache_capacity paths whose resolution is remembered */
+  overlay_filesystem(std::shared_ptr<filesystem> upper,
+                     std::vector<std::shared_ptr<filesystem>> lowers,
+                     std::size_t cache_capacity = 65536);
+  ~overlay_filesystem() override;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  space_info space(const Path& path) const override;
+  file_status status(const Path& path) const override;
+  file_status symlink_status(const Path& path) const override;
+  Path read_symlink(const Path& path) const override;
+  void create_directory(const Path& path) override;
+  void create_directory(const Path& path,
+                        drivex::permissions permissions) override;
+  bool remove(const Path& path) override;
+  void create_symlink(const Path& target, const Path& link) override;
+  void rename(const Path& from, const Path& to) override;
+  void link(const Path& from, const Path& to) override;
+  void permissions(const Path& path, drivex::permissions permissions) override;
+  bool is_empty(const Path& path) const override;
+  void chown(const Path& path, uint32_t user_id, uint32_t group_id) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void release(const Path& path, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  void setxattr(const Path& path,
+                const std::pair<std::string, string_view>& attribute,
+                int flags) override;
+  std::pair<std::string, string_view> getxattr(
+      const Path& path, const std::string& name) override;
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override;
+  xattr_map getxattrs(const Path& path) override;
+  std::vector<std::string> listxattr(const Path& path) override;
+  std::size_t listxattr(const Path& path, string_view& buffer) override;
+  void removexattr(const Path& path, const std::string& name) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  void fsyncdir(const Path& path, int datasync) override;
+  void access(const Path& path,
+              const drivex::permissions& permissions) override;
+  void create_file(const Path& path) override;
+  void create_file(const Path& path, drivex::permissions permissions) override;
+  std::time_t last_read_time(const Path& path) override;
+  void last_read_time(const Path& path, std::time_t new_time) override;
+  std::time_t last_write_time(const Path& path) override;
+  void last_write_time(const Path& path, std::time_t new_time) override;
+  file_times times(const Path& path) override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+  /** Forget the cached resolution of a path and everything below it */
+  void invalidate(const Path& path);
+
+  /** Charge cached resolutions to a budget from now on, or to none if null
+   *
+   * Resolutions already cached are dropped. */
+  void budget(memory_budget* budget);
+
+ private:
+  /** The layers providing a path, topmost first; empty if it is absent */
+  struct resolution {
+    std::vector<std::size_t> layers;
+    bool directory = false;
+  };
+
+  struct cache_entry {
+    resolution value;
+    std::list<const std::string*>::iterator recency;
+    std::size_t bytes;    // charged to the budget
+    std::uint64_t stamp;  // of the last use
+  };
+  using cache_map = std::map<std::string, cache_entry>;
+
+  /** Accounts the resolution cache to a memory_budget */
+  class cache_consumer : public memory_consumer {
+   public:
+    explicit cache_consumer(overlay_filesystem& owner) : owner_(owner) {}
+
+    std::string name() const override;
+    std::uint64_t oldest() const override;
+    std::size_t evict(std::uint64_t until, std::size_t bytes) override;
+
+   private:
+    overlay_filesystem& owner_;
+  };
+
+  filesystem& layer(std::size_t index) const;
+  resolution resolve(const Path& path) const;
+  resolution lookup(const resolution& parent, const Path& path) const;
+  filesystem& top(const Path& path) const;
+  filesystem& copy_up(const Path& path);
+  void copy(const Path& path);
+  void copy_file(filesystem& lower, const Path& path,
+                 drivex::permissions permissions);
+  void add(const Path& path, const std::function<void(filesystem&)>& make);
+  void clear_markers(const Path& directory);
+  void hide(const Path& path);
+  /** Drop a cached resolution; the cache mutex is held */
+  cache_map::iterator forget(cache_map::iterator it) const;
+
+  std::vector<std::shared_ptr<filesystem>> layers_;  // upper first
+  const std::size_t cache_capacity_;
+  mutable std::mutex cache_mutex_;
+  mutable cache_map cache_;
+  mutable std::list<const std::string*> recency_;
+  mutable std::uint64_t generation_;
+  mutable cache_consumer consumer_;
+  memory_budget* budget_;
+  std::mutex copy_mutex_;
+  std::map<std::string, std::shared_ptr<std::mutex>> copying_;  // by path
+};
+}  // namespace drivex
+}  // namespace lockblox
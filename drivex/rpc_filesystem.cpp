@@ -0,0 +1,556 @@
+#include <drivex/directory_entry.h>
+#include <drivex/rpc_filesystem.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+std::uint32_t to_u32(drivex::permissions permissions) {
+  return static_cast<std::uint32_t>(permissions);
+}
+
+std::uint64_t to_u64(std::time_t time) {
+  return static_cast<std::uint64_t>(static_cast<std::int64_t>(time));
+}
+
+std::time_t to_time(std::uint64_t value) {
+  return static_cast<std::time_t>(static_cast<std::int64_t>(value));
+}
+
+void put_time(rpc_writer& writer, const boost::optional<file_time>& time) {
+  if (time) {
+    writer.put_u64(static_cast<std::uint64_t>(
+        time->time_since_epoch().count()));
+  }
+}
+
+file_time get_file_time(rpc_reader& reader) {
+  auto count = static_cast<std::int64_t>(reader.get_u64());
+  return file_time(std::chrono::nanoseconds(count));
+}
+
+}  // namespace
+
+rpc_filesystem::response::response(std::string data)
+    : body(std::move(data)), reader(body) {}
+
+rpc_filesystem::rpc_filesystem(int fd)
+    : fd_(fd), next_id_(1), broken_(false) {
+  receiver_ = std::thread([this]() { receive(); });
+}
+
+std::shared_ptr<rpc_filesystem> rpc_filesystem::connect(
+    const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw error(error_code::filename_too_long, path);
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+  auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw error(static_cast<error_code>(errno), path);
+  }
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) != 0) {
+    auto code = errno;
+    ::close(fd);
+    throw error(static_cast<error_code>(code), path);
+  }
+  return std::make_shared<rpc_filesystem>(fd);
+}
+
+rpc_filesystem::~rpc_filesystem() {
+  ::shutdown(fd_, SHUT_RDWR);
+  receiver_.join();
+  ::close(fd_);
+}
+
+std::uintmax_t rpc_filesystem::file_size(const Path& path) const {
+  auto request = start(rpc_operation::file_size, path);
+  return call(request)->reader.get_u64();
+}
+
+space_info rpc_filesystem::space(const Path& path) const {
+  auto request = start(rpc_operation::space, path);
+  auto response = call(request);
+  space_info info;
+  info.capacity = response->reader.get_u64();
+  info.free = response->reader.get_u64();
+  info.available = response->reader.get_u64();
+  return info;
+}
+
+file_status rpc_filesystem::status(const Path& path) const {
+  auto request = start(rpc_operation::status, path);
+  return call(request)->reader.get_status();
+}
+
+void rpc_filesystem::copy(const Path& from, const Path& to,
+                          CopyOptions options) {
+  auto request = start(rpc_operation::copy, from);
+  request.writer.put_path(to);
+  request.writer.put_u32(static_cast<std::uint32_t>(options));
+  call(request);
+}
+
+void rpc_filesystem::copy_symlink(const Path& from, const Path& to,
+                                  CopyOptions options) {
+  auto request = start(rpc_operation::copy_symlink, from);
+  request.writer.put_path(to);
+  request.writer.put_u32(static_cast<std::uint32_t>(options));
+  call(request);
+}
+
+bool rpc_filesystem::clone_file(const Path& from, const Path& to) {
+  auto request = start(rpc_operation::clone_file, from);
+  request.writer.put_path(to);
+  return call(request)->reader.get_u8() != 0;
+}
+
+file_status rpc_filesystem::symlink_status(const Path& path) const {
+  auto request = start(rpc_operation::symlink_status, path);
+  return call(request)->reader.get_status();
+}
+
+Path rpc_filesystem::read_symlink(const Path& path) const {
+  auto request = start(rpc_operation::read_symlink, path);
+  return call(request)->reader.get_path();
+}
+
+void rpc_filesystem::create_directory(const Path& path) {
+  create_directory(path, drivex::permissions::perms_not_known);
+}
+
+void rpc_filesystem::create_directory(const Path& path,
+                                      drivex::permissions permissions) {
+  auto request = start(rpc_operation::create_directory, path);
+  request.writer.put_u32(to_u32(permissions));
+  call(request);
+}
+
+void rpc_filesystem::create_directories(const Path& path) {
+  auto request = start(rpc_operation::create_directories, path);
+  call(request);
+}
+
+bool rpc_filesystem::equivalent(const Path& p1, const Path& p2) const {
+  auto request = start(rpc_operation::equivalent, p1);
+  request.writer.put_path(p2);
+  return call(request)->reader.get_u8() != 0;
+}
+
+bool rpc_filesystem::remove(const Path& path) {
+  auto request = start(rpc_operation::remove, path);
+  return call(request)->reader.get_u8() != 0;
+}
+
+void rpc_filesystem::create_symlink(const Path& target, const Path& link) {
+  auto request = start(rpc_operation::create_symlink, link);
+  request.writer.put_path(target);
+  call(request);
+}
+
+void rpc_filesystem::rename(const Path& from, const Path& to) {
+  auto request = start(rpc_operation::rename, from);
+  request.writer.put_path(to);
+  call(request);
+}
+
+void rpc_filesystem::link(const Path& from, const Path& to) {
+  auto request = start(rpc_operation::link, from);
+  request.writer.put_path(to);
+  call(request);
+}
+
+void rpc_filesystem::permissions(const Path& path,
+                                 drivex::permissions permissions) {
+  auto request = start(rpc_operation::permissions, path);
+  request.writer.put_u32(to_u32(permissions));
+  call(request);
+}
+
+bool rpc_filesystem::is_empty(const Path& path) const {
+  auto request = start(rpc_operation::is_empty, path);
+  return call(request)->reader.get_u8() != 0;
+}
+
+void rpc_filesystem::chown(const Path& path, uint32_t user_id,
+                           uint32_t group_id) {
+  auto request = start(rpc_operation::chown, path);
+  request.writer.put_u32(user_id);
+  request.writer.put_u32(group_id);
+  call(request);
+}
+
+void rpc_filesystem::truncate(const Path& path, uint64_t offset) {
+  auto request = start(rpc_operation::truncate, path);
+  request.writer.put_u64(offset);
+  call(request);
+}
+
+void rpc_filesystem::set_attributes(const Path& path,
+                                    const attribute_update& update) {
+  auto request = start(rpc_operation::set_attributes, path);
+  auto& writer = request.writer;
+  writer.put_u8(static_cast<std::uint8_t>(
+      (update.permissions ? 0x01u : 0u) | (update.user_id ? 0x02u : 0u) |
+      (update.group_id ? 0x04u : 0u) | (update.size ? 0x08u : 0u) |
+      (update.last_read_time ? 0x10u : 0u) |
+      (update.last_write_time ? 0x20u : 0u)));
+  if (update.permissions) {
+    writer.put_u32(to_u32(*update.permissions));
+  }
+  if (update.user_id) {
+    writer.put_u32(*update.user_id);
+  }
+  if (update.group_id) {
+    writer.put_u32(*update.group_id);
+  }
+  if (update.size) {
+    writer.put_u64(*update.size);
+  }
+  put_time(writer, update.last_read_time);
+  put_time(writer, update.last_write_time);
+  call(request);
+}
+
+void rpc_filesystem::open(const Path& path, int flags) {
+  auto request = start(rpc_operation::open, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(flags));
+  call(request);
+}
+
+open_handle rpc_filesystem::open_file(const Path& path, int flags) {
+  auto request = start(rpc_operation::open_file, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(flags));
+  return call(request)->reader.get_u64();
+}
+
+open_handle rpc_filesystem::create(const Path& path,
+                                   drivex::permissions permissions,
+                                   int flags) {
+  auto request = start(rpc_operation::create, path);
+  request.writer.put_u32(to_u32(permissions));
+  request.writer.put_u32(static_cast<std::uint32_t>(flags));
+  return call(request)->reader.get_u64();
+}
+
+int rpc_filesystem::read(const Path& path, string_view& buffer,
+                         uint64_t offset) const {
+  return read(path, no_open_handle, buffer, offset);
+}
+
+int rpc_filesystem::read(const Path& path, open_handle handle,
+                         string_view& buffer, uint64_t offset) const {
+  auto request = start(rpc_operation::read, path);
+  request.writer.put_u64(handle);
+  request.writer.put_u32(static_cast<std::uint32_t>(buffer.size()));
+  request.writer.put_u64(offset);
+  auto response = call(request);
+  auto data = response->reader.get_bytes();
+  auto count = std::min(data.size(), buffer.size());
+  std::memcpy(const_cast<char*>(buffer.data()), data.data(), count);
+  return static_cast<int>(count);
+}
+
+int rpc_filesystem::write(const Path& path, const string_view& buffer,
+                          uint64_t offset) {
+  return write(path, no_open_handle, buffer, offset);
+}
+
+int rpc_filesystem::write(const Path& path, open_handle handle,
+                          const string_view& buffer, uint64_t offset) {
+  auto request = start(rpc_operation::write, path);
+  request.writer.put_u64(handle);
+  request.writer.put_u64(offset);
+  request.writer.put_bytes(buffer);
+  return static_cast<int>(call(request)->reader.get_u32());
+}
+
+void rpc_filesystem::flush(const Path& path) { flush(path, no_open_handle); }
+
+void rpc_filesystem::flush(const Path& path, open_handle handle) {
+  auto request = start(rpc_operation::flush, path);
+  request.writer.put_u64(handle);
+  call(request);
+}
+
+void rpc_filesystem::release(const Path& path, int flags) {
+  release(path, no_open_handle, flags);
+}
+
+void rpc_filesystem::release(const Path& path, open_handle handle,
+                             int flags) {
+  auto request = start(rpc_operation::release, path);
+  request.writer.put_u64(handle);
+  request.writer.put_u32(static_cast<std::uint32_t>(flags));
+  call(request);
+}
+
+void rpc_filesystem::fsync(const Path& path, int fd) {
+  auto request = start(rpc_operation::fsync, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(fd));
+  call(request);
+}
+
+void rpc_filesystem::setxattr(
+    const Path& path, const std::pair<std::string, string_view>& attribute,
+    int flags) {
+  auto request = start(rpc_operation::setxattr, path);
+  request.writer.put_bytes(attribute.first);
+  request.writer.put_bytes(attribute.second);
+  request.writer.put_u32(static_cast<std::uint32_t>(flags));
+  call(request);
+}
+
+std::size_t rpc_filesystem::getxattr(const Path& path,
+                                     const std::string& name,
+                                     string_view& buffer) {
+  auto request = start(rpc_operation::getxattr, path);
+  request.writer.put_bytes(name);
+  request.writer.put_u32(static_cast<std::uint32_t>(buffer.size()));
+  auto response = call(request);
+  auto size = response->reader.get_u64();
+  auto value = response->reader.get_bytes();
+  std::memcpy(const_cast<char*>(buffer.data()), value.data(),
+              std::min(value.size(), buffer.size()));
+  return size;
+}
+
+xattr_map rpc_filesystem::getxattrs(const Path& path) {
+  auto request = start(rpc_operation::getxattrs, path);
+  auto response = call(request);
+  auto& reader = response->reader;
+  xattr_map attributes;
+  for (auto count = reader.get_u32(); count != 0; --count) {
+    auto name = reader.get_string();
+    attributes.emplace(std::move(name), reader.get_string());
+  }
+  return attributes;
+}
+
+std::vector<std::string> rpc_filesystem::listxattr(const Path& path) {
+  std::vector<std::string> names;
+  for (const auto& attribute : getxattrs(path)) {
+    names.push_back(attribute.first);
+  }
+  return names;
+}
+
+std::size_t rpc_filesystem::listxattr(const Path& path, string_view& buffer) {
+  auto request = start(rpc_operation::listxattr, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(buffer.size()));
+  auto response = call(request);
+  auto size = response->reader.get_u64();
+  auto names = response->reader.get_bytes();
+  std::memcpy(const_cast<char*>(buffer.data()), names.data(),
+              std::min(names.size(), buffer.size()));
+  return size;
+}
+
+void rpc_filesystem::removexattr(const Path& path, const std::string& name) {
+  auto request = start(rpc_operation::removexattr, path);
+  request.writer.put_bytes(name);
+  call(request);
+}
+
+std::vector<Path> rpc_filesystem::read_directory(const Path& path) const {
+  auto request = start(rpc_operation::read_directory, path);
+  auto response = call(request);
+  std::vector<Path> names;
+  for (auto count = response->reader.get_u32(); count != 0; --count) {
+    names.push_back(response->reader.get_path());
+  }
+  return names;
+}
+
+std::vector<directory_entry> rpc_filesystem::read_directory_entries(
+    const Path& path) const {
+  auto request = start(rpc_operation::read_directory_entries, path);
+  auto response = call(request);
+  auto& reader = response->reader;
+  std::vector<directory_entry> entries;
+  for (auto count = reader.get_u32(); count != 0; --count) {
+    auto entry_path = reader.get_path();
+    if (reader.get_u8() != 0) {
+      entries.emplace_back(*this, std::move(entry_path), reader.get_status());
+    } else {
+      entries.emplace_back(*this, std::move(entry_path));
+    }
+  }
+  return entries;
+}
+
+void rpc_filesystem::fsyncdir(const Path& path, int datasync) {
+  auto request = start(rpc_operation::fsyncdir, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(datasync));
+  call(request);
+}
+
+void rpc_filesystem::access(const Path& path,
+                            const drivex::permissions& permissions) {
+  auto request = start(rpc_operation::access, path);
+  request.writer.put_u32(to_u32(permissions));
+  call(request);
+}
+
+void rpc_filesystem::create_file(const Path& path) {
+  create_file(path, drivex::permissions::perms_not_known);
+}
+
+void rpc_filesystem::create_file(const Path& path,
+                                 drivex::permissions permissions) {
+  auto request = start(rpc_operation::create_file, path);
+  request.writer.put_u32(to_u32(permissions));
+  call(request);
+}
+
+void rpc_filesystem::lock(const Path& path, int command, file_lock& lock,
+                          std::uint64_t owner) {
+  auto request = start(rpc_operation::lock, path);
+  auto& writer = request.writer;
+  writer.put_u32(static_cast<std::uint32_t>(command));
+  writer.put_u8(static_cast<std::uint8_t>(lock.type));
+  writer.put_u64(lock.start);
+  writer.put_u64(lock.length);
+  writer.put_u64(static_cast<std::uint64_t>(lock.pid));
+  writer.put_u64(owner);
+  auto response = call(request);
+  auto& reader = response->reader;
+  lock.type = static_cast<lock_type>(reader.get_u8());
+  lock.start = reader.get_u64();
+  lock.length = reader.get_u64();
+  lock.pid = static_cast<std::int64_t>(reader.get_u64());
+}
+
+void rpc_filesystem::flock(const Path& path, int operation,
+                           std::uint64_t owner) {
+  auto request = start(rpc_operation::flock, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(operation));
+  request.writer.put_u64(owner);
+  call(request);
+}
+
+std::time_t rpc_filesystem::last_read_time(const Path& path) {
+  auto request = start(rpc_operation::last_read_time, path);
+  return to_time(call(request)->reader.get_u64());
+}
+
+void rpc_filesystem::last_read_time(const Path& path, std::time_t new_time) {
+  auto request = start(rpc_operation::set_last_read_time, path);
+  request.writer.put_u64(to_u64(new_time));
+  call(request);
+}
+
+std::time_t rpc_filesystem::last_write_time(const Path& path) {
+  auto request = start(rpc_operation::last_write_time, path);
+  return to_time(call(request)->reader.get_u64());
+}
+
+void rpc_filesystem::last_write_time(const Path& path,
+                                     std::time_t new_time) {
+  auto request = start(rpc_operation::set_last_write_time, path);
+  request.writer.put_u64(to_u64(new_time));
+  call(request);
+}
+
+file_times rpc_filesystem::times(const Path& path) {
+  auto request = start(rpc_operation::times, path);
+  auto result = call(request);
+  auto times = file_times();
+  times.last_read_time = get_file_time(result->reader);
+  times.last_write_time = get_file_time(result->reader);
+  return times;
+}
+
+uint64_t rpc_filesystem::bmap(const Path& path, size_t blocksize) {
+  auto request = start(rpc_operation::bmap, path);
+  request.writer.put_u64(blocksize);
+  return call(request)->reader.get_u64();
+}
+
+void rpc_filesystem::fallocate(const Path& path, int mode, uint64_t offset,
+                               uint64_t length) {
+  auto request = start(rpc_operation::fallocate, path);
+  request.writer.put_u32(static_cast<std::uint32_t>(mode));
+  request.writer.put_u64(offset);
+  request.writer.put_u64(length);
+  call(request);
+}
+
+rpc_filesystem::request rpc_filesystem::start(rpc_operation operation,
+                                              const Path& path) const {
+  std::uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    id = next_id_++;
+  }
+  auto result = request{rpc_writer(id), id, path};
+  result.writer.put_u16(static_cast<std::uint16_t>(operation));
+  result.writer.put_path(path);
+  return result;
+}
+
+std::unique_ptr<rpc_filesystem::response> rpc_filesystem::call(
+    request& request) const {
+  const auto& frame = request.writer.frame();
+  std::future<std::string> reply;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    if (broken_) {
+      throw error(error_code::io_error, "rpc connection lost");
+    }
+    reply = pending_[request.id].get_future();
+  }
+  try {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    rpc_send(fd_, frame);
+  } catch (const error&) {
+    // the stream may hold part of the frame; give up on the connection
+    ::shutdown(fd_, SHUT_RDWR);
+    throw;
+  }
+  auto result = std::unique_ptr<response>(new response(reply.get()));
+  auto code = result->reader.get_u32();
+  if (code != 0) {
+    throw error(static_cast<error_code>(code), request.path.string());
+  }
+  return result;
+}
+
+void rpc_filesystem::receive() {
+  try {
+    std::uint64_t id;
+    std::string body;
+    while (rpc_receive(fd_, id, body)) {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      auto found = pending_.find(id);
+      if (found != pending_.end()) {
+        found->second.set_value(std::move(body));
+        pending_.erase(found);
+      }
+      body = std::string();
+    }
+  } catch (const error&) {
+  }
+  fail_pending();
+}
+
+void rpc_filesystem::fail_pending() {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  broken_ = true;
+  for (auto& call : pending_) {
+    call.second.set_exception(std::make_exception_ptr(
+        error(error_code::io_error, "rpc connection lost")));
+  }
+  pending_.clear();
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,146 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/rpc_protocol.h>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Forwards every operation to an rpc_server over a Unix domain socket
+ *
+ * Any number of threads may call in at once.  Each request is tagged with
+ * an id and written as soon as it is made, without waiting for earlier
+ * ones, and a receiver thread hands each response to its caller as it
+ * arrives, so a slow operation does not hold up the others on the
+ * connection.  Errors of the remote filesystem are rethrown with their
+ * code; a broken connection fails every pending and later call with
+ * io_error.
+ *
+ * The pair-returning getxattr, whose value would have to outlive the call,
+ * is not supported; getxattrs and the buffer overload are.  ioctl is not
+ * forwarded. */
+class rpc_filesystem : public filesystem {
+ public:
+  /** Take over a connected socket, which is closed on destruction */
+  explicit rpc_filesystem(int fd);
+
+  /** Connect to a server listening at a Unix socket path */
+  static std::shared_ptr<rpc_filesystem> connect(const std::string& path);
+
+  ~rpc_filesystem() override;
+
+  rpc_filesystem(const rpc_filesystem&) = delete;
+  rpc_filesystem& operator=(const rpc_filesystem&) = delete;
+
+  std::uintmax_t file_size(const Path& path) const override;
+  space_info space(const Path& path) const override;
+  file_status status(const Path& path) const override;
+  void copy(const Path& from, const Path& to, CopyOptions options) override;
+  void copy_symlink(const Path& from, const Path& to,
+                    CopyOptions options) override;
+  bool clone_file(const Path& from, const Path& to) override;
+  file_status symlink_status(const Path& path) const override;
+  Path read_symlink(const Path& path) const override;
+  void create_directory(const Path& path) override;
+  void create_directory(const Path& path,
+                        drivex::permissions permissions) override;
+  void create_directories(const Path& path) override;
+  bool equivalent(const Path& p1, const Path& p2) const override;
+  bool remove(const Path& path) override;
+  void create_symlink(const Path& target, const Path& link) override;
+  void rename(const Path& from, const Path& to) override;
+  void link(const Path& from, const Path& to) override;
+  void permissions(const Path& path,
+                   drivex::permissions permissions) override;
+  bool is_empty(const Path& path) const override;
+  void chown(const Path& path, uint32_t user_id, uint32_t group_id) override;
+  void truncate(const Path& path, uint64_t offset) override;
+  void set_attributes(const Path& path,
+                      const attribute_update& update) override;
+  void open(const Path& path, int flags) override;
+  open_handle open_file(const Path& path, int flags) override;
+  open_handle create(const Path& path, drivex::permissions permissions,
+                     int flags) override;
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override;
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override;
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override;
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override;
+  void flush(const Path& path) override;
+  void flush(const Path& path, open_handle handle) override;
+  void release(const Path& path, int flags) override;
+  void release(const Path& path, open_handle handle, int flags) override;
+  void fsync(const Path& path, int fd) override;
+  void setxattr(const Path& path,
+                const std::pair<std::string, string_view>& attribute,
+                int flags) override;
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override;
+  xattr_map getxattrs(const Path& path) override;
+  std::vector<std::string> listxattr(const Path& path) override;
+  std::size_t listxattr(const Path& path, string_view& buffer) override;
+  void removexattr(const Path& path, const std::string& name) override;
+  std::vector<Path> read_directory(const Path& path) const override;
+  std::vector<directory_entry> read_directory_entries(
+      const Path& path) const override;
+  void fsyncdir(const Path& path, int datasync) override;
+  void access(const Path& path,
+              const drivex::permissions& permissions) override;
+  void create_file(const Path& path) override;
+  void create_file(const Path& path,
+                   drivex::permissions permissions) override;
+  void lock(const Path& path, int command, file_lock& lock,
+            std::uint64_t owner) override;
+  void flock(const Path& path, int operation, std::uint64_t owner) override;
+  std::time_t last_read_time(const Path& path) override;
+  void last_read_time(const Path& path, std::time_t new_time) override;
+  std::time_t last_write_time(const Path& path) override;
+  void last_write_time(const Path& path, std::time_t new_time) override;
+  file_times times(const Path& path) override;
+  uint64_t bmap(const Path& path, size_t blocksize) override;
+  void fallocate(const Path& path, int mode, uint64_t offset,
+                 uint64_t length) override;
+
+ private:
+  /** A request under construction */
+  struct request {
+    rpc_writer writer;
+    std::uint64_t id;
+    const Path& path;  // named in errors
+  };
+
+  /** A response being decoded, which owns its body */
+  struct response {
+    std::string body;
+    rpc_reader reader;
+    explicit response(std::string data);
+  };
+
+  request start(rpc_operation operation, const Path& path) const;
+  /** Send a request and wait for its successful response
+   *
+   * @throws error with the remote code if the operation failed */
+  std::unique_ptr<response> call(request& request) const;
+  void receive();
+  void fail_pending();
+
+  int fd_;
+  std::thread receiver_;
+  mutable std::mutex send_mutex_;
+  mutable std::mutex pending_mutex_;
+  mutable std::uint64_t next_id_;
+  mutable std::unordered_map<std::uint64_t, std::promise<std::string>>
+      pending_;
+  mutable bool broken_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,156 @@
+#include <drivex/rpc_protocol.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::size_t header_size = 12;  // length and id
+
+void store(char* output, std::uint64_t value, std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i) {
+    output[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+std::uint64_t load(const char* input, std::size_t size) {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    value |= std::uint64_t(static_cast<unsigned char>(input[i])) << (8 * i);
+  }
+  return value;
+}
+
+void append(std::string& frame, std::uint64_t value, std::size_t size) {
+  auto at = frame.size();
+  frame.resize(at + size);
+  store(&frame[at], value, size);
+}
+
+/** Read exactly size bytes; false if the peer closed before the first */
+bool receive_exact(int fd, char* output, std::size_t size) {
+  std::size_t done = 0;
+  while (done < size) {
+    auto count = ::recv(fd, output + done, size - done, 0);
+    if (count > 0) {
+      done += static_cast<std::size_t>(count);
+    } else if (count == 0) {
+      if (done == 0) {
+        return false;
+      }
+      throw error(error_code::io_error, "rpc connection closed mid-frame");
+    } else if (errno != EINTR) {
+      throw error(error_code::io_error, std::strerror(errno));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+rpc_writer::rpc_writer(std::uint64_t id) : frame_(4, '\0') {
+  append(frame_, id, 8);
+}
+
+void rpc_writer::put_u8(std::uint8_t value) { append(frame_, value, 1); }
+
+void rpc_writer::put_u16(std::uint16_t value) { append(frame_, value, 2); }
+
+void rpc_writer::put_u32(std::uint32_t value) { append(frame_, value, 4); }
+
+void rpc_writer::put_u64(std::uint64_t value) { append(frame_, value, 8); }
+
+void rpc_writer::put_bytes(const string_view& value) {
+  put_u32(static_cast<std::uint32_t>(value.size()));
+  frame_.append(value.data(), value.size());
+}
+
+void rpc_writer::put_path(const Path& path) { put_bytes(path.string()); }
+
+void rpc_writer::put_status(file_status status) {
+  put_u32(static_cast<std::uint32_t>(status.type()));
+  put_u32(static_cast<std::uint32_t>(status.permissions()));
+}
+
+const std::string& rpc_writer::frame() {
+  if (frame_.size() - 4 > rpc_max_frame) {
+    throw error(error_code::file_too_large, "rpc frame");
+  }
+  store(&frame_[0], frame_.size() - 4, 4);
+  return frame_;
+}
+
+rpc_reader::rpc_reader(const string_view& body) : body_(body), position_(0) {}
+
+std::uint8_t rpc_reader::get_u8() {
+  return static_cast<std::uint8_t>(load(take(1), 1));
+}
+
+std::uint16_t rpc_reader::get_u16() {
+  return static_cast<std::uint16_t>(load(take(2), 2));
+}
+
+std::uint32_t rpc_reader::get_u32() {
+  return static_cast<std::uint32_t>(load(take(4), 4));
+}
+
+std::uint64_t rpc_reader::get_u64() { return load(take(8), 8); }
+
+string_view rpc_reader::get_bytes() {
+  auto size = get_u32();
+  return string_view(take(size), size);
+}
+
+std::string rpc_reader::get_string() { return get_bytes().to_string(); }
+
+Path rpc_reader::get_path() { return Path(get_string()); }
+
+file_status rpc_reader::get_status() {
+  auto type = static_cast<file_type>(get_u32());
+  auto permissions = static_cast<drivex::permissions>(get_u32());
+  return file_status(type, permissions);
+}
+
+const char* rpc_reader::take(std::size_t size) {
+  if (size > body_.size() - position_) {
+    throw error(error_code::io_error, "truncated rpc message");
+  }
+  auto data = body_.data() + position_;
+  position_ += size;
+  return data;
+}
+
+void rpc_send(int fd, const std::string& frame) {
+  std::size_t done = 0;
+  while (done < frame.size()) {
+    auto count = ::send(fd, frame.data() + done, frame.size() - done,
+                        MSG_NOSIGNAL);
+    if (count >= 0) {
+      done += static_cast<std::size_t>(count);
+    } else if (errno != EINTR) {
+      throw error(error_code::io_error, std::strerror(errno));
+    }
+  }
+}
+
+bool rpc_receive(int fd, std::uint64_t& id, std::string& body) {
+  char header[header_size];
+  if (!receive_exact(fd, header, header_size)) {
+    return false;
+  }
+  auto length = load(header, 4);
+  if (length < 8 || length > rpc_max_frame) {
+    throw error(error_code::io_error, "malformed rpc frame");
+  }
+  id = load(header + 4, 8);
+  body.resize(length - 8);
+  if (!body.empty() && !receive_exact(fd, &body[0], body.size())) {
+    throw error(error_code::io_error, "rpc connection closed mid-frame");
+  }
+  return true;
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,125 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <cstdint>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** Operations of the drivex RPC protocol
+ *
+ * Every message is a frame: the little-endian u32 length of the rest, the
+ * u64 id the client gave the request, then the body.  A request body
+ * starts with the u16 operation followed by its arguments, and a response
+ * body with the u32 errno of the failure, zero on success, followed by the
+ * results.  Responses carry the id of their request and may be sent in any
+ * order. */
+enum class rpc_operation : std::uint16_t {
+  file_size = 1,
+  space,
+  status,
+  copy,
+  copy_symlink,
+  clone_file,
+  symlink_status,
+  read_symlink,
+  create_directory,
+  create_directories,
+  equivalent,
+  remove,
+  create_symlink,
+  rename,
+  link,
+  permissions,
+  is_empty,
+  chown,
+  truncate,
+  set_attributes,
+  open,
+  create,
+  read,
+  write,
+  flush,
+  release,
+  fsync,
+  setxattr,
+  getxattr,
+  getxattrs,
+  listxattr,
+  removexattr,
+  read_directory,
+  read_directory_entries,
+  fsyncdir,
+  access,
+  create_file,
+  lock,
+  flock,
+  last_read_time,
+  set_last_read_time,
+  last_write_time,
+  set_last_write_time,
+  bmap,
+  fallocate,
+  open_file,
+  times
+};
+
+/** Largest frame either side accepts */
+const std::uint32_t rpc_max_frame = 64u << 20u;
+
+/** Builds one frame */
+class rpc_writer {
+ public:
+  explicit rpc_writer(std::uint64_t id);
+
+  void put_u8(std::uint8_t value);
+  void put_u16(std::uint16_t value);
+  void put_u32(std::uint32_t value);
+  void put_u64(std::uint64_t value);
+  void put_bytes(const string_view& value);
+  void put_path(const Path& path);
+  void put_status(file_status status);
+
+  /** The finished frame, ready to send */
+  const std::string& frame();
+
+ private:
+  std::string frame_;
+};
+
+/** Decodes the body of a frame, which must outlive the reader
+ *
+ * @throws error(io_error) on reading past the end of the body */
+class rpc_reader {
+ public:
+  explicit rpc_reader(const string_view& body);
+
+  std::uint8_t get_u8();
+  std::uint16_t get_u16();
+  std::uint32_t get_u32();
+  std::uint64_t get_u64();
+  /** Bytes within the body */
+  string_view get_bytes();
+  std::string get_string();
+  Path get_path();
+  file_status get_status();
+
+ private:
+  const char* take(std::size_t size);
+
+  string_view body_;
+  std::size_t position_;
+};
+
+/** Write a whole frame to a socket
+ *
+ * @throws error(io_error) if the connection fails */
+void rpc_send(int fd, const std::string& frame);
+
+/** Read the next frame from a socket
+ *
+ * @return false if the peer closed the connection between frames
+ * @throws error(io_error) if the connection fails or a frame is malformed */
+bool rpc_receive(int fd, std::uint64_t& id, std::string& body);
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,616 @@
+#include <drivex/arena.h>
+#include <drivex/directory_entry.h>
+#include <drivex/lock_manager.h>
+#include <drivex/rpc_server.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+drivex::permissions get_permissions(rpc_reader& reader) {
+  return static_cast<drivex::permissions>(reader.get_u32());
+}
+
+int get_int(rpc_reader& reader) { return static_cast<int>(reader.get_u32()); }
+
+std::time_t get_time(rpc_reader& reader) {
+  return static_cast<std::time_t>(static_cast<std::int64_t>(reader.get_u64()));
+}
+
+void put_time(rpc_writer& writer, std::time_t time) {
+  writer.put_u64(static_cast<std::uint64_t>(static_cast<std::int64_t>(time)));
+}
+
+file_time get_file_time(rpc_reader& reader) {
+  auto count = static_cast<std::int64_t>(reader.get_u64());
+  return file_time(std::chrono::nanoseconds(count));
+}
+
+void put_file_time(rpc_writer& writer, file_time time) {
+  writer.put_u64(
+      static_cast<std::uint64_t>(time.time_since_epoch().count()));
+}
+
+/** Size of a buffer the client asks for, bounded to fit a response */
+std::size_t get_size(rpc_reader& reader) {
+  auto size = reader.get_u32();
+  if (size > rpc_max_frame / 2) {
+    throw error(error_code::invalid_argument, "rpc buffer size");
+  }
+  return size;
+}
+
+/** Uninitialized result buffer of the current request */
+string_view scratch(std::size_t size) {
+  return string_view(static_cast<char*>(arena::local().allocate(size, 1)),
+                     size);
+}
+
+CopyOptions get_copy_options(rpc_reader& reader) {
+  return static_cast<CopyOptions>(reader.get_u32());
+}
+
+/** Whether a request is a lock that may wait for another client */
+bool may_block(const std::string& body) {
+  try {
+    rpc_reader reader(body);
+    auto operation = static_cast<rpc_operation>(reader.get_u16());
+    reader.get_path();
+    if (operation == rpc_operation::lock) {
+      return get_int(reader) == F_SETLKW;
+    }
+    if (operation == rpc_operation::flock) {
+      auto flags = get_int(reader);
+      return (flags & (LOCK_NB | LOCK_UN)) == 0;
+    }
+  } catch (const std::exception&) {
+    // malformed; handle reports it
+  }
+  return false;
+}
+
+}  // namespace
+
+struct rpc_server::connection {
+  explicit connection(int socket) : fd(socket) {}
+
+  int fd;
+  std::mutex send_mutex;
+  std::mutex mutex;
+  std::condition_variable changed;  // a request finished
+  std::size_t outstanding = 0;      // all requests not yet answered
+  std::size_t pooled = 0;           // of those, the ones on the pool
+  std::size_t blocking = 0;         // and the ones that may wait on a lock
+  std::multiset<std::uint64_t> waiting;  // owners of blocking lock requests
+  std::set<std::pair<std::string, std::uint64_t>> granted;  // path, owner
+  std::atomic<bool> closed{false};
+};
+
+rpc_server::rpc_server(std::shared_ptr<filesystem> backend, thread_pool& pool,
+                       std::size_t max_requests, std::size_t wait_threads)
+    : backend_(std::move(backend)),
+      pool_(pool),
+      max_requests_(std::max<std::size_t>(max_requests, 1)),
+      waits_(wait_threads),
+      next_thread_(0),
+      stopping_(false) {}
+
+rpc_server::~rpc_server() {
+  stop();
+  auto threads = std::map<std::uint64_t, std::thread>();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads.swap(threads_);
+  }
+  for (auto& thread : threads) {
+    thread.second.join();
+  }
+}
+
+void rpc_server::serve(int fd) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    sockets_.insert(fd);
+  }
+  connection client(fd);
+  try {
+    std::uint64_t id;
+    std::string body;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(client.mutex);
+        client.changed.wait(lock, [this, &client]() {
+          return client.pooled < max_requests_ &&
+                 client.blocking < max_requests_;
+        });
+      }
+      if (!rpc_receive(fd, id, body)) {
+        break;
+      }
+      auto request = std::make_shared<std::string>(std::move(body));
+      body = std::string();
+      auto blocking = may_block(*request);
+      {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        ++client.outstanding;
+        ++(blocking ? client.blocking : client.pooled);
+      }
+      auto run = [this, &client, id, request, blocking]() {
+        handle(client, id, *request);
+        std::lock_guard<std::mutex> lock(client.mutex);
+        --client.outstanding;
+        --(blocking ? client.blocking : client.pooled);
+        client.changed.notify_all();
+      };
+      (blocking ? waits_ : pool_).post(run);  // serve waits for it below
+    }
+  } catch (const error&) {
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sockets_.erase(fd);
+  }
+  client.closed = true;
+  std::unique_lock<std::mutex> lock(client.mutex);
+  if (auto manager = backend_->locks()) {
+    for (auto owner : client.waiting) {
+      manager->interrupt(owner);  // nobody is left to unlock for them
+    }
+  }
+  client.changed.wait(lock, [&client]() { return client.outstanding == 0; });
+  lock.unlock();
+  release_locks(client);
+}
+
+void rpc_server::listen(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw error(error_code::filename_too_long, path);
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+  auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw error(static_cast<error_code>(errno), path);
+  }
+  ::unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    auto code = errno;
+    ::close(fd);
+    throw error(static_cast<error_code>(code), path);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!stopping_) {
+      sockets_.insert(fd);
+    }
+  }
+  for (;;) {
+    auto client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;  // shut down by stop
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      ::close(client);
+      break;
+    }
+    reap();
+    auto number = next_thread_++;
+    threads_.emplace(number, std::thread([this, client, number]() {
+                       serve(client);
+                       ::close(client);
+                       std::lock_guard<std::mutex> lock(mutex_);
+                       finished_.push_back(number);
+                     }));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sockets_.erase(fd);
+  }
+  ::close(fd);
+}
+
+void rpc_server::stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopping_ = true;
+  for (auto fd : sockets_) {
+    ::shutdown(fd, SHUT_RDWR);
+  }
+}
+
+void rpc_server::release_locks(connection& client) {
+  auto unlock = file_lock();
+  unlock.type = lock_type::unlock;
+  for (const auto& held : client.granted) {
+    auto path = Path(held.first);
+    try {
+      if (auto manager = backend_->locks()) {
+        manager->release(path, held.second);
+        manager->flock(path, LOCK_UN, held.second);
+      } else {
+        backend_->lock(path, F_SETLK, unlock, held.second);
+        backend_->flock(path, LOCK_UN, held.second);
+      }
+    } catch (const std::exception&) {  // the file may have gone
+    }
+  }
+  client.granted.clear();
+}
+
+void rpc_server::reap() {
+  for (auto number : finished_) {
+    auto found = threads_.find(number);
+    found->second.join();  // it has nothing left to do but return
+    threads_.erase(found);
+  }
+  finished_.clear();
+}
+
+void rpc_server::handle(connection& client, std::uint64_t id,
+                        const std::string& body) {
+  rpc_writer response(id);
+  auto code = 0;
+  arena::scope temporaries(arena::local());
+  try {
+    rpc_reader reader(body);
+    auto operation = static_cast<rpc_operation>(reader.get_u16());
+    auto path = reader.get_path();
+    response.put_u32(0);
+    dispatch(client, operation, path, reader, response);
+  } catch (const boost::filesystem::filesystem_error& e) {
+    code = e.code().value();
+  } catch (const std::exception&) {
+    code = static_cast<int>(error_code::io_error);
+  }
+  if (code != 0) {  // drop partial results
+    response = rpc_writer(id);
+    response.put_u32(static_cast<std::uint32_t>(code));
+  }
+  try {
+    std::lock_guard<std::mutex> lock(client.send_mutex);
+    rpc_send(client.fd, response.frame());
+  } catch (const error&) {
+    // the client is gone; its connection is being torn down
+  }
+}
+
+void rpc_server::dispatch(connection& client, rpc_operation operation,
+                          const Path& path, rpc_reader& reader,
+                          rpc_writer& writer) {
+  auto& fs = *backend_;
+  auto closed = [&client]() { return client.closed.load(); };
+  auto waiting = [&client](std::uint64_t owner,
+                           const std::function<void()>& call) {
+    std::multiset<std::uint64_t>::iterator entry;
+    {
+      std::lock_guard<std::mutex> lock(client.mutex);
+      entry = client.waiting.insert(owner);
+    }
+    try {
+      call();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(client.mutex);
+      client.waiting.erase(entry);
+      throw;
+    }
+    std::lock_guard<std::mutex> lock(client.mutex);
+    client.waiting.erase(entry);
+  };
+  auto granted = [&client, &path](std::uint64_t owner) {
+    std::lock_guard<std::mutex> lock(client.mutex);
+    client.granted.emplace(path.string(), owner);
+  };
+  switch (operation) {
+    case rpc_operation::file_size:
+      writer.put_u64(fs.file_size(path));
+      break;
+    case rpc_operation::space: {
+      auto info = fs.space(path);
+      writer.put_u64(info.capacity);
+      writer.put_u64(info.free);
+      writer.put_u64(info.available);
+      break;
+    }
+    case rpc_operation::status:
+      writer.put_status(fs.status(path));
+      break;
+    case rpc_operation::copy: {
+      auto to = reader.get_path();
+      fs.copy(path, to, get_copy_options(reader));
+      break;
+    }
+    case rpc_operation::copy_symlink: {
+      auto to = reader.get_path();
+      fs.copy_symlink(path, to, get_copy_options(reader));
+      break;
+    }
+    case rpc_operation::clone_file:
+      writer.put_u8(fs.clone_file(path, reader.get_path()) ? 1 : 0);
+      break;
+    case rpc_operation::symlink_status:
+      writer.put_status(fs.symlink_status(path));
+      break;
+    case rpc_operation::read_symlink:
+      writer.put_path(fs.read_symlink(path));
+      break;
+    case rpc_operation::create_directory: {
+      auto permissions = get_permissions(reader);
+      if (permissions == drivex::permissions::perms_not_known) {
+        fs.create_directory(path);
+      } else {
+        fs.create_directory(path, permissions);
+      }
+      break;
+    }
+    case rpc_operation::create_directories:
+      fs.create_directories(path);
+      break;
+    case rpc_operation::equivalent:
+      writer.put_u8(fs.equivalent(path, reader.get_path()) ? 1 : 0);
+      break;
+    case rpc_operation::remove:
+      writer.put_u8(fs.remove(path) ? 1 : 0);
+      break;
+    case rpc_operation::create_symlink:
+      fs.create_symlink(reader.get_path(), path);
+      break;
+    case rpc_operation::rename:
+      fs.rename(path, reader.get_path());
+      break;
+    case rpc_operation::link:
+      fs.link(path, reader.get_path());
+      break;
+    case rpc_operation::permissions:
+      fs.permissions(path, get_permissions(reader));
+      break;
+    case rpc_operation::is_empty:
+      writer.put_u8(fs.is_empty(path) ? 1 : 0);
+      break;
+    case rpc_operation::chown: {
+      auto user_id = reader.get_u32();
+      fs.chown(path, user_id, reader.get_u32());
+      break;
+    }
+    case rpc_operation::truncate:
+      fs.truncate(path, reader.get_u64());
+      break;
+    case rpc_operation::set_attributes: {
+      auto present = reader.get_u8();
+      attribute_update update;
+      if ((present & 0x01u) != 0) {
+        update.permissions = get_permissions(reader);
+      }
+      if ((present & 0x02u) != 0) {
+        update.user_id = reader.get_u32();
+      }
+      if ((present & 0x04u) != 0) {
+        update.group_id = reader.get_u32();
+      }
+      if ((present & 0x08u) != 0) {
+        update.size = reader.get_u64();
+      }
+      if ((present & 0x10u) != 0) {
+        update.last_read_time = get_file_time(reader);
+      }
+      if ((present & 0x20u) != 0) {
+        update.last_write_time = get_file_time(reader);
+      }
+      fs.set_attributes(path, update);
+      break;
+    }
+    case rpc_operation::open:
+      fs.open(path, get_int(reader));
+      break;
+    case rpc_operation::open_file:
+      writer.put_u64(fs.open_file(path, get_int(reader)));
+      break;
+    case rpc_operation::create: {
+      auto permissions = get_permissions(reader);
+      writer.put_u64(fs.create(path, permissions, get_int(reader)));
+      break;
+    }
+    case rpc_operation::read: {
+      auto handle = reader.get_u64();
+      auto buffer = scratch(get_size(reader));
+      auto offset = reader.get_u64();
+      auto count = handle == no_open_handle
+                       ? fs.read(path, buffer, offset)
+                       : fs.read(path, handle, buffer, offset);
+      writer.put_bytes(buffer.substr(
+          0, static_cast<std::size_t>(std::max(count, 0))));
+      break;
+    }
+    case rpc_operation::write: {
+      auto handle = reader.get_u64();
+      auto offset = reader.get_u64();
+      auto data = reader.get_bytes();
+      auto count = handle == no_open_handle
+                       ? fs.write(path, data, offset)
+                       : fs.write(path, handle, data, offset);
+      writer.put_u32(static_cast<std::uint32_t>(count));
+      break;
+    }
+    case rpc_operation::flush: {
+      auto handle = reader.get_u64();
+      if (handle == no_open_handle) {
+        fs.flush(path);
+      } else {
+        fs.flush(path, handle);
+      }
+      break;
+    }
+    case rpc_operation::release: {
+      auto handle = reader.get_u64();
+      auto flags = get_int(reader);
+      if (handle == no_open_handle) {
+        fs.release(path, flags);
+      } else {
+        fs.release(path, handle, flags);
+      }
+      break;
+    }
+    case rpc_operation::fsync:
+      fs.fsync(path, get_int(reader));
+      break;
+    case rpc_operation::setxattr: {
+      auto name = reader.get_string();
+      auto value = reader.get_bytes();
+      fs.setxattr(path, std::make_pair(name, value), get_int(reader));
+      break;
+    }
+    case rpc_operation::getxattr: {
+      auto name = reader.get_string();
+      auto buffer = scratch(get_size(reader));
+      auto size = fs.getxattr(path, name, buffer);
+      writer.put_u64(size);
+      writer.put_bytes(buffer.substr(0, std::min(buffer.size(), size)));
+      break;
+    }
+    case rpc_operation::getxattrs: {
+      auto attributes = fs.getxattrs(path);
+      writer.put_u32(static_cast<std::uint32_t>(attributes.size()));
+      for (const auto& attribute : attributes) {
+        writer.put_bytes(attribute.first);
+        writer.put_bytes(attribute.second);
+      }
+      break;
+    }
+    case rpc_operation::listxattr: {
+      auto buffer = scratch(get_size(reader));
+      auto size = fs.listxattr(path, buffer);
+      writer.put_u64(size);
+      writer.put_bytes(buffer.substr(0, std::min(buffer.size(), size)));
+      break;
+    }
+    case rpc_operation::removexattr:
+      fs.removexattr(path, reader.get_string());
+      break;
+    case rpc_operation::read_directory: {
+      auto names = fs.read_directory(path);
+      writer.put_u32(static_cast<std::uint32_t>(names.size()));
+      for (const auto& name : names) {
+        writer.put_path(name);
+      }
+      break;
+    }
+    case rpc_operation::read_directory_entries: {
+      auto entries = fs.read_directory_entries(path);
+      writer.put_u32(static_cast<std::uint32_t>(entries.size()));
+      for (const auto& entry : entries) {
+        writer.put_path(entry.path());
+        writer.put_u8(entry.status_known() ? 1 : 0);
+        if (entry.status_known()) {
+          writer.put_status(entry.symlink_status());
+        }
+      }
+      break;
+    }
+    case rpc_operation::fsyncdir:
+      fs.fsyncdir(path, get_int(reader));
+      break;
+    case rpc_operation::access:
+      fs.access(path, get_permissions(reader));
+      break;
+    case rpc_operation::create_file: {
+      auto permissions = get_permissions(reader);
+      if (permissions == drivex::permissions::perms_not_known) {
+        fs.create_file(path);
+      } else {
+        fs.create_file(path, permissions);
+      }
+      break;
+    }
+    case rpc_operation::lock: {
+      auto command = get_int(reader);
+      file_lock lock;
+      lock.type = static_cast<lock_type>(reader.get_u8());
+      lock.start = reader.get_u64();
+      lock.length = reader.get_u64();
+      lock.pid = static_cast<std::int64_t>(reader.get_u64());
+      auto owner = reader.get_u64();
+      auto manager = fs.locks();
+      if (manager && command == F_SETLKW) {
+        waiting(owner, [&] {
+          manager->lock(path, command, lock, owner, closed);
+        });
+      } else {
+        fs.lock(path, command, lock, owner);
+      }
+      if (command != F_GETLK && lock.type != lock_type::unlock) {
+        granted(owner);
+      }
+      writer.put_u8(static_cast<std::uint8_t>(lock.type));
+      writer.put_u64(lock.start);
+      writer.put_u64(lock.length);
+      writer.put_u64(static_cast<std::uint64_t>(lock.pid));
+      break;
+    }
+    case rpc_operation::flock: {
+      auto operation_flags = get_int(reader);
+      auto owner = reader.get_u64();
+      auto manager = fs.locks();
+      if (manager && (operation_flags & (LOCK_NB | LOCK_UN)) == 0) {
+        waiting(owner, [&] {
+          manager->flock(path, operation_flags, owner, closed);
+        });
+      } else {
+        fs.flock(path, operation_flags, owner);
+      }
+      if ((operation_flags & LOCK_UN) == 0) {
+        granted(owner);
+      }
+      break;
+    }
+    case rpc_operation::last_read_time:
+      put_time(writer, fs.last_read_time(path));
+      break;
+    case rpc_operation::set_last_read_time:
+      fs.last_read_time(path, get_time(reader));
+      break;
+    case rpc_operation::last_write_time:
+      put_time(writer, fs.last_write_time(path));
+      break;
+    case rpc_operation::set_last_write_time:
+      fs.last_write_time(path, get_time(reader));
+      break;
+    case rpc_operation::times: {
+      auto times = fs.times(path);
+      put_file_time(writer, times.last_read_time);
+      put_file_time(writer, times.last_write_time);
+      break;
+    }
+    case rpc_operation::bmap:
+      writer.put_u64(fs.bmap(path, reader.get_u64()));
+      break;
+    case rpc_operation::fallocate: {
+      auto mode = get_int(reader);
+      auto offset = reader.get_u64();
+      fs.fallocate(path, mode, offset, reader.get_u64());
+      break;
+    }
+    default:
+      throw error(error_code::function_not_supported);
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,85 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/rpc_protocol.h>
+#include <drivex/thread_pool.h>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Serves a filesystem to rpc_filesystem clients over Unix domain sockets
+ *
+ * Requests are read off each connection as they arrive and run on the
+ * thread pool, so that many run at once and each response is sent as soon
+ * as its operation completes, whatever the order of the requests.  Errors
+ * thrown by the filesystem are returned to the client with their code.
+ *
+ * A connection stops reading once max_requests of its requests are queued
+ * or running on the pool, so a fast client cannot queue without bound.
+ * Lock requests that may wait, F_SETLKW and flock without LOCK_NB, run on a
+ * small pool of their own instead: parked on the shared pool, enough of
+ * them would stall the requests that release the locks.  A connection
+ * likewise stops reading once max_requests of them are outstanding.  When
+ * a connection ends, its waits in the backend's lock_manager are
+ * interrupted and the locks granted to it are released, as the kernel does
+ * for a process that exits. */
+class rpc_server {
+ public:
+  /** @param max_requests requests of one connection on the pool at once,
+   *        and lock waits of one connection outstanding at once
+   *  @param wait_threads threads that lock requests may wait on */
+  rpc_server(std::shared_ptr<filesystem> backend, thread_pool& pool,
+             std::size_t max_requests = 256, std::size_t wait_threads = 8);
+
+  /** Stop and wait for the connections being served */
+  ~rpc_server();
+
+  rpc_server(const rpc_server&) = delete;
+  rpc_server& operator=(const rpc_server&) = delete;
+
+  /** Serve a connected socket until the client disconnects or stop is
+   * called, then wait for its outstanding requests
+   *
+   * The socket is not closed. */
+  void serve(int fd);
+
+  /** Accept connections on a Unix socket path, serving each on its own
+   * thread, until stop is called
+   *
+   * Any existing socket file at the path is replaced. */
+  void listen(const std::string& path);
+
+  /** Make listen and serve return */
+  void stop();
+
+ private:
+  struct connection;
+
+  void handle(connection& client, std::uint64_t id, const std::string& body);
+  void dispatch(connection& client, rpc_operation operation,
+                const Path& path, rpc_reader& reader, rpc_writer& writer);
+  /** Release the locks granted to a connection that has ended */
+  void release_locks(connection& client);
+  /** Join the threads of connections that have ended; mutex_ is held */
+  void reap();
+
+  std::shared_ptr<filesystem> backend_;
+  thread_pool& pool_;
+  const std::size_t max_requests_;
+  thread_pool waits_;  // for lock requests that may block
+  std::mutex mutex_;
+  std::set<int> sockets_;  // listening and connected, to shut down on stop
+  std::map<std::uint64_t, std::thread> threads_;  // of accepted connections
+  std::vector<std::uint64_t> finished_;  // threads_ that have returned
+  std::uint64_t next_thread_;
+  bool stopping_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,147 @@
+#include <drivex/scheduler.h>
+#include <algorithm>
+
+namespace lockblox {
+namespace drivex {
+
+scheduler::scheduler(thread_pool& pool, scheduler_settings settings)
+    : pool_(pool),
+      settings_(settings),
+      turn_(0),
+      running_(0),
+      queued_(0) {
+  if (settings_.max_running == 0) {
+    settings_.max_running = pool.size();
+  }
+  for (auto& weight : settings_.weights) {
+    weight = std::max<std::uint32_t>(weight, 1);
+  }
+}
+
+scheduler::~scheduler() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return running_ == 0 && queued_ == 0; });
+}
+
+void scheduler::submit(request_class kind, std::uint64_t caller,
+                       std::uint32_t cost, thread_pool::task t) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& queue = classes_[static_cast<std::size_t>(kind)];
+  auto& waiting = queue.callers[caller];
+  if (waiting.jobs.empty()) {
+    queue.turns.push_back(caller);
+    auto debtor = queue.debtors.find(caller);
+    if (debtor != queue.debtors.end()) {  // back before its debt was dropped
+      waiting.deficit = debtor->second->second;
+      queue.debts.erase(debtor->second);
+      queue.debtors.erase(debtor);
+    }
+  }
+  waiting.jobs.push_back({std::max<std::uint32_t>(cost, 1), std::move(t)});
+  ++queue.queued;
+  ++queued_;
+  dispatch();
+}
+
+scheduler::statistics scheduler::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  statistics result;
+  for (std::size_t i = 0; i < request_classes; ++i) {
+    const auto& queue = classes_[i];
+    result[i] = {queue.queued, queue.running, queue.dispatched, queue.cost};
+  }
+  return result;
+}
+
+void scheduler::dispatch() {
+  while (running_ < settings_.max_running) {
+    auto any = false;
+    for (std::size_t i = 0; i < request_classes; ++i) {
+      any = any || eligible(i);
+    }
+    if (!any) {
+      return;
+    }
+    // a class spends its deficit and may overdraw it by one request; a
+    // class in debt is skipped, and paid its weight, until it is not
+    auto& queue = classes_[turn_];
+    if (!eligible(turn_) || queue.deficit <= 0) {
+      if (queue.queued == 0) {
+        queue.deficit = std::min<std::int64_t>(queue.deficit, 0);
+      } else if (eligible(turn_)) {
+        queue.deficit += settings_.weights[turn_];
+      }
+      turn_ = (turn_ + 1) % request_classes;
+      continue;
+    }
+    auto next = take(queue);
+    queue.deficit -= next.cost;
+    --queue.queued;
+    --queued_;
+    ++queue.running;
+    ++queue.dispatched;
+    queue.cost += next.cost;
+    ++running_;
+    auto kind = turn_;
+    auto run = std::move(next.run);
+    pool_.post([this, kind, run]() {
+      run();
+      finish(kind);
+    });
+  }
+}
+
+bool scheduler::eligible(std::size_t kind) const {
+  const auto& queue = classes_[kind];
+  auto cap = settings_.caps[kind];
+  return queue.queued != 0 && (cap == 0 || queue.running < cap);
+}
+
+scheduler::job scheduler::take(class_queue& queue) {
+  for (;;) {
+    auto caller = queue.turns.front();
+    auto& waiting = queue.callers[caller];
+    if (waiting.deficit <= 0) {  // as between classes, with weight one
+      waiting.deficit += 1;
+      queue.turns.pop_front();
+      queue.turns.push_back(caller);
+      continue;
+    }
+    auto next = std::move(waiting.jobs.front());
+    waiting.jobs.pop_front();
+    waiting.deficit -= next.cost;
+    if (waiting.jobs.empty()) {
+      queue.turns.pop_front();
+      if (waiting.deficit < 0) {
+        remember_debt(queue, caller, waiting.deficit);
+      }
+      queue.callers.erase(caller);  // callers come and go with processes
+    }
+    return next;
+  }
+}
+
+void scheduler::remember_debt(class_queue& queue, std::uint64_t caller,
+                              std::int64_t deficit) {
+  if (settings_.debtors == 0) {
+    return;
+  }
+  queue.debts.emplace_front(caller, deficit);
+  queue.debtors[caller] = queue.debts.begin();
+  if (queue.debts.size() > settings_.debtors) {
+    queue.debtors.erase(queue.debts.back().first);
+    queue.debts.pop_back();
+  }
+}
+
+void scheduler::finish(std::size_t kind) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  --classes_[kind].running;
+  --running_;
+  dispatch();
+  if (running_ == 0 && queued_ == 0) {
+    idle_.notify_all();
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
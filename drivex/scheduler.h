@@ -0,0 +1,117 @@
+#pragma once
+#include <drivex/thread_pool.h>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace lockblox {
+namespace drivex {
+
+/** Kinds of request a scheduler keeps apart */
+enum class request_class : std::uint8_t { metadata, read, write, sync };
+
+const std::size_t request_classes = 4;
+
+struct scheduler_settings {
+  /** Cost each class may dispatch per round while all have work, by
+   * request_class */
+  std::array<std::uint32_t, request_classes> weights{{8, 2, 2, 1}};
+  /** Requests of each class running at once; zero for no limit */
+  std::array<std::size_t, request_classes> caps{{0, 0, 0, 0}};
+  /** Requests running at once in all; zero for the size of the pool */
+  std::size_t max_running = 0;
+  /** Callers per class whose debt outlives their queue, most recent kept */
+  std::size_t debtors = 64;
+};
+
+/** Fair queueing in front of a thread pool
+ *
+ * Requests wait in a queue per class and, within it, per caller, and only
+ * as many run as the pool has workers, so that the order they run in is
+ * decided here rather than by the pool's queues.  Classes share the
+ * workers by weighted deficit round robin over request costs, so a class
+ * of small requests keeps its share against one of large ones, and a class
+ * at its cap waits while the others go on.  Callers within a class take
+ * turns the same way with equal weights, so one caller's backlog delays
+ * another's requests by at most one of its own.  A caller whose queue
+ * drains while in debt keeps the debt for when it returns, so that one
+ * sending a large request at a time cannot start each afresh; the debts of
+ * the most recent callers are kept.  Tasks must not throw. */
+class scheduler {
+ public:
+  struct class_statistics {
+    std::size_t queued;
+    std::size_t running;
+    std::uint64_t dispatched;
+    std::uint64_t cost;  // of the dispatched requests
+  };
+
+  using statistics = std::array<class_statistics, request_classes>;
+
+  explicit scheduler(thread_pool& pool,
+                     scheduler_settings settings = scheduler_settings());
+
+  /** Wait for the queued and running requests */
+  ~scheduler();
+
+  scheduler(const scheduler&) = delete;
+  scheduler& operator=(const scheduler&) = delete;
+
+  /** Queue a request
+   *
+   * @param caller whose turn it takes, such as a uid and pid
+   * @param cost relative size, at least one */
+  void submit(request_class kind, std::uint64_t caller, std::uint32_t cost,
+              thread_pool::task t);
+
+  statistics stats() const;
+
+ private:
+  struct job {
+    std::uint32_t cost;
+    thread_pool::task run;
+  };
+
+  struct caller_queue {
+    std::deque<job> jobs;
+    std::int64_t deficit = 0;
+  };
+
+  using debt_list = std::list<std::pair<std::uint64_t, std::int64_t>>;
+
+  struct class_queue {
+    std::unordered_map<std::uint64_t, caller_queue> callers;
+    std::deque<std::uint64_t> turns;  // callers with jobs, in turn
+    debt_list debts;                  // of idle callers, most recent first
+    std::unordered_map<std::uint64_t, debt_list::iterator> debtors;
+    std::int64_t deficit = 0;
+    std::size_t queued = 0;
+    std::size_t running = 0;
+    std::uint64_t dispatched = 0;
+    std::uint64_t cost = 0;
+  };
+
+  /** Start what may run; the mutex is held */
+  void dispatch();
+  bool eligible(std::size_t kind) const;
+  job take(class_queue& queue);
+  void remember_debt(class_queue& queue, std::uint64_t caller,
+                     std::int64_t deficit);
+  void finish(std::size_t kind);
+
+  thread_pool& pool_;
+  scheduler_settings settings_;
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  std::array<class_queue, request_classes> classes_;
+  std::size_t turn_;  // class whose turn it is
+  std::size_t running_;
+  std::size_t queued_;
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,355 @@
+#include <drivex/session_manager.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint64_t wake_id = 0;
+const int max_events = 64;
+
+/** Header of every request from the kernel, as in linux/fuse.h */
+struct request_header {
+  std::uint32_t length;
+  std::uint32_t opcode;
+  std::uint64_t unique;
+  std::uint64_t node;
+  std::uint32_t uid;
+  std::uint32_t gid;
+  std::uint32_t pid;
+  std::uint32_t padding;
+};
+
+/** Opcodes of linux/fuse.h that scheduling tells apart */
+enum : std::uint32_t {
+  fuse_forget = 2,
+  fuse_read = 15,
+  fuse_write = 16,
+  fuse_fsync = 20,
+  fuse_flush = 25,
+  fuse_init = 26,
+  fuse_fsyncdir = 30,
+  fuse_setlkw = 33,
+  fuse_interrupt = 36,
+  fuse_destroy = 38,
+  fuse_batch_forget = 42,
+  fuse_fallocate = 43,
+};
+
+/** Where the size of a read or write request is, after its handle and
+ * offset */
+const std::size_t transfer_size_offset = sizeof(request_header) + 16;
+
+/** Units of transfer a request costs one more scheduling unit for */
+const std::uint32_t cost_unit = 64u << 10u;
+
+/** How to schedule a request
+ *
+ * @return false if it must not wait behind others */
+bool classify(const char* data, std::size_t size, request_class& kind,
+              std::uint64_t& caller, std::uint32_t& cost) {
+  request_header header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  caller = static_cast<std::uint64_t>(header.uid) << 32u | header.pid;
+  cost = 1;
+  switch (header.opcode) {
+    case fuse_forget:
+    case fuse_init:
+    case fuse_setlkw:
+    case fuse_interrupt:
+    case fuse_destroy:
+    case fuse_batch_forget:
+      return false;
+    case fuse_read:
+    case fuse_write:
+      kind = header.opcode == fuse_read ? request_class::read
+                                        : request_class::write;
+      if (size >= transfer_size_offset + sizeof(std::uint32_t)) {
+        std::uint32_t length;
+        std::memcpy(&length, data + transfer_size_offset, sizeof(length));
+        cost += length / cost_unit;
+      }
+      return true;
+    case fuse_fallocate:
+      kind = request_class::write;
+      return true;
+    case fuse_fsync:
+    case fuse_fsyncdir:
+    case fuse_flush:
+      kind = request_class::sync;
+      return true;
+    default:
+      kind = request_class::metadata;
+      return true;
+  }
+}
+
+}  // namespace
+
+session_manager::session_manager(thread_pool& pool, std::size_t max_requests,
+                                 drivex::scheduler* scheduler)
+    : pool_(pool),
+      scheduler_(scheduler),
+      epoll_(::epoll_create1(EPOLL_CLOEXEC)),
+      wake_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      next_id_(wake_id + 1),
+      limit_(max_requests == 0 ? 1 : max_requests),
+      active_(0),
+      live_(0),
+      stopping_(false),
+      running_(false) {
+  if (epoll_ < 0 || wake_ < 0) {
+    auto code = errno;
+    ::close(epoll_);
+    ::close(wake_);
+    throw error(static_cast<error_code>(code));
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = wake_id;
+  ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &event);
+}
+
+session_manager::~session_manager() {
+  stop();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return active_ == 0; });
+  }
+  ::close(wake_);
+  ::close(epoll_);
+}
+
+void session_manager::add(Fuse& mount, std::size_t max_requests) {
+  auto handle = mount.session();
+  if (handle == nullptr) {
+    throw error(error_code::invalid_argument);
+  }
+  auto channel = fuse_session_next_chan(handle, nullptr);
+  std::unique_ptr<session> s(new session);
+  s->mount = &mount;
+  s->limit = max_requests == 0 ? 1 : max_requests;
+  s->source.fd = fuse_chan_fd(channel);
+  s->source.buffer_size = fuse_chan_bufsize(channel);
+  s->source.receive = [handle, channel](char* buffer, std::size_t size) {
+    auto from = channel;
+    auto received = fuse_chan_recv(&from, buffer, size);
+    return received > 0 && fuse_session_exited(handle) != 0 ? 0 : received;
+  };
+  s->source.process = [handle, channel](const char* data, std::size_t size) {
+    fuse_session_process(handle, data, size, channel);
+  };
+  add(std::move(s));
+}
+
+std::uint64_t session_manager::add(endpoint source, std::size_t max_requests) {
+  std::unique_ptr<session> s(new session);
+  s->limit = max_requests == 0 ? 1 : max_requests;
+  s->source = std::move(source);
+  return add(std::move(s));
+}
+
+std::uint64_t session_manager::add(std::unique_ptr<session> s) {
+  auto fd = s->source.fd;
+  std::lock_guard<std::mutex> lock(mutex_);
+  s->id = next_id_++;
+  epoll_event event{};
+  event.data.u64 = s->id;
+  if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    throw error(static_cast<error_code>(errno));
+  }
+  // a spurious wake must not block the thread serving every mount
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  auto& added = *sessions_.emplace(s->id, std::move(s)).first->second;
+  ++live_;
+  resume(added);
+  return added.id;
+}
+
+void session_manager::remove(Fuse& mount) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto& s : sessions_) {
+    if (s.second->mount == &mount) {
+      auto id = s.first;
+      lock.unlock();
+      remove(id);
+      return;
+    }
+  }
+}
+
+void session_manager::remove(std::uint64_t id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto found = sessions_.find(id);
+  if (found != sessions_.end()) {
+    auto& s = *found->second;
+    end(s);
+    idle_.wait(lock, [&s]() { return s.active == 0; });
+    sessions_.erase(found);
+  }
+}
+
+void session_manager::run() {
+  struct running {
+    explicit running(session_manager& manager) : manager(manager) {
+      std::lock_guard<std::mutex> lock(manager.mutex_);
+      manager.running_ = true;
+    }
+    ~running() {
+      std::lock_guard<std::mutex> lock(manager.mutex_);
+      manager.running_ = false;
+      manager.idle_.notify_all();
+    }
+    session_manager& manager;
+  } guard(*this);
+  epoll_event events[max_events];
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_ || live_ == 0) {
+        return;
+      }
+    }
+    auto count = ::epoll_wait(epoll_, events, max_events, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw error(static_cast<error_code>(errno));
+    }
+    for (auto i = 0; i < count; ++i) {
+      if (events[i].data.u64 == wake_id) {
+        std::uint64_t value;
+        while (::read(wake_, &value, sizeof(value)) > 0) {
+        }
+      } else {
+        receive(events[i].data.u64);
+      }
+    }
+  }
+}
+
+void session_manager::stop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopping_ = true;
+  std::uint64_t value = 1;
+  (void)::write(wake_, &value, sizeof(value));
+  idle_.wait(lock, [this]() { return !running_; });
+}
+
+std::size_t session_manager::active() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return active_;
+}
+
+void session_manager::receive(std::uint64_t id) {
+  session* s;
+  std::unique_ptr<char[]> buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = sessions_.find(id);
+    if (found == sessions_.end() || found->second->ended) {
+      return;
+    }
+    s = found->second.get();
+    s->armed = false;  // the descriptor was registered for one event
+    if (active_ >= limit_) {
+      s->waiting = true;  // read once a request of any mount finishes
+      waiting_.push_back(id);
+      return;
+    }
+    ++s->active;       // holds the session while reading without the lock
+    ++active_;
+    if (s->buffers.empty()) {
+      buffer.reset(new char[s->source.buffer_size]);
+    } else {
+      buffer = std::move(s->buffers.back());
+      s->buffers.pop_back();
+    }
+  }
+  auto size = s->source.receive(buffer.get(), s->source.buffer_size);
+  if (size > 0) {
+    {
+      // before posting, as the session may be removed once it finishes
+      std::lock_guard<std::mutex> lock(mutex_);
+      resume(*s);
+    }
+    auto length = static_cast<std::size_t>(size);
+    auto kind = request_class::metadata;
+    std::uint64_t caller = 0;
+    std::uint32_t cost = 1;
+    auto scheduled = scheduler_ != nullptr &&
+                     classify(buffer.get(), length, kind, caller, cost);
+    auto data = buffer.release();
+    auto process = [this, s, data, length]() {
+      std::unique_ptr<char[]> request(data);
+      s->source.process(request.get(), length);
+      finish(*s, std::move(request));
+    };
+    if (scheduled) {
+      scheduler_->submit(kind, caller, cost, process);
+    } else {
+      pool_.post(process);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size != -EINTR && size != -EAGAIN) {
+    end(*s);  // unmounted, or the device failed
+  }
+  s->buffers.push_back(std::move(buffer));
+  --s->active;
+  --active_;
+  resume(*s);
+  idle_.notify_all();
+}
+
+void session_manager::finish(session& s, std::unique_ptr<char[]> buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  s.buffers.push_back(std::move(buffer));
+  --s.active;
+  --active_;
+  while (active_ < limit_ && !waiting_.empty()) {
+    auto found = sessions_.find(waiting_.front());
+    waiting_.pop_front();
+    if (found != sessions_.end()) {
+      found->second->waiting = false;
+      resume(*found->second);
+    }
+  }
+  resume(s);
+  idle_.notify_all();
+}
+
+void session_manager::end(session& s) {
+  if (!s.ended) {
+    s.ended = true;
+    s.armed = false;
+    ::epoll_ctl(epoll_, EPOLL_CTL_DEL, s.source.fd, nullptr);
+    if (--live_ == 0) {
+      std::uint64_t value = 1;
+      (void)::write(wake_, &value, sizeof(value));  // let run return
+    }
+  }
+}
+
+void session_manager::resume(session& s) {
+  if (s.ended || s.armed || s.waiting || s.active >= s.limit) {
+    return;  // a finishing request resumes it
+  }
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.u64 = s.id;
+  s.armed = ::epoll_ctl(epoll_, EPOLL_CTL_MOD, s.source.fd, &event) == 0;
+}
+}  // namespace drivex
+}  // namespace lockblox
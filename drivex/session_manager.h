@@ -0,0 +1,128 @@
+#pragma once
+#include <drivex/fuse.h>
+#include <drivex/scheduler.h>
+#include <drivex/thread_pool.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Serves many mounts from one process on a shared thread pool
+ *
+ * A single thread waits on the /dev/fuse descriptors of every mount with
+ * epoll, reads each request as it arrives and runs it on the pool, so the
+ * thread count no longer grows with the number of mounts.  Each mount has a
+ * limit on its requests in flight, and a descriptor is not read while its
+ * mount is at the limit, which keeps a busy mount from taking over the
+ * pool.  A limit on the requests in flight across all mounts bounds the
+ * work queued on the pool; mounts held back by it are resumed in turn.
+ *
+ * With a scheduler, requests are classified by their FUSE operation and
+ * queued for fair dispatch per class and per calling uid and pid, so that
+ * bulk transfers do not hold up metadata requests.  Requests that must not
+ * wait behind others, such as interrupts, forgets and blocking locks, go
+ * straight to the pool.  The limit across mounts should then be well above
+ * the size of the pool, so that the requests that would jump the queue can
+ * be read while it is full. */
+class session_manager {
+ public:
+  /** Where the requests of a session come from and are handled
+   *
+   * A mounted Fuse provides one over its /dev/fuse descriptor; other
+   * sources of requests, such as a socket, may be served the same way. */
+  struct endpoint {
+    /** Readable while a request is pending; made non-blocking by add */
+    int fd;
+    /** Largest request */
+    std::size_t buffer_size;
+    /** Read one request into a buffer of buffer_size
+     *
+     * @return its size; -EAGAIN or -EINTR if there was none after all;
+     *         0 or another negative errno once the source has ended */
+    std::function<int(char*, std::size_t)> receive;
+    /** Handle one request, on a thread of the pool */
+    std::function<void(const char*, std::size_t)> process;
+  };
+
+  /** @param max_requests requests in flight across all mounts
+   *  @param scheduler to order requests by, if any; must outlive this */
+  session_manager(thread_pool& pool, std::size_t max_requests,
+                  drivex::scheduler* scheduler = nullptr);
+
+  /** Stop and wait for the requests in flight */
+  ~session_manager();
+
+  session_manager(const session_manager&) = delete;
+  session_manager& operator=(const session_manager&) = delete;
+
+  /** Serve a mounted Fuse, with at most max_requests of its requests in
+   * flight, instead of calling its run()
+   *
+   * @throws error(invalid_argument) if it is not mounted */
+  void add(Fuse& mount, std::size_t max_requests);
+
+  /** Serve an endpoint, with at most max_requests of its requests in flight
+   *
+   * @return the id to remove it by */
+  std::uint64_t add(endpoint source, std::size_t max_requests);
+
+  /** Stop serving a mount and wait for its requests in flight
+   *
+   * Must be called before a mount that was added is destroyed. */
+  void remove(Fuse& mount);
+
+  /** Stop serving an endpoint and wait for its requests in flight */
+  void remove(std::uint64_t id);
+
+  /** Serve the mounts until all have been unmounted or stop is called */
+  void run();
+
+  /** Make run return, and wait until it has */
+  void stop();
+
+  /** Requests in flight across all mounts */
+  std::size_t active() const;
+
+ private:
+  struct session {
+    std::uint64_t id;
+    Fuse* mount = nullptr;  // if it serves one
+    endpoint source;
+    std::size_t limit;
+    std::size_t active = 0;
+    bool armed = false;    // the descriptor is being waited on
+    bool waiting = false;  // held back by the shared limit
+    bool ended = false;
+    std::vector<std::unique_ptr<char[]>> buffers;  // free
+  };
+
+  std::uint64_t add(std::unique_ptr<session> s);
+  void receive(std::uint64_t id);
+  void finish(session& s, std::unique_ptr<char[]> buffer);
+  void end(session& s);
+  void resume(session& s);
+
+  thread_pool& pool_;
+  drivex::scheduler* scheduler_;
+  int epoll_;
+  int wake_;  // eventfd that interrupts run
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  std::map<std::uint64_t, std::unique_ptr<session>> sessions_;  // by id
+  std::deque<std::uint64_t> waiting_;
+  std::uint64_t next_id_;
+  std::size_t limit_;
+  std::size_t active_;
+  std::size_t live_;  // sessions not ended
+  bool stopping_;
+  bool running_;  // run has not returned
+};
+}  // namespace drivex
+}  // namespace lockblox
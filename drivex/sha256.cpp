@@ -0,0 +1,139 @@
+#include <drivex/sha256.h>
+#include <algorithm>
+#include <cstring>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+std::uint32_t rotate(std::uint32_t value, unsigned int bits) {
+  return value >> bits | value << (32u - bits);
+}
+
+}  // namespace
+
+sha256::sha256()
+    : state_{{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+              0x9b05688c, 0x1f83d9ab, 0x5be0cd19}},
+      buffer_(),
+      buffered_(0),
+      length_(0) {}
+
+void sha256::update(const string_view& data) {
+  auto input = reinterpret_cast<const std::uint8_t*>(data.data());
+  auto size = data.size();
+  length_ += size;
+  if (buffered_ != 0) {
+    auto count = std::min(size, buffer_.size() - buffered_);
+    std::memcpy(buffer_.data() + buffered_, input, count);
+    buffered_ += count;
+    input += count;
+    size -= count;
+    if (buffered_ < buffer_.size()) {
+      return;
+    }
+    compress(buffer_.data());
+    buffered_ = 0;
+  }
+  for (; size >= buffer_.size(); size -= buffer_.size()) {
+    compress(input);
+    input += buffer_.size();
+  }
+  std::memcpy(buffer_.data(), input, size);
+  buffered_ = size;
+}
+
+sha256::digest sha256::finish() {
+  auto bits = length_ * 8;
+  buffer_[buffered_++] = 0x80;
+  if (buffered_ > 56) {
+    std::memset(buffer_.data() + buffered_, 0, buffer_.size() - buffered_);
+    compress(buffer_.data());
+    buffered_ = 0;
+  }
+  std::memset(buffer_.data() + buffered_, 0, 56 - buffered_);
+  for (int i = 0; i < 8; ++i) {
+    buffer_[63 - i] = static_cast<std::uint8_t>(bits >> (8u * i));
+  }
+  compress(buffer_.data());
+  digest result;
+  for (std::size_t i = 0; i < state_.size(); ++i) {
+    for (std::size_t j = 0; j < 4; ++j) {
+      result[i * 4 + j] = static_cast<std::uint8_t>(state_[i] >> (24 - 8 * j));
+    }
+  }
+  return result;
+}
+
+sha256::digest sha256::hash(const string_view& data) {
+  sha256 hasher;
+  hasher.update(data);
+  return hasher.finish();
+}
+
+std::string sha256::to_hex(const digest& value) {
+  static const char digits[] = "0123456789abcdef";
+  std::string result;
+  result.reserve(value.size() * 2);
+  for (auto byte : value) {
+    result += digits[byte >> 4u];
+    result += digits[byte & 15u];
+  }
+  return result;
+}
+
+void sha256::compress(const std::uint8_t* block) {
+  std::uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = std::uint32_t(block[i * 4]) << 24u |
+           std::uint32_t(block[i * 4 + 1]) << 16u |
+           std::uint32_t(block[i * 4 + 2]) << 8u | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; ++i) {
+    auto s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ w[i - 15] >> 3u;
+    auto s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ w[i - 2] >> 10u;
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  auto a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  auto e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    auto s1 = rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+    auto choice = (e & f) ^ (~e & g);
+    auto t1 = h + s1 + choice + round_constants[i] + w[i];
+    auto s0 = rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+    auto majority = (a & b) ^ (a & c) ^ (b & c);
+    auto t2 = s0 + majority;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,38 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace lockblox {
+namespace drivex {
+
+/** Incremental SHA-256 (FIPS 180-4) */
+class sha256 {
+ public:
+  using digest = std::array<std::uint8_t, 32>;
+
+  sha256();
+
+  /** Hash more input */
+  void update(const string_view& data);
+
+  /** Finish and return the digest; the object must not be updated after */
+  digest finish();
+
+  /** Digest of a whole buffer */
+  static digest hash(const string_view& data);
+
+  /** Lower-case hexadecimal form of a digest */
+  static std::string to_hex(const digest& value);
+
+ private:
+  void compress(const std::uint8_t* block);
+
+  std::array<std::uint32_t, 8> state_;
+  std::array<std::uint8_t, 64> buffer_;
+  std::size_t buffered_;
+  std::uint64_t length_;
+};
+}  // namespace drivex
+}  // namespace lockblox
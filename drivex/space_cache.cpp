@@ -0,0 +1,145 @@
+#include <drivex/space_cache.h>
+#include <algorithm>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+/** Rough bytes held for a result, including the bookkeeping around it */
+std::size_t footprint(const std::string& path) { return path.size() + 96; }
+
+}  // namespace
+
+space_cache::space_cache(clock::duration ttl, std::size_t capacity)
+    : ttl_(ttl), capacity_(capacity), budget_(nullptr) {}
+
+space_cache::~space_cache() { budget(nullptr); }
+
+space_cache::clock::duration space_cache::ttl() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ttl_;
+}
+
+void space_cache::ttl(clock::duration ttl) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ttl_ = ttl;
+  while (!entries_.empty()) {
+    drop(std::prev(entries_.end()));
+  }
+}
+
+space_info space_cache::space(const filesystem& filesystem, const Path& path) {
+  auto key = path.string();
+  auto matches = [&key](const entry& e) { return e.path == key; };
+  clock::duration ttl;
+  memory_budget* budget;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ttl = ttl_;
+    budget = budget_;
+    auto found = std::find_if(entries_.begin(), entries_.end(), matches);
+    if (found != entries_.end()) {
+      if (clock::now() < found->expiry) {
+        if (budget_ != nullptr) {
+          found->stamp = budget_->tick();
+        }
+        return found->space;
+      }
+      drop(found);
+    }
+  }
+  auto result = filesystem.space(path);
+  if (ttl <= clock::duration::zero() || capacity_ == 0) {
+    return result;
+  }
+  auto bytes = footprint(key);
+  // charging may evict from this cache too, so not under the mutex
+  if (budget != nullptr && !budget->charge(*this, bytes)) {
+    return result;
+  }
+  auto expiry = clock::now() + ttl;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (budget != budget_) {
+    if (budget != nullptr) {
+      budget->release(*this, bytes);
+    }
+    return result;  // the budget changed meanwhile
+  }
+  auto stamp = budget_ != nullptr ? budget_->tick() : 0;
+  auto found = std::find_if(entries_.begin(), entries_.end(), matches);
+  if (found != entries_.end()) {
+    drop(found);
+  } else if (entries_.size() >= capacity_) {  // the one closest to expiry
+    drop(std::min_element(entries_.begin(), entries_.end(),
+                          [](const entry& a, const entry& b) {
+                            return a.expiry < b.expiry;
+                          }));
+  }
+  entries_.push_back(entry{key, result, expiry, bytes, stamp});
+  return result;
+}
+
+void space_cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!entries_.empty()) {
+    drop(std::prev(entries_.end()));
+  }
+}
+
+void space_cache::budget(memory_budget* budget) {
+  clear();
+  memory_budget* previous;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    previous = budget_;
+    budget_ = nullptr;
+  }
+  if (previous != nullptr) {
+    previous->remove(*this);
+  }
+  if (budget != nullptr) {
+    budget->add(*this);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = budget;
+}
+
+std::string space_cache::name() const { return "space"; }
+
+std::uint64_t space_cache::oldest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.empty() ? no_items : least_recent()->stamp;
+}
+
+std::size_t space_cache::evict(std::uint64_t until, std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t dropped = 0;
+  std::size_t released = 0;
+  while (!entries_.empty()) {
+    auto victim = least_recent();
+    if (dropped != 0 && (released >= bytes || victim->stamp >= until)) {
+      break;
+    }
+    released += victim->bytes;
+    drop(entries_.begin() + (victim - entries_.cbegin()));
+    ++dropped;
+  }
+  return dropped;
+}
+
+void space_cache::drop(std::vector<entry>::iterator it) {
+  if (budget_ != nullptr) {
+    budget_->release(*this, it->bytes);
+  }
+  entries_.erase(it);
+}
+
+std::vector<space_cache::entry>::const_iterator space_cache::least_recent()
+    const {
+  return std::min_element(
+      entries_.begin(), entries_.end(),
+      [](const entry& a, const entry& b) { return a.stamp < b.stamp; });
+}
+}  // namespace drivex
+}  // namespace lockblox
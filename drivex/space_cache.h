@@ -0,0 +1,71 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/memory_budget.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** Short-lived cache of filesystem::space results
+ *
+ * Some programs query free space before every write; with a time to live the
+ * backend is asked at most once per interval and path.  A time to live of
+ * zero, the default, disables caching and forwards each call.
+ *
+ * A mount usually sees the same answer for every path, so only a few recent
+ * paths are kept; when they are all taken the one closest to expiry goes.
+ * With a memory_budget the results held are charged to it as well. */
+class space_cache : public memory_consumer {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  explicit space_cache(clock::duration ttl = clock::duration::zero(),
+                       std::size_t capacity = 8);
+  ~space_cache() override;
+
+  space_cache(const space_cache&) = delete;
+  space_cache& operator=(const space_cache&) = delete;
+
+  /** How long a result is reused */
+  clock::duration ttl() const;
+  void ttl(clock::duration ttl);
+
+  /** Get the space of the filesystem holding a path */
+  space_info space(const filesystem& filesystem, const Path& path);
+
+  /** Forget all results, e.g. after a large write or delete */
+  void clear();
+
+  /** Charge results to a budget from now on, or to none if null
+   *
+   * Results already held are dropped. */
+  void budget(memory_budget* budget);
+
+  std::string name() const override;
+  std::uint64_t oldest() const override;
+  std::size_t evict(std::uint64_t until, std::size_t bytes) override;
+
+ private:
+  struct entry {
+    std::string path;
+    space_info space;
+    clock::time_point expiry;
+    std::size_t bytes;    // charged to the budget
+    std::uint64_t stamp;  // of the last use
+  };
+
+  /** Drop an entry; the mutex is held */
+  void drop(std::vector<entry>::iterator it);
+  std::vector<entry>::const_iterator least_recent() const;
+
+  mutable std::mutex mutex_;
+  clock::duration ttl_;
+  std::size_t capacity_;
+  memory_budget* budget_;
+  std::vector<entry> entries_;  // at most capacity_, searched linearly
+};
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,386 @@
+#include <drivex/image_builder.h>
+#include <drivex/tar_filesystem.h>
+#include <boost/optional.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+const std::uint64_t block_size = 512;
+
+/** Largest pax extended header or GNU long name read into memory */
+const std::uint64_t max_payload = 1u << 20u;
+
+struct tar_header {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char padding[12];
+};
+
+static_assert(sizeof(tar_header) == block_size, "tar_header must be packed");
+
+/** Parse an octal field, or a base-256 one as written by GNU tar */
+std::uint64_t parse_number(const char* field, std::size_t size) {
+  std::uint64_t value = 0;
+  if ((static_cast<unsigned char>(field[0]) & 0x80u) != 0) {
+    value = static_cast<unsigned char>(field[0]) & 0x7fu;
+    for (std::size_t i = 1; i < size; ++i) {
+      value = value << 8u | static_cast<unsigned char>(field[i]);
+    }
+    return value;
+  }
+  std::size_t i = 0;
+  while (i < size && field[i] == ' ') {
+    ++i;
+  }
+  for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) {
+    value = value * 8 + static_cast<std::uint64_t>(field[i] - '0');
+  }
+  return value;
+}
+
+std::string parse_string(const char* field, std::size_t size) {
+  return std::string(field, strnlen(field, size));
+}
+
+bool checksum_matches(const tar_header& header) {
+  auto bytes = reinterpret_cast<const unsigned char*>(&header);
+  auto first = offsetof(tar_header, checksum);
+  auto last = first + sizeof(header.checksum);
+  std::uint64_t sum = 0;
+  for (std::size_t i = 0; i < block_size; ++i) {
+    sum += i >= first && i < last ? ' ' : bytes[i];
+  }
+  return sum == parse_number(header.checksum, sizeof(header.checksum));
+}
+
+bool is_zero_block(const tar_header& header) {
+  auto bytes = reinterpret_cast<const char*>(&header);
+  return std::all_of(bytes, bytes + block_size,
+                     [](char byte) { return byte == '\0'; });
+}
+
+/** Make a member name relative, dropping empty and "." components
+ *
+ * @throws error(io_error) for a ".." component, which would reach outside
+ *         the archive */
+std::string member_path(const Path& archive, const std::string& name) {
+  std::string path;
+  for (std::size_t start = 0; start <= name.size();) {
+    auto end = std::min(name.find('/', start), name.size());
+    auto component = name.substr(start, end - start);
+    if (component == "..") {
+      throw error(error_code::io_error,
+                  archive.string() + ": member " + name +
+                      " leaves the archive");
+    }
+    if (!component.empty() && component != ".") {
+      if (!path.empty()) {
+        path += '/';
+      }
+      path += component;
+    }
+    start = end + 1;
+  }
+  return path;
+}
+
+/** Attributes a pax extended header overrides for the next member */
+struct pax_records {
+  std::string path;
+  std::string linkpath;
+  boost::optional<std::uint64_t> size;
+  boost::optional<std::int64_t> mtime;
+  bool sparse = false;  // any GNU.sparse record
+};
+
+void parse_pax(const std::string& data, pax_records& records) {
+  std::size_t position = 0;
+  while (position < data.size()) {
+    auto space = data.find(' ', position);
+    if (space == std::string::npos) {
+      break;
+    }
+    auto length = std::strtoull(data.c_str() + position, nullptr, 10);
+    if (length == 0 || position + length > data.size()) {
+      break;
+    }
+    auto record = data.substr(space + 1, position + length - space - 2);
+    auto equals = record.find('=');
+    if (equals != std::string::npos) {
+      auto key = record.substr(0, equals);
+      auto value = record.substr(equals + 1);
+      if (key == "path") {
+        records.path = value;
+      } else if (key == "linkpath") {
+        records.linkpath = value;
+      } else if (key == "size") {
+        records.size = std::strtoull(value.c_str(), nullptr, 10);
+      } else if (key == "mtime") {
+        records.mtime = std::strtoll(value.c_str(), nullptr, 10);
+      } else if (key.compare(0, 11, "GNU.sparse.") == 0) {
+        records.sparse = true;
+      }
+    }
+    position += length;
+  }
+}
+
+std::string read_payload(std::istream& input, std::uint64_t size) {
+  auto payload = std::string(size, '\0');
+  input.read(&payload[0], size);
+  while (!payload.empty() && payload.back() == '\0') {
+    payload.pop_back();
+  }
+  return payload;
+}
+
+/** Whether a stored index describes this archive and is well formed */
+bool index_matches(const boost::interprocess::mapped_region& region,
+                   std::uint64_t size, std::int64_t time) {
+  if (region.get_size() < sizeof(image_header)) {
+    return false;
+  }
+  auto header = static_cast<const image_header*>(region.get_address());
+  if (std::memcmp(header->magic, image_index::magic,
+                  sizeof(header->magic)) != 0 ||
+      header->version != image_index::version ||
+      header->source_size != size || header->source_time != time) {
+    return false;
+  }
+  try {  // a torn or damaged index can still have a matching header
+    image_index(static_cast<const char*>(region.get_address()),
+                region.get_size());
+  } catch (const error&) {
+    return false;
+  }
+  return true;
+}
+
+/** A hard link whose target had not been seen when it was read */
+struct pending_link {
+  Path path;
+  std::string target;
+  unsigned int mode;
+  std::int64_t mtime;
+};
+
+}  // namespace
+
+tar_filesystem::tar_filesystem(const Path& archive)
+    : image_filesystem(load_index(archive)),
+      fd_(::open(archive.string().c_str(), O_RDONLY)) {
+  if (fd_ < 0) {
+    throw error(error_code::io_error, archive.string());
+  }
+}
+
+tar_filesystem::~tar_filesystem() { ::close(fd_); }
+
+Path tar_filesystem::index_path(const Path& archive) {
+  return Path(archive.string() + ".idx");
+}
+
+void tar_filesystem::read_data(const image_entry& entry, char* output,
+                               std::size_t count, std::uint64_t offset) const {
+  auto position = entry.data_offset + offset;
+  while (count > 0) {
+    auto result = ::pread(fd_, output, count, static_cast<off_t>(position));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {  // the archive shrank underneath us
+      throw error(error_code::io_error, "tar member data unavailable");
+    }
+    output += result;
+    position += result;
+    count -= result;
+  }
+}
+
+image_filesystem::metadata tar_filesystem::load_index(const Path& archive) {
+  struct stat archive_stat;
+  if (::stat(archive.string().c_str(), &archive_stat) != 0) {
+    throw error(error_code::io_error, archive.string());
+  }
+  auto size = static_cast<std::uint64_t>(archive_stat.st_size);
+  auto time = static_cast<std::int64_t>(archive_stat.st_mtime);
+  auto index = index_path(archive);
+  try {
+    auto region = map(index);
+    if (index_matches(region, size, time)) {
+      return metadata{std::move(region), std::string()};
+    }
+  } catch (const error&) {  // missing or unreadable, so rebuild it
+  }
+  auto buffer = build_index(archive, size, time);
+  auto temporary = index.string() + ".tmp";
+  {
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    output.write(buffer.data(), buffer.size());
+    output.close();
+    if (!output || std::rename(temporary.c_str(), index.c_str()) != 0) {
+      std::remove(temporary.c_str());  // serve from memory instead
+    }
+  }
+  return metadata{boost::interprocess::mapped_region(), std::move(buffer)};
+}
+
+std::string tar_filesystem::build_index(const Path& archive,
+                                        std::uint64_t size,
+                                        std::int64_t time) {
+  std::ifstream input(archive.string(), std::ios::binary);
+  if (!input) {
+    throw error(error_code::io_error, archive.string());
+  }
+  image_builder builder;
+  std::unordered_map<std::string, std::pair<std::uint64_t, std::uint64_t>>
+      files;  // for hard links: data offset and size by path
+  std::vector<pending_link> links;
+  auto records = pax_records{};
+  std::string long_name;
+  std::string long_link;
+  std::uint64_t offset = 0;
+  tar_header header;
+  while (input.seekg(offset) &&
+         input.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    if (is_zero_block(header)) {
+      break;
+    }
+    if (!checksum_matches(header)) {
+      throw error(error_code::io_error, archive.string() + ": not a tar file");
+    }
+    auto member_size = parse_number(header.size, sizeof(header.size));
+    auto data = offset + block_size;
+    auto available = data < size ? size - data : 0;  // for member data
+    auto type = header.typeflag;
+    if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+      if (member_size > max_payload || member_size > available) {
+        throw error(error_code::io_error,
+                    archive.string() + ": extended header too large");
+      }
+      auto payload = read_payload(input, member_size);
+      if (type == 'x') {
+        parse_pax(payload, records);
+      } else if (type == 'L') {
+        long_name = payload;
+      } else if (type == 'K') {
+        long_link = payload;
+      }  // global pax headers are not applied
+      offset = data + (member_size + block_size - 1) / block_size * block_size;
+      continue;
+    }
+    auto name = parse_string(header.name, sizeof(header.name));
+    auto prefix = parse_string(header.prefix, sizeof(header.prefix));
+    if (!records.path.empty()) {
+      name = records.path;
+    } else if (!long_name.empty()) {
+      name = long_name;
+    } else if (!prefix.empty()) {
+      name = prefix + "/" + name;
+    }
+    auto link = !records.linkpath.empty()
+                    ? records.linkpath
+                    : !long_link.empty()
+                          ? long_link
+                          : parse_string(header.linkname,
+                                         sizeof(header.linkname));
+    if (records.size) {
+      member_size = *records.size;
+    }
+    auto mtime = records.mtime
+                     ? *records.mtime
+                     : static_cast<std::int64_t>(
+                           parse_number(header.mtime, sizeof(header.mtime)));
+    auto mode = static_cast<unsigned int>(
+        parse_number(header.mode, sizeof(header.mode)) & 07777u);
+    auto is_directory = type == '5' || ((type == '0' || type == '\0') &&
+                                        !name.empty() && name.back() == '/');
+    auto path = Path(member_path(archive, name));
+    if (type == 'S' || records.sparse) {  // data would need an extent map
+      throw error(error_code::io_error,
+                  archive.string() + ": sparse member " + name +
+                      " is not supported");
+    }
+    if (is_directory) {
+      builder.add_directory(path, file_status(0040000u | mode), mtime);
+    } else if (path.empty()) {
+      throw error(error_code::io_error, archive.string() + ": bad member");
+    } else if (type == '2') {
+      builder.add_symlink(path, mtime, Path(link));
+    } else if (type == '1') {
+      links.push_back(
+          pending_link{path, member_path(archive, link), mode, mtime});
+    } else if (type == '3' || type == '4' || type == '6') {
+      auto kind = type == '3' ? 0020000u : type == '4' ? 0060000u : 0010000u;
+      builder.add_file(path, file_status(kind | mode), mtime, 0, 0);
+    } else if (member_size > available) {
+      throw error(error_code::io_error,
+                  archive.string() + ": member " + name +
+                      " runs past the end");
+    } else {
+      builder.add_file(path, file_status(0100000u | mode), mtime, member_size,
+                       data);
+      files[path.string()] = std::make_pair(data, member_size);
+    }
+    records = pax_records{};
+    long_name.clear();
+    long_link.clear();
+    auto stored = type == '1' || type == '2' || is_directory ? 0 : member_size;
+    offset = data + (stored + block_size - 1) / block_size * block_size;
+  }
+  // Hard links may name a member that comes later, or another link
+  for (auto resolved = true; resolved && !links.empty();) {
+    resolved = false;
+    for (auto it = links.begin(); it != links.end();) {
+      auto target = files.find(it->target);
+      if (target == files.end()) {
+        ++it;
+        continue;
+      }
+      builder.add_file(it->path, file_status(0100000u | it->mode), it->mtime,
+                       target->second.second, target->second.first);
+      files[it->path.string()] = target->second;
+      it = links.erase(it);
+      resolved = true;
+    }
+  }
+  if (!links.empty()) {
+    const auto& link = links.front();
+    throw error(error_code::io_error,
+                archive.string() + ": hard link " + link.path.string() +
+                    " to missing member " + link.target);
+  }
+  std::ostringstream output;
+  builder.write(output, 0, size, size, time);
+  return output.str();
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,46 @@
+#pragma once
+#include <drivex/image_filesystem.h>
+
+namespace lockblox {
+namespace drivex {
+
+/** Read-only backend serving the members of a tar archive
+ *
+ * The first mount scans the archive once and stores an index of its members
+ * next to it, as <archive>.idx, in the image metadata format.  Later mounts
+ * map that index instead of rescanning, unless the archive's size or
+ * modification time changed or the index is damaged.  If the index cannot be
+ * written it is kept in memory.  Member data is read from the archive with
+ * pread.
+ *
+ * ustar, GNU long names and pax path, linkpath and size records are
+ * understood; hard links share the data of their target, wherever it is in
+ * the archive.  GNU sparse members are not supported. */
+class tar_filesystem : public image_filesystem {
+ public:
+  /** Open the archive at a host path
+   *
+   * @throws error(io_error) if it cannot be read, is not a tar archive, has
+   *         sparse members or hard links to members it does not contain */
+  explicit tar_filesystem(const Path& archive);
+  ~tar_filesystem() override;
+
+  tar_filesystem(const tar_filesystem&) = delete;
+  tar_filesystem& operator=(const tar_filesystem&) = delete;
+
+  /** Path at which the index of an archive is stored */
+  static Path index_path(const Path& archive);
+
+ protected:
+  void read_data(const image_entry& entry, char* output, std::size_t count,
+                 std::uint64_t offset) const override;
+
+ private:
+  static metadata load_index(const Path& archive);
+  static std::string build_index(const Path& archive, std::uint64_t size,
+                                 std::int64_t time);
+
+  int fd_;
+};
+}  // namespace drivex
+}  // namespace lockblox
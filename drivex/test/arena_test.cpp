@@ -0,0 +1,98 @@
+#include <drivex/arena.h>
+#include <drivex/thread_pool.h>
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+
+using lockblox::drivex::arena;
+using lockblox::drivex::arena_allocator;
+using lockblox::drivex::thread_pool;
+
+std::uintptr_t address_of(const void* p) {
+  return reinterpret_cast<std::uintptr_t>(p);
+}
+}  // namespace
+
+TEST(arena_test, allocations_are_aligned_and_disjoint) {
+  arena temporaries(256);
+  auto a = static_cast<char*>(temporaries.allocate(3, 1));
+  auto b = temporaries.allocate(8, 64);
+  auto c = static_cast<char*>(temporaries.allocate(1000));  // a chunk alone
+  EXPECT_EQ(0u, address_of(b) % 64);
+  EXPECT_GE(address_of(b), address_of(a + 3));
+  EXPECT_EQ(0u, address_of(c) % alignof(std::max_align_t));
+  EXPECT_EQ(1011u, temporaries.allocated());
+  std::fill(c, c + 1000, 'c');  // the whole allocation is usable
+}
+
+TEST(arena_test, reset_reuses_chunks_up_to_the_retained_size) {
+  arena temporaries(1024, 4096);
+  for (int i = 0; i < 8; ++i) {
+    temporaries.allocate(1000);
+  }
+  auto reserved = temporaries.reserved();
+  EXPECT_EQ(8u * 1024, reserved);
+  temporaries.reset();
+  EXPECT_EQ(0u, temporaries.allocated());
+  EXPECT_LE(temporaries.reserved(), 4096u);
+  reserved = temporaries.reserved();
+  for (int round = 0; round < 10; ++round) {  // the steady state allocates
+    for (int i = 0; i < 4; ++i) {             // no further chunks
+      temporaries.allocate(1000);
+    }
+    temporaries.reset();
+  }
+  EXPECT_EQ(reserved, temporaries.reserved());
+}
+
+TEST(arena_test, scopes_rewind_what_they_allocated) {
+  arena temporaries(1024);
+  auto kept = temporaries.allocate(100);
+  {
+    arena::scope scope(temporaries);
+    for (int i = 0; i < 10; ++i) {
+      temporaries.allocate(500);
+    }
+  }
+  EXPECT_EQ(100u, temporaries.allocated());
+  auto next = temporaries.allocate(100, 1);
+  EXPECT_EQ(address_of(kept) + 100, address_of(next));  // the same chunk
+}
+
+TEST(arena_test, containers_draw_from_an_arena) {
+  arena temporaries;
+  {
+    std::vector<int, arena_allocator<int>> numbers{
+        arena_allocator<int>(temporaries)};
+    for (int i = 0; i < 1000; ++i) {
+      numbers.push_back(i);
+    }
+    EXPECT_EQ(999, numbers.back());
+  }
+  EXPECT_GE(temporaries.allocated(), 1000 * sizeof(int));
+}
+
+TEST(arena_test, workers_reset_their_arena_between_tasks) {
+  thread_pool pool(1);
+  pool.submit([] { arena::local().allocate(4096); }).get();
+  EXPECT_EQ(0u, pool.submit([] { return arena::local().allocated(); }).get());
+}
+
+#ifdef __linux__
+TEST(arena_test, pinned_workers_run_on_one_cpu) {
+  thread_pool pool(2, true);
+  auto cpus = [] {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    EXPECT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    return CPU_COUNT(&allowed);
+  };
+  EXPECT_EQ(1, pool.submit(cpus).get());
+}
+#endif
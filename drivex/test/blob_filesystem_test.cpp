@@ -0,0 +1,267 @@
+#include <drivex/blob_filesystem.h>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::attribute_update;
+using lockblox::drivex::blob_filesystem;
+using lockblox::drivex::blob_settings;
+using lockblox::drivex::directory_blob_store;
+using lockblox::drivex::file_time;
+using lockblox::drivex::Path;
+using lockblox::drivex::permissions;
+using lockblox::drivex::string_view;
+using lockblox::drivex::thread_pool;
+
+/** Counts the calls made to the store and the bytes read from it */
+class counting_store : public directory_blob_store {
+ public:
+  using directory_blob_store::directory_blob_store;
+
+  void put(const std::string& key, const string_view& data) override {
+    ++calls;
+    directory_blob_store::put(key, data);
+  }
+
+  std::string get(const std::string& key) const override {
+    ++calls;
+    auto data = directory_blob_store::get(key);
+    fetched += data.size();
+    return data;
+  }
+
+  std::string get(const std::string& key, std::uint64_t offset,
+                  std::size_t length) const override {
+    ++calls;
+    auto data = directory_blob_store::get(key, offset, length);
+    fetched += data.size();
+    return data;
+  }
+
+  std::string start_upload(const std::string& key) override {
+    ++calls;
+    return directory_blob_store::start_upload(key);
+  }
+
+  void put_part(const std::string& upload, std::uint32_t number,
+                const string_view& data) override {
+    ++calls;
+    ++parts;
+    directory_blob_store::put_part(upload, number, data);
+  }
+
+  void complete_upload(const std::string& upload,
+                       std::uint32_t count) override {
+    ++calls;
+    directory_blob_store::complete_upload(upload, count);
+  }
+
+  bool remove(const std::string& key) override {
+    ++calls;
+    return directory_blob_store::remove(key);
+  }
+
+  mutable std::atomic<std::size_t> calls{0};
+  mutable std::atomic<std::size_t> fetched{0};
+  std::atomic<std::size_t> parts{0};
+};
+
+std::string read_all(const blob_filesystem& blobs, const Path& path) {
+  auto result = std::string(blobs.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(blobs.read(path, buffer, 0)));
+  return result;
+}
+
+class blob_filesystem_test : public ::testing::Test {
+ protected:
+  blob_filesystem_test()
+      : root(boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path("drivex-%%%%-%%%%")),
+        store(std::make_shared<counting_store>(root / "store")) {
+    settings.index = root / "index";
+    settings.staging = root / "staging";
+    settings.range_size = 4096;
+    settings.part_size = 16384;
+  }
+
+  ~blob_filesystem_test() override { boost::filesystem::remove_all(root); }
+
+  void save(blob_filesystem& blobs, const Path& path, const std::string& data,
+            std::uint64_t offset = 0) {
+    blobs.open(path, O_RDWR);
+    EXPECT_EQ(static_cast<int>(data.size()),
+              blobs.write(path, string_view(data), offset));
+    blobs.release(path, O_RDWR);
+  }
+
+  boost::filesystem::path root;
+  std::shared_ptr<counting_store> store;
+  blob_settings settings;
+};
+}  // namespace
+
+TEST_F(blob_filesystem_test, writes_without_downloading_the_whole_object) {
+  auto data = std::string(100000, 'a');
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_file("/f");
+    save(blobs, "/f", data);
+  }
+  blob_filesystem blobs(store, settings);
+  blobs.open("/f", O_RDWR);
+  blobs.write("/f", string_view("bb"), 50000);
+  blobs.truncate("/f", 90000);
+  blobs.truncate("/f", 95000);  // the regrown end reads as zeros
+  auto buffer = std::string(10, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(10, blobs.read("/f", view, 49996));
+  EXPECT_EQ("aaaabbaaaa", buffer);
+  EXPECT_EQ(4096u, store->fetched.load());  // only the range read
+  blobs.release("/f", O_RDWR);
+  data.replace(50000, 2, "bb");
+  data.resize(90000);
+  data.resize(95000, '\0');
+  EXPECT_EQ(data, read_all(blobs, "/f"));
+}
+
+TEST_F(blob_filesystem_test, uploads_large_files_in_parts) {
+  thread_pool pool(4);
+  settings.pool = &pool;
+  auto data = std::string(100000, '\0');
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 7 / 3);
+  }
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_file("/f");
+    save(blobs, "/f", data);
+    EXPECT_EQ(7u, store->parts.load());  // 100000 bytes in 16384 byte parts
+  }
+  blob_filesystem reopened(store, settings);
+  EXPECT_EQ(data, read_all(reopened, "/f"));
+}
+
+TEST_F(blob_filesystem_test, metadata_never_reaches_the_store) {
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_directory("/d");
+    blobs.create_file("/d/f");
+    save(blobs, "/d/f", "data");
+    blobs.rename("/d/f", "/d/g");
+  }
+  auto calls = store->calls.load();
+  blob_filesystem reopened(store, settings);
+  EXPECT_EQ((std::vector<Path>{".", "..", "g"}),
+            reopened.read_directory("/d"));
+  EXPECT_EQ(4u, reopened.file_size("/d/g"));
+  EXPECT_TRUE(reopened.is_regular_file(reopened.status("/d/g")));
+  EXPECT_EQ(calls, store->calls.load());
+}
+
+TEST_F(blob_filesystem_test, sequential_reads_fetch_ahead) {
+  auto data = std::string(10 * 4096, 'r');
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_file("/f");
+    save(blobs, "/f", data);
+  }
+  thread_pool pool(2);
+  settings.pool = &pool;
+  settings.read_ahead = 4;
+  blob_filesystem blobs(store, settings);
+  auto buffer = std::string(4096, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(4096, blobs.read("/f", view, 0));
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (store->fetched.load() < 5 * 4096u &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(5 * 4096u, store->fetched.load());  // the range and 4 ahead
+  for (std::uint64_t offset = 4096; offset < 5 * 4096u; offset += 4096) {
+    view = string_view(&buffer[0], buffer.size());
+    EXPECT_EQ(4096, blobs.read("/f", view, offset));
+    EXPECT_EQ(std::string(4096, 'r'), buffer);
+  }
+}
+
+TEST_F(blob_filesystem_test, replaced_objects_are_deleted_in_the_background) {
+  settings.journal.flush_interval = std::chrono::milliseconds(10);
+  blob_filesystem blobs(store, settings);
+  blobs.create_file("/f");
+  save(blobs, "/f", "first");
+  save(blobs, "/f", "second");  // replaces the object, without an fsync
+  auto objects = [this]() {
+    auto directory = root / "store" / "objects";
+    return std::distance(boost::filesystem::directory_iterator(directory),
+                         boost::filesystem::directory_iterator());
+  };
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (objects() > 1 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(1, objects());
+  EXPECT_EQ("second", read_all(blobs, "/f"));
+}
+
+TEST_F(blob_filesystem_test, files_stay_open_across_directory_renames) {
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_directory("/a");
+    blobs.create_file("/a/f");
+    blobs.open("/a/f", O_RDWR);
+    blobs.write("/a/f", string_view("hello"), 0);
+    blobs.rename("/a", "/b");
+    blobs.release("/b/f", O_RDWR);
+    EXPECT_EQ("hello", read_all(blobs, "/b/f"));
+  }
+  blob_filesystem reopened(store, settings);
+  EXPECT_EQ("hello", read_all(reopened, "/b/f"));
+}
+
+TEST_F(blob_filesystem_test, renaming_over_an_open_file_unstages_it) {
+  blob_filesystem blobs(store, settings);
+  blobs.create_file("/f");
+  blobs.create_file("/g");
+  save(blobs, "/f", "from f");
+  blobs.open("/g", O_RDWR);
+  blobs.write("/g", string_view("from g"), 0);
+  blobs.rename("/f", "/g");
+  EXPECT_TRUE(boost::filesystem::is_empty(root / "staging"));
+  blobs.release("/g", O_RDWR);
+  EXPECT_EQ("from f", read_all(blobs, "/g"));
+}
+
+TEST_F(blob_filesystem_test, set_attributes_keeps_nanoseconds) {
+  auto read_time = file_time(std::chrono::nanoseconds(1500000000123456789));
+  auto write_time = file_time(std::chrono::nanoseconds(1600000000987654321));
+  {
+    blob_filesystem blobs(store, settings);
+    blobs.create_file("/f", static_cast<permissions>(0600));
+    save(blobs, "/f", "contents");
+    auto update = attribute_update();
+    update.permissions = static_cast<permissions>(0640);
+    update.user_id = 7;
+    update.size = 3;
+    update.last_read_time = read_time;
+    update.last_write_time = write_time;
+    blobs.set_attributes("/f", update);
+    auto times = blobs.times("/f");
+    EXPECT_EQ(read_time, times.last_read_time);
+    EXPECT_EQ(write_time, times.last_write_time);
+    EXPECT_EQ(1600000000, blobs.last_write_time("/f"));
+  }
+  blob_filesystem reopened(store, settings);
+  auto times = reopened.times("/f");
+  EXPECT_EQ(read_time, times.last_read_time);
+  EXPECT_EQ(write_time, times.last_write_time);
+  EXPECT_EQ(static_cast<permissions>(0640),
+            reopened.status("/f").permissions());
+  EXPECT_EQ("con", read_all(reopened, "/f"));
+}
@@ -0,0 +1,123 @@
+#include "memory_filesystem.h"
+#include <drivex/checksum_filesystem.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::checksum_filesystem;
+using lockblox::drivex::checksum_settings;
+using lockblox::drivex::checksum_storage;
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+error_code code_of(const std::function<void()>& call) {
+  try {
+    call();
+  } catch (const error& e) {
+    return static_cast<error_code>(e.code().value());
+  }
+  ADD_FAILURE() << "no error";
+  return error_code::io_error;
+}
+
+std::string read_all(const checksum_filesystem& filesystem, const Path& path) {
+  auto result = std::string(filesystem.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(filesystem.read(path, buffer, 0)));
+  return result;
+}
+
+class checksum_filesystem_test : public ::testing::Test {
+ protected:
+  checksum_filesystem_test() : inner(std::make_shared<memory_filesystem>()) {
+    settings.block_size = 1024;
+    inner->put("/f", "");
+  }
+
+  /** Write through a checksum layer and close the file */
+  void save(checksum_filesystem& filesystem, const std::string& data,
+            std::uint64_t offset = 0) {
+    filesystem.open("/f", O_RDWR);
+    EXPECT_EQ(static_cast<int>(data.size()),
+              filesystem.write("/f", string_view(data), offset));
+    filesystem.release("/f", O_RDWR);
+  }
+
+  std::shared_ptr<memory_filesystem> inner;
+  checksum_settings settings;
+};
+}  // namespace
+
+TEST_F(checksum_filesystem_test, detects_changed_data) {
+  checksum_filesystem checked(inner, settings);
+  save(checked, std::string(3000, 'a'));
+  save(checked, "bb", 1500);  // partial block, keeping verified data
+  auto expected = std::string(3000, 'a').replace(1500, 2, "bb");
+  EXPECT_EQ(expected, read_all(checked, "/f"));
+  inner->write("/f", string_view("x"), 2500);
+  auto buffer = std::string(10, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(10, checked.read("/f", view, 0));  // another block
+  EXPECT_EQ(error_code::io_error, code_of([&] { read_all(checked, "/f"); }));
+}
+
+TEST_F(checksum_filesystem_test, sums_only_what_a_short_write_wrote) {
+  checksum_filesystem checked(inner, settings);
+  checked.open("/f", O_RDWR);
+  inner->fail_writes_after(1500);
+  auto data = std::string(4000, 'c');
+  EXPECT_EQ(1500, checked.write("/f", string_view(data), 0));
+  inner->fail_writes_after(SIZE_MAX);
+  checked.release("/f", O_RDWR);
+  checksum_filesystem reopened(inner, settings);
+  EXPECT_EQ(std::string(1500, 'c'), read_all(reopened, "/f"));
+}
+
+TEST_F(checksum_filesystem_test, stale_sums_fail_unless_rebuilt) {
+  {
+    checksum_filesystem checked(inner, settings);
+    save(checked, std::string(3000, 'a'));
+  }
+  inner->put("/f", std::string(5000, 'a'));  // as if a crash lost the sums
+  {
+    checksum_filesystem checked(inner, settings);
+    EXPECT_EQ(error_code::io_error, code_of([&] { read_all(checked, "/f"); }));
+    checked.rebuild("/f");
+    EXPECT_EQ(std::string(5000, 'a'), read_all(checked, "/f"));
+  }
+  inner->put("/f", std::string(6000, 'a'));
+  settings.rebuild_stale = true;
+  checksum_filesystem checked(inner, settings);
+  EXPECT_EQ(std::string(6000, 'a'), read_all(checked, "/f"));
+}
+
+TEST_F(checksum_filesystem_test, hides_sidecars) {
+  settings.storage = checksum_storage::sidecar;
+  checksum_filesystem checked(inner, settings);
+  save(checked, "data");
+  EXPECT_EQ((std::vector<Path>{".", "..", ".f.crc32c", "f"}),
+            inner->read_directory("/"));
+  EXPECT_EQ((std::vector<Path>{".", "..", "f"}), checked.read_directory("/"));
+  checked.rename("/f", "/g");
+  EXPECT_EQ("data", read_all(checked, "/g"));
+  checked.remove("/g");
+  EXPECT_EQ((std::vector<Path>{".", ".."}), inner->read_directory("/"));
+}
+
+TEST_F(checksum_filesystem_test, files_stay_open_across_directory_renames) {
+  {
+    checksum_filesystem checked(inner, settings);
+    inner->create_directory("/a");
+    inner->put("/a/f", "");
+    checked.open("/a/f", O_RDWR);
+    checked.write("/a/f", string_view(std::string(3000, 'a')), 0);
+    checked.rename("/a", "/b");
+    inner->write("/b/f", string_view("x"), 2500);  // the written sums hold
+    checked.release("/b/f", O_RDWR);
+  }
+  checksum_filesystem reopened(inner, settings);
+  EXPECT_EQ(error_code::io_error, code_of([&] { read_all(reopened, "/b/f"); }));
+}
@@ -0,0 +1,170 @@
+#include "memory_filesystem.h"
+#include <drivex/compression_filesystem.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::compression_filesystem;
+using lockblox::drivex::compression_settings;
+using lockblox::drivex::error;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+/** Bytes that do not compress, different for each seed */
+std::string noise(std::size_t size, std::uint32_t seed) {
+  auto result = std::string(size, '\0');
+  for (auto& byte : result) {
+    seed = seed * 1664525u + 1013904223u;
+    byte = static_cast<char>(seed >> 24u);
+  }
+  return result;
+}
+
+std::string read_all(const compression_filesystem& filesystem,
+                     const Path& path) {
+  auto result = std::string(filesystem.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(filesystem.read(path, buffer, 0)));
+  return result;
+}
+
+void write(compression_filesystem& filesystem, const Path& path,
+           const std::string& data, std::uint64_t offset = 0) {
+  EXPECT_EQ(static_cast<int>(data.size()),
+            filesystem.write(path, string_view(data), offset));
+}
+
+class compression_filesystem_test : public ::testing::Test {
+ protected:
+  compression_filesystem_test() : inner(std::make_shared<memory_filesystem>()) {
+    settings.block_size = 4096;
+    settings.dirty_blocks = 1024;  // write only on flush
+    inner->put("/f", "");
+  }
+
+  std::shared_ptr<memory_filesystem> inner;
+  compression_settings settings;
+};
+}  // namespace
+
+TEST_F(compression_filesystem_test, stores_compressed_blocks) {
+  auto text = std::string();
+  while (text.size() < 50000) {
+    text += "the same few words over and over ";
+  }
+  {
+    compression_filesystem compressed(inner, settings);
+    compressed.open("/f", O_RDWR);
+    write(compressed, "/f", text);
+    write(compressed, "/f", "patched", 4090);  // straddles two blocks
+    EXPECT_EQ(text.size(), compressed.file_size("/f"));
+    compressed.release("/f", O_RDWR);
+  }
+  text.replace(4090, 7, "patched");
+  EXPECT_LT(inner->contents("/f").size(), text.size() / 4);
+  compression_filesystem reopened(inner, settings);
+  EXPECT_EQ(text, read_all(reopened, "/f"));
+}
+
+TEST_F(compression_filesystem_test, zeroed_blocks_become_holes) {
+  compression_filesystem compressed(inner, settings);
+  compressed.open("/f", O_RDWR);
+  write(compressed, "/f", noise(3 * 4096, 1));
+  compressed.fallocate(
+      "/f",
+      lockblox::drivex::fallocate_punch_hole |
+          lockblox::drivex::fallocate_keep_size,
+      4096, 4096);
+  compressed.flush("/f");
+  auto data = read_all(compressed, "/f");
+  EXPECT_EQ(std::string(4096, '\0'), data.substr(4096, 4096));
+  EXPECT_EQ(noise(3 * 4096, 1).substr(8192), data.substr(8192));
+  compressed.truncate("/f", 100000);
+  compressed.release("/f", O_RDWR);
+  EXPECT_EQ(100000u, compressed.file_size("/f"));
+  EXPECT_LT(inner->contents("/f").size(), 5u * 4096);
+}
+
+TEST_F(compression_filesystem_test, compaction_reclaims_replaced_blocks) {
+  const std::size_t size = 512u << 10u;
+  compression_filesystem compressed(inner, settings);
+  compressed.open("/f", O_RDWR);
+  for (std::uint32_t version = 0; version < 3; ++version) {
+    write(compressed, "/f", noise(size, version));
+    compressed.flush("/f");
+  }
+  compressed.release("/f", O_RDWR);
+  EXPECT_LT(inner->contents("/f").size(), size + size / 8);
+  EXPECT_EQ(noise(size, 2), read_all(compressed, "/f"));
+}
+
+TEST_F(compression_filesystem_test, crash_during_compaction_keeps_a_version) {
+  const std::size_t size = 512u << 10u;
+  for (std::size_t budget = 0; budget < 3 * size; budget += 40009) {
+    inner = std::make_shared<memory_filesystem>();
+    inner->put("/f", "");
+    {
+      compression_filesystem compressed(inner, settings);
+      compressed.open("/f", O_RDWR);
+      write(compressed, "/f", noise(size, 0));
+      compressed.flush("/f");
+      write(compressed, "/f", noise(size, 1));
+      compressed.flush("/f");
+      write(compressed, "/f", noise(size, 2));
+      inner->fail_writes_after(budget);  // this flush compacts
+      try {
+        compressed.flush("/f");
+      } catch (const error&) {
+        inner->fail_writes_after(0);  // and nothing more reaches the disk
+      }
+    }
+    inner->fail_writes_after(SIZE_MAX);
+    compression_filesystem recovered(inner, settings);
+    auto data = read_all(recovered, "/f");
+    EXPECT_TRUE(data == noise(size, 1) || data == noise(size, 2))
+        << "crashed after " << budget << " bytes";
+  }
+}
+
+TEST_F(compression_filesystem_test, renamed_directories_leave_no_blocks) {
+  compression_filesystem compressed(inner, settings);
+  inner->create_directory("/a");
+  inner->put("/a/f", "");
+  compressed.open("/a/f", O_RDWR);
+  write(compressed, "/a/f", std::string(4096, 'x'));
+  compressed.release("/a/f", O_RDWR);
+  EXPECT_EQ(std::string(4096, 'x'), read_all(compressed, "/a/f"));  // cached
+  compressed.rename("/a", "/b");
+  inner->create_directory("/a");
+  inner->put("/a/f", "");
+  compressed.truncate("/a/f", 4096);
+  EXPECT_EQ(std::string(4096, '\0'), read_all(compressed, "/a/f"));
+  EXPECT_EQ(std::string(4096, 'x'), read_all(compressed, "/b/f"));
+}
+
+TEST_F(compression_filesystem_test, files_stay_open_across_directory_renames) {
+  {
+    compression_filesystem compressed(inner, settings);
+    inner->create_directory("/a");
+    inner->put("/a/f", "");
+    compressed.open("/a/f", O_RDWR);
+    write(compressed, "/a/f", "buffered");
+    compressed.rename("/a", "/b");
+    compressed.release("/b/f", O_RDWR);
+  }
+  compression_filesystem reopened(inner, settings);
+  EXPECT_EQ("buffered", read_all(reopened, "/b/f"));
+}
+
+TEST_F(compression_filesystem_test, open_file_goes_through_this_layer) {
+  compression_filesystem compressed(inner, settings);
+  compressed.open("/f", O_RDWR);
+  write(compressed, "/f", std::string(10000, 'z'));
+  compressed.release("/f", O_RDWR);
+  auto handle = compressed.open_file("/f", O_RDWR | O_TRUNC);
+  EXPECT_EQ(0u, compressed.file_size("/f"));
+  EXPECT_EQ(2, compressed.write("/f", handle, string_view("hi"), 0));
+  compressed.release("/f", handle, O_RDWR);
+  EXPECT_EQ("hi", read_all(compressed, "/f"));
+}
@@ -0,0 +1,121 @@
+#include "memory_filesystem.h"
+#include <drivex/copy.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+using lockblox::drivex::CopyOptions;
+using lockblox::drivex::copy_settings;
+using lockblox::drivex::copy_statistics;
+using lockblox::drivex::error;
+using lockblox::drivex::Path;
+using lockblox::drivex::thread_pool;
+
+std::string pattern(std::size_t size) {
+  auto result = std::string(size, '\0');
+  for (std::size_t i = 0; i < size; ++i) {
+    result[i] = static_cast<char>(i * 7 + i / 4096);
+  }
+  return result;
+}
+
+/** Clones files by copying them in one call, as a reflinking backend would */
+class cloning_filesystem : public memory_filesystem {
+ public:
+  bool clone_file(const Path& from, const Path& to) override {
+    put(to, contents(from));
+    ++clones;
+    return true;
+  }
+
+  std::atomic<std::size_t> clones{0};
+};
+
+class copy_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    source.create_directory("/d");
+    source.create_directory("/d/e");
+    source.put("/d/f", pattern(3u << 20u));
+    source.put("/d/e/g", "");
+    source.create_symlink("../f", "/d/e/l");
+    settings.chunk_size = 1u << 20u;
+    settings.pool = &pool;
+  }
+
+  memory_filesystem source;
+  memory_filesystem destination;
+  thread_pool pool{4};
+  copy_settings settings;
+};
+}  // namespace
+
+TEST_F(copy_test, copies_a_tree_between_filesystems) {
+  auto statistics = lockblox::drivex::copy(source, "/d", destination, "/x",
+                                           CopyOptions::none, settings);
+  EXPECT_EQ(pattern(3u << 20u), destination.contents("/x/f"));
+  EXPECT_EQ("", destination.contents("/x/e/g"));
+  EXPECT_EQ(Path("../f"), destination.read_symlink("/x/e/l"));
+  EXPECT_EQ(2u, statistics.files);
+  EXPECT_EQ(2u, statistics.directories);
+  EXPECT_EQ(1u, statistics.symlinks);
+  EXPECT_EQ(3u << 20u, statistics.bytes);
+}
+
+TEST_F(copy_test, replaces_files_only_when_asked) {
+  lockblox::drivex::copy(source, "/d", destination, "/x", CopyOptions::none,
+                         settings);
+  source.put("/d/f", "changed");
+  EXPECT_THROW(lockblox::drivex::copy(source, "/d", destination, "/x",
+                                      CopyOptions::none, settings),
+               error);
+  lockblox::drivex::copy(source, "/d", destination, "/x",
+                         CopyOptions::overwrite_if_exists, settings);
+  EXPECT_EQ("changed", destination.contents("/x/f"));
+}
+
+TEST_F(copy_test, copies_within_a_filesystem) {
+  source.copy("/d", "/z", CopyOptions::none);
+  EXPECT_EQ(source.contents("/d/f"), source.contents("/z/f"));
+  EXPECT_EQ(Path("../f"), source.read_symlink("/z/e/l"));
+}
+
+TEST_F(copy_test, refuses_to_copy_a_directory_into_itself) {
+  EXPECT_THROW(source.copy("/d", "/d/e/q", CopyOptions::none), error);
+}
+
+TEST_F(copy_test, clones_files_within_a_filesystem) {
+  cloning_filesystem fs;
+  fs.create_directory("/d");
+  fs.put("/d/f", pattern(3u << 20u));
+  fs.put("/d/g", "g");
+  auto statistics = lockblox::drivex::copy(fs, "/d", fs, "/z",
+                                           CopyOptions::none, settings);
+  EXPECT_EQ(2u, fs.clones.load());
+  EXPECT_EQ(pattern(3u << 20u), fs.contents("/z/f"));
+  EXPECT_EQ("g", fs.contents("/z/g"));
+  EXPECT_EQ(2u, statistics.files);
+  EXPECT_EQ((3u << 20u) + 1u, statistics.bytes);
+}
+
+TEST_F(copy_test, reports_throughput) {
+  auto statistics = copy_statistics{};
+  EXPECT_EQ(0.0, statistics.throughput());
+  statistics.bytes = 3u << 20u;
+  statistics.elapsed = std::chrono::milliseconds(500);
+  EXPECT_DOUBLE_EQ(6.0 * (1u << 20u), statistics.throughput());
+  statistics = lockblox::drivex::copy(source, "/d", destination, "/x",
+                                      CopyOptions::none, settings);
+  EXPECT_GT(statistics.elapsed.count(), 0);
+  EXPECT_GT(statistics.throughput(), 0.0);
+}
+
+TEST_F(copy_test, removes_a_partially_copied_file) {
+  destination.fail_writes_after(1u << 20u);
+  EXPECT_THROW(lockblox::drivex::copy(source, "/d", destination, "/x",
+                                      CopyOptions::none, settings),
+               error);
+  EXPECT_THROW(destination.symlink_status("/x/f"), error);
+}
@@ -0,0 +1,59 @@
+#include <drivex/crc32c.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+using lockblox::drivex::string_view;
+
+/** Throughput in GB/s of f over data in block_size pieces */
+template <typename F>
+double measure(const std::string& data, std::size_t block_size, F f) {
+  const int rounds = 8;
+  std::uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; ++round) {
+    for (std::size_t offset = 0; offset < data.size(); offset += block_size) {
+      sink ^= f(string_view(data.data() + offset, block_size));
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (sink == 1) {  // keep the work from being optimized away
+    std::cout << "";
+  }
+  return rounds * static_cast<double>(data.size()) / elapsed.count() / 1e9;
+}
+
+}  // namespace
+
+int main() {
+  std::string data(64u << 20u, '\0');
+  std::mt19937 random(42);
+  for (auto& byte : data) {
+    byte = static_cast<char>(random());
+  }
+  std::string copy(data.size(), '\0');
+  std::cout << "hardware crc32c: "
+            << (lockblox::drivex::crc32c_hardware() ? "yes" : "no") << "\n";
+  for (std::size_t block_size : {4096u, 65536u, 1u << 20u}) {
+    auto crc = measure(data, block_size, [](const string_view& block) {
+      return lockblox::drivex::crc32c(block);
+    });
+    auto portable = measure(data, block_size, [](const string_view& block) {
+      return lockblox::drivex::crc32c_portable(block);
+    });
+    auto memcpy = measure(data, block_size, [&](const string_view& block) {
+      std::memcpy(&copy[block.data() - data.data()], block.data(),
+                  block.size());
+      return static_cast<std::uint32_t>(copy[0]);
+    });
+    std::cout << block_size << " byte blocks: crc32c " << crc
+              << " GB/s, portable " << portable << " GB/s, memcpy " << memcpy
+              << " GB/s\n";
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "memory_filesystem.h"
+#include <drivex/dedup_filesystem.h>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::dedup_filesystem;
+using lockblox::drivex::error;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+/** Bytes that do not repeat, different for each seed */
+std::string noise(std::size_t size, std::uint32_t seed) {
+  auto result = std::string(size, '\0');
+  for (auto& byte : result) {
+    seed = seed * 1664525u + 1013904223u;
+    byte = static_cast<char>(seed >> 24u);
+  }
+  return result;
+}
+
+std::string read_all(const dedup_filesystem& filesystem, const Path& path) {
+  auto result = std::string(filesystem.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(filesystem.read(path, buffer, 0)));
+  return result;
+}
+
+class dedup_filesystem_test : public ::testing::Test {
+ protected:
+  dedup_filesystem_test()
+      : inner(std::make_shared<memory_filesystem>()),
+        store(boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("drivex-%%%%-%%%%")) {}
+
+  ~dedup_filesystem_test() override { boost::filesystem::remove_all(store); }
+
+  /** Write a whole file through a dedup layer and close it */
+  void save(dedup_filesystem& filesystem, const Path& path,
+            const std::string& data) {
+    inner->put(path, "");
+    filesystem.open(path, O_RDWR);
+    EXPECT_EQ(static_cast<int>(data.size()),
+              filesystem.write(path, string_view(data), 0));
+    filesystem.release(path, O_RDWR);
+  }
+
+  std::shared_ptr<memory_filesystem> inner;
+  boost::filesystem::path store;
+};
+}  // namespace
+
+TEST_F(dedup_filesystem_test, identical_data_is_stored_once) {
+  auto data = noise(300000, 1);
+  {
+    dedup_filesystem dedup(inner, store.string());
+    save(dedup, "/a", data);
+    auto chunks = dedup.store().list().size();
+    EXPECT_GT(chunks, 1u);
+    save(dedup, "/b", data);
+    EXPECT_EQ(chunks, dedup.store().list().size());
+  }
+  dedup_filesystem reopened(inner, store.string());
+  EXPECT_EQ(data, read_all(reopened, "/a"));
+  EXPECT_EQ(data, read_all(reopened, "/b"));
+  EXPECT_LT(inner->contents("/a").size(), data.size() / 100);
+}
+
+TEST_F(dedup_filesystem_test, gc_deletes_only_unreferenced_chunks) {
+  dedup_filesystem dedup(inner, store.string());
+  save(dedup, "/a", noise(200000, 1));
+  auto kept = dedup.store().list().size();
+  save(dedup, "/b", noise(200000, 2));
+  save(dedup, "/c", noise(200000, 1));
+  EXPECT_EQ(0u, dedup.gc());
+  dedup.remove("/b");
+  dedup.remove("/a");  // /c still refers to its chunks
+  EXPECT_GT(dedup.gc(), 0u);
+  EXPECT_EQ(kept, dedup.store().list().size());
+  dedup.cache().clear();
+  EXPECT_EQ(noise(200000, 1), read_all(dedup, "/c"));
+}
+
+TEST_F(dedup_filesystem_test, failed_write_back_keeps_the_old_list) {
+  {
+    dedup_filesystem dedup(inner, store.string());
+    save(dedup, "/f", noise(100000, 1));
+    dedup.open("/f", O_RDWR);
+    auto data = noise(1000, 2);
+    dedup.write("/f", string_view(data), 5000);
+    inner->fail_writes_after(10);
+    EXPECT_THROW(dedup.release("/f", O_RDWR), error);
+  }
+  inner->fail_writes_after(SIZE_MAX);
+  EXPECT_EQ((std::vector<Path>{".", "..", "f"}), inner->read_directory("/"));
+  dedup_filesystem reopened(inner, store.string());
+  EXPECT_EQ(noise(100000, 1), read_all(reopened, "/f"));
+}
+
+TEST_F(dedup_filesystem_test, files_stay_open_across_directory_renames) {
+  auto data = noise(100000, 3);
+  {
+    dedup_filesystem dedup(inner, store.string());
+    inner->create_directory("/a");
+    inner->put("/a/f", "");
+    dedup.open("/a/f", O_RDWR);
+    dedup.write("/a/f", string_view(data), 0);
+    dedup.rename("/a", "/b");
+    dedup.release("/b/f", O_RDWR);
+  }
+  dedup_filesystem reopened(inner, store.string());
+  EXPECT_EQ(data, read_all(reopened, "/b/f"));
+}
@@ -0,0 +1,146 @@
+#include <drivex/dentry_cache.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::dentry_cache;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+const std::uint64_t files = 1000;
+
+/** Node ids that name their path: generation, directory and file */
+std::uint64_t node_of(std::uint64_t generation, std::uint64_t directory,
+                      std::uint64_t file) {
+  return generation * 1000000 + directory * 10000 + file + 1;
+}
+
+Path path_of(std::uint64_t directory, std::uint64_t file) {
+  return Path("/d" + std::to_string(directory) + "/f" + std::to_string(file));
+}
+
+/** Threads that look paths up until stopped, checking each node found */
+class readers {
+ public:
+  template <typename Check>
+  readers(std::size_t count, Check check) {
+    for (std::size_t i = 0; i < count; ++i) {
+      threads_.emplace_back([this, check, i] {
+        for (std::uint64_t n = i; !stop_.load(); ++n) {
+          check(n);
+          ++lookups_;
+        }
+      });
+    }
+    while (lookups_.load() < count) {  // so that the writer races them
+      std::this_thread::yield();
+    }
+  }
+
+  /** @return the lookups made */
+  std::uint64_t join() {
+    stop_.store(true);
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    return lookups_.load();
+  }
+
+ private:
+  std::atomic<bool> stop_{false};
+  std::atomic<std::uint64_t> lookups_{0};
+  std::vector<std::thread> threads_;
+};
+}  // namespace
+
+TEST(dentry_cache_test, lookups_race_inserts_and_growth) {
+  dentry_cache cache(1u << 20u);
+  cache.insert("/", 1);
+  cache.insert("/d0", node_of(0, 0, 9999));
+  readers lookups(4, [&](std::uint64_t n) {
+    auto file = n % files;
+    auto found = cache.find(path_of(0, file));
+    if (found) {
+      EXPECT_EQ(node_of(0, 0, file), *found);
+    }
+    found = cache.find(node_of(0, 0, 9999),
+                       string_view("f" + std::to_string(file)));
+    if (found) {
+      EXPECT_EQ(node_of(0, 0, file), *found);
+    }
+    EXPECT_EQ(1u, *cache.find("/"));
+  });
+  for (std::uint64_t file = 0; file < files; ++file) {
+    EXPECT_TRUE(cache.insert(path_of(0, file), node_of(0, 0, file)));
+  }
+  EXPECT_GT(lookups.join(), 0u);
+  for (std::uint64_t file = 0; file < files; ++file) {
+    EXPECT_EQ(node_of(0, 0, file), *cache.find(path_of(0, file)));
+  }
+}
+
+TEST(dentry_cache_test, lookups_race_invalidation_and_eviction) {
+  dentry_cache cache(2000);  // small enough to be swept and trimmed
+  cache.insert("/", 1);
+  readers lookups(4, [&](std::uint64_t n) {
+    auto directory = n % 8;
+    auto file = n / 8 % files;
+    auto found = cache.find(path_of(directory, file));
+    if (found) {  // from whichever generation, but always this path's
+      EXPECT_EQ(node_of(0, directory, file), *found % 1000000);
+    }
+  });
+  for (std::uint64_t generation = 1; generation < 20; ++generation) {
+    for (std::uint64_t directory = 0; directory < 8; ++directory) {
+      auto name = "/d" + std::to_string(directory);
+      cache.insert(Path(name), node_of(generation, directory, 9999));
+      for (std::uint64_t file = 0; file < files; file += 7) {
+        cache.insert(path_of(directory, file),
+                     node_of(generation, directory, file));
+      }
+      if ((generation + directory) % 3 == 0) {
+        cache.invalidate(Path(name));
+      }
+    }
+  }
+  EXPECT_GT(lookups.join(), 0u);
+  EXPECT_LE(cache.size(), 2000u);
+}
+
+TEST(dentry_cache_test, renamed_directories_hide_their_subtree) {
+  dentry_cache cache;
+  cache.insert("/", 1);
+  cache.insert("/a", 2);
+  cache.insert("/a/b", 3);
+  for (std::uint64_t file = 0; file < files; ++file) {
+    cache.insert(Path("/a/b/f" + std::to_string(file)), file + 10);
+  }
+  std::atomic<bool> renamed{false};
+  readers lookups(4, [&](std::uint64_t n) {
+    auto gone = renamed.load();
+    auto name = "f" + std::to_string(n % files);
+    auto found = cache.find(Path("/a/b/" + name));
+    auto child = cache.find(3, string_view(name));
+    if (gone) {  // once invalidated nothing beneath /a resolves
+      EXPECT_FALSE(found);
+      EXPECT_FALSE(child);
+      EXPECT_FALSE(cache.find("/a/b"));
+    } else {  // until then everything does, unless the rename overtook us
+      EXPECT_TRUE(found || renamed.load());
+      EXPECT_EQ(n % files + 10, found.value_or(n % files + 10));
+      EXPECT_EQ(n % files + 10, child.value_or(n % files + 10));
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  cache.invalidate("/a");  // as rename("/a", "/z") does
+  renamed.store(true);
+  cache.insert("/z", 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_GT(lookups.join(), 0u);
+  EXPECT_FALSE(cache.find("/z/b"));  // not until walked to again
+  EXPECT_EQ(2u, *cache.find("/z"));
+  EXPECT_TRUE(cache.insert("/z/b", 3));
+  EXPECT_FALSE(cache.find(3, string_view("f0")));
+}
@@ -0,0 +1,63 @@
+#include "memory_filesystem.h"
+#include <drivex/directory_entry.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::directory_entry;
+using lockblox::drivex::file_status;
+using lockblox::drivex::file_type;
+using lockblox::drivex::Path;
+
+/** A backend written before the const getters existed */
+class legacy_filesystem : public memory_filesystem {
+ public:
+  std::time_t last_write_time(const Path& path) override {
+    (void)path;
+    return 1234;
+  }
+};
+}  // namespace
+
+TEST(directory_entry_test, answers_known_attributes_without_the_backend) {
+  memory_filesystem filesystem;
+  filesystem.put("/f", "hello");
+  auto entry =
+      directory_entry(filesystem, "/f", file_status(file_type::regular), 5, 7);
+  auto before = filesystem.calls();
+  EXPECT_TRUE(entry.status_known());
+  EXPECT_TRUE(entry.is_regular_file());
+  EXPECT_EQ(5u, entry.file_size());
+  EXPECT_EQ(7, entry.last_write_time());
+  EXPECT_EQ(before, filesystem.calls());
+}
+
+TEST(directory_entry_test, refresh_fetches_and_caches_attributes) {
+  memory_filesystem filesystem;
+  filesystem.put("/f", "hello");
+  filesystem.last_write_time(Path("/f"), 99);
+  auto entry = directory_entry(filesystem, "/f");
+  EXPECT_FALSE(entry.status_known());
+  entry.refresh();
+  auto before = filesystem.calls();
+  EXPECT_EQ(5u, entry.file_size());
+  EXPECT_EQ(99, entry.last_write_time());
+  EXPECT_EQ(before, filesystem.calls());
+}
+
+TEST(directory_entry_test, dangling_symlink_does_not_exist) {
+  memory_filesystem filesystem;
+  filesystem.create_symlink("/missing", "/l");
+  auto entry = directory_entry(filesystem, "/l");
+  entry.refresh();
+  EXPECT_TRUE(entry.is_symlink());
+  EXPECT_FALSE(entry.exists());
+}
+
+TEST(directory_entry_test, const_getter_reaches_non_const_override) {
+  legacy_filesystem filesystem;
+  filesystem.put("/f", "");
+  const lockblox::drivex::filesystem& view = filesystem;
+  EXPECT_EQ(1234, view.last_write_time("/f"));
+  EXPECT_EQ(1234, directory_entry(filesystem, "/f").last_write_time());
+}
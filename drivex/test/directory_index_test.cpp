@@ -0,0 +1,103 @@
+#include <drivex/directory_index.h>
+#include <gtest/gtest.h>
+#include <set>
+
+namespace {
+
+using lockblox::drivex::directory_index;
+using lockblox::drivex::string_view;
+
+std::string name_of(std::uint64_t i) { return "file" + std::to_string(i); }
+
+/** Everything listed after a cursor, fetched a few entries at a time */
+std::vector<std::string> rest(const directory_index& index,
+                              directory_index::cursor& after) {
+  std::vector<std::string> names;
+  for (;;) {
+    auto page = index.list(after, 7);
+    if (page.empty()) {
+      return names;
+    }
+    for (const auto& e : page) {
+      names.push_back(e.name);
+      after = e.position;
+    }
+  }
+}
+}  // namespace
+
+TEST(directory_index_test, finds_assigns_and_erases) {
+  directory_index index;
+  EXPECT_TRUE(index.insert(string_view("a"), 1));
+  EXPECT_FALSE(index.insert(string_view("a"), 2));
+  EXPECT_EQ(1u, *index.find(string_view("a")));
+  EXPECT_TRUE(index.assign(string_view("a"), 3));
+  EXPECT_EQ(3u, *index.find(string_view("a")));
+  EXPECT_FALSE(index.assign(string_view("b"), 3));
+  EXPECT_TRUE(index.erase(string_view("a")));
+  EXPECT_FALSE(index.erase(string_view("a")));
+  EXPECT_FALSE(index.find(string_view("a")));
+  EXPECT_TRUE(index.empty());
+}
+
+TEST(directory_index_test, cursors_survive_rehash) {
+  directory_index index;
+  for (std::uint64_t i = 0; i < 10; ++i) {
+    index.insert(string_view(name_of(i)), i);
+  }
+  auto page = index.list(0, 5);
+  ASSERT_EQ(5u, page.size());
+  auto after = page.back().position;
+  for (std::uint64_t i = 10; i < 10000; ++i) {  // grows the table many times
+    index.insert(string_view(name_of(i)), i);
+  }
+  auto names = rest(index, after);
+  ASSERT_EQ(9995u, names.size());
+  for (std::uint64_t i = 0; i < names.size(); ++i) {
+    EXPECT_EQ(name_of(i + 5), names[i]);
+  }
+  for (std::uint64_t i = 0; i < 10000; ++i) {
+    EXPECT_EQ(i, *index.find(string_view(name_of(i))));
+  }
+}
+
+TEST(directory_index_test, cursors_survive_compaction) {
+  directory_index index;
+  for (std::uint64_t i = 0; i < 1000; ++i) {
+    index.insert(string_view(name_of(i)), i);
+  }
+  auto page = index.list(0, 100);
+  auto after = page.back().position;
+  for (std::uint64_t i = 0; i < 1000; ++i) {
+    if (i % 10 != 0) {  // tombstones come to outnumber the live entries
+      index.erase(string_view(name_of(i)));
+    }
+  }
+  index.insert(string_view("late"), 1000);
+  std::set<std::string> listed;
+  for (const auto& name : rest(index, after)) {
+    EXPECT_TRUE(listed.insert(name).second) << name << " listed twice";
+  }
+  for (std::uint64_t i = 100; i < 1000; i += 10) {
+    EXPECT_EQ(1u, listed.count(name_of(i))) << name_of(i) << " skipped";
+  }
+  EXPECT_EQ(1u, listed.count("late"));
+  EXPECT_EQ(91u, listed.size());
+  EXPECT_EQ(101u, index.size());
+}
+
+TEST(directory_index_test, indexes_hash_names_differently) {
+  directory_index first;
+  directory_index second;
+  for (std::uint64_t i = 0; i < 64; ++i) {
+    first.insert(string_view(name_of(i)), i);
+    second.insert(string_view(name_of(i)), i);
+  }
+  // listing follows insertion whatever the seed
+  auto a = first.list(0, 64);
+  auto b = second.list(0, 64);
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].name, b[i].name);
+  }
+}
@@ -0,0 +1,73 @@
+#include "memory_filesystem.h"
+#include <drivex/directory_iterator.h>
+#include <gtest/gtest.h>
+#include <set>
+
+namespace {
+
+using lockblox::drivex::directory_iterator;
+using lockblox::drivex::directory_options;
+using lockblox::drivex::recursive_directory_iterator;
+
+class directory_iterator_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    filesystem.create_directory("/d");
+    filesystem.create_directory("/d/e");
+    filesystem.create_directory("/d/empty");
+    filesystem.put("/d/f", "f");
+    filesystem.put("/d/e/g", "g");
+    filesystem.create_symlink("/d/e", "/d/l");
+  }
+
+  memory_filesystem filesystem;
+};
+}  // namespace
+
+TEST_F(directory_iterator_test, lists_one_directory_without_dots) {
+  auto names = std::set<std::string>{};
+  for (const auto& entry : directory_iterator(filesystem, "/d")) {
+    names.insert(entry.path().string());
+  }
+  EXPECT_EQ((std::set<std::string>{"/d/e", "/d/empty", "/d/f", "/d/l"}),
+            names);
+}
+
+TEST_F(directory_iterator_test, empty_directory_is_the_end_iterator) {
+  EXPECT_EQ(directory_iterator(), directory_iterator(filesystem, "/d/empty"));
+}
+
+TEST_F(directory_iterator_test, recursive_iterator_visits_the_tree) {
+  auto names = std::set<std::string>{};
+  auto deepest = 0;
+  for (auto it = recursive_directory_iterator(filesystem, "/");
+       it != end(it); ++it) {
+    names.insert(it->path().string());
+    deepest = std::max(deepest, it.depth());
+  }
+  EXPECT_EQ((std::set<std::string>{"/d", "/d/e", "/d/e/g", "/d/empty",
+                                   "/d/f", "/d/l"}),
+            names);
+  EXPECT_EQ(2, deepest);
+}
+
+TEST_F(directory_iterator_test, recursion_can_be_disabled_per_entry) {
+  auto names = std::set<std::string>{};
+  for (auto it = recursive_directory_iterator(filesystem, "/d");
+       it != end(it); ++it) {
+    names.insert(it->path().string());
+    if (it->path() == "/d/e") {
+      it.disable_recursion_pending();
+    }
+  }
+  EXPECT_EQ(0u, names.count("/d/e/g"));
+}
+
+TEST_F(directory_iterator_test, follows_directory_symlinks_when_asked) {
+  auto names = std::set<std::string>{};
+  for (const auto& entry : recursive_directory_iterator(
+           filesystem, "/d", directory_options::follow_directory_symlink)) {
+    names.insert(entry.path().string());
+  }
+  EXPECT_EQ(1u, names.count("/d/l/g"));
+}
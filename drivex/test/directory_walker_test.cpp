@@ -0,0 +1,131 @@
+#include "memory_filesystem.h"
+#include <drivex/directory_iterator.h>
+#include <drivex/directory_walker.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <set>
+
+namespace {
+
+using lockblox::drivex::directory_entry;
+using lockblox::drivex::directory_options;
+using lockblox::drivex::parallel_directory_walker;
+using lockblox::drivex::Path;
+using lockblox::drivex::thread_pool;
+
+std::set<std::string> walk(parallel_directory_walker& walker) {
+  auto names = std::set<std::string>{};
+  auto entry = directory_entry{};
+  while (walker.next(entry)) {
+    EXPECT_TRUE(entry.status_known());
+    names.insert(entry.path().string());
+  }
+  return names;
+}
+
+class directory_walker_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    filesystem.create_directory("/d");
+    for (int i = 0; i < 20; ++i) {
+      auto directory = "/d/" + std::to_string(i);
+      filesystem.create_directory(directory);
+      expected.insert(directory);
+      for (int j = 0; j < 50; ++j) {
+        auto file = directory + "/" + std::to_string(j);
+        filesystem.put(file, "");
+        expected.insert(file);
+      }
+    }
+  }
+
+  memory_filesystem filesystem;
+  std::set<std::string> expected;
+};
+}  // namespace
+
+TEST_F(directory_walker_test, visits_every_entry_once) {
+  thread_pool pool(4);
+  parallel_directory_walker walker(filesystem, "/d", pool,
+                                   directory_options::none, 8);
+  EXPECT_EQ(expected, walk(walker));
+}
+
+TEST_F(directory_walker_test, consumer_may_run_on_the_pool) {
+  thread_pool pool(1);
+  auto names = pool.submit([&]() {
+    parallel_directory_walker walker(filesystem, "/d", pool,
+                                     directory_options::none, 4);
+    return walk(walker);
+  });
+  ASSERT_EQ(std::future_status::ready,
+            names.wait_for(std::chrono::seconds(30)));
+  EXPECT_EQ(expected, names.get());
+}
+
+TEST_F(directory_walker_test, slow_consumer_does_not_hold_workers) {
+  thread_pool pool(2);
+  parallel_directory_walker walker(filesystem, "/d", pool,
+                                   directory_options::none, 1);
+  auto entry = directory_entry{};
+  ASSERT_TRUE(walker.next(entry));
+  auto other = pool.submit([]() { return 42; });
+  ASSERT_EQ(std::future_status::ready,
+            other.wait_for(std::chrono::seconds(30)));
+  EXPECT_EQ(expected.size() - 1, walk(walker).size());
+}
+
+TEST_F(directory_walker_test, consumer_runs_only_the_walks_tasks) {
+  thread_pool pool(1);
+  std::promise<void> started;
+  std::promise<void> release;
+  auto busy = pool.submit([&]() {
+    started.set_value();
+    release.get_future().wait();
+  });
+  started.get_future().wait();
+  std::atomic<bool> unrelated{false};
+  pool.post([&]() { unrelated = true; });
+  {
+    parallel_directory_walker walker(filesystem, "/d", pool,
+                                     directory_options::none, 8);
+    EXPECT_EQ(expected, walk(walker));  // the only worker is busy
+  }
+  EXPECT_FALSE(unrelated);
+  release.set_value();
+  busy.get();
+}
+
+TEST_F(directory_walker_test, cancel_discards_the_rest) {
+  thread_pool pool(4);
+  parallel_directory_walker walker(filesystem, "/d", pool,
+                                   directory_options::none, 4);
+  auto entry = directory_entry{};
+  ASSERT_TRUE(walker.next(entry));
+  walker.cancel();
+  EXPECT_FALSE(walker.next(entry));
+}
+
+TEST_F(directory_walker_test, rethrows_backend_errors) {
+  thread_pool pool(2);
+  parallel_directory_walker walker(filesystem, "/missing", pool);
+  auto entry = directory_entry{};
+  EXPECT_THROW(walker.next(entry), lockblox::drivex::error);
+}
+
+TEST_F(directory_walker_test, does_not_follow_links_around_a_cycle) {
+  filesystem.create_symlink("/d", "/d/0/top");
+  filesystem.create_symlink("..", "/d/1/up");
+  filesystem.create_symlink("/d/2", "/d/3/two");
+  thread_pool pool(4);
+  parallel_directory_walker walker(filesystem, "/d", pool,
+                                   directory_options::follow_directory_symlink);
+  auto names = walk(walker);
+  EXPECT_EQ(1u, names.count("/d/0/top"));
+  EXPECT_EQ(1u, names.count("/d/1/up"));
+  EXPECT_EQ(0u, names.count("/d/0/top/1"));
+  EXPECT_EQ(1u, names.count("/d/3/two/7"));
+  EXPECT_EQ(expected.size() + 3 + 50, names.size());
+}
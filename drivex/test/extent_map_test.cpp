@@ -0,0 +1,73 @@
+#include <drivex/extent_map.h>
+#include <gtest/gtest.h>
+#include <utility>
+
+namespace {
+
+using lockblox::drivex::extent_map;
+using extents = std::vector<std::pair<std::uint64_t, std::uint64_t>>;
+
+/** Offset and end of each extent */
+extents all(const extent_map& map) {
+  return extents(map.begin(), map.end());
+}
+}  // namespace
+
+TEST(extent_map_test, insert_coalesces_touching_ranges) {
+  extent_map map;
+  map.insert(10, 10);
+  map.insert(30, 10);
+  EXPECT_EQ((extents{{10, 20}, {30, 40}}), all(map));
+  map.insert(20, 10);  // fills the gap exactly
+  EXPECT_EQ((extents{{10, 40}}), all(map));
+  map.insert(5, 50);  // swallows it
+  map.insert(60, 0);
+  EXPECT_EQ((extents{{5, 55}}), all(map));
+  EXPECT_EQ(50u, map.allocated());
+}
+
+TEST(extent_map_test, erase_splits_the_extents_it_cuts) {
+  extent_map map;
+  map.insert(0, 100);
+  map.insert(200, 100);
+  map.erase(40, 20);
+  EXPECT_EQ((extents{{0, 40}, {60, 100}, {200, 300}}), all(map));
+  map.erase(90, 120);  // the end of one extent and the start of the next
+  EXPECT_EQ((extents{{0, 40}, {60, 90}, {210, 300}}), all(map));
+  map.erase(0, 40);
+  EXPECT_EQ((extents{{60, 90}, {210, 300}}), all(map));
+  EXPECT_EQ(120u, map.allocated());
+  map.truncate(250);
+  EXPECT_EQ((extents{{60, 90}, {210, 250}}), all(map));
+  map.truncate(60);
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(0u, map.allocated());
+}
+
+TEST(extent_map_test, seeks_data_and_holes) {
+  extent_map map;
+  map.insert(100, 50);
+  map.insert(300, 50);
+  EXPECT_EQ(100u, *map.next_data(0));
+  EXPECT_EQ(120u, *map.next_data(120));
+  EXPECT_EQ(300u, *map.next_data(150));
+  EXPECT_FALSE(map.next_data(350));
+  EXPECT_EQ(0u, map.next_hole(0));
+  EXPECT_EQ(150u, map.next_hole(100));
+  EXPECT_EQ(350u, map.next_hole(349));
+  EXPECT_TRUE(map.contains(149));
+  EXPECT_FALSE(map.contains(150));
+}
+
+TEST(extent_map_test, lists_the_allocated_parts_of_a_range) {
+  extent_map map;
+  map.insert(100, 50);
+  map.insert(300, 50);
+  auto parts = map.overlapping(120, 200);
+  ASSERT_EQ(2u, parts.size());
+  EXPECT_EQ(120u, parts[0].offset);
+  EXPECT_EQ(30u, parts[0].length);
+  EXPECT_EQ(300u, parts[1].offset);
+  EXPECT_EQ(20u, parts[1].length);
+  EXPECT_TRUE(map.overlapping(150, 150).empty());
+}
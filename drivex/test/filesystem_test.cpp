@@ -0,0 +1,275 @@
+#include "memory_filesystem.h"
+#include <drivex/filesystem_decorator.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+using lockblox::drivex::attribute_update;
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::file_time;
+using lockblox::drivex::filesystem_decorator;
+using lockblox::drivex::from_time_t;
+using lockblox::drivex::no_open_handle;
+using lockblox::drivex::open_handle;
+using lockblox::drivex::Path;
+using lockblox::drivex::permissions;
+using lockblox::drivex::string_view;
+using lockblox::drivex::to_time_t;
+
+/** Logs the calls that the default compound operations are made of */
+class recording_filesystem : public memory_filesystem {
+ public:
+  using filesystem::create_directory;
+  using filesystem::create_file;
+  using memory_filesystem::last_read_time;
+  using memory_filesystem::last_write_time;
+  using filesystem::flush;
+  using filesystem::read;
+  using filesystem::release;
+  using filesystem::write;
+
+  void create_directory(const Path& path) override {
+    log.push_back("create_directory " + path.string());
+    memory_filesystem::create_directory(path);
+  }
+
+  void create_file(const Path& path) override {
+    log.push_back("create_file " + path.string());
+    memory_filesystem::create_file(path);
+  }
+
+  void permissions(const Path& path,
+                   lockblox::drivex::permissions permissions) override {
+    log.push_back("permissions " +
+                  std::to_string(static_cast<unsigned int>(permissions)));
+    memory_filesystem::permissions(path, permissions);
+  }
+
+  void chown(const Path& path, uint32_t user_id, uint32_t group_id) override {
+    (void)path;
+    log.push_back("chown " + std::to_string(user_id) + " " +
+                  std::to_string(group_id));
+  }
+
+  void truncate(const Path& path, uint64_t offset) override {
+    log.push_back("truncate " + std::to_string(offset));
+    memory_filesystem::truncate(path, offset);
+  }
+
+  void last_read_time(const Path& path, std::time_t new_time) override {
+    (void)path;
+    log.push_back("last_read_time " + std::to_string(new_time));
+  }
+
+  void last_write_time(const Path& path, std::time_t new_time) override {
+    log.push_back("last_write_time " + std::to_string(new_time));
+    memory_filesystem::last_write_time(path, new_time);
+  }
+
+  void open(const Path& path, int flags) override {
+    log.push_back("open " + path.string());
+    if (open_unsupported) {
+      throw error(error_code::function_not_supported);
+    }
+    memory_filesystem::open(path, flags);
+  }
+
+  int read(const Path& path, string_view& buffer,
+           uint64_t offset) const override {
+    log.push_back("read");
+    return memory_filesystem::read(path, buffer, offset);
+  }
+
+  int write(const Path& path, const string_view& buffer,
+            uint64_t offset) override {
+    log.push_back("write");
+    return memory_filesystem::write(path, buffer, offset);
+  }
+
+  void flush(const Path& path) override {
+    log.push_back("flush");
+    memory_filesystem::flush(path);
+  }
+
+  void release(const Path& path, int flags) override {
+    log.push_back("release");
+    memory_filesystem::release(path, flags);
+  }
+
+  mutable std::vector<std::string> log;
+  bool open_unsupported = false;
+};
+
+/** Hands out handles and logs the handles it is given back */
+class handle_filesystem : public memory_filesystem {
+ public:
+  using memory_filesystem::flush;
+  using memory_filesystem::read;
+  using memory_filesystem::release;
+  using memory_filesystem::write;
+
+  open_handle open_file(const Path& path, int flags) override {
+    open(path, flags);
+    return 42;
+  }
+
+  open_handle create(const Path& path,
+                     lockblox::drivex::permissions permissions,
+                     int flags) override {
+    filesystem::create(path, permissions, flags);
+    return 43;
+  }
+
+  int read(const Path& path, open_handle handle, string_view& buffer,
+           uint64_t offset) const override {
+    handles.push_back(handle);
+    return read(path, buffer, offset);
+  }
+
+  int write(const Path& path, open_handle handle, const string_view& buffer,
+            uint64_t offset) override {
+    handles.push_back(handle);
+    return write(path, buffer, offset);
+  }
+
+  void flush(const Path& path, open_handle handle) override {
+    handles.push_back(handle);
+    flush(path);
+  }
+
+  void release(const Path& path, open_handle handle, int flags) override {
+    handles.push_back(handle);
+    release(path, flags);
+  }
+
+  mutable std::vector<open_handle> handles;
+};
+
+file_time at(std::int64_t nanoseconds) {
+  return file_time(std::chrono::nanoseconds(nanoseconds));
+}
+}  // namespace
+
+TEST(file_time_test, converts_to_seconds_rounding_toward_the_past) {
+  EXPECT_EQ(1, to_time_t(at(1999999999)));
+  EXPECT_EQ(0, to_time_t(at(0)));
+  EXPECT_EQ(-1, to_time_t(at(-1)));
+  EXPECT_EQ(-1, to_time_t(at(-1000000000)));
+  EXPECT_EQ(at(-2000000000), from_time_t(-2));
+}
+
+TEST(filesystem_test, set_attributes_applies_each_present_attribute) {
+  recording_filesystem fs;
+  fs.put("/f", "contents");
+  auto update = attribute_update();
+  update.permissions = static_cast<permissions>(0640);
+  update.user_id = 7;
+  update.size = 3;
+  update.last_read_time = at(1999999999);
+  update.last_write_time = at(-500000000);
+  fs.set_attributes("/f", update);
+  EXPECT_EQ((std::vector<std::string>{"permissions 416",
+                                      "chown 7 4294967295", "truncate 3",
+                                      "last_read_time 1",
+                                      "last_write_time -1"}),
+            fs.log);
+  EXPECT_EQ("con", fs.contents("/f"));
+  EXPECT_EQ(static_cast<permissions>(0640), fs.status("/f").permissions());
+}
+
+TEST(filesystem_test, set_attributes_leaves_absent_attributes_alone) {
+  recording_filesystem fs;
+  fs.put("/f", "contents");
+  fs.set_attributes("/f", attribute_update());
+  EXPECT_TRUE(fs.log.empty());
+  auto update = attribute_update();
+  update.group_id = 9;
+  fs.set_attributes("/f", update);
+  EXPECT_EQ(std::vector<std::string>{"chown 4294967295 9"}, fs.log);
+}
+
+TEST(filesystem_test, times_default_to_whole_seconds) {
+  memory_filesystem fs;  // keeps no read time
+  fs.put("/f", "");
+  fs.last_write_time("/f", 5);
+  auto times = fs.times("/f");
+  EXPECT_EQ(file_time(), times.last_read_time);
+  EXPECT_EQ(from_time_t(5), times.last_write_time);
+}
+
+TEST(filesystem_test, create_with_permissions_defaults_to_two_calls) {
+  recording_filesystem fs;
+  fs.create_file("/f", static_cast<permissions>(0600));
+  fs.create_directory("/d", static_cast<permissions>(0750));
+  EXPECT_EQ((std::vector<std::string>{"create_file /f", "permissions 384",
+                                      "create_directory /d",
+                                      "permissions 488"}),
+            fs.log);
+  EXPECT_EQ(static_cast<permissions>(0600), fs.status("/f").permissions());
+  EXPECT_EQ(static_cast<permissions>(0750), fs.status("/d").permissions());
+}
+
+TEST(filesystem_test, create_defaults_to_create_file_then_open) {
+  recording_filesystem fs;
+  EXPECT_EQ(no_open_handle,
+            fs.create("/f", static_cast<permissions>(0600), O_RDWR));
+  EXPECT_EQ((std::vector<std::string>{"create_file /f", "permissions 384",
+                                      "open /f"}),
+            fs.log);
+  fs.log.clear();
+  fs.open_unsupported = true;  // a backend without open still creates
+  EXPECT_EQ(no_open_handle,
+            fs.create("/g", static_cast<permissions>(0600), O_RDWR));
+  EXPECT_TRUE(fs.exists("/g"));
+}
+
+TEST(filesystem_test, open_file_defaults_to_open) {
+  recording_filesystem fs;
+  fs.put("/f", "");
+  EXPECT_EQ(no_open_handle, fs.open_file("/f", O_RDONLY));
+  EXPECT_EQ(std::vector<std::string>{"open /f"}, fs.log);
+  fs.open_unsupported = true;
+  try {
+    fs.open_file("/f", O_RDONLY);
+    ADD_FAILURE() << "open_file hid the failure of open";
+  } catch (const error& e) {
+    EXPECT_EQ(static_cast<int>(error_code::function_not_supported),
+              e.code().value());
+  }
+}
+
+TEST(filesystem_test, handle_overloads_default_to_the_path_ones) {
+  recording_filesystem fs;
+  fs.put("/f", "");
+  EXPECT_EQ(5, fs.write("/f", 7, string_view("hello"), 0));
+  auto buffer = std::string(5, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(5, fs.read("/f", 7, view, 0));
+  EXPECT_EQ("hello", buffer);
+  fs.flush("/f", 7);
+  fs.release("/f", 7, O_RDWR);
+  EXPECT_EQ((std::vector<std::string>{"write", "read", "flush", "release"}),
+            fs.log);
+}
+
+TEST(filesystem_test, decorators_pass_handles_through) {
+  auto inner = std::make_shared<handle_filesystem>();
+  filesystem_decorator decorator(inner);
+  inner->put("/f", "");
+  auto handle = decorator.open_file("/f", O_RDWR);
+  EXPECT_EQ(42u, handle);
+  EXPECT_EQ(43u, decorator.create("/g", static_cast<permissions>(0600),
+                                  O_RDWR));
+  EXPECT_EQ(2, decorator.write("/f", handle, string_view("hi"), 0));
+  auto buffer = std::string(2, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(2, decorator.read("/f", handle, view, 0));
+  decorator.flush("/f", handle);
+  decorator.release("/f", handle, O_RDWR);
+  EXPECT_EQ((std::vector<open_handle>{42, 42, 42, 42}), inner->handles);
+  EXPECT_EQ("hi", inner->contents("/f"));
+}
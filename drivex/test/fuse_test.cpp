@@ -1 +1,84 @@
-int main() { return 0; }
+#include <drivex/Fuse.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::Fuse;
+using lockblox::drivex::Path;
+using lockblox::drivex::space_info;
+using lockblox::drivex::string_view;
+
+/** Counts the cached calls that reach the backend */
+class counting_filesystem : public lockblox::drivex::filesystem {
+ public:
+  using filesystem::getxattr;
+
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override {
+    (void)path;
+    (void)name;
+    ++gets;
+    const_cast<char*>(buffer.data())[0] = 'v';
+    return 1;
+  }
+
+  space_info space(const Path& path) const override {
+    (void)path;
+    ++spaces;
+    return space_info{};
+  }
+
+  int gets = 0;
+  mutable int spaces = 0;
+};
+
+/** A Fuse that never mounts, for the parts that work without the kernel */
+class fuse_test : public ::testing::Test {
+ protected:
+  fuse_test()
+      : backend(std::make_shared<counting_filesystem>()),
+        fuse(backend, "/nonexistent/drivex/fuse_test") {
+    fuse.xattrs().capacity(16);
+    fuse.space().ttl(std::chrono::minutes(1));
+  }
+
+  void get(const Path& path) {
+    char value[8] = {};
+    auto buffer = string_view(value, sizeof value);
+    fuse.xattrs().getxattr(*backend, path, "user.a", buffer);
+  }
+
+  std::shared_ptr<counting_filesystem> backend;
+  Fuse fuse;
+};
+}  // namespace
+
+TEST_F(fuse_test, stays_unmounted_without_a_mount_point) {
+  fuse.mount();
+  EXPECT_FALSE(fuse.is_mounted());
+  EXPECT_EQ(nullptr, fuse.session());
+  EXPECT_EQ(backend.get(), &fuse.backend());
+  fuse.run();
+  fuse.invalidate("/");  // the kernel part is ignored while unmounted
+  fuse.flush_invalidations();
+}
+
+TEST_F(fuse_test, invalidate_drops_cached_attributes_below_a_path) {
+  get("/a/b/c");
+  get("/d");
+  get("/a/b/c");
+  EXPECT_EQ(2, backend->gets);
+  fuse.invalidate("/a/b");
+  get("/a/b/c");
+  get("/d");
+  EXPECT_EQ(3, backend->gets);
+}
+
+TEST_F(fuse_test, invalidate_drops_cached_space) {
+  fuse.space().space(*backend, "/");
+  fuse.space().space(*backend, "/");
+  EXPECT_EQ(1, backend->spaces);
+  fuse.invalidate("/a/b/c");  // deeper than the kernel has node ids for
+  fuse.space().space(*backend, "/");
+  EXPECT_EQ(2, backend->spaces);
+}
@@ -0,0 +1,98 @@
+#include "memory_filesystem.h"
+#include <drivex/image_builder.h>
+#include <drivex/image_filesystem.h>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <fstream>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::file_type;
+using lockblox::drivex::image_filesystem;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+error_code code_of(const std::function<void()>& call) {
+  try {
+    call();
+  } catch (const error& e) {
+    return static_cast<error_code>(e.code().value());
+  }
+  ADD_FAILURE() << "no error";
+  return error_code::io_error;
+}
+
+std::string read_all(const image_filesystem& image, const Path& path) {
+  auto result = std::string(image.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(image.read(path, buffer, 0)));
+  return result;
+}
+
+class image_filesystem_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    source.create_directory("/d");
+    source.create_directory("/d/e");
+    source.put("/d/e/f", std::string(10000, 'x') + "end");
+    source.put("/g", "");
+    source.create_symlink("e", "/d/link");
+    source.create_symlink("/d/e/f", "/absolute");
+    source.create_symlink("../../d", "/d/e/up");
+    source.create_symlink("loop", "/loop");
+    source.last_write_time("/g", 1234);
+    image = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("drivex-%%%%-%%%%.img");
+    lockblox::drivex::build_image(source, "/", image.string());
+  }
+
+  void TearDown() override { boost::filesystem::remove(image); }
+
+  memory_filesystem source;
+  boost::filesystem::path image;
+};
+}  // namespace
+
+TEST_F(image_filesystem_test, round_trips_a_tree) {
+  image_filesystem copy(image.string());
+  EXPECT_EQ(std::string(10000, 'x') + "end", read_all(copy, "/d/e/f"));
+  EXPECT_EQ(0u, copy.file_size("/g"));
+  EXPECT_EQ(1234, copy.last_write_time(Path("/g")));
+  EXPECT_EQ(Path("e"), copy.read_symlink("/d/link"));
+  EXPECT_EQ(file_type::directory, copy.status("/d/e").type());
+  EXPECT_EQ(file_type::symlink, copy.symlink_status("/d/link").type());
+  auto names = copy.read_directory("/d");
+  EXPECT_EQ((std::vector<Path>{".", "..", "e", "link"}), names);
+}
+
+TEST_F(image_filesystem_test, resolves_symlinks_inside_paths) {
+  image_filesystem copy(image.string());
+  EXPECT_EQ(file_type::regular, copy.status("/d/link/f").type());
+  EXPECT_EQ(file_type::regular, copy.status("/absolute").type());
+  EXPECT_EQ(file_type::directory, copy.status("/d/e/up/e/up").type());
+  EXPECT_EQ(std::string(10000, 'x') + "end", read_all(copy, "/d/e/up/link/f"));
+  EXPECT_EQ(file_type::symlink, copy.symlink_status("/d/link/up").type());
+  EXPECT_EQ(file_type::directory, copy.status("/d/link/..").type());
+  EXPECT_EQ(error_code::no_such_file_or_directory,
+            code_of([&] { copy.status("/d/link/missing"); }));
+  EXPECT_EQ(error_code::too_many_symbolic_link_levels,
+            code_of([&] { copy.status("/loop/x"); }));
+  EXPECT_EQ(error_code::not_a_directory,
+            code_of([&] { copy.status("/g/x"); }));
+}
+
+TEST_F(image_filesystem_test, is_read_only) {
+  image_filesystem copy(image.string());
+  copy.open("/d/e/f", O_RDONLY);
+  EXPECT_EQ(error_code::read_only_file_system,
+            code_of([&] { copy.open("/d/e/f", O_RDWR); }));
+}
+
+TEST_F(image_filesystem_test, rejects_files_that_are_not_images) {
+  std::ofstream(image.string(), std::ios::trunc) << "not an image";
+  EXPECT_EQ(error_code::io_error,
+            code_of([&] { image_filesystem copy(image.string()); }));
+}
@@ -0,0 +1,104 @@
+#include <drivex/invalidation_queue.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+using lockblox::drivex::invalidation_queue;
+
+using inode_call = std::tuple<std::uint64_t, std::int64_t, std::int64_t>;
+using entry_call = std::pair<std::uint64_t, std::string>;
+
+/** Records what a queue delivers, from whichever thread delivers it */
+class invalidation_queue_test : public ::testing::Test {
+ protected:
+  std::unique_ptr<invalidation_queue> make(
+      std::chrono::milliseconds delay = std::chrono::hours(1),
+      std::size_t batch_limit = 1024) {
+    return std::unique_ptr<invalidation_queue>(new invalidation_queue(
+        [this](std::uint64_t node, std::int64_t offset, std::int64_t length) {
+          std::lock_guard<std::mutex> lock(mutex);
+          inodes.emplace_back(node, offset, length);
+          delivered.notify_all();
+        },
+        [this](std::uint64_t parent, const std::string& name) {
+          std::lock_guard<std::mutex> lock(mutex);
+          entries.emplace_back(parent, name);
+          delivered.notify_all();
+        },
+        delay, batch_limit));
+  }
+
+  /** Wait until count invalidations have been delivered */
+  bool wait_for(std::size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return delivered.wait_for(lock, std::chrono::seconds(10), [&] {
+      return inodes.size() + entries.size() >= count;
+    });
+  }
+
+  std::mutex mutex;
+  std::condition_variable delivered;
+  std::vector<inode_call> inodes;
+  std::vector<entry_call> entries;
+};
+}  // namespace
+
+TEST_F(invalidation_queue_test, holds_invalidations_until_flushed) {
+  auto queue = make();
+  queue->invalidate_attributes(1);
+  queue->invalidate_entry(1, "a");
+  EXPECT_TRUE(inodes.empty());
+  EXPECT_TRUE(entries.empty());
+  queue->flush();
+  EXPECT_EQ(std::vector<inode_call>{inode_call(1, -1, 0)}, inodes);
+  EXPECT_EQ(std::vector<entry_call>{entry_call(1, "a")}, entries);
+  queue->flush();  // nothing is sent twice
+  EXPECT_EQ(1u, inodes.size());
+  EXPECT_EQ(1u, entries.size());
+}
+
+TEST_F(invalidation_queue_test, coalesces_requests_for_one_node) {
+  auto queue = make();
+  queue->invalidate_attributes(1);
+  queue->invalidate_data(1, 100, 10);
+  queue->invalidate_attributes(1);  // covered by the data invalidation
+  queue->invalidate_data(1, 50, 10);
+  queue->invalidate_data(2, 0, 4096);
+  queue->invalidate_data(2);  // to the end of the file
+  queue->invalidate_entry(1, "a");
+  queue->invalidate_entry(1, "a");
+  queue->invalidate_entry(2, "a");
+  queue->flush();
+  std::sort(inodes.begin(), inodes.end());
+  EXPECT_EQ((std::vector<inode_call>{inode_call(1, 50, 60),
+                                     inode_call(2, 0, 0)}),
+            inodes);
+  EXPECT_EQ((std::vector<entry_call>{entry_call(1, "a"), entry_call(2, "a")}),
+            entries);
+}
+
+TEST_F(invalidation_queue_test, delivers_after_the_delay) {
+  auto queue = make(std::chrono::milliseconds(1));
+  queue->invalidate_data(3);
+  EXPECT_TRUE(wait_for(1));
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(std::vector<inode_call>{inode_call(3, 0, 0)}, inodes);
+}
+
+TEST_F(invalidation_queue_test, a_full_batch_cuts_the_delay) {
+  auto queue = make(std::chrono::hours(1), 3);
+  queue->invalidate_attributes(1);
+  queue->invalidate_attributes(2);
+  queue->invalidate_entry(1, "a");
+  EXPECT_TRUE(wait_for(3));
+}
+
+TEST_F(invalidation_queue_test, delivers_what_is_pending_on_destruction) {
+  auto queue = make();
+  queue->invalidate_entry(1, "a");
+  queue.reset();
+  EXPECT_EQ(std::vector<entry_call>{entry_call(1, "a")}, entries);
+}
@@ -0,0 +1,110 @@
+#include <drivex/journal.h>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <fstream>
+
+namespace {
+
+using lockblox::drivex::journal;
+using lockblox::drivex::journal_settings;
+using lockblox::drivex::string_view;
+
+/** The records a journal replays after a checkpoint */
+std::vector<std::string> replayed(journal& log, std::uint64_t after = 0) {
+  std::vector<std::string> records;
+  log.replay(after, [&records](const string_view& record) {
+    records.push_back(record.to_string());
+  });
+  return records;
+}
+
+class journal_test : public ::testing::Test {
+ protected:
+  journal_test()
+      : directory(boost::filesystem::temp_directory_path() /
+                  boost::filesystem::unique_path("drivex-%%%%-%%%%")) {}
+
+  ~journal_test() override { boost::filesystem::remove_all(directory); }
+
+  /** Total size of the segment files */
+  std::uintmax_t logged() const {
+    std::uintmax_t size = 0;
+    for (boost::filesystem::directory_iterator it(directory), end; it != end;
+         ++it) {
+      size += boost::filesystem::file_size(it->path());
+    }
+    return size;
+  }
+
+  boost::filesystem::path directory;
+};
+}  // namespace
+
+TEST_F(journal_test, replays_committed_records_after_a_checkpoint) {
+  {
+    journal log(directory);
+    EXPECT_TRUE(replayed(log).empty());
+    EXPECT_EQ(1u, log.append(string_view("one")));
+    EXPECT_EQ(2u, log.append(string_view("two")));
+    log.commit(2);
+    EXPECT_EQ(2u, log.durable());
+    log.checkpoint(1);
+    log.append(string_view("three"));
+    log.commit(log.last());
+  }
+  journal log(directory);
+  EXPECT_EQ((std::vector<std::string>{"two", "three"}), replayed(log, 1));
+  EXPECT_EQ(4u, log.append(string_view("four")));
+}
+
+TEST_F(journal_test, a_torn_tail_ends_the_log) {
+  {
+    journal log(directory);
+    replayed(log);
+    log.append(string_view("kept"));
+    log.append(string_view("torn"));
+    log.commit(2);
+  }
+  boost::filesystem::directory_iterator segment(directory);
+  auto path = segment->path();
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 2);
+  {
+    journal log(directory);
+    EXPECT_EQ((std::vector<std::string>{"kept"}), replayed(log));
+    EXPECT_EQ(2u, log.append(string_view("again")));
+    log.commit(2);
+  }
+  std::vector<boost::filesystem::path> segments(
+      boost::filesystem::directory_iterator(directory),
+      boost::filesystem::directory_iterator{});
+  std::sort(segments.begin(), segments.end());
+  {
+    std::ofstream garbage(segments.back().string(),
+                          std::ios::binary | std::ios::app);
+    garbage << "not a record";
+  }
+  journal log(directory);
+  EXPECT_EQ((std::vector<std::string>{"kept", "again"}), replayed(log));
+}
+
+TEST_F(journal_test, a_full_buffer_is_written_without_a_sync) {
+  journal_settings settings;
+  settings.buffer_bytes = 1000;
+  settings.flush_bytes = 5000;
+  journal log(directory, settings);
+  replayed(log);
+  auto record = std::string(100, 'r');
+  while (logged() == 0) {
+    log.append(string_view(record));
+  }
+  EXPECT_EQ(0u, log.durable());
+  EXPECT_FALSE(log.flush_due());
+  while (!log.flush_due()) {
+    log.append(string_view(record));
+  }
+  log.commit(log.last());
+  EXPECT_EQ(log.last(), log.durable());
+  EXPECT_FALSE(log.flush_due());
+  EXPECT_EQ(log.size(), logged());
+}
@@ -0,0 +1,212 @@
+#include <drivex/lock_manager.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/file.h>
+#include <atomic>
+#include <future>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::file_lock;
+using lockblox::drivex::lock_manager;
+using lockblox::drivex::lock_type;
+
+file_lock range(lock_type type, std::uint64_t start, std::uint64_t length,
+                std::int64_t pid = 1) {
+  auto result = file_lock{};
+  result.type = type;
+  result.start = start;
+  result.length = length;
+  result.pid = pid;
+  return result;
+}
+
+error_code code_of(const std::function<void()>& call) {
+  try {
+    call();
+  } catch (const error& e) {
+    return static_cast<error_code>(e.code().value());
+  }
+  ADD_FAILURE() << "no error";
+  return error_code::io_error;
+}
+
+/** Test lock, returning the conflict F_GETLK reports */
+file_lock probe(lock_manager& locks, std::uint64_t owner, lock_type type,
+                std::uint64_t start, std::uint64_t length) {
+  auto lock = range(type, start, length);
+  locks.lock("/f", F_GETLK, lock, owner);
+  return lock;
+}
+
+/** An interrupt_check that reports when its wait is about to sleep */
+class sleep_signal {
+ public:
+  lock_manager::interrupt_check check(bool interrupted = false) {
+    return [this, interrupted] {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!sleeping_) {
+        sleeping_ = true;
+        promise_.set_value();
+      }
+      return interrupted && checks_++ > 0;
+    };
+  }
+
+  void wait() { promise_.get_future().wait(); }
+
+ private:
+  std::mutex mutex_;
+  std::promise<void> promise_;
+  bool sleeping_ = false;
+  int checks_ = 0;
+};
+}  // namespace
+
+TEST(lock_manager_test, reports_and_refuses_conflicts) {
+  lock_manager locks;
+  auto held = range(lock_type::write, 10, 10, 42);
+  locks.lock("/f", F_SETLK, held, 1);
+  auto conflict = probe(locks, 2, lock_type::read, 0, 0);
+  EXPECT_EQ(lock_type::write, conflict.type);
+  EXPECT_EQ(10u, conflict.start);
+  EXPECT_EQ(10u, conflict.length);
+  EXPECT_EQ(42, conflict.pid);
+  EXPECT_EQ(lock_type::unlock, probe(locks, 1, lock_type::write, 0, 0).type);
+  EXPECT_EQ(lock_type::unlock, probe(locks, 2, lock_type::write, 20, 5).type);
+  auto mine = range(lock_type::read, 15, 1);
+  EXPECT_EQ(error_code::resource_unavailable_try_again,
+            code_of([&] { locks.lock("/f", F_SETLK, mine, 2); }));
+}
+
+TEST(lock_manager_test, read_locks_are_shared) {
+  lock_manager locks;
+  auto lock = range(lock_type::read, 0, 0);
+  locks.lock("/f", F_SETLK, lock, 1);
+  locks.lock("/f", F_SETLK, lock, 2);
+  EXPECT_EQ(lock_type::read, probe(locks, 3, lock_type::write, 5, 1).type);
+}
+
+TEST(lock_manager_test, unlocking_the_middle_splits_a_range) {
+  lock_manager locks;
+  auto lock = range(lock_type::write, 0, 100);
+  locks.lock("/f", F_SETLK, lock, 1);
+  auto hole = range(lock_type::unlock, 40, 20);
+  locks.lock("/f", F_SETLK, hole, 1);
+  EXPECT_EQ(lock_type::unlock, probe(locks, 2, lock_type::write, 40, 20).type);
+  auto head = probe(locks, 2, lock_type::read, 0, 50);
+  EXPECT_EQ(0u, head.start);
+  EXPECT_EQ(40u, head.length);
+  auto tail = probe(locks, 2, lock_type::read, 50, 0);
+  EXPECT_EQ(60u, tail.start);
+  EXPECT_EQ(40u, tail.length);
+}
+
+TEST(lock_manager_test, adjacent_ranges_coalesce) {
+  lock_manager locks;
+  auto first = range(lock_type::read, 0, 10);
+  auto second = range(lock_type::read, 10, 10);
+  locks.lock("/f", F_SETLK, first, 1);
+  locks.lock("/f", F_SETLK, second, 1);
+  auto conflict = probe(locks, 2, lock_type::write, 0, 0);
+  EXPECT_EQ(0u, conflict.start);
+  EXPECT_EQ(20u, conflict.length);
+}
+
+TEST(lock_manager_test, release_drops_every_lock_of_an_owner) {
+  lock_manager locks;
+  auto lock = range(lock_type::write, 0, 10);
+  locks.lock("/f", F_SETLK, lock, 1);
+  lock = range(lock_type::write, 20, 10);
+  locks.lock("/f", F_SETLK, lock, 1);
+  locks.release("/f", 1);
+  EXPECT_EQ(lock_type::unlock, probe(locks, 2, lock_type::write, 0, 0).type);
+}
+
+TEST(lock_manager_test, blocked_lock_proceeds_on_release) {
+  lock_manager locks;
+  auto held = range(lock_type::write, 0, 0);
+  locks.lock("/f", F_SETLK, held, 1);
+  sleep_signal sleeping;
+  auto waiter = std::async(std::launch::async, [&] {
+    auto lock = range(lock_type::read, 0, 0);
+    locks.lock("/f", F_SETLKW, lock, 2, sleeping.check());
+  });
+  sleeping.wait();
+  auto unlock = range(lock_type::unlock, 0, 0);
+  locks.lock("/f", F_SETLK, unlock, 1);
+  waiter.get();
+  EXPECT_EQ(lock_type::read, probe(locks, 1, lock_type::write, 0, 0).type);
+}
+
+TEST(lock_manager_test, interrupt_wakes_a_blocked_lock) {
+  lock_manager locks;
+  auto held = range(lock_type::write, 0, 0);
+  locks.lock("/f", F_SETLK, held, 1);
+  sleep_signal sleeping;
+  auto waiter = std::async(std::launch::async, [&] {
+    auto lock = range(lock_type::write, 0, 0);
+    locks.lock("/f", F_SETLKW, lock, 2, sleeping.check(true));
+  });
+  sleeping.wait();
+  locks.interrupt(2);
+  EXPECT_EQ(error_code::interrupted, code_of([&] { waiter.get(); }));
+  EXPECT_EQ(lock_type::unlock, probe(locks, 1, lock_type::write, 0, 0).type);
+}
+
+TEST(lock_manager_test, interrupt_leaves_uninterrupted_requests_waiting) {
+  lock_manager locks;
+  auto held = range(lock_type::write, 0, 0);
+  locks.lock("/f", F_SETLK, held, 1);
+  sleep_signal sleeping;
+  auto waiter = std::async(std::launch::async, [&] {
+    auto lock = range(lock_type::write, 0, 0);
+    locks.lock("/f", F_SETLKW, lock, 2, sleeping.check(false));
+  });
+  sleeping.wait();
+  locks.interrupt(2);
+  EXPECT_EQ(std::future_status::timeout,
+            waiter.wait_for(std::chrono::milliseconds(50)));
+  locks.release("/f", 1);
+  waiter.get();
+}
+
+TEST(lock_manager_test, detects_deadlock_across_files) {
+  lock_manager locks;
+  auto a = range(lock_type::write, 0, 0);
+  auto b = range(lock_type::write, 0, 0);
+  locks.lock("/a", F_SETLK, a, 1);
+  locks.lock("/b", F_SETLK, b, 2);
+  sleep_signal sleeping;
+  auto waiter = std::async(std::launch::async, [&] {
+    auto lock = range(lock_type::write, 0, 0);
+    locks.lock("/b", F_SETLKW, lock, 1, sleeping.check());
+  });
+  sleeping.wait();
+  auto lock = range(lock_type::write, 0, 0);
+  EXPECT_EQ(error_code::resource_deadlock_would_occur,
+            code_of([&] { locks.lock("/a", F_SETLKW, lock, 2); }));
+  locks.release("/b", 2);
+  waiter.get();
+}
+
+TEST(lock_manager_test, flocks_are_shared_or_exclusive) {
+  lock_manager locks;
+  locks.flock("/f", LOCK_SH, 1);
+  locks.flock("/f", LOCK_SH | LOCK_NB, 2);
+  EXPECT_EQ(error_code::resource_unavailable_try_again,
+            code_of([&] { locks.flock("/f", LOCK_EX | LOCK_NB, 3); }));
+  locks.flock("/f", LOCK_UN, 1);
+  sleep_signal sleeping;
+  auto waiter = std::async(std::launch::async, [&] {
+    locks.flock("/f", LOCK_EX, 3, sleeping.check());
+  });
+  sleeping.wait();
+  locks.flock("/f", LOCK_UN, 2);
+  waiter.get();
+  EXPECT_EQ(error_code::resource_unavailable_try_again,
+            code_of([&] { locks.flock("/f", LOCK_SH | LOCK_NB, 1); }));
+}
@@ -0,0 +1,158 @@
+#include "memory_filesystem.h"
+#include <drivex/dentry_cache.h>
+#include <drivex/memory_budget.h>
+#include <drivex/overlay_filesystem.h>
+#include <drivex/space_cache.h>
+#include <gtest/gtest.h>
+#include <deque>
+
+namespace {
+
+using lockblox::drivex::dentry_cache;
+using lockblox::drivex::memory_budget;
+using lockblox::drivex::memory_consumer;
+using lockblox::drivex::overlay_filesystem;
+using lockblox::drivex::Path;
+using lockblox::drivex::space_cache;
+using lockblox::drivex::space_info;
+
+/** Items of a fixed size, evicted oldest first */
+class items : public memory_consumer {
+ public:
+  items(memory_budget& budget, std::string name)
+      : budget_(budget), name_(std::move(name)) {
+    budget_.add(*this);
+  }
+
+  ~items() override { budget_.remove(*this); }
+
+  bool keep(std::size_t bytes) {
+    if (!budget_.charge(*this, bytes)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_.push_back({budget_.tick(), bytes});
+    return true;
+  }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return held_.size();
+  }
+
+  std::string name() const override { return name_; }
+
+  std::uint64_t oldest() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return held_.empty() ? no_items : held_.front().first;
+  }
+
+  std::size_t evict(std::uint64_t until, std::size_t bytes) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++evict_calls;
+    std::size_t dropped = 0;
+    std::size_t released = 0;
+    while (!held_.empty() &&
+           (dropped == 0 ||
+            (released < bytes && held_.front().first < until))) {
+      released += held_.front().second;
+      budget_.release(*this, held_.front().second);
+      held_.pop_front();
+      ++dropped;
+    }
+    return dropped;
+  }
+
+  std::size_t evict_calls = 0;
+
+ private:
+  memory_budget& budget_;
+  std::string name_;
+  mutable std::mutex mutex_;
+  std::deque<std::pair<std::uint64_t, std::size_t>> held_;  // stamp, bytes
+};
+
+/** Answers space queries */
+class spacious_filesystem : public memory_filesystem {
+ public:
+  space_info space(const Path& path) const override {
+    (void)path;
+    return space_info{};
+  }
+};
+
+std::size_t bytes_of(const memory_budget& budget, const std::string& name) {
+  for (const auto& consumer : budget.stats().consumers) {
+    if (consumer.name == name) {
+      return consumer.bytes;
+    }
+  }
+  return 0;
+}
+}  // namespace
+
+TEST(memory_budget_test, refuses_more_than_the_limit_without_evicting) {
+  memory_budget budget(1000);
+  items cache(budget, "cache");
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(cache.keep(100));
+  }
+  EXPECT_FALSE(cache.keep(1001));
+  EXPECT_EQ(10u, cache.size());
+  EXPECT_EQ(0u, budget.stats().evictions);
+  EXPECT_EQ(1u, budget.stats().refusals);
+}
+
+TEST(memory_budget_test, evicts_the_oldest_items_in_batches) {
+  memory_budget budget(1000);
+  items first(budget, "first");
+  items second(budget, "second");
+  for (int i = 0; i < 5; ++i) {
+    first.keep(100);
+  }
+  for (int i = 0; i < 5; ++i) {
+    second.keep(100);
+  }
+  EXPECT_TRUE(second.keep(400));  // the four oldest, all from first
+  EXPECT_EQ(1u, first.size());
+  EXPECT_EQ(6u, second.size());
+  EXPECT_EQ(1u, first.evict_calls);
+  EXPECT_EQ(0u, second.evict_calls);
+  EXPECT_EQ(4u, budget.stats().evictions);
+  EXPECT_EQ(1000u, budget.stats().used);
+}
+
+TEST(memory_budget_test, path_caches_are_charged) {
+  memory_budget budget(1u << 20u);
+  auto filesystem = std::make_shared<spacious_filesystem>();
+  filesystem->create_directory("/d");
+  filesystem->put("/d/f", "data");
+
+  space_cache space(std::chrono::minutes(1));
+  space.budget(&budget);
+  space.space(*filesystem, "/");
+
+  dentry_cache dentries;
+  dentries.budget(&budget);
+  dentries.insert("/", 1);
+  dentries.insert("/d", 2);
+  dentries.insert("/d/f", 3);
+
+  overlay_filesystem overlay(std::make_shared<memory_filesystem>(),
+                             {filesystem});
+  overlay.budget(&budget);
+  overlay.file_size("/d/f");
+
+  EXPECT_GT(bytes_of(budget, "space"), 0u);
+  EXPECT_GT(bytes_of(budget, "dentries"), 0u);
+  EXPECT_GT(bytes_of(budget, "overlay"), 0u);
+  budget.limit(0);  // evicts everything that can go
+  EXPECT_EQ(0u, bytes_of(budget, "space"));
+  EXPECT_EQ(0u, bytes_of(budget, "overlay"));
+  EXPECT_FALSE(dentries.find(Path("/d/f")));
+  EXPECT_EQ(4u, overlay.file_size("/d/f"));  // still resolves, uncached
+  budget.limit(1u << 20u);
+  overlay.invalidate("/");
+  dentries.clear();
+  EXPECT_EQ(0u, budget.stats().used);
+}
@@ -0,0 +1,372 @@
+#include "memory_filesystem.h"
+#include <algorithm>
+#include <cstring>
+
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::file_status;
+using lockblox::drivex::file_type;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+namespace {
+
+const auto file_permissions = lockblox::drivex::permissions::owner_read |
+                              lockblox::drivex::permissions::owner_write;
+
+std::string key(const Path& path) {
+  auto result = path.generic_string();
+  while (result.size() > 1 && result.back() == '/') {
+    result.pop_back();
+  }
+  return result.empty() ? "/" : result;
+}
+
+/** Prefix shared by the keys of everything below a directory */
+std::string below(const std::string& directory) {
+  return directory == "/" ? directory : directory + "/";
+}
+
+bool is_below(const std::string& path, const std::string& prefix) {
+  return path.size() > prefix.size() &&
+         path.compare(0, prefix.size(), prefix) == 0;
+}
+}  // namespace
+
+memory_filesystem::memory_filesystem() {
+  auto root = std::make_shared<node>();
+  root->status = file_status(file_type::directory,
+                             lockblox::drivex::permissions::owner_all);
+  nodes_["/"] = root;
+}
+
+std::uintmax_t memory_filesystem::file_size(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return find(path).data.size();
+}
+
+file_status memory_filesystem::status(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return find(path).status;
+}
+
+file_status memory_filesystem::symlink_status(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return find_link(path).status;
+}
+
+Path memory_filesystem::read_symlink(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& node = find_link(path);
+  if (node.status.type() != file_type::symlink) {
+    throw error(error_code::invalid_argument, path.string());
+  }
+  return node.target;
+}
+
+void memory_filesystem::create_directory(const Path& path) {
+  auto node = std::make_shared<memory_filesystem::node>();
+  node->status = file_status(file_type::directory,
+                             lockblox::drivex::permissions::owner_all);
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(path, node);
+}
+
+void memory_filesystem::create_file(const Path& path) {
+  auto node = std::make_shared<memory_filesystem::node>();
+  node->status = file_status(file_type::regular, file_permissions);
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(path, node);
+}
+
+void memory_filesystem::create_symlink(const Path& target, const Path& link) {
+  auto node = std::make_shared<memory_filesystem::node>();
+  node->status = file_status(file_type::symlink,
+                             lockblox::drivex::permissions::owner_all |
+                                 lockblox::drivex::permissions::group_all |
+                                 lockblox::drivex::permissions::others_all);
+  node->target = target;
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert(link, node);
+}
+
+bool memory_filesystem::remove(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  count();
+  auto name = resolve(path, false);
+  auto it = nodes_.find(name);
+  if (it == nodes_.end()) {
+    return false;
+  }
+  auto child = nodes_.upper_bound(below(name));
+  if (child != nodes_.end() && is_below(child->first, below(name))) {
+    throw error(error_code::directory_not_empty, path.string());
+  }
+  nodes_.erase(it);
+  return true;
+}
+
+void memory_filesystem::rename(const Path& from, const Path& to) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  count();
+  auto source = resolve(from, false);
+  auto target = resolve(to, false);
+  find_link(source);
+  find(Path(target).parent_path());
+  auto moved = std::map<std::string, node_ptr>{};
+  for (auto it = nodes_.begin(); it != nodes_.end();) {
+    if (it->first == source || is_below(it->first, below(source))) {
+      moved[target + it->first.substr(source.size())] = it->second;
+    } else if (it->first != target && !is_below(it->first, below(target))) {
+      ++it;
+      continue;
+    }
+    it = nodes_.erase(it);
+  }
+  nodes_.insert(moved.begin(), moved.end());
+}
+
+void memory_filesystem::link(const Path& from, const Path& to) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto node = nodes_.find(resolve(from, false));
+  if (node == nodes_.end()) {
+    throw error(error_code::no_such_file_or_directory, from.string());
+  }
+  insert(to, node->second);
+}
+
+void memory_filesystem::permissions(
+    const Path& path, lockblox::drivex::permissions permissions) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path).status.permissions(permissions);
+}
+
+void memory_filesystem::truncate(const Path& path, uint64_t offset) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  find_regular(path).data.resize(offset);
+}
+
+void memory_filesystem::open(const Path& path, int flags) {
+  (void)flags;
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path);
+}
+
+int memory_filesystem::read(const Path& path, string_view& buffer,
+                            uint64_t offset) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& data = find_regular(path).data;
+  if (offset >= data.size()) {
+    return 0;
+  }
+  auto length = std::min<std::size_t>(buffer.size(), data.size() - offset);
+  std::memcpy(const_cast<char*>(buffer.data()), data.data() + offset, length);
+  return static_cast<int>(length);
+}
+
+int memory_filesystem::write(const Path& path, const string_view& buffer,
+                             uint64_t offset) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& data = find_regular(path).data;
+  auto length = std::min(buffer.size(), write_budget_);
+  if (length == 0 && !buffer.empty()) {
+    throw error(error_code::io_error, path.string());
+  }
+  write_budget_ -= write_budget_ == SIZE_MAX ? 0 : length;
+  if (data.size() < offset + length) {
+    data.resize(offset + length);
+  }
+  std::memcpy(&data[offset], buffer.data(), length);
+  return static_cast<int>(length);
+}
+
+void memory_filesystem::flush(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path);
+}
+
+void memory_filesystem::release(const Path& path, int flags) {
+  (void)path;
+  (void)flags;
+  count();
+}
+
+void memory_filesystem::fsync(const Path& path, int fd) {
+  (void)fd;
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path);
+}
+
+void memory_filesystem::setxattr(
+    const Path& path, const std::pair<std::string, string_view>& attribute,
+    int flags) {
+  (void)flags;
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path).xattrs[attribute.first] = attribute.second.to_string();
+}
+
+std::pair<std::string, string_view> memory_filesystem::getxattr(
+    const Path& path, const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& xattrs = find(path).xattrs;
+  auto it = xattrs.find(name);
+  if (it == xattrs.end()) {
+    throw error(error_code::no_message_available, name);
+  }
+  return {name, string_view(it->second)};
+}
+
+std::vector<std::string> memory_filesystem::listxattr(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto result = std::vector<std::string>{};
+  for (const auto& xattr : find(path).xattrs) {
+    result.push_back(xattr.first);
+  }
+  return result;
+}
+
+void memory_filesystem::removexattr(const Path& path,
+                                    const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (find(path).xattrs.erase(name) == 0) {
+    throw error(error_code::no_message_available, name);
+  }
+}
+
+std::vector<Path> memory_filesystem::read_directory(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto name = resolve(path, true);
+  if (find(name).status.type() != file_type::directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  auto result = std::vector<Path>{".", ".."};
+  auto prefix = below(name);
+  for (auto it = nodes_.upper_bound(prefix);
+       it != nodes_.end() && is_below(it->first, prefix); ++it) {
+    auto rest = it->first.substr(prefix.size());
+    if (rest.find('/') == std::string::npos) {
+      result.emplace_back(rest);
+    }
+  }
+  return result;
+}
+
+void memory_filesystem::fsyncdir(const Path& path, int datasync) {
+  (void)datasync;
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path);
+}
+
+std::time_t memory_filesystem::last_write_time(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return find(path).write_time;
+}
+
+void memory_filesystem::last_write_time(const Path& path,
+                                        std::time_t new_time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  find(path).write_time = new_time;
+}
+
+void memory_filesystem::put(const Path& path, const std::string& data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto name = resolve(path, true);
+  auto it = nodes_.find(name);
+  if (it == nodes_.end()) {
+    auto node = std::make_shared<memory_filesystem::node>();
+    node->status = file_status(file_type::regular, file_permissions);
+    insert(name, node);
+    it = nodes_.find(name);
+  }
+  it->second->data = data;
+}
+
+std::string memory_filesystem::contents(const Path& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return find_regular(path).data;
+}
+
+std::size_t memory_filesystem::calls() const noexcept { return calls_; }
+
+void memory_filesystem::fail_writes_after(std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  write_budget_ = bytes;
+}
+
+memory_filesystem::node& memory_filesystem::find(const Path& path) const {
+  count();
+  auto it = nodes_.find(resolve(path, true));
+  if (it == nodes_.end()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  return *it->second;
+}
+
+memory_filesystem::node& memory_filesystem::find_link(const Path& path) const {
+  count();
+  auto it = nodes_.find(resolve(path, false));
+  if (it == nodes_.end()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  return *it->second;
+}
+
+std::string memory_filesystem::resolve(const Path& path, bool follow) const {
+  auto output = Path("/");
+  auto links = 0;
+  auto parts = std::vector<Path>(path.begin(), path.end());
+  for (std::size_t i = 0; i < parts.size();) {
+    auto part = parts[i++];
+    if (part == "/" || part == "." || part.empty()) {
+      continue;
+    }
+    if (part == "..") {
+      output = parent_path(output);
+      continue;
+    }
+    output /= part;
+    auto it = nodes_.find(key(output));
+    auto last = i == parts.size();
+    if (it == nodes_.end() ||
+        it->second->status.type() != file_type::symlink || (last && !follow)) {
+      continue;
+    }
+    if (++links > 40) {
+      throw error(error_code::too_many_symbolic_link_levels, path.string());
+    }
+    auto target = it->second->target;
+    auto rest = std::vector<Path>(target.begin(), target.end());
+    parts.erase(parts.begin(), parts.begin() + i);
+    parts.insert(parts.begin(), rest.begin(), rest.end());
+    i = 0;
+    output = target.is_absolute() ? Path("/") : parent_path(output);
+  }
+  return key(output);
+}
+
+memory_filesystem::node& memory_filesystem::find_regular(
+    const Path& path) const {
+  auto& node = find(path);
+  if (node.status.type() == file_type::directory) {
+    throw error(error_code::is_a_directory, path.string());
+  }
+  return node;
+}
+
+void memory_filesystem::insert(const Path& path, node_ptr node) {
+  count();
+  auto name = resolve(path, false);
+  if (nodes_.count(name) != 0) {
+    throw error(error_code::file_exists, path.string());
+  }
+  auto parent = nodes_.find(key(Path(name).parent_path()));
+  if (parent == nodes_.end()) {
+    throw error(error_code::no_such_file_or_directory, path.string());
+  }
+  if (parent->second->status.type() != file_type::directory) {
+    throw error(error_code::not_a_directory, path.string());
+  }
+  nodes_[name] = std::move(node);
+}
+
+void memory_filesystem::count() const noexcept { ++calls_; }
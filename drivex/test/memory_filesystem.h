@@ -0,0 +1,125 @@
+#pragma once
+
+#include <drivex/filesystem.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+/** @brief An in-memory filesystem for unit tests
+ *
+ * Regular files, directories and symbolic links live in a path-keyed map.
+ * Hard links share one node.  Every call is serialized by one mutex, so it is
+ * safe to use from several threads, and each call bumps a counter that tests
+ * use to check how often a layer above went to the backend. */
+class memory_filesystem : public lockblox::drivex::filesystem {
+ public:
+  memory_filesystem();
+
+  std::uintmax_t file_size(const lockblox::drivex::Path& path) const override;
+
+  lockblox::drivex::file_status status(
+      const lockblox::drivex::Path& path) const override;
+
+  lockblox::drivex::file_status symlink_status(
+      const lockblox::drivex::Path& path) const override;
+
+  lockblox::drivex::Path read_symlink(
+      const lockblox::drivex::Path& path) const override;
+
+  void create_directory(const lockblox::drivex::Path& path) override;
+
+  void create_file(const lockblox::drivex::Path& path) override;
+
+  void create_symlink(const lockblox::drivex::Path& target,
+                      const lockblox::drivex::Path& link) override;
+
+  bool remove(const lockblox::drivex::Path& path) override;
+
+  void rename(const lockblox::drivex::Path& from,
+              const lockblox::drivex::Path& to) override;
+
+  void link(const lockblox::drivex::Path& from,
+            const lockblox::drivex::Path& to) override;
+
+  void permissions(const lockblox::drivex::Path& path,
+                   lockblox::drivex::permissions permissions) override;
+
+  void truncate(const lockblox::drivex::Path& path, uint64_t offset) override;
+
+  void open(const lockblox::drivex::Path& path, int flags) override;
+
+  int read(const lockblox::drivex::Path& path,
+           lockblox::drivex::string_view& buffer,
+           uint64_t offset) const override;
+
+  int write(const lockblox::drivex::Path& path,
+            const lockblox::drivex::string_view& buffer,
+            uint64_t offset) override;
+
+  void flush(const lockblox::drivex::Path& path) override;
+
+  void release(const lockblox::drivex::Path& path, int flags) override;
+
+  void fsync(const lockblox::drivex::Path& path, int fd) override;
+
+  void setxattr(
+      const lockblox::drivex::Path& path,
+      const std::pair<std::string, lockblox::drivex::string_view>& attribute,
+      int flags) override;
+
+  std::pair<std::string, lockblox::drivex::string_view> getxattr(
+      const lockblox::drivex::Path& path, const std::string& name) override;
+
+  std::vector<std::string> listxattr(
+      const lockblox::drivex::Path& path) override;
+
+  void removexattr(const lockblox::drivex::Path& path,
+                   const std::string& name) override;
+
+  std::vector<lockblox::drivex::Path> read_directory(
+      const lockblox::drivex::Path& path) const override;
+
+  void fsyncdir(const lockblox::drivex::Path& path, int datasync) override;
+
+  std::time_t last_write_time(const lockblox::drivex::Path& path) override;
+
+  void last_write_time(const lockblox::drivex::Path& path,
+                       std::time_t new_time) override;
+
+  /** Replace the contents of a file, creating it if needed */
+  void put(const lockblox::drivex::Path& path, const std::string& data);
+
+  /** Contents of a file */
+  std::string contents(const lockblox::drivex::Path& path) const;
+
+  /** Backend calls made so far */
+  std::size_t calls() const noexcept;
+
+  /** Make every later write fail after this many more bytes
+   *
+   * Simulates a full device or a crash part way through a write. */
+  void fail_writes_after(std::size_t bytes);
+
+ private:
+  struct node {
+    lockblox::drivex::file_status status;
+    std::string data;
+    lockblox::drivex::Path target;
+    lockblox::drivex::xattr_map xattrs;
+    std::time_t write_time = 0;
+  };
+  using node_ptr = std::shared_ptr<node>;
+
+  node& find(const lockblox::drivex::Path& path) const;
+  node& find_link(const lockblox::drivex::Path& path) const;
+  node& find_regular(const lockblox::drivex::Path& path) const;
+  std::string resolve(const lockblox::drivex::Path& path, bool follow) const;
+  void insert(const lockblox::drivex::Path& path, node_ptr node);
+  void count() const noexcept;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, node_ptr> nodes_;
+  std::size_t write_budget_ = SIZE_MAX;
+  mutable std::atomic<std::size_t> calls_{0};
+};
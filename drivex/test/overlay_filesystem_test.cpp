@@ -0,0 +1,65 @@
+#include "memory_filesystem.h"
+#include <drivex/overlay_filesystem.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::overlay_filesystem;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+
+std::string read_all(const overlay_filesystem& overlay, const Path& path) {
+  auto result = std::string(overlay.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(overlay.read(path, buffer, 0)));
+  return result;
+}
+
+class overlay_filesystem_test : public ::testing::Test {
+ protected:
+  overlay_filesystem_test()
+      : upper(std::make_shared<memory_filesystem>()),
+        lower(std::make_shared<memory_filesystem>()),
+        overlay(upper, {lower}) {
+    lower->create_directory("/d");
+    lower->put("/d/f", std::string(300000, 'a'));
+  }
+
+  std::shared_ptr<memory_filesystem> upper;
+  std::shared_ptr<memory_filesystem> lower;
+  overlay_filesystem overlay;
+};
+}  // namespace
+
+TEST_F(overlay_filesystem_test, concurrent_writers_copy_up_once) {
+  std::vector<std::thread> writers;
+  for (char id = 0; id < 8; ++id) {
+    writers.emplace_back([this, id] {
+      auto byte = std::string(1, static_cast<char>('0' + id));
+      overlay.write("/d/f", string_view(byte), id * 1000);
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  auto expected = std::string(300000, 'a');
+  for (char id = 0; id < 8; ++id) {
+    expected[id * 1000] = static_cast<char>('0' + id);
+  }
+  EXPECT_EQ(expected, upper->contents("/d/f"));  // no write was copied over
+  EXPECT_EQ(std::string(300000, 'a'), lower->contents("/d/f"));
+  EXPECT_EQ((std::vector<Path>{".", "..", "f"}), upper->read_directory("/d"));
+}
+
+TEST_F(overlay_filesystem_test, failed_copy_leaves_no_partial_file) {
+  upper->fail_writes_after(100000);
+  EXPECT_THROW(overlay.write("/d/f", string_view("b"), 0), error);
+  upper->fail_writes_after(SIZE_MAX);
+  EXPECT_EQ((std::vector<Path>{".", ".."}), upper->read_directory("/d"));
+  EXPECT_EQ(std::string(300000, 'a'), read_all(overlay, "/d/f"));
+  overlay.write("/d/f", string_view("b"), 0);
+  EXPECT_EQ("b" + std::string(299999, 'a'), read_all(overlay, "/d/f"));
+  EXPECT_EQ((std::vector<Path>{".", "..", "f"}), overlay.read_directory("/d"));
+}
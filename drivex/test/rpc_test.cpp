@@ -0,0 +1,168 @@
+#include "memory_filesystem.h"
+#include <drivex/lock_manager.h>
+#include <drivex/rpc_filesystem.h>
+#include <drivex/rpc_server.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::error_code;
+using lockblox::drivex::file_lock;
+using lockblox::drivex::from_time_t;
+using lockblox::drivex::lock_manager;
+using lockblox::drivex::lock_type;
+using lockblox::drivex::rpc_filesystem;
+using lockblox::drivex::rpc_server;
+using lockblox::drivex::string_view;
+using lockblox::drivex::thread_pool;
+
+error_code code_of(const std::function<void()>& call) {
+  try {
+    call();
+  } catch (const error& e) {
+    return static_cast<error_code>(e.code().value());
+  }
+  ADD_FAILURE() << "no error";
+  return error_code::io_error;
+}
+
+/** A memory filesystem whose locks drivex manages */
+class locking_filesystem : public memory_filesystem {
+ public:
+  lock_manager* locks() override { return &manager_; }
+
+ private:
+  lock_manager manager_;
+};
+
+file_lock whole_file(lock_type type) {
+  file_lock lock;
+  lock.type = type;
+  return lock;
+}
+
+/** A server thread and a client joined by a socket pair */
+class rpc_test : public ::testing::Test {
+ protected:
+  explicit rpc_test(std::size_t max_requests = 256)
+      : backend(std::make_shared<locking_filesystem>()),
+        pool(1),
+        server(backend, pool, max_requests) {
+    int fds[2];
+    EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    server_fd = fds[0];
+    serving = std::thread([this] { server.serve(server_fd); });
+    client = std::make_shared<rpc_filesystem>(fds[1]);
+  }
+
+  ~rpc_test() override {
+    client.reset();  // the server sees the connection close
+    if (serving.joinable()) {
+      serving.join();
+    }
+    ::close(server_fd);
+  }
+
+  std::shared_ptr<locking_filesystem> backend;
+  thread_pool pool;
+  rpc_server server;
+  int server_fd;
+  std::thread serving;
+  std::shared_ptr<rpc_filesystem> client;
+};
+
+class rpc_bounded_test : public rpc_test {
+ protected:
+  rpc_bounded_test() : rpc_test(1) {}
+};
+}  // namespace
+
+TEST_F(rpc_test, forwards_calls_and_errors) {
+  client->create_file("/f");
+  EXPECT_EQ(5, client->write("/f", string_view("hello"), 0));
+  EXPECT_EQ("hello", backend->contents("/f"));
+  auto buffer = std::string(5, '\0');
+  auto view = string_view(&buffer[0], buffer.size());
+  EXPECT_EQ(3, client->read("/f", view, 2));
+  EXPECT_EQ("llo", buffer.substr(0, 3));
+  EXPECT_EQ(error_code::no_such_file_or_directory,
+            code_of([&] { client->file_size("/missing"); }));
+}
+
+TEST_F(rpc_test, forwards_times) {
+  backend->put("/f", "");
+  backend->last_write_time("/f", 12345);
+  auto times = client->times("/f");
+  EXPECT_EQ(from_time_t(12345), times.last_write_time);
+  EXPECT_EQ(from_time_t(0), times.last_read_time);
+}
+
+TEST_F(rpc_bounded_test, concurrent_calls_share_a_bounded_connection) {
+  backend->put("/f", std::string(4096, 'x'));
+  std::vector<std::thread> readers;
+  for (int reader = 0; reader < 8; ++reader) {
+    readers.emplace_back([this] {
+      for (int call = 0; call < 50; ++call) {
+        EXPECT_EQ(4096u, client->file_size("/f"));
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST_F(rpc_test, waiting_locks_do_not_hold_the_pool) {
+  backend->put("/f", "");
+  auto held = whole_file(lock_type::write);
+  client->lock("/f", F_SETLK, held, 1);
+  std::vector<std::thread> waiters;
+  for (std::uint64_t owner = 2; owner < 5; ++owner) {
+    waiters.emplace_back([this, owner] {
+      auto lock = whole_file(lock_type::read);
+      client->lock("/f", F_SETLKW, lock, owner);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0u, client->file_size("/f"));  // the pool still serves
+  auto unlock = whole_file(lock_type::unlock);
+  client->lock("/f", F_SETLK, unlock, 1);
+  for (auto& waiter : waiters) {
+    waiter.join();
+  }
+  auto probe = whole_file(lock_type::write);
+  client->lock("/f", F_GETLK, probe, 1);
+  EXPECT_EQ(lock_type::read, probe.type);
+}
+
+TEST_F(rpc_test, disconnecting_ends_lock_waits) {
+  backend->put("/f", "");
+  auto held = whole_file(lock_type::write);
+  backend->lock("/f", F_SETLK, held, 1);
+  std::thread waiter([this] {
+    auto lock = whole_file(lock_type::write);
+    EXPECT_THROW(client->lock("/f", F_SETLKW, lock, 2), error);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ::shutdown(server_fd, SHUT_RDWR);  // as if the client had gone away
+  waiter.join();
+  serving.join();  // the wait in the backend did not keep serve waiting
+}
+
+TEST_F(rpc_test, disconnecting_releases_held_locks) {
+  backend->put("/f", "");
+  backend->put("/g", "");
+  auto held = whole_file(lock_type::write);
+  client->lock("/f", F_SETLK, held, 1);
+  client->flock("/g", LOCK_EX, 1);
+  ::shutdown(server_fd, SHUT_RDWR);  // as if the client had crashed
+  serving.join();
+  auto lock = whole_file(lock_type::write);
+  backend->lock("/f", F_SETLK, lock, 2);
+  backend->flock("/g", LOCK_EX | LOCK_NB, 2);
+}
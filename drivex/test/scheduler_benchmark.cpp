@@ -0,0 +1,97 @@
+#include <drivex/scheduler.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+using lockblox::drivex::request_class;
+using lockblox::drivex::scheduler;
+using lockblox::drivex::thread_pool;
+
+const std::size_t workers = 4;
+const int bulk_reads = 2000;
+const std::size_t lookups = 100;
+const auto read_time = std::chrono::microseconds(250);
+const auto lookup_interval = std::chrono::microseconds(1000);
+
+/** Occupy the calling thread, as a read copying data would */
+void spin(clock_type::duration length) {
+  auto until = clock_type::now() + length;
+  while (clock_type::now() < until) {
+  }
+}
+
+/** Milliseconds from submission to completion of lookups made while a
+ * backlog of bulk reads saturates the workers
+ *
+ * @param submit queues a task as a read (true) or a lookup (false) */
+template <typename Submit>
+std::vector<double> measure(Submit submit) {
+  std::mutex mutex;
+  std::condition_variable done;
+  std::vector<double> latencies;
+  for (int i = 0; i < bulk_reads; ++i) {
+    submit(true, [] { spin(read_time); });
+  }
+  for (std::size_t i = 0; i < lookups; ++i) {
+    auto start = clock_type::now();
+    submit(false, [&mutex, &done, &latencies, start] {
+      std::chrono::duration<double, std::milli> latency =
+          clock_type::now() - start;
+      std::lock_guard<std::mutex> lock(mutex);
+      latencies.push_back(latency.count());
+      done.notify_all();
+    });
+    std::this_thread::sleep_for(lookup_interval);
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&latencies] { return latencies.size() == lookups; });
+  return latencies;
+}
+
+void report(const char* name, std::vector<double> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&latencies](double quantile) {
+    return latencies[static_cast<std::size_t>(quantile *
+                                              (latencies.size() - 1))];
+  };
+  std::cout << name << ": lookup p50 " << at(0.5) << " ms, p99 " << at(0.99)
+            << " ms\n";
+}
+
+}  // namespace
+
+int main() {
+  std::cout << workers << " workers, " << bulk_reads << " queued reads of "
+            << read_time.count() << " us, a lookup every "
+            << lookup_interval.count() << " us\n";
+  {
+    std::vector<double> latencies;
+    {
+      thread_pool pool(workers);
+      latencies = measure([&pool](bool, thread_pool::task t) {
+        pool.post(std::move(t));
+      });
+    }
+    report("thread_pool", latencies);
+  }
+  {
+    std::vector<double> latencies;
+    {
+      thread_pool pool(workers);
+      scheduler requests(pool);
+      latencies = measure([&requests](bool read, thread_pool::task t) {
+        requests.submit(read ? request_class::read : request_class::metadata,
+                        read ? 1 : 2, read ? 4 : 1, std::move(t));
+      });
+    }
+    report("scheduler", latencies);
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include <drivex/scheduler.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::request_class;
+using lockblox::drivex::scheduler;
+using lockblox::drivex::scheduler_settings;
+using lockblox::drivex::thread_pool;
+
+/** A scheduler running one request at a time, held shut until opened
+ *
+ * The requests queued meanwhile then run in the order the scheduler picks,
+ * which order() records by label. */
+class scheduler_test : public ::testing::Test {
+ protected:
+  scheduler_test() : scheduler_test(scheduler_settings()) {}
+
+  explicit scheduler_test(scheduler_settings settings)
+      : pool(1), shut(opened.get_future().share()) {
+    settings.max_running = 1;
+    requests.reset(new scheduler(pool, settings));
+    auto gate = shut;
+    requests->submit(request_class::sync, 0, 1, [gate] { gate.wait(); });
+  }
+
+  /** Queue a request that records its label when it runs */
+  void submit(request_class kind, std::uint64_t caller, std::uint32_t cost,
+              char label) {
+    requests->submit(kind, caller, cost, [this, label] { ran += label; });
+  }
+
+  /** Requests of caller 1 that each queue the next once they run, as a
+   * process making one large call at a time does */
+  void one_at_a_time(int left) {
+    one_at_a_time(*requests, left);
+  }
+
+  void one_at_a_time(scheduler& queue, int left) {
+    // by reference, as order() releases requests before the last ones run
+    queue.submit(request_class::read, 1, 10, [this, &queue, left] {
+      ran += 'A';
+      if (left > 1) {
+        one_at_a_time(queue, left - 1);
+      }
+    });
+  }
+
+  /** Open the gate and wait for every request */
+  std::string order() {
+    opened.set_value();
+    requests.reset();
+    return ran;
+  }
+
+  thread_pool pool;
+  std::promise<void> opened;
+  std::shared_future<void> shut;
+  std::unique_ptr<scheduler> requests;
+  std::string ran;  // only touched by the one running request
+};
+
+class scheduler_forgetful_test : public scheduler_test {
+ protected:
+  scheduler_forgetful_test() : scheduler_test(forgetful()) {}
+
+  static scheduler_settings forgetful() {
+    scheduler_settings settings;
+    settings.debtors = 0;
+    return settings;
+  }
+};
+
+}  // namespace
+
+TEST_F(scheduler_test, classes_share_workers_by_weight) {
+  for (int i = 0; i < 100; ++i) {
+    submit(request_class::read, 1, 1, 'r');
+  }
+  for (int i = 0; i < 100; ++i) {
+    submit(request_class::metadata, 2, 1, 'm');
+  }
+  auto ran = order();
+  ASSERT_EQ(200u, ran.size());
+  // once both have work, reads get 2 turns to every 8 of metadata
+  auto first = ran.substr(ran.find('m'), 50);
+  auto reads = std::count(first.begin(), first.end(), 'r');
+  EXPECT_GE(reads, 5);
+  EXPECT_LE(reads, 15);
+}
+
+TEST_F(scheduler_test, callers_take_turns_within_a_class) {
+  for (int i = 0; i < 10; ++i) {
+    submit(request_class::read, 1, 1, 'a');
+  }
+  submit(request_class::read, 2, 1, 'b');
+  submit(request_class::read, 2, 1, 'b');
+  auto ran = order();
+  EXPECT_LT(ran.rfind('b'), 5u);  // not behind all of caller 1's
+}
+
+TEST_F(scheduler_test, debts_outlive_a_drained_queue) {
+  one_at_a_time(5);
+  for (int i = 0; i < 40; ++i) {
+    submit(request_class::read, 2, 1, 'b');
+  }
+  auto ran = order();
+  ASSERT_EQ(45u, ran.size());
+  auto first = ran.substr(0, 20);
+  // each request of cost 10 is repaid by 9 turns before the next
+  EXPECT_LE(std::count(first.begin(), first.end(), 'A'), 3);
+}
+
+TEST_F(scheduler_forgetful_test, forgotten_debts_start_afresh) {
+  one_at_a_time(5);
+  for (int i = 0; i < 40; ++i) {
+    submit(request_class::read, 2, 1, 'b');
+  }
+  auto ran = order();
+  auto first = ran.substr(0, 20);
+  EXPECT_EQ(5, std::count(first.begin(), first.end(), 'A'));
+}
+
+TEST(scheduler_caps_test, a_class_at_its_cap_waits) {
+  scheduler_settings settings;
+  settings.caps[static_cast<std::size_t>(request_class::write)] = 1;
+  thread_pool pool(4);
+  std::atomic<int> writing{0};
+  std::atomic<int> most{0};
+  std::atomic<int> reads{0};
+  {
+    scheduler capped(pool, settings);
+    for (std::uint64_t caller = 0; caller < 20; ++caller) {
+      capped.submit(request_class::write, caller, 1, [&] {
+        auto now = ++writing;
+        auto seen = most.load();
+        while (now > seen && !most.compare_exchange_weak(seen, now)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        --writing;
+      });
+    }
+    for (int i = 0; i < 20; ++i) {
+      capped.submit(request_class::read, 1, 1, [&] { ++reads; });
+    }
+  }
+  EXPECT_EQ(1, most.load());
+  EXPECT_EQ(20, reads.load());
+}
@@ -0,0 +1,178 @@
+#include <drivex/error.h>
+#include <drivex/session_manager.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <thread>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::session_manager;
+using lockblox::drivex::thread_pool;
+
+/** Endpoints over socket pairs whose requests wait at a gate while being
+ * processed, serving one message per request */
+class session_manager_test : public ::testing::Test {
+ protected:
+  explicit session_manager_test(std::size_t max_requests = 64)
+      : pool(4), manager(pool, max_requests) {}
+
+  ~session_manager_test() override {
+    open_gate();
+    manager.stop();
+    if (serving.joinable()) {
+      serving.join();
+    }
+    for (auto fd : fds) {
+      ::close(fd);
+    }
+  }
+
+  struct counts {
+    std::size_t active = 0;
+    std::size_t most = 0;
+    std::size_t done = 0;
+  };
+
+  /** Add an endpoint, returning the socket its requests are sent on */
+  int add(std::size_t max_requests, std::uint64_t* id = nullptr) {
+    int pair[2];
+    EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair));
+    fds.push_back(pair[0]);
+    fds.push_back(pair[1]);
+    auto& counted = endpoints[pair[0]];
+    session_manager::endpoint source;
+    source.fd = pair[0];
+    source.buffer_size = 16;
+    source.receive = [pair](char* buffer, std::size_t size) {
+      auto received = ::read(pair[0], buffer, size);
+      return received < 0 ? -errno : static_cast<int>(received);
+    };
+    source.process = [this, &counted](const char*, std::size_t) {
+      std::unique_lock<std::mutex> lock(mutex);
+      ++active;
+      most = std::max(most, active);
+      counted.most = std::max(counted.most, ++counted.active);
+      changed.notify_all();
+      changed.wait(lock, [this] { return open; });
+      --active;
+      --counted.active;
+      ++counted.done;
+      changed.notify_all();
+    };
+    auto added = manager.add(source, max_requests);
+    if (id != nullptr) {
+      *id = added;
+    }
+    return pair[1];
+  }
+
+  void send(int fd, int requests) {
+    for (int request = 0; request < requests; ++request) {
+      EXPECT_EQ(1, ::write(fd, "r", 1));
+    }
+  }
+
+  void start() {
+    serving = std::thread([this] { manager.run(); });
+  }
+
+  /** Wait until pred holds, under the mutex */
+  template <typename Predicate>
+  bool wait(Predicate pred) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return changed.wait_for(lock, std::chrono::seconds(10), pred);
+  }
+
+  void open_gate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    open = true;
+    changed.notify_all();
+  }
+
+  thread_pool pool;
+  session_manager manager;
+  std::thread serving;
+  std::vector<int> fds;
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool open = false;
+  std::size_t active = 0;
+  std::size_t most = 0;
+  std::map<int, counts> endpoints;
+};
+
+class session_manager_limited_test : public session_manager_test {
+ protected:
+  session_manager_limited_test() : session_manager_test(3) {}
+};
+}  // namespace
+
+TEST_F(session_manager_test, serves_endpoints_until_removed) {
+  std::uint64_t id;
+  auto fd = add(8, &id);
+  auto& counted = endpoints.begin()->second;
+  start();
+  send(fd, 3);
+  open_gate();
+  EXPECT_TRUE(wait([&] { return counted.done == 3; }));
+  manager.remove(id);  // the last one, so run returns
+  serving.join();
+  EXPECT_EQ(0u, manager.active());
+}
+
+TEST_F(session_manager_test, an_endpoint_that_ends_is_dropped) {
+  auto fd = add(8);
+  start();
+  ::shutdown(fd, SHUT_RDWR);  // its receive now sees the end
+  serving.join();
+}
+
+TEST_F(session_manager_test, limits_requests_per_endpoint) {
+  auto fd = add(2);
+  auto& counted = endpoints.begin()->second;
+  start();
+  send(fd, 5);
+  EXPECT_TRUE(wait([&] { return counted.active == 2; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(2u, counted.most);
+  }
+  open_gate();
+  EXPECT_TRUE(wait([&] { return counted.done == 5; }));
+  EXPECT_EQ(2u, counted.most);
+}
+
+TEST_F(session_manager_limited_test, limits_requests_across_endpoints) {
+  auto first = add(8);
+  auto second = add(8);
+  start();
+  send(first, 4);
+  send(second, 4);
+  EXPECT_TRUE(wait([&] { return active == 3; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(3u, manager.active());
+  open_gate();
+  EXPECT_TRUE(wait([&] {
+    return endpoints[fds[0]].done + endpoints[fds[2]].done == 8;
+  }));
+  EXPECT_EQ(3u, most);
+}
+
+TEST_F(session_manager_test, a_descriptor_that_cannot_be_added_is_untouched) {
+  auto file = std::tmpfile();  // regular files cannot be waited on
+  ASSERT_NE(nullptr, file);
+  session_manager::endpoint source;
+  source.fd = ::fileno(file);
+  source.buffer_size = 16;
+  EXPECT_THROW(manager.add(source, 1), error);
+  EXPECT_EQ(0, ::fcntl(source.fd, F_GETFL) & O_NONBLOCK);
+  std::fclose(file);
+}
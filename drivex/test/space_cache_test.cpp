@@ -0,0 +1,57 @@
+#include "memory_filesystem.h"
+#include <drivex/space_cache.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::Path;
+using lockblox::drivex::space_cache;
+using lockblox::drivex::space_info;
+
+/** Answers space queries with a growing number */
+class counting_filesystem : public memory_filesystem {
+ public:
+  space_info space(const Path& path) const override {
+    (void)path;
+    auto result = space_info{};
+    result.available = ++queries;
+    return result;
+  }
+
+  mutable std::uintmax_t queries = 0;
+};
+
+const auto minute = std::chrono::minutes(1);
+}  // namespace
+
+TEST(space_cache_test, forwards_every_call_without_a_ttl) {
+  counting_filesystem filesystem;
+  space_cache cache;
+  cache.space(filesystem, "/");
+  cache.space(filesystem, "/");
+  EXPECT_EQ(2u, filesystem.queries);
+}
+
+TEST(space_cache_test, reuses_results_until_cleared) {
+  counting_filesystem filesystem;
+  space_cache cache(minute);
+  EXPECT_EQ(1u, cache.space(filesystem, "/a").available);
+  EXPECT_EQ(1u, cache.space(filesystem, "/a").available);
+  EXPECT_EQ(2u, cache.space(filesystem, "/b").available);
+  cache.clear();
+  EXPECT_EQ(3u, cache.space(filesystem, "/a").available);
+}
+
+TEST(space_cache_test, keeps_at_most_capacity_paths) {
+  counting_filesystem filesystem;
+  space_cache cache(minute, 2);
+  cache.space(filesystem, "/a");
+  cache.space(filesystem, "/b");
+  cache.space(filesystem, "/c");  // replaces /a, the oldest
+  EXPECT_EQ(3u, filesystem.queries);
+  cache.space(filesystem, "/b");
+  cache.space(filesystem, "/c");
+  EXPECT_EQ(3u, filesystem.queries);
+  cache.space(filesystem, "/a");
+  EXPECT_EQ(4u, filesystem.queries);
+}
@@ -0,0 +1,185 @@
+#include <drivex/tar_filesystem.h>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::file_type;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+using lockblox::drivex::tar_filesystem;
+
+/** Writes ustar archives member by member */
+class tar_writer {
+ public:
+  void add(const std::string& name, char type, const std::string& data = "",
+           const std::string& link = "") {
+    char header[512] = {};
+    std::snprintf(header, 100, "%s", name.c_str());
+    std::snprintf(header + 100, 8, "%07o", 0644);
+    std::snprintf(header + 124, 12, "%011o",
+                  static_cast<unsigned int>(data.size()));
+    std::snprintf(header + 136, 12, "%011o", 1000000000u);
+    header[156] = type;
+    std::snprintf(header + 157, 100, "%s", link.c_str());
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+    std::memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (auto byte : header) {
+      sum += static_cast<unsigned char>(byte);
+    }
+    std::snprintf(header + 148, 8, "%06o", sum);
+    archive_.append(header, sizeof header);
+    archive_ += data;
+    archive_.append((512 - data.size() % 512) % 512, '\0');
+  }
+
+  /** Add a pax extended header applying to the next member */
+  void pax(const std::string& key, const std::string& value) {
+    auto record = " " + key + "=" + value + "\n";
+    auto length = record.size();
+    while (std::to_string(length).size() + record.size() != length) {
+      length = std::to_string(length).size() + record.size();
+    }
+    add("PaxHeader", 'x', std::to_string(length) + record);
+  }
+
+  void save(const boost::filesystem::path& path) const {
+    std::ofstream(path.string(), std::ios::binary | std::ios::trunc)
+        << archive_ << std::string(1024, '\0');
+  }
+
+ private:
+  std::string archive_;
+};
+
+std::string read_all(const tar_filesystem& tar, const Path& path) {
+  auto result = std::string(tar.file_size(path), '\0');
+  auto buffer = string_view(&result[0], result.size());
+  result.resize(static_cast<std::size_t>(tar.read(path, buffer, 0)));
+  return result;
+}
+
+class tar_filesystem_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    archive = boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("drivex-%%%%-%%%%.tar");
+  }
+
+  void TearDown() override {
+    boost::filesystem::remove(archive);
+    boost::filesystem::remove(tar_filesystem::index_path(archive.string()));
+  }
+
+  boost::filesystem::path archive;
+  tar_writer writer;
+};
+}  // namespace
+
+TEST_F(tar_filesystem_test, serves_members) {
+  writer.add("d/", '5');
+  writer.add("d/f", '0', "contents");
+  writer.add("d/l", '2', "", "f");
+  writer.pax("path", "d/" + std::string(150, 'n'));
+  writer.add("short", '0', "long name");
+  writer.save(archive);
+  tar_filesystem tar(archive.string());
+  EXPECT_EQ("contents", read_all(tar, "/d/f"));
+  EXPECT_EQ(Path("f"), tar.read_symlink("/d/l"));
+  EXPECT_EQ(file_type::regular, tar.status("/d/l").type());
+  EXPECT_EQ(file_type::directory, tar.status("/d").type());
+  EXPECT_EQ("long name", read_all(tar, "/d/" + std::string(150, 'n')));
+  EXPECT_THROW(tar.status("/short"), error);
+}
+
+TEST_F(tar_filesystem_test, hard_links_may_precede_their_target) {
+  writer.add("early", '1', "", "late");
+  writer.add("chained", '1', "", "early");
+  writer.add("late", '0', "shared");
+  writer.save(archive);
+  tar_filesystem tar(archive.string());
+  EXPECT_EQ("shared", read_all(tar, "/early"));
+  EXPECT_EQ("shared", read_all(tar, "/chained"));
+}
+
+TEST_F(tar_filesystem_test, refuses_hard_links_to_missing_members) {
+  writer.add("link", '1', "", "nowhere");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+}
+
+TEST_F(tar_filesystem_test, refuses_sparse_members) {
+  writer.add("old", 'S', "data");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+  writer = tar_writer{};
+  writer.pax("GNU.sparse.size", "4096");
+  writer.add("new", '0', "data");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+}
+
+TEST_F(tar_filesystem_test, reuses_and_repairs_the_index) {
+  writer.add("f", '0', "contents");
+  writer.save(archive);
+  { tar_filesystem tar(archive.string()); }
+  auto index = tar_filesystem::index_path(archive.string()).string();
+  ASSERT_TRUE(boost::filesystem::exists(index));
+  { tar_filesystem tar(archive.string()); }
+
+  // Keep the header, which still matches the archive, and lose the rest
+  boost::filesystem::resize_file(index, 80);
+  tar_filesystem tar(archive.string());
+  EXPECT_EQ("contents", read_all(tar, "/f"));
+  EXPECT_GT(boost::filesystem::file_size(index), 80u);
+}
+
+TEST_F(tar_filesystem_test, normalizes_member_names) {
+  writer.add("./a/", '5');
+  writer.add("a//./f", '0', "contents");
+  writer.add("/a/./l", '1', "", "./a//f");
+  writer.save(archive);
+  tar_filesystem tar(archive.string());
+  EXPECT_EQ("contents", read_all(tar, "/a/f"));
+  EXPECT_EQ("contents", read_all(tar, "/a/l"));
+}
+
+TEST_F(tar_filesystem_test, refuses_members_that_leave_the_archive) {
+  writer.add("../escape", '0', "data");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+  writer = tar_writer{};
+  writer.add("a/../../escape", '0', "data");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+  writer = tar_writer{};
+  writer.add("link", '1', "", "../target");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+}
+
+TEST_F(tar_filesystem_test, refuses_oversized_extended_headers) {
+  writer.add("././@LongLink", 'L', std::string(2u << 20u, 'n'));
+  writer.add("short", '0', "data");
+  writer.save(archive);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+}
+
+TEST_F(tar_filesystem_test, refuses_members_past_the_end_of_the_archive) {
+  writer.add("f", '0', std::string(4096, 'x'));
+  writer.save(archive);
+  boost::filesystem::resize_file(archive, 2048);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+  writer = tar_writer{};
+  writer.pax("path", std::string(4096, 'n'));
+  writer.add("short", '0', "data");
+  writer.save(archive);
+  boost::filesystem::resize_file(archive, 2048);
+  EXPECT_THROW(tar_filesystem tar(archive.string()), error);
+}
@@ -0,0 +1,131 @@
+#include "memory_filesystem.h"
+#include <drivex/xattr_cache.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+using lockblox::drivex::error;
+using lockblox::drivex::memory_budget;
+using lockblox::drivex::Path;
+using lockblox::drivex::string_view;
+using lockblox::drivex::xattr_cache;
+
+/** Counts the attribute calls that reach the backend */
+class counting_filesystem : public memory_filesystem {
+ public:
+  using memory_filesystem::getxattr;
+  using memory_filesystem::listxattr;
+
+  std::size_t getxattr(const Path& path, const std::string& name,
+                       string_view& buffer) override {
+    ++gets;
+    return filesystem::getxattr(path, name, buffer);
+  }
+
+  std::vector<std::string> listxattr(const Path& path) override {
+    ++lists;
+    return memory_filesystem::listxattr(path);
+  }
+
+  int gets = 0;
+  int lists = 0;
+};
+
+std::string get(xattr_cache& cache, counting_filesystem& filesystem,
+                const Path& path, const std::string& name) {
+  auto value = std::string(64, '\0');
+  auto buffer = string_view(&value[0], value.size());
+  value.resize(cache.getxattr(filesystem, path, name, buffer));
+  return value;
+}
+
+std::string list(xattr_cache& cache, counting_filesystem& filesystem,
+                 const Path& path) {
+  auto names = std::string(64, '\0');
+  auto buffer = string_view(&names[0], names.size());
+  names.resize(cache.listxattr(filesystem, path, buffer));
+  return names;
+}
+
+class xattr_cache_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    filesystem.put("/f", "");
+    filesystem.setxattr("/f", {"user.a", "1"}, 0);
+    filesystem.setxattr("/f", {"user.b", "22"}, 0);
+    filesystem.put("/g", "");
+  }
+
+  counting_filesystem filesystem;
+  xattr_cache cache{16};
+};
+}  // namespace
+
+TEST_F(xattr_cache_test, getxattr_miss_fetches_one_name) {
+  EXPECT_EQ("1", get(cache, filesystem, "/f", "user.a"));
+  EXPECT_EQ(1, filesystem.gets);
+  EXPECT_EQ(0, filesystem.lists);
+  EXPECT_EQ("1", get(cache, filesystem, "/f", "user.a"));
+  EXPECT_EQ(1, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, absent_names_are_remembered) {
+  EXPECT_THROW(get(cache, filesystem, "/f", "security.selinux"), error);
+  EXPECT_THROW(get(cache, filesystem, "/f", "security.selinux"), error);
+  EXPECT_EQ(1, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, listxattr_fills_every_name) {
+  EXPECT_EQ(std::string("user.a\0user.b\0", 14),
+            list(cache, filesystem, "/f"));
+  auto gets = filesystem.gets;
+  EXPECT_EQ("22", get(cache, filesystem, "/f", "user.b"));
+  EXPECT_THROW(get(cache, filesystem, "/f", "user.c"), error);
+  EXPECT_EQ(std::string("user.a\0user.b\0", 14),
+            list(cache, filesystem, "/f"));
+  EXPECT_EQ(gets, filesystem.gets);
+  EXPECT_EQ(1, filesystem.lists);
+}
+
+TEST_F(xattr_cache_test, size_probe_and_short_buffer) {
+  auto probe = string_view();
+  EXPECT_EQ(2u, cache.getxattr(filesystem, "/f", "user.b", probe));
+  char small[1];
+  auto buffer = string_view(small, sizeof small);
+  EXPECT_THROW(cache.getxattr(filesystem, "/f", "user.b", buffer), error);
+  EXPECT_EQ(1, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, invalidate_forgets_a_path) {
+  get(cache, filesystem, "/f", "user.a");
+  filesystem.setxattr("/f", {"user.a", "changed"}, 0);
+  cache.invalidate("/f");
+  EXPECT_EQ("changed", get(cache, filesystem, "/f", "user.a"));
+  EXPECT_EQ(2, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, zero_capacity_forwards_every_call) {
+  cache.capacity(0);
+  get(cache, filesystem, "/f", "user.a");
+  get(cache, filesystem, "/f", "user.a");
+  EXPECT_EQ(2, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, least_recently_used_path_is_evicted) {
+  cache.capacity(1);
+  get(cache, filesystem, "/f", "user.a");
+  EXPECT_THROW(get(cache, filesystem, "/g", "user.a"), error);
+  get(cache, filesystem, "/f", "user.a");
+  EXPECT_EQ(3, filesystem.gets);
+}
+
+TEST_F(xattr_cache_test, bytes_are_charged_to_a_budget) {
+  memory_budget budget(1u << 20u);
+  cache.budget(&budget);
+  list(cache, filesystem, "/f");
+  EXPECT_THROW(get(cache, filesystem, "/g", "user.a"), error);
+  EXPECT_GT(budget.stats().used, 0u);
+  cache.clear();
+  EXPECT_EQ(0u, budget.stats().used);
+  cache.budget(nullptr);
+}
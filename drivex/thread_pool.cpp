@@ -0,0 +1,205 @@
+#include <drivex/arena.h>
+#include <drivex/thread_pool.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/** Pool and queue owned by the calling thread, if it is a worker */
+thread_local const void* current_pool = nullptr;
+thread_local std::size_t current_index = 0;
+
+/** Bind the calling thread to the index-th CPU the process may run on, best
+ * effort */
+void pin(std::size_t index) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+  auto count = static_cast<std::size_t>(CPU_COUNT(&allowed));
+  if (count == 0) {
+    return;
+  }
+  index %= count;
+  for (auto cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+      cpu_set_t one;
+      CPU_ZERO(&one);
+      CPU_SET(cpu, &one);
+      pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+      return;
+    }
+  }
+#else
+  (void)index;
+#endif
+}
+
+}  // namespace
+
+namespace lockblox {
+namespace drivex {
+
+thread_pool::thread_pool(std::size_t thread_count, bool pinned)
+    : next_queue_(0), pending_(0), stopping_(false) {
+  thread_count = std::max<std::size_t>(thread_count, 1);
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    queues_.emplace_back(new worker_queue);
+  }
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back([this, i, pinned]() { work(i, pinned); });
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+std::size_t thread_pool::size() const noexcept { return threads_.size(); }
+
+void thread_pool::post(task t) {
+  ++pending_;
+  if (current_pool == this) {  // keep nested work local to the worker
+    auto& queue = *queues_[current_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_front(std::move(t));
+  } else {
+    auto& queue = *queues_[next_queue_++ % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(t));
+  }
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_one();
+}
+
+bool thread_pool::run_pending_task() {
+  auto index = current_pool == this ? current_index
+                                    : next_queue_.load() % queues_.size();
+  task t;
+  if (pop_task(index, t) || steal_task(index, t)) {
+    t();
+    return true;
+  }
+  return false;
+}
+
+bool thread_pool::pop_task(std::size_t index, task& t) {
+  auto& queue = *queues_[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  t = std::move(queue.tasks.front());
+  queue.tasks.pop_front();
+  --pending_;
+  return true;
+}
+
+bool thread_pool::steal_task(std::size_t thief, task& t) {
+  for (std::size_t i = 1; i < queues_.size(); ++i) {
+    auto& queue = *queues_[(thief + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      t = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --pending_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void thread_pool::work(std::size_t index, bool pinned) {
+  if (pinned) {  // first, so that the worker's memory is touched on its node
+    pin(index);
+  }
+  current_pool = this;
+  current_index = index;
+  auto& temporaries = arena::local();
+  for (;;) {
+    task t;
+    if (pop_task(index, t) || steal_task(index, t)) {
+      t();
+      t = nullptr;  // before the arena, as captures may hold its memory
+      temporaries.reset();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this]() { return stopping_ || pending_ > 0; });
+    if (stopping_ && pending_ == 0) {
+      return;
+    }
+  }
+}
+
+task_group::task_group(thread_pool& pool)
+    : pool_(pool), outstanding_(0), posted_(0) {}
+
+task_group::~task_group() {
+  try {
+    wait();
+  } catch (...) {  // errors are only reported to an explicit wait()
+  }
+}
+
+void task_group::run(thread_pool::task t) {
+  ++outstanding_;
+  pool_.post([this, t]() {
+    try {
+      t();
+      finish(nullptr);
+    } catch (...) {
+      finish(std::current_exception());
+    }
+  });
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++posted_;
+  }
+  done_.notify_all();  // a waiter may have found the queue empty
+}
+
+void task_group::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (outstanding_ > 0) {
+    auto seen = posted_;
+    lock.unlock();
+    auto ran = pool_.run_pending_task();
+    lock.lock();
+    if (!ran) {  // sleep until the group finishes or queues more work
+      done_.wait(lock, [this, seen]() {
+        return outstanding_ == 0 || posted_ != seen;
+      });
+    }
+  }
+  if (error_) {
+    auto error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void task_group::finish(std::exception_ptr error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (error && !error_) {
+    error_ = error;
+  }
+  if (--outstanding_ == 0) {
+    done_.notify_all();
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lockblox {
+namespace drivex {
+
+/** A work-stealing pool of worker threads
+ *
+ * Each worker owns a task queue.  Tasks posted from a worker go to the front
+ * of its own queue, tasks posted from elsewhere are spread round-robin, and an
+ * idle worker steals from the back of its peers' queues.  Threads waiting on
+ * results may lend a hand with run_pending_task() so that nested waits cannot
+ * starve the pool.  A worker resets its arena::local() after each task it
+ * takes from the queues, so per-task temporaries drawn from it cost no
+ * global allocation once the arena has grown to fit them. */
+class thread_pool {
+ public:
+  using task = std::function<void()>;
+
+  /** @param pinned whether to bind each worker to one CPU, spreading them
+   *        over the CPUs the process may run on */
+  explicit thread_pool(
+      std::size_t thread_count = std::thread::hardware_concurrency(),
+      bool pinned = false);
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+  ~thread_pool();
+
+  /** Number of worker threads */
+  std::size_t size() const noexcept;
+
+  /** Queue a task for execution */
+  void post(task t);
+
+  /** Queue a callable and obtain a future for its result */
+  template <typename F>
+  auto submit(F f) -> std::future<decltype(f())> {
+    using result_type = decltype(f());
+    auto job = std::make_shared<std::packaged_task<result_type()>>(
+        std::move(f));
+    auto result = job->get_future();
+    post([job]() { (*job)(); });
+    return result;
+  }
+
+  /** Run one queued task on the calling thread
+   *
+   * @return false if no task was available */
+  bool run_pending_task();
+
+ private:
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  bool pop_task(std::size_t index, task& t);
+  bool steal_task(std::size_t thief, task& t);
+  void work(std::size_t index, bool pinned);
+
+  std::vector<std::unique_ptr<worker_queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<std::size_t> next_queue_;
+  std::atomic<std::size_t> pending_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+};
+
+/** A set of tasks that can be waited on as a unit
+ *
+ * Tasks may add further tasks to the group they run in.  The first exception
+ * thrown by any task is rethrown from wait(). */
+class task_group {
+ public:
+  explicit task_group(thread_pool& pool);
+  task_group(const task_group&) = delete;
+  task_group& operator=(const task_group&) = delete;
+  ~task_group();
+
+  /** Queue a task in this group */
+  void run(thread_pool::task t);
+
+  /** Wait for all tasks in the group, executing pending work meanwhile */
+  void wait();
+
+ private:
+  void finish(std::exception_ptr error);
+
+  thread_pool& pool_;
+  std::atomic<std::size_t> outstanding_;
+  std::uint64_t posted_;  // tasks queued so far, guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable done_;
+  std::exception_ptr error_;
+};
+}  // namespace drivex
+}  // namespace lockblox
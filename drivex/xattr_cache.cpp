@@ -0,0 +1,302 @@
+#include <drivex/xattr_cache.h>
+#include <algorithm>
+
+namespace lockblox {
+namespace drivex {
+
+namespace {
+
+/** Rough bytes held for one known attribute, with its bookkeeping */
+std::size_t footprint(const std::string& name, const std::string& value) {
+  return name.size() + value.size() + 96;
+}
+
+/** Rough bytes held for what is known of the attributes of a path, with
+ * the bookkeeping of the path itself unless it is empty */
+std::size_t footprint(const std::string& path, const xattr_map& values,
+                      const std::set<std::string>& absent) {
+  auto bytes = path.empty() ? std::size_t{0} : 2 * path.size() + 160;
+  for (const auto& value : values) {
+    bytes += footprint(value.first, value.second);
+  }
+  for (const auto& name : absent) {
+    bytes += footprint(name, std::string());
+  }
+  return bytes;
+}
+
+/** Fetch one attribute value through the size-aware getxattr
+ *
+ * @return none if the path has no such attribute */
+boost::optional<std::string> fetch_value(filesystem& filesystem,
+                                         const Path& path,
+                                         const std::string& name) {
+  auto value = std::string(256, '\0');
+  for (;;) {
+    try {
+      auto buffer = string_view(&value[0], value.size());
+      value.resize(filesystem.getxattr(path, name, buffer));
+      return value;
+    } catch (const error& e) {
+      auto code = e.code().value();
+      if (code == static_cast<int>(error_code::no_message_available)) {
+        return boost::none;
+      }
+      if (code != static_cast<int>(error_code::result_out_of_range)) {
+        throw;
+      }
+    }
+    auto probe = string_view();  // it grew; ask for its size and retry
+    value.resize(std::max(filesystem.getxattr(path, name, probe),
+                          2 * value.size()));
+  }
+}
+
+std::size_t copy_value(const std::string& value, string_view& buffer) {
+  if (!buffer.empty()) {
+    if (buffer.size() < value.size()) {
+      throw error(error_code::result_out_of_range);
+    }
+    std::copy(value.begin(), value.end(), const_cast<char*>(buffer.data()));
+  }
+  return value.size();
+}
+
+}  // namespace
+
+xattr_cache::xattr_cache(std::size_t capacity)
+    : capacity_(capacity), generation_(0), budget_(nullptr) {}
+
+xattr_cache::~xattr_cache() { budget(nullptr); }
+
+std::size_t xattr_cache::capacity() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_;
+}
+
+void xattr_cache::capacity(std::size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  trim();
+}
+
+void xattr_cache::budget(memory_budget* budget) {
+  clear();
+  memory_budget* previous;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    previous = budget_;
+    budget_ = nullptr;
+  }
+  if (previous != nullptr) {
+    previous->remove(*this);
+  }
+  if (budget != nullptr) {
+    budget->add(*this);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = budget;
+}
+
+std::size_t xattr_cache::getxattr(filesystem& filesystem, const Path& path,
+                                  const std::string& name,
+                                  string_view& buffer) {
+  auto key = path.string();
+  auto before = lookup(key);
+  if (!before.enabled) {
+    return filesystem.getxattr(path, name, buffer);
+  }
+  if (before.known) {
+    const auto& known = *before.known;
+    auto found = known.values.find(name);
+    if (found != known.values.end()) {
+      return copy_value(found->second, buffer);
+    }
+    if (known.complete || known.absent.count(name) != 0) {
+      throw error(error_code::no_message_available);
+    }
+  }
+  auto value = fetch_value(filesystem, path, name);
+  auto update = attribute_set{};
+  if (value) {
+    update.values.emplace(name, *value);
+  } else {
+    update.absent.insert(name);
+  }
+  remember(key, before, std::move(update));
+  if (!value) {
+    throw error(error_code::no_message_available);
+  }
+  return copy_value(*value, buffer);
+}
+
+std::size_t xattr_cache::listxattr(filesystem& filesystem, const Path& path,
+                                   string_view& buffer) {
+  auto key = path.string();
+  auto before = lookup(key);
+  if (!before.enabled) {
+    return filesystem.listxattr(path, buffer);
+  }
+  auto known = before.known;
+  if (!known || !known->complete) {
+    auto update = attribute_set{};
+    update.values = filesystem.getxattrs(path);
+    update.complete = true;
+    known = std::make_shared<const attribute_set>(update);
+    remember(key, before, std::move(update));
+  }
+  std::size_t length = 0;
+  for (const auto& attribute : known->values) {
+    length += attribute.first.size() + 1;
+  }
+  if (!buffer.empty()) {
+    if (buffer.size() < length) {
+      throw error(error_code::result_out_of_range);
+    }
+    auto output = const_cast<char*>(buffer.data());
+    for (const auto& attribute : known->values) {
+      const auto& name = attribute.first;
+      output = std::copy(name.begin(), name.end(), output);
+      *output++ = '\0';
+    }
+  }
+  return length;
+}
+
+void xattr_cache::invalidate(const Path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  auto found = index_.find(path.string());
+  if (found != index_.end()) {
+    drop(found->second);
+    index_.erase(found);
+  }
+}
+
+void xattr_cache::invalidate_tree(const Path& path) {
+  auto prefix = path.string();
+  if (prefix.empty() || prefix == "/") {
+    clear();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  auto it = index_.lower_bound(prefix);
+  while (it != index_.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0) {
+    const auto& key = it->first;
+    if (key.size() == prefix.size() || key[prefix.size()] == '/') {
+      drop(it->second);
+      it = index_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void xattr_cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  while (!entries_.empty()) {
+    drop(std::prev(entries_.end()));
+  }
+  index_.clear();
+}
+
+std::string xattr_cache::name() const { return "xattrs"; }
+
+std::uint64_t xattr_cache::oldest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.empty() ? no_items : entries_.back().stamp;
+}
+
+std::size_t xattr_cache::evict(std::uint64_t until, std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t dropped = 0;
+  std::size_t released = 0;
+  while (!entries_.empty() &&
+         (dropped == 0 ||
+          (released < bytes && entries_.back().stamp < until))) {
+    released += entries_.back().bytes;
+    index_.erase(entries_.back().path);
+    drop(std::prev(entries_.end()));
+    ++dropped;
+  }
+  return dropped;
+}
+
+xattr_cache::snapshot xattr_cache::lookup(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (capacity_ == 0) {
+    return snapshot{false, nullptr, generation_, budget_};
+  }
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    return snapshot{true, nullptr, generation_, budget_};
+  }
+  entries_.splice(entries_.begin(), entries_, found->second);
+  if (budget_ != nullptr) {
+    found->second->stamp = budget_->tick();
+  }
+  return snapshot{true, found->second->values, generation_, budget_};
+}
+
+void xattr_cache::remember(const std::string& key, const snapshot& before,
+                           attribute_set update) {
+  auto bytes = footprint(update.complete || !before.known ? key : "",
+                         update.values, update.absent);
+  auto budget = before.budget;
+  // charging may evict from this cache too, so not under the mutex
+  if (budget != nullptr && !budget->charge(*this, bytes)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (before.generation != generation_ || budget != budget_ ||
+      capacity_ == 0) {  // what was fetched may already be stale
+    if (budget != nullptr) {
+      budget->release(*this, bytes);
+    }
+    return;
+  }
+  auto stamp = budget_ != nullptr ? budget_->tick() : 0;
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    entries_.push_front(
+        {key, std::make_shared<const attribute_set>(update), bytes, stamp});
+    index_.emplace(key, entries_.begin());
+    trim();
+    return;
+  }
+  auto& cached = *found->second;
+  if (update.complete) {  // replaces what was known
+    if (budget_ != nullptr) {
+      budget_->release(*this, cached.bytes);
+    }
+    cached.bytes = bytes;
+  } else {  // adds to it
+    auto merged = *cached.values;
+    merged.values.insert(update.values.begin(), update.values.end());
+    merged.absent.insert(update.absent.begin(), update.absent.end());
+    update = std::move(merged);
+    cached.bytes += bytes;
+  }
+  cached.values = std::make_shared<const attribute_set>(std::move(update));
+  cached.stamp = stamp;
+  entries_.splice(entries_.begin(), entries_, found->second);
+}
+
+void xattr_cache::drop(lru_list::iterator it) {
+  if (budget_ != nullptr) {
+    budget_->release(*this, it->bytes);
+  }
+  entries_.erase(it);
+}
+
+void xattr_cache::trim() {
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().path);
+    drop(std::prev(entries_.end()));
+  }
+}
+}  // namespace drivex
+}  // namespace lockblox
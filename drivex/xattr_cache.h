@@ -0,0 +1,104 @@
+#pragma once
+#include <drivex/filesystem.h>
+#include <drivex/memory_budget.h>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace lockblox {
+namespace drivex {
+
+/** Least-recently-used cache of the extended attributes of recent paths
+ *
+ * The cache fills lazily.  A getxattr miss fetches that one attribute, and
+ * remembers its absence if the path lacks it, so the probes for ACLs and
+ * security labels that follow most lookups cost one backend call each and
+ * then none.  A listxattr miss fetches every attribute of the path with one
+ * filesystem::getxattrs call, after which getxattr, listxattr and size
+ * probes for the path, including lookups of absent names, are answered from
+ * memory.  getxattrs costs one call on backends that store attributes
+ * together and override it, and a listxattr plus one getxattr per name on
+ * the rest.  A capacity of zero disables caching and forwards each call to
+ * the filesystem.  Callers must invalidate paths whose attributes change.
+ * With a memory_budget the bytes held are charged to it as well, and paths
+ * may be evicted to make room for other caches. */
+class xattr_cache : public memory_consumer {
+ public:
+  explicit xattr_cache(std::size_t capacity = 0);
+  ~xattr_cache() override;
+
+  xattr_cache(const xattr_cache&) = delete;
+  xattr_cache& operator=(const xattr_cache&) = delete;
+
+  /** Maximum number of paths held */
+  std::size_t capacity() const;
+  void capacity(std::size_t capacity);
+
+  /** Charge attributes to a budget from now on, or to none if null
+   *
+   * Paths already held are dropped. */
+  void budget(memory_budget* budget);
+
+  /** Get an attribute value, see filesystem::getxattr */
+  std::size_t getxattr(filesystem& filesystem, const Path& path,
+                       const std::string& name, string_view& buffer);
+
+  /** List attribute names, see filesystem::listxattr */
+  std::size_t listxattr(filesystem& filesystem, const Path& path,
+                        string_view& buffer);
+
+  /** Forget the attributes of one path */
+  void invalidate(const Path& path);
+
+  /** Forget the attributes of a path and everything beneath it */
+  void invalidate_tree(const Path& path);
+
+  /** Forget everything */
+  void clear();
+
+  std::string name() const override;
+  std::uint64_t oldest() const override;
+  std::size_t evict(std::uint64_t until, std::size_t bytes) override;
+
+ private:
+  /** What is known of the attributes of one path */
+  struct attribute_set {
+    xattr_map values;
+    std::set<std::string> absent;  // names known to be missing
+    bool complete = false;         // values holds every attribute
+  };
+  using attributes = std::shared_ptr<const attribute_set>;
+
+  /** State of a path's entry when a lookup started */
+  struct snapshot {
+    bool enabled;
+    attributes known;  // or null
+    std::uint64_t generation;
+    memory_budget* budget;
+  };
+
+  struct entry {
+    std::string path;
+    attributes values;
+    std::size_t bytes;    // charged to the budget
+    std::uint64_t stamp;  // of the last use
+  };
+  using lru_list = std::list<entry>;
+
+  snapshot lookup(const std::string& key);
+  void remember(const std::string& key, const snapshot& before,
+                attribute_set update);
+  void drop(lru_list::iterator it);
+  void trim();
+
+  mutable std::mutex mutex_;
+  std::size_t capacity_;
+  std::uint64_t generation_;  // bumped by every invalidation
+  memory_budget* budget_;
+  lru_list entries_;
+  std::map<std::string, lru_list::iterator> index_;
+};
+}  // namespace drivex
+}  // namespace lockblox